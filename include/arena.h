@@ -0,0 +1,50 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_BLOCK_SIZE 16384
+
+typedef struct ArenaBlock ArenaBlock;
+
+/*
+ * bump allocator for state that lives exactly as long as one statement: ring buffers, points and the like. Allocations
+ * are carved out of a chain of blocks and are never freed one by one, `arena_reset` releases all of them at once.
+ *
+ * A reset keeps the newest block (the largest, as blocks only grow to fit) so once it has warmed up an arena serves
+ * every statement without calling malloc.
+ */
+typedef struct {
+  ArenaBlock *block; // current block, chained to the previous ones
+  size_t block_size;
+  void *last; // most recent allocation, the only one `arena_grow` can extend in place
+} Arena;
+
+/*
+ * returns 0 on success, else 1 (out of memory). `block_size` 0 means ARENA_BLOCK_SIZE.
+ */
+int init_arena(Arena *arena, size_t block_size);
+void destroy_arena(Arena *arena);
+
+/*
+ * returns `size` bytes aligned for any type, or NULL when out of memory.
+ */
+void *arena_alloc(Arena *arena, size_t size);
+
+/*
+ * resizes the allocation `ptr` of `old_size` bytes to `new_size`, in place when it is the most recent allocation and the
+ * block has room, else by copying it. `ptr` may be NULL. returns NULL when out of memory, `ptr` is left untouched.
+ */
+void *arena_grow(Arena *arena, void *ptr, size_t old_size, size_t new_size);
+
+/*
+ * releases every allocation. Pointers handed out before are invalid afterwards.
+ */
+void arena_reset(Arena *arena);
+
+/*
+ * bytes handed out since the last reset, alignment padding included.
+ */
+size_t arena_used(const Arena *arena);
+
+#endif
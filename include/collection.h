@@ -0,0 +1,256 @@
+#ifndef COLLECTION_H
+#define COLLECTION_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "field.h"
+#include "filter.h"
+#include "geometry.h"
+#include "intern.h"
+#include "polygon.h"
+#include "rtree.h"
+#include "scan_pool.h"
+#include "timer_wheel.h"
+
+typedef enum {
+  STORE_OK,
+  STORE_OUT_OF_MEMORY,
+  STORE_KEY_NOT_FOUND,
+  STORE_ID_NOT_FOUND,
+  STORE_INVALID_STATEMENT,
+  STORE_IO_ERROR,
+  STORE_INVALID_SNAPSHOT,
+  STORE_INVALID_IMPORT,
+} StoreResult;
+
+/*
+ * the geometry of a line string object, owned by it. Closed rings also get a `polygon`, built once at SET time, since
+ * fences are written rarely and tested constantly.
+ */
+typedef struct {
+  LineString line_string;
+  Rect rect;
+  Polygon *polygon; // NULL unless the line string is a closed ring
+} Shape;
+
+/*
+ * a stored object. `id` is the handle of its id in the collection's `ids` table, see `collection_object_id` for the
+ * bytes. A point object keeps its coordinates in the point columns of its collection, a line string its Shape. A free
+ * slot has `id == UINT32_MAX`.
+ */
+typedef struct {
+  uint32_t id;
+  GeometryType type;
+  Shape *shape; // NULL for a point
+} Object;
+
+/*
+ * the coordinates of the point objects of a collection, indexed by slot like the objects (whatever sits in the slots
+ * of other objects is meaningless).
+ *
+ * an exact collection holds them as doubles in `x` and `y`. A quantized one holds them in `qx` and `qy` instead, fixed
+ * point in units of 1 / COORDINATE_SCALE degree: 8 bytes a point rather than 16, read back within COORDINATE_PRECISION
+ * degrees of what was set and limited to +-214.7 degrees. The columns of the other kind stay NULL. Either way `z` is
+ * only allocated once a point of the collection has one, and holds NAN for the points that don't.
+ *
+ * a collection is quantized or not from its creation on, see `store_quantize_points`. Line strings keep their points
+ * as doubles in both.
+ */
+typedef struct {
+  bool quantized;
+  double *x;
+  double *y;
+  int32_t *qx;
+  int32_t *qy;
+  double *z;
+  bool borrowed; // the x and y columns are part of the mapped snapshot
+  bool z_borrowed;
+} PointColumns;
+
+/*
+ * all the objects stored under one key. Ids are interned in `ids` and an object's slot is the handle of its id, so a
+ * lookup by id is a single probe of the interning table and the spatial index stores the same 4 byte handle. Neither
+ * has to be touched when the slot array is reallocated; slots of deleted ids are reused along with their handles.
+ *
+ * a collection loaded from a snapshot has `objects_borrowed` set: the slot array is part of the mapped file until it
+ * has to grow. So are its point columns.
+ *
+ * `fields` is the field dictionary of the key: one column per field name ever set on one of its objects. There are few
+ * of them, names are looked up by a linear scan.
+ *
+ * `expirations` holds the deadlines (unix milliseconds) of the objects SET with EX, its items are slots. Its arrays are
+ * only allocated once the first object of the key is given a deadline, then grow along with the slot array.
+ *
+ * the functions below don't lock anything. The store takes `lock` for reading around queries and for writing around
+ * writes, so readers of a collection run in parallel and its writers one at a time.
+ */
+typedef struct {
+  char *key;
+  size_t key_length;
+  InternTable ids;
+  RTree index;
+  Object *objects; // indexed by id handle
+  uint32_t objects_capacity;
+  bool objects_borrowed;
+  PointColumns points; // as long as `objects`
+  size_t count; // number of live objects
+  FieldColumn *fields;
+  uint32_t fields_count;
+  uint32_t fields_capacity;
+  TimerWheel expirations;
+  bool index_deferred; // set while loading: `index` is left alone until `collection_build_index`
+  pthread_rwlock_t lock;
+} Collection;
+
+/*
+ * called for every object whose bounding box intersects the search rect. Returning non-zero stops the search.
+ */
+typedef int (*collection_search_callback)(const Object *object, void *user_data);
+
+/*
+ * called by `collection_nearby` for objects in increasing distance (meters). Returning non-zero stops the query.
+ */
+typedef int (*collection_nearby_callback)(const Object *object, double distance, void *user_data);
+
+int init_collection(Collection *collection, const char *key, size_t key_length);
+void destroy_collection(Collection *collection);
+
+/*
+ * inserts or replaces the object `id` along with its fields: a replaced object keeps none of its previous field values
+ * and no expiration. The geometry is deep copied. returns a StoreResult, STORE_INVALID_STATEMENT for a point a
+ * quantized collection can't hold.
+ */
+int collection_set(Collection *collection, const char *id, size_t id_length, const Geometry *geometry,
+                   const FieldValue *fields, size_t fields_count);
+
+/*
+ * makes room for `count` more objects up front: the id table and the slot array, point and field columns are grown
+ * once instead of doubling over and over. returns a StoreResult.
+ */
+int collection_reserve(Collection *collection, size_t count);
+
+/*
+ * sets `fields` of the existing object `id`, leaving its other fields and its geometry alone. The values are written
+ * into the columns in place, only a field name the collection has never seen adds a column. returns a StoreResult.
+ */
+int collection_set_fields(Collection *collection, const char *id, size_t id_length, const FieldValue *fields,
+                          size_t fields_count);
+
+/*
+ * makes the existing object `id` expire at `deadline` (unix milliseconds, 0 to keep it forever). `now` is the current
+ * time. returns a StoreResult.
+ */
+int collection_set_expiration(Collection *collection, const char *id, size_t id_length, uint64_t deadline,
+                              uint64_t now);
+
+/*
+ * the deadline of `object`, 0 when it doesn't expire.
+ */
+uint64_t collection_object_expiration(const Collection *collection, const Object *object);
+
+/*
+ * removes the objects whose deadline is at or before `now` from the expiration schedule (not from the collection) and
+ * writes the slots of up to `capacity` of them into `expired`, due objects left over are returned by the next call.
+ * returns how many were written.
+ */
+size_t collection_expired(Collection *collection, uint64_t now, uint32_t *expired, size_t capacity);
+
+/*
+ * returns the object `id` or NULL. The pointer is only valid until the next write to the collection.
+ */
+const Object *collection_get(const Collection *collection, const char *id, size_t id_length);
+
+/*
+ * removes the object `id`. returns a StoreResult, STORE_OUT_OF_MEMORY leaves the object in place.
+ */
+int collection_delete(Collection *collection, const char *id, size_t id_length);
+
+/*
+ * bulk loads every object into a fresh spatial index and clears `index_deferred`. returns a StoreResult.
+ */
+int collection_build_index(Collection *collection);
+
+/*
+ * gives the line string object in `slot` of a collection loaded from a snapshot its Shape, with its own copy of
+ * `line_string`. returns a StoreResult.
+ */
+int collection_attach_line_string(Collection *collection, uint32_t slot, const LineString *line_string);
+
+/*
+ * adds the column `name` of a collection loaded from a snapshot, borrowing `values` (`objects_capacity` long) from the
+ * mapped file. returns a StoreResult.
+ */
+int collection_attach_field(Collection *collection, const char *name, size_t name_length, double *values);
+
+/*
+ * schedules the objects of a collection loaded from a snapshot, `deadlines` holding one per slot (0 for the objects
+ * that don't expire). returns a StoreResult.
+ */
+int collection_attach_expirations(Collection *collection, const uint64_t *deadlines, uint64_t now);
+
+/*
+ * the value of field `field` (an index into `fields`) of a live object, NAN when it has none.
+ */
+double collection_object_field(const Collection *collection, const Object *object, uint32_t field);
+
+/*
+ * the position of a live point object, dequantized when the collection is quantized.
+ */
+Point collection_object_point(const Collection *collection, const Object *object);
+
+/*
+ * the geometry of a live object. The points of a line string are borrowed from the object, they are only valid until
+ * the next write to it.
+ */
+Geometry collection_object_geometry(const Collection *collection, const Object *object);
+
+/*
+ * the id bytes of a live object of `collection`. Only valid until the next delete from the collection.
+ */
+Span collection_object_id(const Collection *collection, const Object *object);
+
+/*
+ * bytes held by the arrays of `collection` (slots, point columns, id table, index nodes, field columns, deadlines), by
+ * capacity and whether or not they are mapped from a snapshot. The shapes of line strings are left out, counting them
+ * would mean visiting every object.
+ */
+size_t collection_memory_usage(const Collection *collection);
+
+int collection_search(const Collection *collection, const Rect *rect, collection_search_callback cb, void *user_data);
+
+/*
+ * streams the objects closest to `point` to `cb`, nearest first, stopping after `limit` objects (0 = no limit) or at
+ * the first object further than `max_distance` meters. Line strings are measured to their bounding box. returns a
+ * StoreResult.
+ *
+ * with a `pool` (may be NULL), queries without a limit that are estimated to visit at least `pool->min_candidates`
+ * objects are split: every subtree of the index sorts its own objects within `max_distance` on the pool and their lists
+ * are merged. `cb` is always called from the calling thread.
+ *
+ * with a `filter` (may be NULL), only the objects that pass it are yielded and count towards `limit`.
+ */
+int collection_nearby(const Collection *collection, const Point *point, size_t limit, double max_distance,
+                      const Filter *filter, ScanPool *pool, collection_nearby_callback cb, void *user_data);
+
+/*
+ * streams the objects entirely inside `polygon` to `cb`. Candidates come from the index so only objects whose box is
+ * inside the polygon's box are tested. returns the non-zero value of `cb` if it stopped the query, else 0.
+ *
+ * with a `pool` (may be NULL), queries estimated to visit at least `pool->min_candidates` objects test the subtrees of
+ * the index in parallel and stream the matches afterwards, in no particular order, from the calling thread.
+ *
+ * with a `filter` (may be NULL), candidates are filtered before the exact polygon test, which is the costlier one.
+ */
+int collection_within(const Collection *collection, const Polygon *polygon, const Filter *filter, ScanPool *pool,
+                      collection_search_callback cb, void *user_data);
+
+/*
+ * like `collection_within` but for objects that overlap or touch `polygon`.
+ */
+int collection_intersects(const Collection *collection, const Polygon *polygon, const Filter *filter, ScanPool *pool,
+                          collection_search_callback cb, void *user_data);
+
+#endif
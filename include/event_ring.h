@@ -0,0 +1,69 @@
+#ifndef EVENT_RING_H
+#define EVENT_RING_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "geofence.h"
+
+typedef enum {
+  OVERFLOW_DROP_OLDEST, // overwrite the oldest unread event
+  OVERFLOW_DROP_NEWEST, // discard the event being published
+  OVERFLOW_BLOCK, // spin (yielding the cpu) until the consumer makes room
+} OverflowPolicy;
+
+#define QUEUED_EVENT_SPAN_LENGTH 64 // channels, keys and ids longer than this are cut in queued events
+
+/*
+ * a DetectEvent with its strings copied in, so it can be read after the fence or the object is gone. `truncated` is
+ * set when the channel, key or id was longer than QUEUED_EVENT_SPAN_LENGTH and only its start was kept.
+ */
+typedef struct {
+  DetectType type;
+  bool truncated;
+  char channel[QUEUED_EVENT_SPAN_LENGTH];
+  size_t channel_length;
+  char key[QUEUED_EVENT_SPAN_LENGTH];
+  size_t key_length;
+  char id[QUEUED_EVENT_SPAN_LENGTH];
+  size_t id_length;
+  Point point;
+} QueuedDetectEvent;
+
+/*
+ * bounded lock free single producer / single consumer queue of detect events. The engine thread publishes, one other
+ * thread drains. Records are fixed size QueuedDetectEvents so publishing never allocates.
+ *
+ * `head` and `tail` are free running counters, the slot of counter c is `c & mask`. With OVERFLOW_DROP_OLDEST the
+ * producer also advances `head`, so the consumer claims what it copied with a compare and swap and retries if the
+ * producer got there first.
+ */
+typedef struct {
+  QueuedDetectEvent *events;
+  size_t mask; // capacity - 1, capacity is a power of 2
+  OverflowPolicy policy;
+  _Alignas(64) atomic_size_t head; // next event to read, written by the consumer (and the producer when dropping oldest)
+  _Alignas(64) atomic_size_t tail; // next slot to write, written by the producer
+  atomic_size_t dropped; // events lost to overflow
+} EventRing;
+
+/*
+ * `capacity` is rounded up to a power of 2. returns 0 on success, else 1 (out of memory).
+ */
+int init_event_ring(EventRing *ring, size_t capacity, OverflowPolicy policy);
+void destroy_event_ring(EventRing *ring);
+
+/*
+ * producer side, copies `event` in. returns false if the event was dropped (OVERFLOW_DROP_NEWEST on a full ring).
+ */
+bool event_ring_publish(EventRing *ring, const DetectEvent *event);
+
+/*
+ * consumer side. copies up to `max` of the oldest events into `out` and returns how many were copied.
+ */
+size_t event_ring_drain(EventRing *ring, QueuedDetectEvent *out, size_t max);
+
+size_t event_ring_dropped(EventRing *ring);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef FIELD_H
+#define FIELD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "stringutils.h"
+
+/*
+ * one numeric field of an object as SET, FSET and the log carry it: its name and value. Objects keep their fields in
+ * the columns of their collection.
+ */
+typedef struct {
+  Span name;
+  double value;
+} FieldValue;
+
+/*
+ * the values of one field for every object of a collection. Objects of a key tend to carry the same handful of
+ * numeric fields (speed, heading, battery...), so each field is a dense array indexed by object slot, as long as the
+ * slot array, rather than a map per object. An object without a value for the field has NAN there.
+ */
+typedef struct {
+  char *name;
+  size_t name_length;
+  double *values; // indexed by id handle, `objects_capacity` of the collection long
+  bool values_borrowed; // part of a mapped snapshot until the slot array grows
+} FieldColumn;
+
+/*
+ * `WHERE field min max` of a query: matches the objects whose value of `field` is in [min, max], either bound may be
+ * infinite. An object without a value for `field` never matches. Clauses are ANDed and OR separates groups of them,
+ * AND binding tighter: `WHERE a 1 1 WHERE b 20 +inf OR WHERE c 0 0` is (a AND b) OR c.
+ */
+typedef struct {
+  Span field;
+  double min;
+  double max;
+  bool starts_group; // preceded by OR
+} WhereClause;
+
+#endif
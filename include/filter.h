@@ -0,0 +1,51 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "field.h"
+
+#define FILTER_BLOCK_SIZE 64
+
+/*
+ * one range test of a compiled filter.
+ */
+typedef struct {
+  const double *values; // the field column, NULL when the collection doesn't have the field (nothing passes)
+  double min;
+  double max;
+  bool starts_group;
+} FilterTerm;
+
+/*
+ * the WHERE clauses of a query compiled against the field columns of one collection: names are resolved once, what is
+ * left is a flat list of range tests over column pointers.
+ *
+ * candidates are filtered a block of up to FILTER_BLOCK_SIZE slots at a time rather than one object at a time. Every
+ * test gathers the values of the block from its column and compares them several at once (AVX2 gathers, AVX or SSE2
+ * compares when the build targets them) into one bit per candidate. The bits of a group are ANDed and the groups ORed,
+ * and the tests of a group are skipped as soon as none of the block is left in it.
+ *
+ * column pointers are only valid until the collection is written to: a filter is compiled for every execution, under
+ * the lock of the collection.
+ */
+typedef struct {
+  FilterTerm *terms;
+  size_t terms_count;
+} Filter;
+
+/*
+ * returns 0 on success, else 1 (out of memory).
+ */
+int compile_filter(Filter *filter, const WhereClause *clauses, size_t clauses_count, const FieldColumn *fields,
+                   uint32_t fields_count);
+void destroy_filter(Filter *filter);
+
+/*
+ * returns which of the `count` (at most FILTER_BLOCK_SIZE) candidate `slots` pass, bit i standing for `slots[i]`.
+ */
+uint64_t filter_block(const Filter *filter, const uint32_t *slots, size_t count);
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef GEOFENCE_H
+#define GEOFENCE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "geometry.h"
+#include "hashmap.h"
+#include "polygon.h"
+#include "rtree.h"
+#include "stringutils.h"
+
+typedef enum {
+  FENCE_NEARBY, // circle of `radius` meters around `center`
+  FENCE_WITHIN, // closed ring
+} FenceType;
+
+typedef enum {
+  DETECT_ENTER,
+  DETECT_EXIT,
+  DETECT_INSIDE,
+  DETECT_OUTSIDE,
+} DetectType;
+
+/*
+ * a channel: a fence watching every point SET on `key`. `name` and `key` are owned copies.
+ */
+typedef struct {
+  char *name;
+  size_t name_length;
+  char *key;
+  size_t key_length;
+  FenceType type;
+  Point center;
+  double radius;
+  Polygon polygon;
+  Rect rect;
+} Fence;
+
+/*
+ * what a detect_callback gets. The spans point into the fence and the object being written, so they are only valid
+ * during the callback; `event_ring_publish` copies them out.
+ */
+typedef struct {
+  DetectType type;
+  Span channel;
+  Span key;
+  Span id;
+  Point point;
+} DetectEvent;
+
+typedef void (*detect_callback)(const DetectEvent *event, void *user_data);
+
+/*
+ * all the fences of a store, indexed by their bounding box so that an update only looks at the fences around it.
+ * Fences are kept dense in `fences`; deleting one moves the last fence into its slot.
+ */
+typedef struct {
+  HashMap names; // channel name -> index into `fences`
+  RTree index;
+  Fence *fences;
+  uint32_t fences_count;
+  uint32_t fences_capacity;
+} Geofences;
+
+int init_geofences(Geofences *geofences);
+void destroy_geofences(Geofences *geofences);
+
+/*
+ * creates or replaces the channel `name`. return a StoreResult.
+ */
+int geofences_set_nearby(Geofences *geofences, const char *name, size_t name_length, const char *key, size_t key_length,
+                         const Point *center, double radius);
+int geofences_set_within(Geofences *geofences, const char *name, size_t name_length, const char *key, size_t key_length,
+                         const LineString *ring);
+
+int geofences_delete(Geofences *geofences, const char *name, size_t name_length);
+
+/*
+ * emits the events caused by object `id` of `key` moving from `previous` to `current`. Either may be NULL, for an
+ * object that didn't exist yet or was deleted. Membership is derived from the previous position, so no per object
+ * state is kept and only fences whose box holds one of the two positions are tested.
+ */
+void geofences_detect(const Geofences *geofences, const char *key, size_t key_length, const char *id, size_t id_length,
+                      const Point *previous, const Point *current, detect_callback cb, void *user_data);
+
+const char *detect_type_to_string(DetectType type);
+
+#endif
@@ -3,7 +3,14 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
+#define COORDINATE_SCALE 10000000.0 // quantized coordinates count 1e-7 degrees, about 1.1 cm of latitude
+#define COORDINATE_PRECISION (0.5 / COORDINATE_SCALE) // how far a quantized coordinate reads back from the one set
+
+/*
+ * NOTE: x is the longitude and y is the latitude when using lat/lon (see README).
+ */
 typedef struct {
   double x;
   double y;
@@ -17,5 +24,152 @@ typedef struct {
   bool is_closed;
 } LineString;
 
-#endif
+typedef enum {
+  GEOMETRY_POINT,
+  GEOMETRY_LINE_STRING
+} GeometryType;
+
+typedef struct {
+  GeometryType type;
+  union {
+    Point point;
+    LineString line_string;
+  };
+} Geometry;
+
+/*
+ * axis aligned bounding box. Used as the key of every entry in the spatial index.
+ */
+typedef struct {
+  double min_x;
+  double min_y;
+  double max_x;
+  double max_y;
+} Rect;
+
+int points_equal(const Point *p1, const Point *p2);
+
+/*
+ * deep copies `src` into `dst` (line string points get their own allocation). returns 0 on success, else 1 (out of
+ * memory).
+ */
+int copy_geometry(Geometry *dst, const Geometry *src);
+void free_geometry(Geometry *geometry);
+
+Rect point_rect(const Point *p);
+Rect line_string_rect(const LineString *ls);
+Rect geometry_rect(const Geometry *g);
+
+bool rects_intersect(const Rect *a, const Rect *b);
+bool rect_contains(const Rect *outer, const Rect *inner);
+Rect rects_union(const Rect *a, const Rect *b);
+double rect_area(const Rect *r);
+
+/*
+ * great circle (haversine) distance in meters between two lat/lon points. z is ignored.
+ */
+double point_distance_meters(const Point *a, const Point *b);
+
+/*
+ * great circle distance in meters from `p` to the closest point of the lat/lon box `r` (0 when `p` is inside),
+ * longitudes wrapping around the antimeridian. Used as the lower bound when walking the spatial index: it is never
+ * larger than the distance to anything in the box.
+ */
+double rect_distance_meters(const Point *p, const Rect *r);
+
+/*
+ * the lat/lon box around the circle of `radius` meters (INFINITY for the whole globe) around `center`, from the same
+ * bound `init_distance_query` rejects candidates with. It covers every longitude when the circle reaches a pole or
+ * crosses the antimeridian, and is clamped to [-90, 90] x [-180, 180], the range coordinates are taken to be in.
+ */
+Rect circle_rect(const Point *center, double radius);
+
+#define DISTANCE_BATCH_RELATIVE_ERROR 1e-12 // of the vectorised kernels against `point_distance_meters`
 
+typedef struct DistanceQuery DistanceQuery;
+
+/*
+ * computes the distances of up to `count` candidates to the query, see `point_distances_meters`.
+ */
+typedef void (*distance_kernel)(const DistanceQuery *query, const double *xs, const double *ys, size_t count,
+                                double *distances);
+
+/*
+ * one point measured against many, set up once by `init_distance_query` and then shared (read only) by any number of
+ * threads.
+ */
+struct DistanceQuery {
+  double x; // degrees
+  double y;
+  double lat; // radians
+  double cos_lat;
+  double tan_lat;
+  // candidates further than this many degrees of latitude, or longitude (wrapped around), from the point are further
+  // than `max_distance`. INFINITY when there is no such shortcut.
+  double lat_delta;
+  double lon_delta;
+  distance_kernel kernel;
+};
+
+/*
+ * the first call picks the distance kernel from the features of the cpu: AVX2 with FMA, else SSE2, else plain scalar
+ * code calling libm. `max_distance` (meters, INFINITY for none) only enables a shortcut, see `point_distances_meters`.
+ */
+void init_distance_query(DistanceQuery *query, const Point *p, double max_distance);
+
+/*
+ * great circle distances in meters from the query point to the `count` points (`xs[i]`, `ys[i]`), a batch at a time:
+ * the vectorised kernels evaluate sin, cos and asin as polynomials on 4 (AVX2) or 2 (SSE2) candidates at once and stay
+ * within DISTANCE_BATCH_RELATIVE_ERROR (or a nanometer) of `point_distance_meters`, which is their reference, up to
+ * 20000 km. Closer to the antipode asin is ill conditioned and the two drift apart by up to a meter.
+ *
+ * candidates further than the query's `max_distance` may come out as INFINITY without their distance being computed:
+ * a cheap equirectangular test of their latitude and longitude differences against the widest the circle of that
+ * radius reaches rejects them first (a whole vector of them skips the trig). That test takes the latitudes to be within
+ * [-90, 90].
+ */
+void point_distances_meters(const DistanceQuery *query, const double *xs, const double *ys, size_t count,
+                            double *distances);
+
+/*
+ * `rect_distance_meters` of `count` boxes given column by column, with the same `max_distance` shortcut: the closest
+ * point of every box is found first, then measured by the query's kernel.
+ */
+void rect_distances_meters(const DistanceQuery *query, const double *min_x, const double *min_y, const double *max_x,
+                           const double *max_y, size_t count, double *distances);
+
+/*
+ * "avx2", "sse2" or "scalar": the kernel `init_distance_query` picks on this cpu.
+ */
+const char *distance_kernel_name(void);
+
+/*
+ * the kernel of that name, NULL when this cpu can't run it. A query set up by `init_distance_query` can have its
+ * `kernel` replaced, to compare them.
+ */
+distance_kernel distance_kernel_by_name(const char *name);
+
+/*
+ * true when `v` fits a quantized coordinate, which spans about +-214.7 degrees. NAN doesn't.
+ */
+static inline bool coordinate_quantizable(double v) {
+  return v * COORDINATE_SCALE > (double)INT32_MIN + 1 && v * COORDINATE_SCALE < (double)INT32_MAX - 1;
+}
+
+/*
+ * rounds `v`, which must be `coordinate_quantizable`, to the nearest fixed point coordinate.
+ */
+static inline int32_t quantize_coordinate(double v) {
+  double scaled = v * COORDINATE_SCALE;
+  return (int32_t)(scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+}
+
+/*
+ * a division rather than a multiplication by 1e-7: a coordinate set with at most 7 decimals reads back as the very
+ * double it was parsed to.
+ */
+static inline double dequantize_coordinate(int32_t q) {
+  return q / COORDINATE_SCALE;
+}
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef HASHMAP_H
+#define HASHMAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "stringutils.h"
+
+/*
+ * control bytes of the Swiss table style maps (HashMap, InternTable). Every slot has one control byte: SWISS_EMPTY,
+ * SWISS_DELETED (a tombstone) or, for a full slot, the top 7 bits of its key's hash. A probe compares a whole group of
+ * 16 control bytes against the tag at once and only looks at the slots whose tag matches, so a lookup almost never
+ * touches a slot (let alone key bytes) that doesn't hold the key.
+ *
+ * groups are aligned, a table has a power of 2 of them and probes visit groups h, h + 1, h + 3, h + 6, ... which
+ * reaches every group. A probe stops at the first group with an empty slot.
+ */
+#define SWISS_GROUP_WIDTH 16
+#define SWISS_EMPTY 0x80
+#define SWISS_DELETED 0xfe
+
+static inline uint8_t swiss_tag(uint64_t hash) {
+  return (uint8_t)(hash >> 57);
+}
+
+/*
+ * bit i is set when control byte i of `group` equals `byte`.
+ */
+static inline uint32_t swiss_match(const uint8_t *group, uint8_t byte) {
+#if defined(__SSE2__)
+  __m128i g = _mm_loadu_si128((const __m128i *)group);
+  return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)byte)));
+#else
+  uint32_t mask = 0;
+  for (int i = 0; i < SWISS_GROUP_WIDTH; i++) {
+    mask |= (uint32_t)(group[i] == byte) << i;
+  }
+  return mask;
+#endif
+}
+
+/*
+ * bit i is set when slot i of `group` is empty or deleted, both have the high bit set.
+ */
+static inline uint32_t swiss_match_free(const uint8_t *group) {
+#if defined(__SSE2__)
+  return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+#else
+  uint32_t mask = 0;
+  for (int i = 0; i < SWISS_GROUP_WIDTH; i++) {
+    mask |= (uint32_t)(group[i] >> 7) << i;
+  }
+  return mask;
+#endif
+}
+
+/*
+ * first empty or deleted slot on the probe sequence of `hash`. The table must have one (tables never fill up).
+ */
+static inline size_t swiss_find_free(const uint8_t *control, size_t capacity, uint64_t hash) {
+  size_t groups_mask = capacity / SWISS_GROUP_WIDTH - 1;
+  for (size_t g = hash & groups_mask, step = 1;; g = (g + step++) & groups_mask) {
+    uint32_t free_slots = swiss_match_free(control + g * SWISS_GROUP_WIDTH);
+    if (free_slots != 0) {
+      return g * SWISS_GROUP_WIDTH + (size_t)__builtin_ctz(free_slots);
+    }
+  }
+}
+
+/*
+ * frees a full slot. It can go straight back to empty when its group still has an empty slot, since every probe that
+ * reaches the group stops there anyway; otherwise it becomes a tombstone so probes keep going past it.
+ */
+static inline void swiss_erase(uint8_t *control, size_t slot, size_t *growth_left) {
+  if (swiss_match(control + (slot & ~(size_t)(SWISS_GROUP_WIDTH - 1)), SWISS_EMPTY) != 0) {
+    control[slot] = SWISS_EMPTY;
+    (*growth_left)++;
+  } else {
+    control[slot] = SWISS_DELETED;
+  }
+}
+
+/*
+ * map from a byte string to a uint32_t value. The map does NOT own the key bytes, the caller must keep the memory a key
+ * points at alive (and unchanged) for as long as the key is in the map.
+ */
+typedef struct {
+  const char *key;
+  size_t key_length;
+  uint32_t value;
+} HashMapEntry;
+
+typedef struct {
+  uint8_t *control;
+  HashMapEntry *entries;
+  size_t capacity; // a power of 2, at least SWISS_GROUP_WIDTH
+  size_t count;
+  size_t growth_left; // inserts into empty slots left before the table is rebuilt
+} HashMap;
+
+uint64_t hash_bytes(const char *bytes, size_t length);
+
+int init_hashmap(HashMap *map, size_t initial_capacity);
+void destroy_hashmap(HashMap *map);
+
+/*
+ * returns 0 and writes `value` when the key is found, else 1.
+ */
+int hashmap_get(const HashMap *map, const char *key, size_t key_length, uint32_t *value);
+
+/*
+ * inserts or overwrites the value of `key`. returns 0 on success, else 1 (out of memory).
+ */
+int hashmap_put(HashMap *map, const char *key, size_t key_length, uint32_t value);
+
+/*
+ * returns 0 if the key was removed, else 1 (key was not in the map).
+ */
+int hashmap_remove(HashMap *map, const char *key, size_t key_length);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef IMPORT_H
+#define IMPORT_H
+
+#include <stddef.h>
+
+#include "store.h"
+
+#define IMPORT_CHUNK_SIZE (4 << 20) // bytes of the file a parsing task starts from
+#define IMPORT_CHUNKS_PER_WORKER 2 // chunks parsed per worker before their objects are set
+
+typedef enum {
+  IMPORT_GEOJSON,
+  IMPORT_CSV,
+} ImportFormat;
+
+/*
+ * what `store_import` read.
+ */
+typedef struct {
+  size_t records; // features or rows
+  size_t imported;
+  size_t skipped; // records without a geometry the collection can hold
+  size_t error_offset; // where in the file parsing failed, when it did
+} ImportReport;
+
+/*
+ * IMPORT_CSV for a path ending in .csv, IMPORT_GEOJSON for anything else.
+ */
+ImportFormat import_format_for_path(const char *path);
+
+/*
+ * sets every record of the GeoJSON FeatureCollection or CSV file at `path` into the collection `key`, creating it when
+ * it doesn't exist yet.
+ *
+ * the file is mapped and cut into chunks of about IMPORT_CHUNK_SIZE bytes that the workers of the store's scan pool
+ * (see `store_parallel_scans`) parse at the same time, or the calling thread one after the other without one. The
+ * objects of a round of chunks are then set in file order with the spatial index left alone, and the index is bulk
+ * loaded once at the end (Sort-Tile-Recursive, see `rtree_bulk_load`) rather than grown insert by insert. Every object
+ * is appended to the log of a store that logs its writes like a SET, committed once at the end. No geofence events are
+ * emitted.
+ *
+ * GeoJSON: Point features become points and Polygon features the BOUNDS of their outer ring (holes are dropped), other
+ * geometries are skipped. The id is the "id" of the feature, a string or a number as written, and the numeric
+ * properties become fields. CSV: the first line names the columns. lat (or latitude, y) and lon (or lng, longitude, x)
+ * hold the point, z (or alt, altitude) its z, id its id, and every other column is a field, its empty or non numeric
+ * cells having no value. Cells may be double quoted but can't span lines. A record without an id gets its position in
+ * the file, counted from 1 among the records.
+ *
+ * CSV chunks start after a newline. A GeoJSON chunk starts at a guess, the `{` of the first `}, {` past its offset, and
+ * every chunk parses on until the first feature starting in the next one. A chunk whose guess isn't where the previous
+ * one stopped is parsed again from there, so a wrong guess only costs time.
+ *
+ * like loading and replaying, it locks nothing: import before the store is shared. returns a StoreResult:
+ * STORE_IO_ERROR when the file can't be read (errno is set), STORE_INVALID_IMPORT when it is not a FeatureCollection,
+ * has no lat and lon columns or is malformed (`error_offset` says where). The objects set before an error are kept.
+ */
+int store_import(Store *store, const char *key, size_t key_length, const char *path, ImportFormat format,
+                 ImportReport *report);
+
+#endif
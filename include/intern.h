@@ -0,0 +1,74 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hashmap.h"
+#include "stringutils.h"
+
+#define INTERN_BLOCK_SIZE 65536
+
+/*
+ * string interning table: maps every distinct byte string to a dense uint32_t handle, starting at 0, so that the rest
+ * of the engine can store and compare 4 byte handles instead of strings.
+ *
+ * every string is copied (NUL terminated) once into a chain of blocks. The hash table itself is a Swiss table of
+ * handles (see hashmap.h): 5 bytes per slot, keys are compared through `strings`. Removed handles are reused by later
+ * strings.
+ *
+ * strings never move as long as nothing is removed, so the spans of a table that is only appended to can be handed
+ * to other threads and kept for the lifetime of the table. Removing strings eventually compacts the blocks, which
+ * moves every string: the spans of such a table are only valid until the next `intern_remove`.
+ *
+ * a table loaded from a snapshot has `slots_borrowed` set: `control` and `slots` point into the mapped file and its
+ * strings live there too rather than in the blocks. The hash table is moved to the heap by its first rebuild and the
+ * strings by the first compaction.
+ */
+typedef struct {
+  uint8_t *control;
+  uint32_t *slots; // handle held by each full slot
+  size_t slots_capacity; // a power of 2, at least SWISS_GROUP_WIDTH
+  bool slots_borrowed;
+  size_t growth_left; // inserts into empty slots left before the hash table is rebuilt
+  Span *strings; // handle -> string. A free handle has a NULL start and the next free handle as length
+  uint32_t count; // live strings
+  uint32_t handles_count; // handles handed out, including free ones
+  uint32_t handles_capacity;
+  uint32_t free_handle; // first free handle, UINT32_MAX when there is none
+  char *block; // current block, its first bytes hold the pointer to the previous block
+  size_t block_used;
+  size_t block_size;
+  size_t live_bytes; // bytes used by live strings, terminators included
+  size_t garbage_bytes; // bytes left behind by removed strings
+} InternTable;
+
+int init_intern_table(InternTable *table);
+void destroy_intern_table(InternTable *table);
+
+/*
+ * writes the handle of `bytes` into `handle`, copying the string in on first sight. `inserted` (may be NULL) tells
+ * whether it was. returns 0 on success, else 1 (out of memory).
+ */
+int intern_string(InternTable *table, const char *bytes, size_t length, uint32_t *handle, bool *inserted);
+
+/*
+ * makes room for `count` more strings, so that interning them neither rebuilds the hash table nor grows the handle
+ * array. returns 0 on success, else 1 (out of memory).
+ */
+int intern_reserve(InternTable *table, size_t count);
+
+/*
+ * returns 0 and writes the handle of `bytes` into `handle` when it is interned, else 1.
+ */
+int intern_lookup(const InternTable *table, const char *bytes, size_t length, uint32_t *handle);
+
+/*
+ * frees `handle`, which must be live, for reuse by a later string.
+ */
+void intern_remove(InternTable *table, uint32_t handle);
+
+Span interned_span(const InternTable *table, uint32_t handle);
+
+#endif
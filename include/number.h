@@ -0,0 +1,60 @@
+#ifndef NUMBER_H
+#define NUMBER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define DECIMAL_MAX_DIGITS 19
+
+/*
+ * a decimal number as read from the statement text: value = (negative ? -1 : 1) * mantissa * 10^exponent. Only the
+ * first 19 significant digits fit the mantissa, `truncated` is set when a non zero digit had to be dropped.
+ *
+ * The tokenizer fills one of these while it scans a number token, so the digits are only ever read once.
+ */
+typedef struct {
+  uint64_t mantissa;
+  int64_t exponent;
+  int digits_count; // significant digits in `mantissa`
+  bool negative;
+  bool truncated;
+} DecimalNumber;
+
+/*
+ * appends one digit of the integer part (`fraction == false`) or of the fraction part.
+ */
+static inline void decimal_add_digit(DecimalNumber *number, char c, bool fraction) {
+  if (number->digits_count < DECIMAL_MAX_DIGITS) {
+    number->mantissa = number->mantissa * 10 + (uint64_t)(c - '0');
+    if (number->mantissa != 0) {
+      number->digits_count++;
+    }
+    if (fraction) {
+      number->exponent--;
+    }
+  } else {
+    if (c != '0') {
+      number->truncated = true;
+    }
+    if (!fraction) {
+      number->exponent++;
+    }
+  }
+}
+
+/*
+ * converts to the nearest double (round half to even), independently of the locale. `text`/`length` is the token
+ * `number` was scanned from, only read by the slow path for truncated or out of table range numbers.
+ *
+ * returns 0 on success, else 1 (the number overflows a double).
+ */
+int decimal_to_double(const DecimalNumber *number, const char *text, size_t length, double *value);
+
+/*
+ * scans and converts `[+-]digits[.digits][(e|E)[+-]digits]` (either digit run may be empty, not both). returns 0 when
+ * the whole of `text` was a valid number, else 1.
+ */
+int parse_double(const char *text, size_t length, double *value);
+
+#endif
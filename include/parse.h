@@ -1,23 +1,109 @@
 #ifndef PARSE_H
 #define PARSE_H
 
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "arena.h"
+#include "field.h"
+#include "geometry.h"
 #include "stringutils.h"
 
+#define MAX_EXPIRE_SECONDS 1e10 // a few centuries, keeps deadlines in milliseconds far from overflowing
+
 typedef enum {
   DELETE,
   GET,
   SET,
-  DROP
+  DROP,
+  NEARBY,
+  WITHIN,
+  INTERSECTS,
+  SETCHAN,
+  DELCHAN,
+  FSET
 } CommandType;
 
+#define COMMAND_TYPES_COUNT (FSET + 1)
+
+/*
+ * what a `?` placeholder stands for. Coordinates of a BOUNDS ring also record which point they belong to.
+ */
+typedef enum {
+  PARAM_KEY,
+  PARAM_ID,
+  PARAM_CHANNEL,
+  PARAM_Y, // lat
+  PARAM_X, // lon
+  PARAM_Z,
+  PARAM_LIMIT,
+  PARAM_DISTANCE,
+  PARAM_FIELD, // a field value of SET or FSET
+  PARAM_WHERE_MIN,
+  PARAM_WHERE_MAX,
+  PARAM_EXPIRE
+} ParameterTarget;
+
+typedef struct {
+  ParameterTarget target;
+  size_t point; // ring point index for PARAM_X and PARAM_Y, index into `fields` for PARAM_FIELD, into `wheres` for
+                // PARAM_WHERE_MIN and PARAM_WHERE_MAX
+  bool bound;
+} Parameter;
+
 typedef struct {
   CommandType command_type;
   Span key;
   Span id;
+  Geometry geometry; // SET geometry, the NEARBY query point or the WITHIN/INTERSECTS ring
+  size_t limit; // NEARBY LIMIT, 0 when not given
+  double distance; // NEARBY distance in meters, INFINITY when not given
+  Span channel; // SETCHAN/DELCHAN channel name
+  CommandType fence_command; // SETCHAN fence kind, NEARBY or WITHIN
+  FieldValue *fields; // SET and FSET fields in statement order, the spans point into the statement
+  size_t fields_count;
+  bool with_fields; // GET ... WITHFIELDS
+  double expire_seconds; // SET EX, 0 when the object doesn't expire
+  WhereClause *wheres; // NEARBY, WITHIN and INTERSECTS filters in statement order
+  size_t wheres_count;
+  Parameter *parameters; // `?` placeholders in statement order
+  size_t parameters_count;
+  size_t unbound_count; // the statement can only be executed once this is 0
 } PreparedStatement;
 
 
 typedef void (*error_callback)(int error_code, const char *error_message);
-int make_prepared_statement(const char *cmd, PreparedStatement *prepared_statement, error_callback ec_func);
+int make_prepared_statement(const char *cmd, PreparedStatement *prepared_statement, Arena *arena, error_callback ec_func);
+
+/*
+ * parses the first statement of a buffer of newline separated statements and points `next` at the statement after it
+ * (or at the terminating NUL), whether or not parsing succeeded. The newline is found by the tokenizer itself, only the
+ * rest of a statement that failed is scanned past.
+ */
+int make_next_prepared_statement(const char *cmd, const char **next, PreparedStatement *prepared_statement, Arena *arena,
+                                 error_callback ec_func);
+
+/*
+ * a statement may hold `?` placeholders wherever a key, id, channel, coordinate, field value, WHERE bound, EX, LIMIT
+ * or distance goes, for example "SET fleet ? FIELD speed ? POINT ? ?". It is then parsed once and executed many times,
+ * binding native values in between without any tokenizing. Placeholders are numbered from 0 in statement order.
+ * Bindings stay in place across executions, so only the values that changed need binding again. WHERE bounds are the
+ * only values that may be bound to an infinity.
+ *
+ * bound spans are not copied, their bytes must stay valid until the statement is executed. The bind functions return
+ * 0 on success, else 1 (no such placeholder, wrong type or invalid value).
+ */
+int bind_span(PreparedStatement *prepared_statement, size_t index, const char *bytes, size_t length);
+int bind_double(PreparedStatement *prepared_statement, size_t index, double value);
+
+/*
+ * unbinds every placeholder.
+ */
+void reset_prepared_statement(PreparedStatement *prepared_statement);
+
+/*
+ * the keyword of `command_type`, "DEL" for DELETE.
+ */
+const char *command_type_to_string(CommandType command_type);
 
 #endif
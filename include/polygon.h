@@ -0,0 +1,59 @@
+#ifndef POLYGON_H
+#define POLYGON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "geometry.h"
+
+/*
+ * rings with at least this many vertices get the y-bucketed edge index built in `init_polygon`.
+ */
+#ifndef POLYGON_BUCKETS_MIN_VERTICES
+#define POLYGON_BUCKETS_MIN_VERTICES 64
+#endif
+
+/*
+ * a closed ring prepared for containment tests. Vertices are copied into separate x and y arrays so the crossing number
+ * kernel can load several edges per SIMD register.
+ *
+ * Large rings additionally split their y range into `buckets_count` equal bands. `bucket_offsets[b]` ..
+ * `bucket_offsets[b + 1]` indexes `bucket_edges`, the start vertex of every edge whose y span overlaps band b, so a
+ * point only tests the edges of its own band instead of the whole ring, and an edge of another ring those of the bands
+ * it spans.
+ */
+typedef struct {
+  double *xs;
+  double *ys;
+  size_t count; // vertices, the last one equals the first
+  Rect rect;
+  uint32_t buckets_count; // 0 when the ring is too small to be worth it
+  double bucket_height;
+  uint32_t *bucket_offsets;
+  uint32_t *bucket_edges;
+} Polygon;
+
+/*
+ * returns 0 on success, else 1 (out of memory). `ring` must be closed.
+ */
+int init_polygon(Polygon *polygon, const LineString *ring);
+void destroy_polygon(Polygon *polygon);
+
+/*
+ * crossing number (even-odd) test. Points exactly on an edge may be reported either way.
+ */
+bool polygon_contains_point(const Polygon *polygon, const Point *p);
+
+/*
+ * true if every point of `inner` is inside `outer` or on its boundary, so a ring sharing edges with `outer` (or equal
+ * to it) is contained.
+ */
+bool polygon_contains_polygon(const Polygon *outer, const Polygon *inner);
+
+/*
+ * true if the two rings overlap, touch or one contains the other.
+ */
+bool polygons_intersect(const Polygon *a, const Polygon *b);
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef RESP_H
+#define RESP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "arena.h"
+#include "stringutils.h"
+
+#define RESP_MAX_INLINE_LENGTH (64 << 10)
+#define RESP_MAX_ARGUMENTS (1 << 20)
+#define RESP_MAX_BULK_LENGTH (512 << 20)
+
+typedef enum {
+  RESP_INCOMPLETE, // the buffer ends before the request does
+  RESP_REQUEST,
+  RESP_PROTOCOL_ERROR, // not RESP, nothing after it can be framed
+  RESP_OUT_OF_MEMORY, // a complete request that could not be rewritten
+} RespFrame;
+
+/*
+ * a request framed by `resp_next_request`. `statement` points into the buffer the request was read into.
+ */
+typedef struct {
+  char *statement; // NUL terminated, the arguments separated by spaces
+  Span name; // first argument, empty for an empty request
+  Span argument; // second argument, empty when there is none
+  size_t arguments_count;
+  Span *parameters; // the arguments replaced by `?` in `statement`, in order, to be bound with `bind_span`
+  size_t parameters_count;
+} RespRequest;
+
+/*
+ * frames the request at the start of `buffer` (`length` bytes) and rewrites it in place into a statement for
+ * `make_prepared_statement`, so the parser reads it straight from the connection's buffer.
+ *
+ * requests are either RESP arrays of bulk strings (what clients send) or inline commands, a line of space separated
+ * words passed on as is (what people type into telnet). In an array the bytes between two arguments,
+ * "\r\n$<length>\r\n", are overwritten with spaces and the "\r\n" after the last argument with the terminating NUL.
+ * Arguments the tokenizer would not read back as they are (empty, holding whitespace, a newline or a NUL, starting
+ * with a quote or a lone `?`) are copied into `arena` and replaced by a `?` placeholder, which keeps every byte of
+ * them.
+ *
+ * returns a RespFrame. `consumed` is set to the length of the request for RESP_REQUEST and RESP_OUT_OF_MEMORY.
+ */
+RespFrame resp_next_request(char *buffer, size_t length, Arena *arena, RespRequest *request, size_t *consumed);
+
+/*
+ * growable buffer replies are encoded into. Running out of memory is sticky: the append functions do nothing once
+ * `out_of_memory` is set.
+ */
+typedef struct {
+  char *data;
+  size_t length;
+  size_t capacity;
+  bool out_of_memory;
+} RespBuffer;
+
+void init_resp_buffer(RespBuffer *buffer);
+void destroy_resp_buffer(RespBuffer *buffer);
+
+void resp_append_simple(RespBuffer *buffer, const char *string); // +string
+void resp_append_error(RespBuffer *buffer, const char *message); // -ERR message
+void resp_append_bulk(RespBuffer *buffer, const char *bytes, size_t length);
+void resp_append_null(RespBuffer *buffer);
+void resp_append_double(RespBuffer *buffer, double value); // as a bulk string
+void resp_append_array_header(RespBuffer *buffer, size_t count);
+
+/*
+ * for arrays whose length is only known once their elements are appended: returns the offset to pass to
+ * `resp_end_array`, which inserts the header there.
+ */
+size_t resp_begin_array(RespBuffer *buffer);
+void resp_end_array(RespBuffer *buffer, size_t start, size_t count);
+
+#endif
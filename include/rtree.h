@@ -0,0 +1,127 @@
+#ifndef RTREE_H
+#define RTREE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "geometry.h"
+
+#define RTREE_MAX_ENTRIES 16
+#define RTREE_MIN_ENTRIES 6
+#define RTREE_MAX_HEIGHT 32
+#define RTREE_NULL_NODE UINT32_MAX
+#define RTREE_MAX_PARTITION 256
+
+/*
+ * a single node of the tree. Entry rects are stored as a structure of arrays so that testing all the entries of a node
+ * against a query rect is a tight loop over 4 contiguous double arrays (vectorizable, no pointer chasing).
+ *
+ * `children[i]` is the index of a child node in `RTree.nodes` for internal nodes (level > 0) and the caller supplied
+ * item value (object slot) for leaves (level == 0).
+ */
+typedef struct {
+  double min_x[RTREE_MAX_ENTRIES];
+  double min_y[RTREE_MAX_ENTRIES];
+  double max_x[RTREE_MAX_ENTRIES];
+  double max_y[RTREE_MAX_ENTRIES];
+  uint32_t children[RTREE_MAX_ENTRIES];
+  uint16_t count;
+  uint16_t level;
+} RTreeNode;
+
+/*
+ * R-tree (Guttman, quadratic split) whose nodes all live in one contiguous array and reference each other by index.
+ * Freed nodes are chained into a free list through `children[0]` and reused before the array grows.
+ *
+ * nothing in the array is a pointer, so a snapshot can map it from a file as is: such a tree has `nodes_borrowed` set,
+ * never frees the array and copies it to the heap the first time it has to grow.
+ */
+typedef struct {
+  RTreeNode *nodes;
+  uint32_t nodes_count;
+  uint32_t nodes_capacity;
+  bool nodes_borrowed;
+  uint32_t free_list;
+  uint32_t root;
+  size_t items_count;
+} RTree;
+
+/*
+ * called for every item whose rect intersects the query rect. Returning non-zero stops the search and that value is
+ * returned from `rtree_search`.
+ */
+typedef int (*rtree_search_callback)(uint32_t item, const Rect *rect, void *user_data);
+
+/*
+ * used by `rtree_nearby`: writes the distance from the query to each of the `node->count` entry rects of `node` into
+ * `distances`, all of a node at once so that it can be vectorised. A distance must never be larger than the distance to
+ * anything contained in the rect so that the best first traversal yields items in increasing distance. Entries at
+ * INFINITY are left out of the traversal.
+ */
+typedef void (*rtree_distance_function)(const RTreeNode *node, double *distances, void *user_data);
+
+/*
+ * called for items in increasing distance. Returning non-zero stops the traversal.
+ */
+typedef int (*rtree_nearby_callback)(uint32_t item, double distance, void *user_data);
+
+int init_rtree(RTree *tree);
+void destroy_rtree(RTree *tree);
+
+int rtree_insert(RTree *tree, const Rect *rect, uint32_t item);
+
+/*
+ * removes `item` stored with exactly `rect`. returns 0 on success, else 1 (not found or out of memory, in which case
+ * the tree is unchanged).
+ */
+int rtree_remove(RTree *tree, const Rect *rect, uint32_t item);
+
+/*
+ * builds the tree from `count` items at once with Sort-Tile-Recursive packing: much faster than inserting them one by
+ * one and the nodes come out nearly full with little overlap. The tree must be empty. returns 0 on success, else 1
+ * (the tree was not empty, or out of memory in which case it is left empty).
+ */
+int rtree_bulk_load(RTree *tree, const Rect *rects, const uint32_t *items, size_t count);
+
+/*
+ * moves `item` from `old_rect` to `rect`. Small moves that stay inside the box of the item's leaf only rewrite the leaf
+ * entry, anything else is a remove and an insert. returns 0 on success, else 1 (not found or out of memory, in which
+ * case the tree is unchanged).
+ */
+int rtree_update(RTree *tree, const Rect *old_rect, const Rect *rect, uint32_t item);
+
+int rtree_search(const RTree *tree, const Rect *rect, rtree_search_callback cb, void *user_data);
+
+/*
+ * best first (Hjaltason & Samet) k nearest neighbour traversal. Nodes and items share one min heap keyed on distance so
+ * only the nodes closer than the last yielded item are ever opened. returns 0 when done or stopped, 1 when out of
+ * memory.
+ */
+int rtree_nearby(const RTree *tree, rtree_distance_function dist, rtree_nearby_callback cb, void *user_data);
+
+/*
+ * splits a search for `rect` into disjoint subtrees that can be searched independently, for parallel scans. The tree is
+ * expanded breadth first, one level at a time for as long as the nodes of the next level that intersect `rect` fit in
+ * `max_subtrees` (at most RTREE_MAX_PARTITION), stopping at the leaves. returns the number of subtrees written to
+ * `subtrees`, all of them at `level`. Items outside of all of them don't intersect `rect`.
+ */
+size_t rtree_partition(const RTree *tree, const Rect *rect, uint32_t *subtrees, size_t max_subtrees, uint16_t *level);
+
+/*
+ * `rtree_search` and `rtree_nearby` limited to the subtree rooted at `node`.
+ */
+int rtree_search_subtree(const RTree *tree, uint32_t node, const Rect *rect, rtree_search_callback cb,
+                         void *user_data);
+int rtree_nearby_subtree(const RTree *tree, uint32_t node, rtree_distance_function dist, rtree_nearby_callback cb,
+                         void *user_data);
+
+Rect rtree_node_entry_rect(const RTreeNode *node, int index);
+
+/*
+ * nodes the calling thread has opened in searches (`rtree_search`, `rtree_nearby`, `rtree_partition` and their subtree
+ * variants), for instrumentation: read it before and after a search. Added to once per search, not once per node.
+ */
+extern _Thread_local uint64_t rtree_nodes_visited;
+
+#endif
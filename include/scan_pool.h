@@ -0,0 +1,51 @@
+#ifndef SCAN_POOL_H
+#define SCAN_POOL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * runs task `task` of a job, tasks of one job may run at the same time on different threads.
+ */
+typedef void (*scan_task_function)(size_t task, void *user_data);
+
+typedef struct ScanJob ScanJob;
+
+/*
+ * fixed set of worker threads that large spatial scans are split across. A scan is a job of independent tasks (the
+ * subtrees of the index it has to visit), every idle worker claims the next unstarted task of the oldest job and the
+ * thread that submitted the job works on it too, so a job always makes progress and jobs submitted by different
+ * threads at once share the workers.
+ *
+ * `min_candidates` is the threshold below which a scan isn't worth splitting: queries estimated to visit fewer objects
+ * run on the calling thread alone.
+ */
+typedef struct {
+  pthread_t *workers;
+  unsigned int workers_count;
+  size_t min_candidates;
+  pthread_mutex_t lock;
+  pthread_cond_t wakeup; // broadcast when a job is queued or the pool closes
+  ScanJob *jobs; // jobs with unclaimed tasks, oldest first
+  ScanJob *last_job;
+  bool closing;
+} ScanPool;
+
+/*
+ * starts `workers_count` (at least 1) workers. returns 0 on success, else 1 (errno is set).
+ */
+int init_scan_pool(ScanPool *pool, unsigned int workers_count, size_t min_candidates);
+
+/*
+ * stops the workers, no job may be running.
+ */
+void destroy_scan_pool(ScanPool *pool);
+
+/*
+ * calls `fn` for every task in [0, tasks_count) on the workers and the calling thread, returns once all of them are
+ * done.
+ */
+void scan_pool_run(ScanPool *pool, size_t tasks_count, scan_task_function fn, void *user_data);
+
+#endif
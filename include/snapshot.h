@@ -0,0 +1,57 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "store.h"
+
+/*
+ * point in time image of the collections of a store, made to be mapped and queried in place rather than parsed.
+ *
+ * the file is a header followed by sections aligned to 64 bytes that only reference each other by file offset. Each
+ * collection contributes its key, the Swiss table of its id interning table (control bytes and handle slots), the id
+ * bytes, its objects, its point columns (quantized or not, as the collection holds them), the points of its line
+ * strings, the nodes of its spatial index, its field columns and the EX deadlines of its objects. The hash table, the
+ * objects, the point columns, the index nodes and the field columns are written exactly as they sit in memory, so
+ * loading one maps the file copy-on-write and points the collection at them: the only per object work is building the
+ * span table of the ids, copying out line strings and scheduling the deadlines. Those
+ * raw layouts tie a snapshot to the build that wrote it, the header records their sizes and a snapshot from a
+ * different layout is refused.
+ *
+ * the header also records the id of the log and the offset in it up to which writes are included, startup is then
+ * `store_load_snapshot` followed by `store_replay_wal` of the log tail. Geofence channels are not part of snapshots,
+ * like they are not part of the log.
+ *
+ * only the header and the collection table are checksummed: a snapshot is written to a temporary file, synced and
+ * renamed into place, it is never modified afterwards.
+ */
+
+/*
+ * writes the snapshot of `store` to `path`, replacing it atomically. `log_id` and `log_offset` name the end of the log
+ * the store is at (0 when there is no log). returns a StoreResult.
+ */
+int store_write_snapshot(const Store *store, const char *path, uint64_t log_id, uint64_t log_offset);
+
+/*
+ * forks a child that writes the snapshot of the store as it is right now and exits. The store keeps serving reads and
+ * writes meanwhile: the child sees memory as it was at the fork and the kernel only copies the pages the parent
+ * writes to afterwards. The log of the store is synced first so that a snapshot never includes writes the log could
+ * still lose. returns the pid of the child, -1 when it could not be started.
+ */
+pid_t store_snapshot_in_background(Store *store, const char *path);
+
+/*
+ * waits for a child started by `store_snapshot_in_background`. returns a StoreResult.
+ */
+int store_wait_snapshot(pid_t pid);
+
+/*
+ * loads the snapshot at `path` into the empty `store`. `wal` (may be NULL) is the log the store is about to replay,
+ * a snapshot that does not belong to it is refused so that the whole log is replayed instead. returns a StoreResult:
+ * STORE_IO_ERROR when the file can't be read (errno is set) and STORE_INVALID_SNAPSHOT when it can't be used, the
+ * store is left empty in both cases.
+ */
+int store_load_snapshot(Store *store, const char *path, const Wal *wal);
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "parse.h"
+
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_MAX_BITS 40 // 2^40ns is about 18 minutes, anything longer lands in the last bucket
+#define HISTOGRAM_BUCKETS ((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+#define SLOW_LOG_CAPACITY 128
+#define SLOW_LOG_SPAN_LENGTH 32 // keys and ids longer than this are cut in the slow log
+
+/*
+ * log linear histogram of nanoseconds: values below 16 have a bucket each, above that every power of 2 is split in 16
+ * buckets, so a percentile is off by at most 1/16 of its value whatever its magnitude.
+ */
+typedef struct {
+  uint64_t counts[HISTOGRAM_BUCKETS];
+  uint64_t count;
+  uint64_t total;
+  uint64_t max;
+} LatencyHistogram;
+
+void histogram_record(LatencyHistogram *histogram, uint64_t value);
+void histogram_merge(LatencyHistogram *into, const LatencyHistogram *histogram);
+
+/*
+ * the value below which `percentile` percent of the recorded values are, rounded up to the end of its bucket (and
+ * never above the largest value recorded). 0 when nothing was recorded.
+ */
+uint64_t histogram_percentile(const LatencyHistogram *histogram, double percentile);
+
+/*
+ * what was recorded for one command type, or for parsing.
+ */
+typedef struct {
+  uint64_t calls;
+  uint64_t errors; // any result but STORE_OK, or a parse error
+  uint64_t results; // objects yielded to `on_object` by GET and queries
+  uint64_t nodes_visited; // spatial index nodes visited, by queries and by the geofence lookups of writes
+  uint64_t arena_bytes; // statement arena bytes used by parsing
+  uint64_t arena_bytes_max;
+  LatencyHistogram latency;
+} CommandStats;
+
+/*
+ * a statement that took at least the slow log threshold.
+ */
+typedef struct {
+  uint64_t timestamp; // unix milliseconds when it finished
+  uint64_t duration; // nanoseconds
+  CommandType command_type;
+  int store_result;
+  char key[SLOW_LOG_SPAN_LENGTH];
+  size_t key_length;
+  char id[SLOW_LOG_SPAN_LENGTH]; // or the channel of SETCHAN and DELCHAN
+  size_t id_length;
+  uint64_t results;
+  uint64_t nodes_visited;
+} SlowQuery;
+
+typedef struct StatsShard StatsShard;
+
+/*
+ * counters and latency histograms of every statement a store executes, see `store_record_stats`.
+ *
+ * recording never contends: every thread records into a shard of its own, allocated the first time the thread records
+ * and found again through a thread specific key, so the hot path is plain loads and stores on memory no other thread
+ * writes. A report sums the shards. The shard of a thread that exits is handed to the next new thread, so a server
+ * that cycles threads keeps a bounded number of them.
+ *
+ * statements taking at least `slow_threshold` nanoseconds are also copied into a ring of the last SLOW_LOG_CAPACITY
+ * of them. Those are rare, the ring is behind a mutex.
+ */
+typedef struct {
+  pthread_key_t key;
+  pthread_mutex_t lock; // guards the shard list and the slow log
+  StatsShard *shards;
+  atomic_uint_fast64_t slow_threshold; // 0 turns the slow log off
+  SlowQuery slow_log[SLOW_LOG_CAPACITY];
+  uint64_t slow_count; // ever logged, the newest is at (slow_count - 1) % SLOW_LOG_CAPACITY
+} Stats;
+
+/*
+ * what a Stats recorded, summed over threads, along with the size of the store when filled by `store_stats`.
+ */
+typedef struct {
+  CommandStats parse;
+  CommandStats commands[COMMAND_TYPES_COUNT];
+  uint64_t slow_count;
+  uint64_t slow_threshold;
+  uint32_t collections;
+  size_t objects;
+  size_t memory_bytes; // held by the collections' arrays, see `collection_memory_usage`
+} StatsReport;
+
+/*
+ * slow log off by default. returns 0 on success, else 1.
+ */
+int init_stats(Stats *stats);
+
+/*
+ * no thread may be recording.
+ */
+void destroy_stats(Stats *stats);
+
+/*
+ * statements taking at least `threshold` nanoseconds go to the slow log, 0 turns it off.
+ */
+void stats_set_slow_threshold(Stats *stats, uint64_t threshold);
+
+/*
+ * records one `make_prepared_statement` that took `duration` nanoseconds and used `arena_bytes` of its arena.
+ */
+void stats_record_parse(Stats *stats, uint64_t duration, size_t arena_bytes, bool failed);
+
+/*
+ * records one executed statement.
+ */
+void stats_record_command(Stats *stats, const PreparedStatement *prepared_statement, uint64_t duration,
+                          int store_result, uint64_t results, uint64_t nodes_visited);
+
+/*
+ * sums the shards into `report`, the store size fields are left at 0.
+ */
+void stats_report(Stats *stats, StatsReport *report);
+
+/*
+ * copies up to `capacity` entries of the slow log, newest first. returns how many were copied.
+ */
+size_t stats_slow_queries(Stats *stats, SlowQuery *queries, size_t capacity);
+
+/*
+ * writes `report` and `slow_queries` as lines of text into `buffer` (NUL terminated, cut if it doesn't fit), with
+ * mean, p50, p99, p999 and max latencies in microseconds. returns the length the full text needs, like snprintf.
+ */
+size_t format_stats(const StatsReport *report, const SlowQuery *slow_queries, size_t slow_queries_count, char *buffer,
+                    size_t capacity);
+
+/*
+ * monotonic nanoseconds, what durations are measured with.
+ */
+uint64_t stats_now_ns(void);
+
+#endif
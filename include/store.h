@@ -0,0 +1,175 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "collection.h"
+#include "event_ring.h"
+#include "geofence.h"
+#include "hashmap.h"
+#include "parse.h"
+#include "scan_pool.h"
+#include "stats.h"
+#include "wal.h"
+
+/*
+ * the in-memory database: every key maps to its own Collection. Collections are heap allocated individually so the
+ * pointers handed out stay valid while other keys are created or dropped.
+ *
+ * statements (`execute_prepared_statement`, `execute_batch`) can be executed from any number of threads at once. Each
+ * one holds `lock` for reading, which keeps its collection alive, and the lock of its collection: queries and GETs of
+ * a collection run in parallel, its writes one at a time, and collections don't wait for each other. Only creating and
+ * dropping a collection takes `lock` for writing. Writes are appended to the log while their collection is locked, so
+ * the log has the writes of every collection in the order they were applied, and committed after it is unlocked, so
+ * concurrent writers share syncs.
+ *
+ * the other functions don't lock: they are meant for setting the store up (loading, replaying) before it is shared.
+ */
+typedef struct {
+  pthread_rwlock_t lock;
+  HashMap keys; // key -> index into `collections`
+  Collection **collections;
+  uint32_t collections_count;
+  uint32_t collections_capacity;
+  uint64_t drops; // collections dropped so far, a batch's cached collection is alive as long as this didn't change
+  pthread_rwlock_t geofences_lock;
+  Geofences geofences;
+  // receives the geofence events caused by SET and DEL, may be NULL. Called by the writing thread with the collection
+  // locked: the events of a collection are in order, those of different collections may arrive concurrently.
+  detect_callback on_detect;
+  void *detect_user_data;
+  EventRing *events; // set by `store_publish_events`
+  pthread_mutex_t events_lock; // the ring has a single producer, writers publish one at a time
+  Wal *wal; // set by `store_log_writes`, may be NULL
+  ScanPool *scan_pool; // set by `store_parallel_scans`, may be NULL
+  Stats *stats; // set by `store_record_stats`, may be NULL
+  bool quantize_points; // set by `store_quantize_points`
+  void *snapshot; // mapping set by `store_load_snapshot`, the collections it loaded borrow their arrays from it
+  size_t snapshot_size;
+  uint64_t log_offset; // where `store_replay_wal` starts, the end of the log covered by the loaded snapshot
+} Store;
+
+/*
+ * called for every object GET or a query command (NEARBY, WITHIN, INTERSECTS) yields, in result order, while the
+ * collection is locked for reading. `distance` is in meters for NEARBY and 0 otherwise. Returning non-zero stops the
+ * query.
+ */
+typedef int (*object_callback)(const Object *object, double distance, void *user_data);
+
+typedef struct {
+  // set by GET and query commands, `collection_object_id` and `collection_object_field` read the objects' ids and fields
+  const Collection *collection;
+  const Object *object; // set by GET, only safe to read after the statement if no other thread writes
+  size_t objects_count; // number of objects passed to `on_object` by a query command
+  object_callback on_object; // set by the caller before executing a query command, results are streamed to it
+  void *user_data; // passed to `on_object`
+} ExecuteResult;
+
+int init_store(Store *store);
+void destroy_store(Store *store);
+
+Collection *store_get_collection(const Store *store, const char *key, size_t key_length);
+
+/*
+ * returns the collection for `key`, creating it when it doesn't exist yet. NULL when out of memory.
+ */
+Collection *store_get_or_create_collection(Store *store, const char *key, size_t key_length);
+
+/*
+ * routes every geofence event into `events` (replacing `on_detect`). The ring is not owned by the store.
+ */
+void store_publish_events(Store *store, EventRing *events);
+
+int store_drop_collection(Store *store, const char *key, size_t key_length);
+
+/*
+ * appends every applied SET, FSET, DEL and DROP to `wal` from now on. A statement only returns once its write is
+ * committed according to the log's sync policy; STORE_IO_ERROR means it was applied in memory but may not be durable.
+ * The log is not owned by the store.
+ */
+void store_log_writes(Store *store, Wal *wal);
+
+/*
+ * splits large NEARBY, WITHIN and INTERSECTS queries across the workers of `pool` from now on, NULL (the default) runs
+ * every query on the thread executing it. The pool can be shared by stores and is not owned by the store.
+ */
+void store_parallel_scans(Store *store, ScanPool *pool);
+
+/*
+ * records every statement `execute_prepared_statement` and `execute_batch` execute into `stats` from now on: its
+ * latency (log commit included), whether it failed, the objects it yielded and the spatial index nodes it visited, and
+ * slow ones in the slow log. `execute_batch` also records its parsing; callers that parse statements themselves record
+ * that with `stats_record_parse`. NULL (the default) records nothing. `stats` is not owned by the store.
+ */
+void store_record_stats(Store *store, Stats *stats);
+
+/*
+ * creates the collections of keys written from now on quantized (see PointColumns) when `quantize` is set, exact (the
+ * default) when it is not. Existing collections, those of a loaded snapshot included, keep their own representation.
+ * Set it before `store_replay_wal` so that the collections the log recreates get it too.
+ */
+void store_quantize_points(Store *store, bool quantize);
+
+/*
+ * fills `report` with what `store->stats` recorded (nothing when it is NULL) and the size of the store.
+ */
+void store_stats(Store *store, StatsReport *report);
+
+/*
+ * applies every write of `wal` to the store without logging or emitting geofence events, starting after the writes
+ * covered by a snapshot loaded with `store_load_snapshot`. The spatial indexes of collections that start out empty are
+ * bulk loaded once at the end instead of growing with every record. Call it right after `open_wal`, before
+ * `store_log_writes`. returns a StoreResult.
+ */
+int store_replay_wal(Store *store, Wal *wal);
+
+/*
+ * applies a statement created by `make_prepared_statement` to the store.
+ *
+ * returns a StoreResult. `result` is filled for commands that return data, its pointers are only valid until the next
+ * write to the store.
+ */
+int execute_prepared_statement(Store *store, const PreparedStatement *prepared_statement, ExecuteResult *result);
+
+/*
+ * outcome of one statement of a batch. `store_result` is STORE_INVALID_STATEMENT when parsing failed.
+ */
+typedef struct {
+  int parse_result; // ParserResult, 0 when the statement was executed
+  int store_result; // StoreResult
+} BatchResult;
+
+/*
+ * parses and applies the newline separated statements of `commands` in order, in a single pass over the buffer.
+ * `results[i]` receives the outcome of statement i. Objects found by GET and by query commands are all streamed to
+ * `result->on_object`. Every statement takes its locks on its own, statements of other threads can run in between.
+ *
+ * writes are committed to the log once per run of consecutive writes rather than once per statement.
+ *
+ * `arena` is reset after every statement. Stops after `results_capacity` statements, `rest` (may be NULL) is pointed at
+ * the first statement left unprocessed. returns the number of statements processed.
+ */
+size_t execute_batch(Store *store, const char *commands, Arena *arena, BatchResult *results, size_t results_capacity,
+                     ExecuteResult *result, const char **rest);
+
+/*
+ * removes every object whose EX deadline is at or before `now` (unix milliseconds, see `store_now_ms`), like a DEL:
+ * the removal is logged and fences get their exit events. Deadlines are kept in a timer wheel per collection, so only
+ * the due objects are touched. Call it periodically (the server does every 100ms); GET already hides an object past its
+ * deadline, queries return it until it is removed. `expired` (may be NULL) receives the number of objects removed.
+ * returns a StoreResult.
+ */
+int store_expire(Store *store, uint64_t now, size_t *expired);
+
+/*
+ * the wall clock in unix milliseconds, what EX deadlines are measured with. Deadlines are logged as they are, so they
+ * still hold after a restart.
+ */
+uint64_t store_now_ms(void);
+
+const char *store_result_to_string(int store_result);
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TIMER_WHEEL_LEVEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_LEVEL_BITS)
+#define TIMER_WHEEL_LEVELS 6 // 64^6 ticks ahead, about 2 years of milliseconds, before deadlines wrap around
+#define TIMER_WHEEL_NONE UINT32_MAX
+#define TIMER_WHEEL_HEAD 0x80000000u // flags the `previous` of the first item of a bucket, items stay below it
+
+/*
+ * hierarchical timer wheel over dense uint32_t items (object slots): scheduling, cancelling and firing a deadline are
+ * O(1) and no structure is ever scanned for what is due.
+ *
+ * level l has 64 buckets of 64^l ticks each. A deadline goes to the lowest level whose bucket span still separates it
+ * from `now`, in the bucket of its digit at that level. When `now` reaches the start of a bucket of level l > 0, the
+ * bucket is cascaded: its items move down a level or more, so every item is moved at most once per level and only the
+ * level 0 bucket of `now` ever fires. A bitmap of the non empty buckets lets `timer_wheel_advance` jump straight to the
+ * next bucket that holds anything.
+ *
+ * buckets are intrusive doubly linked lists threaded through `next` and `previous`, indexed by item like `deadlines`.
+ * The first item of a bucket has TIMER_WHEEL_HEAD | bucket as its `previous`, so cancelling needs no search.
+ *
+ * ticks have no unit of their own, the store uses milliseconds.
+ */
+typedef struct {
+  uint64_t *deadlines; // 0 when the item is not scheduled
+  uint32_t *next;
+  uint32_t *previous;
+  uint32_t capacity; // of the item arrays
+  uint64_t now; // every tick before it has fired
+  size_t count; // scheduled items
+  uint64_t occupied[TIMER_WHEEL_LEVELS]; // bit b of level l is set when bucket b is not empty
+  uint32_t buckets[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS]; // first item, TIMER_WHEEL_NONE when empty
+} TimerWheel;
+
+void init_timer_wheel(TimerWheel *wheel);
+void destroy_timer_wheel(TimerWheel *wheel);
+
+/*
+ * makes room for items below `capacity`. returns 0 on success, else 1 (out of memory).
+ */
+int timer_wheel_reserve(TimerWheel *wheel, uint32_t capacity);
+
+/*
+ * (re)schedules `item`, below the reserved capacity, to fire at `deadline` (not 0). A deadline already passed fires at
+ * the next advance. `now` is the current time: an empty wheel jumps to it, so its first deadline isn't filed relative
+ * to a time long gone.
+ */
+void timer_wheel_schedule(TimerWheel *wheel, uint32_t item, uint64_t deadline, uint64_t now);
+
+/*
+ * unschedules `item` if it is scheduled.
+ */
+void timer_wheel_cancel(TimerWheel *wheel, uint32_t item);
+
+static inline uint64_t timer_wheel_deadline(const TimerWheel *wheel, uint32_t item) {
+  return item < wheel->capacity ? wheel->deadlines[item] : 0;
+}
+
+/*
+ * fires every tick up to and including `now`: unschedules the items whose deadline is due and writes up to `capacity`
+ * of them into `expired`. returns how many were written; when that is `capacity`, more may be due and the call should
+ * be repeated.
+ */
+size_t timer_wheel_advance(TimerWheel *wheel, uint64_t now, uint32_t *expired, size_t capacity);
+
+#endif
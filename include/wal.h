@@ -0,0 +1,161 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "field.h"
+#include "geometry.h"
+#include "stringutils.h"
+
+#define WAL_FLUSH_THRESHOLD (1 << 20)
+
+typedef enum {
+  WAL_SYNC_ALWAYS, // a commit returns once its records are on disk (fdatasync)
+  WAL_SYNC_INTERVAL, // a commit returns once its records are written, a background thread syncs every interval
+  WAL_SYNC_OS, // a commit returns once its records are written, the OS decides when they reach the disk
+} WalSyncPolicy;
+
+typedef enum {
+  WAL_SET,
+  WAL_DELETE,
+  WAL_DROP,
+} WalOp;
+
+/*
+ * one applied write. `id` is unused by WAL_DROP, `geometry`, `fields` and `expires_at` are only set for WAL_SET, which
+ * holds every field of the object and its deadline. When replaying, the spans, the line string points and the fields
+ * are only valid during the callback.
+ */
+typedef struct {
+  WalOp op;
+  Span key;
+  Span id;
+  const Geometry *geometry;
+  const FieldValue *fields;
+  size_t fields_count;
+  uint64_t expires_at; // unix milliseconds, 0 when the object doesn't expire
+} WalRecord;
+
+/*
+ * append only log of the writes applied to a store.
+ *
+ * the file starts with a 16 byte header: magic and version, written in host byte order so a log moved to a host of the
+ * other endianness is rejected rather than misread, and a random id that snapshots use to tell which log their offset
+ * belongs to. Every record is a uint32_t payload length, the crc32c of the payload and the payload: the op byte, varint
+ * length prefixed key and id, then the geometry type and its points as raw doubles, followed for a SET with fields by
+ * their varint count and every varint length prefixed name and raw double value (a SET without fields ends after the
+ * geometry, as in logs written before fields existed). A SET that expires always has the field count, 0 if need be,
+ * and ends with its deadline as a raw uint64_t. A record that is cut short or fails its checksum ends the log, it can
+ * only be the tail of an interrupted write.
+ *
+ * group commit: `wal_append` only encodes the record into an in memory buffer. The first thread to `wal_commit` becomes
+ * the leader, swaps the buffer for an empty one and writes (and syncs) everything appended so far while the lock is
+ * released, so every writer that appended in the meantime is covered by the same write and fdatasync. Writers that
+ * arrive while a leader is busy wait for it and only lead a round of their own if their records were appended too late
+ * to be part of it.
+ *
+ * compaction rewrites the log down to the last SET of every live id on a thread of its own while writers keep
+ * appending, see `wal_compact`.
+ */
+typedef struct {
+  int fd;
+  char *path;
+  uint64_t id; // random, picked when the log file is created
+  uint64_t end_offset; // file offset right after the last appended record, buffered ones included
+  WalSyncPolicy policy;
+  unsigned int sync_interval_ms;
+  pthread_mutex_t lock;
+  pthread_cond_t flushed; // broadcast when a leader is done
+  char *buffer; // records appended but not handed to a leader yet
+  size_t buffer_used;
+  size_t buffer_capacity;
+  char *flush_buffer; // the buffer being written by the leader
+  size_t flush_buffer_capacity;
+  uint64_t appended_lsn; // every record gets the next log sequence number, starting at 1
+  uint64_t written_lsn; // records handed to the OS
+  uint64_t synced_lsn; // records known to be on disk
+  bool flushing; // a leader is writing
+  int error; // errno of the first failed write or sync, the log refuses further commits after it
+  pthread_t syncer; // WAL_SYNC_INTERVAL only
+  pthread_cond_t syncer_wakeup;
+  bool closing;
+  pthread_t compactor;
+  bool compactor_started; // `compactor` has to be joined
+  bool compacting;
+  int compaction_error; // errno of the last compaction, 0 when it succeeded
+  uint64_t compact_min_size; // 0 when the log is only compacted by `wal_compact`
+  uint64_t compacted_size; // size of the log right after the last compaction
+} Wal;
+
+typedef int (*wal_replay_callback)(const WalRecord *record, void *user_data);
+
+/*
+ * opens (creating it if needed) the log at `path`. `sync_interval_ms` is only used by WAL_SYNC_INTERVAL. returns 0 on
+ * success, else 1 (errno is set).
+ */
+int open_wal(Wal *wal, const char *path, WalSyncPolicy policy, unsigned int sync_interval_ms);
+
+/*
+ * commits everything appended, syncs it whatever the policy and closes the log. returns 0 on success, else 1.
+ */
+int close_wal(Wal *wal);
+
+/*
+ * passes every record from file offset `offset` on (0 for the first record) to `cb` in order, then cuts off a torn tail
+ * so new records are appended right after the last complete one. Must be called before anything is appended. A
+ * non-zero return of `cb` stops the replay and is returned. returns 0 on success, else -1 (unreadable, not a log or
+ * `offset` is not in it; errno is set).
+ */
+int wal_replay(Wal *wal, uint64_t offset, wal_replay_callback cb, void *user_data);
+
+/*
+ * encodes `record` into the log buffer and writes its sequence number into `lsn`. The record is not durable until
+ * `wal_commit` returns for it. returns 0 on success, else 1 (out of memory or the log failed earlier).
+ */
+int wal_append(Wal *wal, const WalRecord *record, uint64_t *lsn);
+
+/*
+ * blocks until record `lsn` (and every one before it) is as durable as the sync policy promises. Safe to call from
+ * several threads at once, their records are written together. returns 0 on success, else 1 (IO error).
+ */
+int wal_commit(Wal *wal, uint64_t lsn);
+
+/*
+ * writes and syncs every record appended so far, whatever the policy. returns 0 on success, else 1 (IO error).
+ */
+int wal_sync(Wal *wal);
+
+uint64_t wal_end_offset(Wal *wal);
+
+/*
+ * starts rewriting the log to only the last SET of every id that is still live, which bounds both its size and the
+ * replay time under constant updates. Runs on its own thread: appends are never blocked and commits only wait while
+ * the records appended during the rewrite are copied over for the last time. The rewritten log gets a new id, so
+ * snapshots taken before it are refused at the next start and the (compacted) log is replayed in full instead. Must
+ * not run during `wal_replay`. returns 0 when started, else 1 (one is running or the thread could not be created).
+ */
+int wal_compact(Wal *wal);
+
+/*
+ * waits for the running compaction, if any. returns 0 when the last compaction succeeded (or there was none), else 1.
+ */
+int wal_wait_compaction(Wal *wal);
+
+/*
+ * compacts automatically once the log is at least `min_size` bytes and twice as large as right after the previous
+ * compaction. 0 (the default) turns it off.
+ */
+void wal_auto_compact(Wal *wal, uint64_t min_size);
+
+/*
+ * fsyncs the directory holding `path`, which makes creating or renaming that file durable. returns 0 on success, else
+ * 1.
+ */
+int sync_parent_directory(const char *path);
+
+uint32_t crc32c(uint32_t crc, const void *bytes, size_t length);
+
+#endif
@@ -0,0 +1,110 @@
+#include "arena.h"
+
+#include <stdalign.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGNMENT alignof(max_align_t)
+
+struct ArenaBlock {
+  ArenaBlock *previous;
+  size_t size; // usable bytes in `data`
+  size_t used;
+  alignas(ARENA_ALIGNMENT) unsigned char data[];
+};
+
+static size_t align_up(size_t size) {
+  return (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+}
+
+/*
+ * pushes a new block of at least `needed` bytes. returns 0 on success, else 1 (out of memory).
+ */
+static int push_block(Arena *arena, size_t needed) {
+  size_t size = needed > arena->block_size ? align_up(needed) : arena->block_size;
+  ArenaBlock *block = malloc(sizeof(ArenaBlock) + size);
+  if (block == NULL) {
+    return 1;
+  }
+  block->previous = arena->block;
+  block->size = size;
+  block->used = 0;
+  arena->block = block;
+  return 0;
+}
+
+int init_arena(Arena *arena, size_t block_size) {
+  *arena = (Arena){ .block_size = align_up(block_size == 0 ? ARENA_BLOCK_SIZE : block_size) };
+  return push_block(arena, 0);
+}
+
+void destroy_arena(Arena *arena) {
+  ArenaBlock *block = arena->block;
+  while (block != NULL) {
+    ArenaBlock *previous = block->previous;
+    free(block);
+    block = previous;
+  }
+  *arena = (Arena){ 0 };
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+  size = align_up(size);
+  if (size == 0) {
+    size = ARENA_ALIGNMENT;
+  } else if (size > SIZE_MAX - sizeof(ArenaBlock)) {
+    return NULL;
+  }
+
+  if (arena->block == NULL || arena->block->size - arena->block->used < size) {
+    if (push_block(arena, size) != 0) {
+      return NULL;
+    }
+  }
+  void *ptr = arena->block->data + arena->block->used;
+  arena->block->used += size;
+  arena->last = ptr;
+  return ptr;
+}
+
+void *arena_grow(Arena *arena, void *ptr, size_t old_size, size_t new_size) {
+  if (ptr != NULL && ptr == arena->last) {
+    ArenaBlock *block = arena->block;
+    size_t offset = (size_t)((unsigned char *)ptr - block->data);
+    if (new_size <= block->size - offset) {
+      block->used = offset + align_up(new_size);
+      return ptr;
+    }
+  }
+
+  void *grown = arena_alloc(arena, new_size);
+  if (grown != NULL && ptr != NULL) {
+    memcpy(grown, ptr, old_size < new_size ? old_size : new_size);
+  }
+  return grown;
+}
+
+void arena_reset(Arena *arena) {
+  ArenaBlock *block = arena->block;
+  if (block == NULL) {
+    return;
+  }
+  ArenaBlock *previous = block->previous;
+  while (previous != NULL) {
+    ArenaBlock *next = previous->previous;
+    free(previous);
+    previous = next;
+  }
+  block->previous = NULL;
+  block->used = 0;
+  arena->last = NULL;
+}
+
+size_t arena_used(const Arena *arena) {
+  size_t used = 0;
+  for (const ArenaBlock *block = arena->block; block != NULL; block = block->previous) {
+    used += block->used;
+  }
+  return used;
+}
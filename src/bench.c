@@ -0,0 +1,519 @@
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "geoqlite.h"
+#include "store.h"
+
+#define BENCH_DEFAULT_OBJECTS 100000
+#define BENCH_DEFAULT_QUERIES 10000
+#define BENCH_DEFAULT_FENCES 1000
+#define BENCH_DEFAULT_SEED 1
+#define BENCH_ID_LENGTH 16
+#define BENCH_CHANNEL_LENGTH 32
+#define BENCH_STATEMENT_LENGTH 96
+#define BENCH_CITIES 32
+#define BENCH_CITY_SPREAD_DEGREES 0.08 // standard deviation around a city center, about 9km
+#define BENCH_TRACE_STEPS 20 // positions per object of the traces fleet
+#define BENCH_MOVE_METERS 50.0 // longest move of one update
+#define BENCH_NEARBY_LIMIT 10
+#define BENCH_WITHIN_DEGREES 0.05 // side of a WITHIN square, about 5km
+#define BENCH_FENCE_METERS 2000.0
+#define BENCH_EVENTS_CAPACITY 4096
+#define BENCH_EVENTS_DRAIN_BATCH 256
+#define BENCH_PARALLEL_SCAN_MIN_CANDIDATES 16384
+#define METERS_PER_DEGREE 111320.0
+
+// fleets are spread over a continent sized box.
+#define REGION_MIN_LAT 30.0
+#define REGION_MAX_LAT 45.0
+#define REGION_MIN_LON -120.0
+#define REGION_MAX_LON -75.0
+
+/*
+ * geoqlite-bench: runs synthetic fleets through an embedded store and writes what it measured as JSON, so two builds
+ * can be compared.
+ *
+ * three fleets are generated from the seed: `uniform` spreads objects over the region, `clustered` packs them around
+ * a few dozen cities of very different sizes the way real fleets are, and `traces` moves fewer objects along random
+ * walks so most SETs replace an object that is already indexed. Every fleet goes through the same phases, each on a
+ * fresh key:
+ *  - parse: SET statements parsed from text, nothing executed.
+ *  - set: every position SET through a prepared statement.
+ *  - nearby: NEARBY LIMIT 10 around points drawn like the fleet.
+ *  - within: WITHIN a 5km square around the same points.
+ *  - geofence: NEARBY fences around such points, then every object moves a little, detect events drained as they come.
+ *  - del: every object DELeted.
+ *
+ * statements other than parse are prepared once and executed with bound values, the way an embedder would run them,
+ * and every execution is timed on its own into a latency histogram (the ones STATS reports, see stats.h).
+ */
+
+typedef enum {
+  FLEET_UNIFORM,
+  FLEET_CLUSTERED,
+  FLEET_TRACES,
+} FleetKind;
+
+typedef struct {
+  const char *name;
+  FleetKind kind;
+  Point *positions; // of every SET, in order
+  uint32_t *objects; // object of every SET
+  size_t sets_count;
+  char (*ids)[BENCH_ID_LENGTH];
+  size_t objects_count;
+} Fleet;
+
+typedef struct {
+  uint64_t state;
+  Point cities[BENCH_CITIES];
+  double city_weights[BENCH_CITIES]; // cumulative, the last one is 1
+} Generator;
+
+typedef struct {
+  size_t objects;
+  size_t queries;
+  size_t fences;
+  uint64_t seed;
+} BenchOptions;
+
+// xorshift64*: the same fleets on every platform for a given seed.
+static uint64_t next_random(Generator *generator) {
+  generator->state ^= generator->state >> 12;
+  generator->state ^= generator->state << 25;
+  generator->state ^= generator->state >> 27;
+  return generator->state * 0x2545F4914F6CDD1Dull;
+}
+
+static double random_unit(Generator *generator) {
+  return (double)(next_random(generator) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double random_between(Generator *generator, double min, double max) {
+  return min + (max - min) * random_unit(generator);
+}
+
+static double random_normal(Generator *generator) {
+  double u = 1.0 - random_unit(generator);
+  return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * random_unit(generator));
+}
+
+static void init_generator(Generator *generator, uint64_t seed) {
+  // splitmix the seed, a state of 0 would stay 0.
+  uint64_t z = seed + 0x9E3779B97F4A7C15ull;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  generator->state = (z ^ (z >> 31)) | 1;
+  // city sizes follow Zipf's law: the n-th largest is 1/n of the largest.
+  double total = 0;
+  for (unsigned i = 0; i < BENCH_CITIES; i++) {
+    generator->cities[i] = (Point){ .x = random_between(generator, REGION_MIN_LON + 1, REGION_MAX_LON - 1),
+                                    .y = random_between(generator, REGION_MIN_LAT + 1, REGION_MAX_LAT - 1) };
+    total += 1.0 / (i + 1);
+    generator->city_weights[i] = total;
+  }
+  for (unsigned i = 0; i < BENCH_CITIES; i++) {
+    generator->city_weights[i] /= total;
+  }
+}
+
+static Point random_point(Generator *generator, FleetKind kind) {
+  if (kind == FLEET_UNIFORM) {
+    return (Point){ .x = random_between(generator, REGION_MIN_LON, REGION_MAX_LON),
+                    .y = random_between(generator, REGION_MIN_LAT, REGION_MAX_LAT) };
+  }
+  double pick = random_unit(generator);
+  unsigned city = 0;
+  while (city < BENCH_CITIES - 1 && generator->city_weights[city] < pick) {
+    city++;
+  }
+  return (Point){ .x = generator->cities[city].x + random_normal(generator) * BENCH_CITY_SPREAD_DEGREES,
+                  .y = generator->cities[city].y + random_normal(generator) * BENCH_CITY_SPREAD_DEGREES };
+}
+
+static Point move_point(Generator *generator, Point point) {
+  double meters = random_unit(generator) * BENCH_MOVE_METERS;
+  double heading = random_unit(generator) * 2.0 * M_PI;
+  point.y += meters * cos(heading) / METERS_PER_DEGREE;
+  point.x += meters * sin(heading) / (METERS_PER_DEGREE * cos(point.y * M_PI / 180.0));
+  return point;
+}
+
+static void destroy_fleet(Fleet *fleet) {
+  free(fleet->positions);
+  free(fleet->objects);
+  free(fleet->ids);
+  *fleet = (Fleet){ 0 };
+}
+
+/*
+ * returns 0 on success, else 1 (out of memory).
+ */
+static int init_fleet(Fleet *fleet, const char *name, FleetKind kind, size_t sets_count, Generator *generator) {
+  size_t steps = kind == FLEET_TRACES ? BENCH_TRACE_STEPS : 1;
+  *fleet = (Fleet){ .name = name, .kind = kind, .sets_count = sets_count };
+  fleet->objects_count = (sets_count + steps - 1) / steps;
+  fleet->positions = malloc(sizeof(Point) * sets_count);
+  fleet->objects = malloc(sizeof(uint32_t) * sets_count);
+  fleet->ids = malloc(sizeof(*fleet->ids) * (fleet->objects_count + 1));
+  if (fleet->positions == NULL || fleet->objects == NULL || fleet->ids == NULL) {
+    destroy_fleet(fleet);
+    return 1;
+  }
+  for (size_t i = 0; i < fleet->objects_count; i++) {
+    snprintf(fleet->ids[i], BENCH_ID_LENGTH, "v%u", (unsigned)i);
+  }
+  // traces interleave their objects: step s of every object comes before step s + 1 of any.
+  for (size_t i = 0; i < sets_count; i++) {
+    size_t object = i % fleet->objects_count;
+    fleet->objects[i] = (uint32_t)object;
+    fleet->positions[i] = i < fleet->objects_count ? random_point(generator, kind)
+                                                   : move_point(generator, fleet->positions[i - fleet->objects_count]);
+  }
+  return 0;
+}
+
+static void fail(const char *what, int rc) {
+  fprintf(stderr, "%s failed: %s\n", what, store_result_to_string(rc));
+  exit(EXIT_FAILURE);
+}
+
+static void prepare(const char *text, PreparedStatement *statement, Arena *arena) {
+  if (make_prepared_statement(text, statement, arena, NULL) != 0) {
+    fprintf(stderr, "Failed to prepare `%s`\n", text);
+    exit(EXIT_FAILURE);
+  }
+}
+
+static int count_object(const Object *object, double distance, void *user_data) {
+  (void)object;
+  (void)distance;
+  (*(size_t *)user_data)++;
+  return 0;
+}
+
+/*
+ * executes a bound statement and records how long it took.
+ */
+static void execute_timed(Store *store, const PreparedStatement *statement, ExecuteResult *result,
+                          LatencyHistogram *histogram, const char *what) {
+  uint64_t start = stats_now_ns();
+  int rc = execute_prepared_statement(store, statement, result);
+  histogram_record(histogram, stats_now_ns() - start);
+  if (rc != STORE_OK) {
+    fail(what, rc);
+  }
+}
+
+static void print_histogram(FILE *out, const char *name, const LatencyHistogram *histogram, const char *extra) {
+  double seconds = histogram->total / 1e9;
+  fprintf(out,
+          "      \"%s\": {\"operations\": %llu, \"seconds\": %.6f, \"ops_per_second\": %.1f, \"latency_ns\": "
+          "{\"mean\": %.1f, \"p50\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu}%s}",
+          name, (unsigned long long)histogram->count, seconds, seconds > 0 ? histogram->count / seconds : 0.0,
+          histogram->count > 0 ? (double)histogram->total / histogram->count : 0.0,
+          (unsigned long long)histogram_percentile(histogram, 50), (unsigned long long)histogram_percentile(histogram, 99),
+          (unsigned long long)histogram_percentile(histogram, 99.9), (unsigned long long)histogram->max, extra);
+}
+
+static void bench_parse(const Fleet *fleet, Arena *arena, FILE *out) {
+  char *texts = malloc((size_t)BENCH_STATEMENT_LENGTH * fleet->sets_count);
+  if (texts == NULL) {
+    fail("parse", STORE_OUT_OF_MEMORY);
+  }
+  for (size_t i = 0; i < fleet->sets_count; i++) {
+    const Point *p = &fleet->positions[i];
+    snprintf(texts + i * BENCH_STATEMENT_LENGTH, BENCH_STATEMENT_LENGTH, "SET %s %s POINT %.6f %.6f", fleet->name,
+             fleet->ids[fleet->objects[i]], p->y, p->x);
+  }
+  PreparedStatement statement;
+  uint64_t start = stats_now_ns();
+  for (size_t i = 0; i < fleet->sets_count; i++) {
+    if (make_prepared_statement(texts + i * BENCH_STATEMENT_LENGTH, &statement, arena, NULL) != 0) {
+      fprintf(stderr, "Failed to parse `%s`\n", texts + i * BENCH_STATEMENT_LENGTH);
+      exit(EXIT_FAILURE);
+    }
+    arena_reset(arena);
+  }
+  double seconds = (stats_now_ns() - start) / 1e9;
+  fprintf(out, "      \"parse\": {\"operations\": %zu, \"seconds\": %.6f, \"ops_per_second\": %.1f}", fleet->sets_count,
+          seconds, seconds > 0 ? fleet->sets_count / seconds : 0.0);
+  free(texts);
+}
+
+static void bench_set(Store *store, const Fleet *fleet, Arena *arena, FILE *out) {
+  char text[BENCH_STATEMENT_LENGTH];
+  snprintf(text, sizeof(text), "SET %s ? POINT ? ?", fleet->name);
+  PreparedStatement statement;
+  prepare(text, &statement, arena);
+  ExecuteResult result = { 0 };
+  static LatencyHistogram histogram;
+  histogram = (LatencyHistogram){ 0 };
+  for (size_t i = 0; i < fleet->sets_count; i++) {
+    const char *id = fleet->ids[fleet->objects[i]];
+    bind_span(&statement, 0, id, strlen(id));
+    bind_double(&statement, 1, fleet->positions[i].y);
+    bind_double(&statement, 2, fleet->positions[i].x);
+    execute_timed(store, &statement, &result, &histogram, "SET");
+  }
+  print_histogram(out, "set", &histogram, "");
+  arena_reset(arena);
+}
+
+static void bench_queries(Store *store, const Fleet *fleet, const BenchOptions *options, Generator *generator,
+                          Arena *arena, FILE *out) {
+  char text[BENCH_STATEMENT_LENGTH];
+  snprintf(text, sizeof(text), "NEARBY %s LIMIT %d POINT ? ?", fleet->name, BENCH_NEARBY_LIMIT);
+  PreparedStatement nearby;
+  prepare(text, &nearby, arena);
+  snprintf(text, sizeof(text), "WITHIN %s BOUNDS ? ? ? ? ? ? ? ? ? ?", fleet->name);
+  PreparedStatement within;
+  prepare(text, &within, arena);
+
+  static LatencyHistogram nearby_histogram;
+  static LatencyHistogram within_histogram;
+  nearby_histogram = (LatencyHistogram){ 0 };
+  within_histogram = (LatencyHistogram){ 0 };
+  size_t nearby_results = 0;
+  size_t within_results = 0;
+  ExecuteResult result = { .on_object = count_object };
+  for (size_t i = 0; i < options->queries; i++) {
+    Point center = random_point(generator, fleet->kind);
+    bind_double(&nearby, 0, center.y);
+    bind_double(&nearby, 1, center.x);
+    result.user_data = &nearby_results;
+    execute_timed(store, &nearby, &result, &nearby_histogram, "NEARBY");
+
+    double half = BENCH_WITHIN_DEGREES / 2;
+    double ring[10] = { center.y - half, center.x - half, center.y + half, center.x - half, center.y + half,
+                        center.x + half, center.y - half, center.x + half, center.y - half, center.x - half };
+    for (size_t j = 0; j < 10; j++) {
+      bind_double(&within, j, ring[j]);
+    }
+    result.user_data = &within_results;
+    execute_timed(store, &within, &result, &within_histogram, "WITHIN");
+  }
+  char extra[64];
+  snprintf(extra, sizeof(extra), ", \"results_per_query\": %.2f",
+           options->queries > 0 ? (double)nearby_results / options->queries : 0.0);
+  print_histogram(out, "nearby", &nearby_histogram, extra);
+  fprintf(out, ",\n");
+  snprintf(extra, sizeof(extra), ", \"results_per_query\": %.2f",
+           options->queries > 0 ? (double)within_results / options->queries : 0.0);
+  print_histogram(out, "within", &within_histogram, extra);
+  arena_reset(arena);
+}
+
+static size_t drain_events(EventRing *events) {
+  QueuedDetectEvent drained[BENCH_EVENTS_DRAIN_BATCH];
+  size_t total = 0;
+  size_t n;
+  while ((n = event_ring_drain(events, drained, BENCH_EVENTS_DRAIN_BATCH)) > 0) {
+    total += n;
+  }
+  return total;
+}
+
+static void bench_geofence(Store *store, EventRing *events, const Fleet *fleet, const BenchOptions *options,
+                           Generator *generator, Arena *arena, FILE *out) {
+  size_t dropped = event_ring_dropped(events);
+
+  char text[BENCH_STATEMENT_LENGTH];
+  snprintf(text, sizeof(text), "SETCHAN ? NEARBY %s FENCE POINT ? ? %.1f", fleet->name, BENCH_FENCE_METERS);
+  PreparedStatement setchan;
+  prepare(text, &setchan, arena);
+  char (*channels)[BENCH_CHANNEL_LENGTH] = malloc(sizeof(*channels) * (options->fences + 1));
+  if (channels == NULL) {
+    fail("geofence", STORE_OUT_OF_MEMORY);
+  }
+  ExecuteResult result = { 0 };
+  for (size_t i = 0; i < options->fences; i++) {
+    snprintf(channels[i], BENCH_CHANNEL_LENGTH, "%s%u", fleet->name, (unsigned)i);
+    Point center = random_point(generator, fleet->kind);
+    bind_span(&setchan, 0, channels[i], strlen(channels[i]));
+    bind_double(&setchan, 1, center.y);
+    bind_double(&setchan, 2, center.x);
+    int rc = execute_prepared_statement(store, &setchan, &result);
+    if (rc != STORE_OK) {
+      fail("SETCHAN", rc);
+    }
+  }
+
+  // every object moves once from where the set phase left it.
+  snprintf(text, sizeof(text), "SET %s ? POINT ? ?", fleet->name);
+  PreparedStatement set;
+  prepare(text, &set, arena);
+  static LatencyHistogram histogram;
+  histogram = (LatencyHistogram){ 0 };
+  size_t events_count = 0;
+  uint64_t drain_time = 0;
+  size_t last = fleet->sets_count - fleet->objects_count;
+  for (size_t i = 0; i < fleet->objects_count; i++) {
+    Point moved = move_point(generator, fleet->positions[last + i]);
+    const char *id = fleet->ids[fleet->objects[last + i]];
+    bind_span(&set, 0, id, strlen(id));
+    bind_double(&set, 1, moved.y);
+    bind_double(&set, 2, moved.x);
+    execute_timed(store, &set, &result, &histogram, "SET");
+    uint64_t start = stats_now_ns();
+    events_count += drain_events(events);
+    drain_time += stats_now_ns() - start;
+  }
+  double seconds = (histogram.total + drain_time) / 1e9;
+  char extra[192];
+  snprintf(extra, sizeof(extra),
+           ", \"fences\": %zu, \"events\": %zu, \"events_per_second\": %.1f, \"events_dropped\": %zu", options->fences,
+           events_count, seconds > 0 ? events_count / seconds : 0.0, event_ring_dropped(events) - dropped);
+  print_histogram(out, "geofence", &histogram, extra);
+
+  snprintf(text, sizeof(text), "DELCHAN ?");
+  PreparedStatement delchan;
+  prepare(text, &delchan, arena);
+  for (size_t i = 0; i < options->fences; i++) {
+    bind_span(&delchan, 0, channels[i], strlen(channels[i]));
+    int rc = execute_prepared_statement(store, &delchan, &result);
+    if (rc != STORE_OK) {
+      fail("DELCHAN", rc);
+    }
+  }
+  free(channels);
+  arena_reset(arena);
+}
+
+static void bench_del(Store *store, const Fleet *fleet, Arena *arena, FILE *out) {
+  char text[BENCH_STATEMENT_LENGTH];
+  snprintf(text, sizeof(text), "DEL %s ?", fleet->name);
+  PreparedStatement statement;
+  prepare(text, &statement, arena);
+  ExecuteResult result = { 0 };
+  static LatencyHistogram histogram;
+  histogram = (LatencyHistogram){ 0 };
+  for (size_t i = 0; i < fleet->objects_count; i++) {
+    bind_span(&statement, 0, fleet->ids[i], strlen(fleet->ids[i]));
+    execute_timed(store, &statement, &result, &histogram, "DEL");
+  }
+  print_histogram(out, "del", &histogram, "");
+  arena_reset(arena);
+}
+
+static void usage(const char *program) {
+  fprintf(stderr,
+          "usage: %s [-n sets] [-q queries] [-f fences] [-s seed] [-p workers] [-Q] [-o output path]\n"
+          "  -n  SETs per fleet, default %d\n"
+          "  -q  NEARBY and WITHIN queries per fleet, default %d\n"
+          "  -f  geofences per fleet, default %d\n"
+          "  -s  seed of the generated fleets, default %d\n"
+          "  -p  split large queries across this many workers, default none\n"
+          "  -Q  store the points as fixed point rather than doubles\n"
+          "  -o  write the JSON report to a file rather than stdout\n",
+          program, BENCH_DEFAULT_OBJECTS, BENCH_DEFAULT_QUERIES, BENCH_DEFAULT_FENCES, BENCH_DEFAULT_SEED);
+}
+
+int main(int argc, char **argv) {
+  BenchOptions options = {
+    .objects = BENCH_DEFAULT_OBJECTS,
+    .queries = BENCH_DEFAULT_QUERIES,
+    .fences = BENCH_DEFAULT_FENCES,
+    .seed = BENCH_DEFAULT_SEED,
+  };
+  unsigned long workers = 0;
+  bool quantize = false;
+  const char *output_path = NULL;
+  int option;
+  while ((option = getopt(argc, argv, "n:q:f:s:p:Qo:")) != -1) {
+    switch (option) {
+      case 'n': options.objects = strtoull(optarg, NULL, 10); break;
+      case 'q': options.queries = strtoull(optarg, NULL, 10); break;
+      case 'f': options.fences = strtoull(optarg, NULL, 10); break;
+      case 's': options.seed = strtoull(optarg, NULL, 10); break;
+      case 'p': workers = strtoul(optarg, NULL, 10); break;
+      case 'Q': quantize = true; break;
+      case 'o': output_path = optarg; break;
+      default: usage(argv[0]); return EXIT_FAILURE;
+    }
+  }
+  if (options.objects == 0 || options.objects > UINT32_MAX || options.fences > UINT32_MAX) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  FILE *out = stdout;
+  if (output_path != NULL && (out = fopen(output_path, "w")) == NULL) {
+    perror("Failed to open the output");
+    return EXIT_FAILURE;
+  }
+  Store store;
+  Arena arena;
+  EventRing events;
+  if (init_store(&store) != STORE_OK || init_arena(&arena, 0) != 0 ||
+      init_event_ring(&events, BENCH_EVENTS_CAPACITY, OVERFLOW_DROP_OLDEST) != 0) {
+    fprintf(stderr, "Failed to initialize the store\n");
+    return EXIT_FAILURE;
+  }
+  store_quantize_points(&store, quantize);
+  // only the geofence phase has fences, it drains the ring after every update.
+  store_publish_events(&store, &events);
+  ScanPool scan_pool;
+  if (workers > 0) {
+    if (init_scan_pool(&scan_pool, (unsigned)workers, BENCH_PARALLEL_SCAN_MIN_CANDIDATES) != 0) {
+      perror("Failed to start the workers");
+      return EXIT_FAILURE;
+    }
+    store_parallel_scans(&store, &scan_pool);
+  }
+
+  static const struct {
+    const char *name;
+    FleetKind kind;
+  } fleets[] = {
+    { "uniform", FLEET_UNIFORM },
+    { "clustered", FLEET_CLUSTERED },
+    { "traces", FLEET_TRACES },
+  };
+  Generator generator;
+  init_generator(&generator, options.seed);
+  fprintf(out,
+          "{\n  \"version\": \"%s\",\n  \"sets\": %zu,\n  \"queries\": %zu,\n  \"fences\": %zu,\n  \"seed\": %llu,\n"
+          "  \"workers\": %lu,\n  \"quantized\": %s,\n  \"distance_kernel\": \"%s\",\n  \"fleets\": [\n",
+          GEOQLITE_VERSION, options.objects, options.queries, options.fences, (unsigned long long)options.seed,
+          workers, quantize ? "true" : "false", distance_kernel_name());
+  for (size_t f = 0; f < sizeof(fleets) / sizeof(fleets[0]); f++) {
+    Fleet fleet;
+    if (init_fleet(&fleet, fleets[f].name, fleets[f].kind, options.objects, &generator) != 0) {
+      fail("generating the fleet", STORE_OUT_OF_MEMORY);
+    }
+    fprintf(out, "    {\n      \"name\": \"%s\",\n      \"objects\": %zu,\n", fleet.name, fleet.objects_count);
+    bench_parse(&fleet, &arena, out);
+    fprintf(out, ",\n");
+    bench_set(&store, &fleet, &arena, out);
+    fprintf(out, ",\n");
+    bench_queries(&store, &fleet, &options, &generator, &arena, out);
+    fprintf(out, ",\n");
+    bench_geofence(&store, &events, &fleet, &options, &generator, &arena, out);
+    fprintf(out, ",\n");
+    bench_del(&store, &fleet, &arena, out);
+    fprintf(out, "\n    }%s\n", f + 1 < sizeof(fleets) / sizeof(fleets[0]) ? "," : "");
+    store_drop_collection(&store, fleet.name, strlen(fleet.name));
+    destroy_fleet(&fleet);
+  }
+  fprintf(out, "  ]\n}\n");
+
+  if (workers > 0) {
+    store_parallel_scans(&store, NULL);
+    destroy_scan_pool(&scan_pool);
+  }
+  destroy_arena(&arena);
+  destroy_store(&store);
+  destroy_event_ring(&events);
+  if (out != stdout && fclose(out) != 0) {
+    perror("Failed to write the output");
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
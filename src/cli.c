@@ -1,11 +1,22 @@
+#include <errno.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 // library headers
+#include "import.h"
 #include "parse.h"
+#include "snapshot.h"
+#include "store.h"
 #include "geoqlite.h"
 
+#define DETECT_EVENTS_CAPACITY 4096
+#define DETECT_EVENTS_DRAIN_BATCH 256
+#define LOG_COMPACT_MIN_SIZE (64 << 20)
+#define PARALLEL_SCAN_MIN_CANDIDATES 16384
+
 typedef struct {
   char *buffer;
   size_t buffer_length;
@@ -45,11 +56,237 @@ void stderr_logger(int ec, const char * emsg) {
   fprintf(stderr, "Error code: %d. Message: %s\n", ec, emsg);
 }
 
-int main() {
+void print_point(const Point *p) {
+  if (p->has_z) {
+    printf("%f %f %f", p->y, p->x, p->z);
+  } else {
+    printf("%f %f", p->y, p->x);
+  }
+}
+
+void print_object(const Collection *collection, const Object *object, bool with_fields) {
+  Span id = collection_object_id(collection, object);
+  printf("%.*s ", (int)id.length, id.start);
+  Geometry geometry = collection_object_geometry(collection, object);
+  if (geometry.type == GEOMETRY_POINT) {
+    printf("POINT ");
+    print_point(&geometry.point);
+  } else {
+    printf("BOUNDS");
+    for (size_t i = 0; i < geometry.line_string.points_count; i++) {
+      printf(" ");
+      print_point(&geometry.line_string.points[i]);
+    }
+  }
+  for (uint32_t i = 0; with_fields && i < collection->fields_count; i++) {
+    double value = collection_object_field(collection, object, i);
+    if (!isnan(value)) {
+      printf(" FIELD %s %f", collection->fields[i].name, value);
+    }
+  }
+  printf("\n");
+}
+
+typedef struct {
+  const ExecuteResult *result;
+  const PreparedStatement *prepared_statement;
+} PrintContext;
+
+/*
+ * objects are printed while the statement still holds the lock of their collection, NEARBY ones with their distance.
+ */
+int print_result_object(const Object *object, double distance, void *user_data) {
+  const PrintContext *context = user_data;
+  if (context->prepared_statement->command_type == NEARBY) {
+    printf("%f m: ", distance);
+  }
+  print_object(context->result->collection, object, context->prepared_statement->with_fields);
+  return 0;
+}
+
+/*
+ * the STATS report of the store, the last slow statements included.
+ */
+void print_stats(Store *store) {
+  static StatsReport report;
+  static SlowQuery slow_queries[SLOW_LOG_CAPACITY];
+  store_stats(store, &report);
+  size_t slow_queries_count = stats_slow_queries(store->stats, slow_queries, SLOW_LOG_CAPACITY);
+  size_t length = format_stats(&report, slow_queries, slow_queries_count, NULL, 0);
+  char *text = malloc(length + 1);
+  if (text == NULL) {
+    printf("%s\n", store_result_to_string(STORE_OUT_OF_MEMORY));
+    return;
+  }
+  format_stats(&report, slow_queries, slow_queries_count, text, length + 1);
+  fputs(text, stdout);
+  free(text);
+}
+
+void print_detect_event(const QueuedDetectEvent *event) {
+  printf("detect %s: channel %.*s, %.*s %.*s at ", detect_type_to_string(event->type), (int)event->channel_length,
+         event->channel, (int)event->key_length, event->key, (int)event->id_length, event->id);
+  print_point(&event->point);
+  printf(event->truncated ? " (names cut)\n" : "\n");
+}
+
+/*
+ * `geoqlite import [-p workers] [-Q] key path/to/file path/to/log [path/to/snapshot]` sets every feature of a GeoJSON
+ * FeatureCollection (or every row of a .csv file) into `key` of the store the log (and snapshot) holds, then exits.
+ * The imported objects are logged, and a new snapshot is written when a path is given so the next start doesn't replay
+ * them. The file is parsed on the workers (one less than the cores by default) and the calling thread.
+ */
+int run_import(int argc, char **argv) {
+  long workers = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+  bool quantize = false;
+  int option;
+  while ((option = getopt(argc, argv, "p:Q")) != -1) {
+    switch (option) {
+      case 'p': workers = strtol(optarg, NULL, 10); break;
+      case 'Q': quantize = true; break;
+      default: optind = argc + 1; break;
+    }
+  }
+  if (argc - optind < 3 || argc - optind > 4) {
+    fprintf(stderr, "usage: geoqlite import [-p workers] [-Q] key path/to/file path/to/log [path/to/snapshot]\n");
+    return EXIT_FAILURE;
+  }
+  const char *key = argv[optind];
+  const char *path = argv[optind + 1];
+  const char *snapshot_path = argc - optind > 3 ? argv[optind + 3] : NULL;
+
+  Store store;
+  Wal wal;
+  if (init_store(&store) != STORE_OK) {
+    printf("Failed to initialize the store\n");
+    return EXIT_FAILURE;
+  }
+  store_quantize_points(&store, quantize);
+  if (open_wal(&wal, argv[optind + 2], WAL_SYNC_INTERVAL, 1000) != 0) {
+    perror("Failed to open the log");
+    return EXIT_FAILURE;
+  }
+  if (snapshot_path != NULL) {
+    int rc = store_load_snapshot(&store, snapshot_path, &wal);
+    if (rc != STORE_OK && !(rc == STORE_IO_ERROR && errno == ENOENT)) {
+      printf("Ignoring the snapshot: %s\n", store_result_to_string(rc));
+    }
+  }
+  int rc = store_replay_wal(&store, &wal);
+  if (rc != STORE_OK) {
+    printf("Failed to replay the log: %s\n", store_result_to_string(rc));
+    return EXIT_FAILURE;
+  }
+  store_log_writes(&store, &wal);
+  ScanPool scan_pool;
+  if (workers > 0) {
+    if (init_scan_pool(&scan_pool, (unsigned)workers, PARALLEL_SCAN_MIN_CANDIDATES) != 0) {
+      perror("Failed to start the workers");
+      return EXIT_FAILURE;
+    }
+    store_parallel_scans(&store, &scan_pool);
+  }
+
+  uint64_t start = stats_now_ns();
+  ImportReport report;
+  rc = store_import(&store, key, strlen(key), path, import_format_for_path(path), &report);
+  double seconds = (double)(stats_now_ns() - start) / 1e9;
+  if (rc == STORE_IO_ERROR) {
+    perror("Failed to import");
+  } else if (rc != STORE_OK) {
+    printf("Import failed at byte %zu: %s\n", report.error_offset, store_result_to_string(rc));
+  }
+  printf("imported %zu of %zu records (%zu skipped) in %.3f s\n", report.imported, report.records, report.skipped,
+         seconds);
+
+  if (rc == STORE_OK && snapshot_path != NULL) {
+    // the snapshot covers the log up to its end, so the log has to be on disk first.
+    rc = wal_sync(&wal) != 0 ? STORE_IO_ERROR
+                             : store_write_snapshot(&store, snapshot_path, wal.id, wal_end_offset(&wal));
+    if (rc != STORE_OK) {
+      printf("Failed to write the snapshot: %s\n", store_result_to_string(rc));
+    }
+  }
+  if (store.scan_pool != NULL) {
+    destroy_scan_pool(&scan_pool);
+  }
+  if (close_wal(&wal) != 0) {
+    perror("Failed to close the log");
+    rc = STORE_IO_ERROR;
+  }
+  destroy_store(&store);
+  return rc == STORE_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "import") == 0) {
+    exit(run_import(argc - 1, argv + 1));
+  }
   printf("geoqlite cli v%s\n", GEOQLITE_VERSION);
 
+  Store store;
+  if (init_store(&store) != STORE_OK) {
+    printf("Failed to initialize the store\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // `geoqlite path/to/log` restores the store from the log and appends every write to it, synced once per second. The
+  // log is compacted in the background whenever it doubled past 64MB.
+  // `geoqlite path/to/log path/to/snapshot` starts from the snapshot and only replays the log written after it, the
+  // `.snapshot` command takes a new one in the background.
+  Wal wal;
+  bool logging = argc > 1;
+  const char *snapshot_path = argc > 2 ? argv[2] : NULL;
+  pid_t snapshot_pid = -1;
+  if (logging) {
+    if (open_wal(&wal, argv[1], WAL_SYNC_INTERVAL, 1000) != 0) {
+      perror("Failed to open the log");
+      exit(EXIT_FAILURE);
+    }
+    if (snapshot_path != NULL) {
+      int rc = store_load_snapshot(&store, snapshot_path, &wal);
+      if (rc != STORE_OK && !(rc == STORE_IO_ERROR && errno == ENOENT)) {
+        printf("Ignoring the snapshot: %s\n", store_result_to_string(rc));
+      }
+    }
+    int rc = store_replay_wal(&store, &wal);
+    if (rc != STORE_OK) {
+      printf("Failed to replay the log: %s\n", store_result_to_string(rc));
+      exit(EXIT_FAILURE);
+    }
+    store_log_writes(&store, &wal);
+    wal_auto_compact(&wal, LOG_COMPACT_MIN_SIZE);
+  }
+  EventRing events;
+  if (init_event_ring(&events, DETECT_EVENTS_CAPACITY, OVERFLOW_DROP_OLDEST) != 0) {
+    printf("Failed to initialize the event ring\n");
+    exit(EXIT_FAILURE);
+  }
+  store_publish_events(&store, &events);
+  QueuedDetectEvent drained[DETECT_EVENTS_DRAIN_BATCH];
+
+  // statements are parsed and executed one at a time, they all share one arena reset after each of them.
+  Arena statement_arena;
+  if (init_arena(&statement_arena, 0) != 0) {
+    printf("Failed to initialize the statement arena\n");
+    exit(EXIT_FAILURE);
+  }
+
+  ScanPool scan_pool;
+
+  // every statement is recorded, STATS (or INFO) prints what was and `.slowlog usec` sets the slow log threshold.
+  Stats stats;
+  if (init_stats(&stats) != 0) {
+    printf("Failed to initialize the stats\n");
+    exit(EXIT_FAILURE);
+  }
+  store_record_stats(&store, &stats);
+
   InputBuffer *input_buffer = new_input_buffer();
   PreparedStatement prepared_statement;
+  ExecuteResult result = { .on_object = print_result_object };
+  PrintContext print_context = { .result = &result, .prepared_statement = &prepared_statement };
+  result.user_data = &print_context;
   while(1) {
     print_prompt();
     read_input(input_buffer);
@@ -60,13 +297,88 @@ int main() {
     if (strcmp(input_buffer->buffer, ".exit") == 0) {
       break;
     }
+    if (strcmp(input_buffer->buffer, ".snapshot") == 0) {
+      if (snapshot_path == NULL) {
+        printf("Start with a log and a snapshot path to take snapshots\n");
+        continue;
+      }
+      // one snapshot at a time.
+      if (snapshot_pid > 0 && store_wait_snapshot(snapshot_pid) != STORE_OK) {
+        printf("The previous snapshot failed\n");
+      }
+      snapshot_pid = store_snapshot_in_background(&store, snapshot_path);
+      printf(snapshot_pid < 0 ? "Failed to start the snapshot\n" : "Snapshot started\n");
+      continue;
+    }
+
+    if (strcmp(input_buffer->buffer, "STATS") == 0 || strcmp(input_buffer->buffer, "INFO") == 0) {
+      print_stats(&store);
+      continue;
+    }
+    double slow_usec;
+    if (sscanf(input_buffer->buffer, ".slowlog %lf", &slow_usec) == 1) {
+      stats_set_slow_threshold(&stats, slow_usec > 0 ? (uint64_t)(slow_usec * 1000) : 0);
+      continue;
+    }
+
+    // `.quantize on` stores the points of keys created from now on as fixed point, `.quantize off` as doubles again.
+    if (strcmp(input_buffer->buffer, ".quantize on") == 0 || strcmp(input_buffer->buffer, ".quantize off") == 0) {
+      store_quantize_points(&store, strcmp(input_buffer->buffer, ".quantize on") == 0);
+      continue;
+    }
+
+    // `.parallel n` splits large queries across n workers, `.parallel 0` turns it back off.
+    unsigned int workers;
+    if (sscanf(input_buffer->buffer, ".parallel %u", &workers) == 1) {
+      if (store.scan_pool != NULL) {
+        store_parallel_scans(&store, NULL);
+        destroy_scan_pool(&scan_pool);
+      }
+      if (workers > 0) {
+        if (init_scan_pool(&scan_pool, workers, PARALLEL_SCAN_MIN_CANDIDATES) != 0) {
+          perror("Failed to start the workers");
+          continue;
+        }
+        store_parallel_scans(&store, &scan_pool);
+      }
+      continue;
+    }
 
-    int rc = make_prepared_statement(input_buffer->buffer, &prepared_statement, stderr_logger);
+    uint64_t start = stats_now_ns();
+    int rc = make_prepared_statement(input_buffer->buffer, &prepared_statement, &statement_arena, stderr_logger);
+    stats_record_parse(&stats, stats_now_ns() - start, arena_used(&statement_arena), rc != 0);
 
     printf("Return code from `make_prepared_statment` was %d\n", rc);
+    if (rc == 0) {
+      // no timer runs between prompts, whatever expired while waiting for input goes first.
+      store_expire(&store, store_now_ms(), NULL);
+      rc = execute_prepared_statement(&store, &prepared_statement, &result);
+      printf("%s\n", store_result_to_string(rc));
+    }
+
+    size_t n;
+    while ((n = event_ring_drain(&events, drained, DETECT_EVENTS_DRAIN_BATCH)) > 0) {
+      for (size_t i = 0; i < n; i++) {
+        print_detect_event(&drained[i]);
+      }
+    }
+    arena_reset(&statement_arena);
   }
 
   close_input_buffer(input_buffer);
+  if (snapshot_pid > 0 && store_wait_snapshot(snapshot_pid) != STORE_OK) {
+    printf("The snapshot failed\n");
+  }
+  if (store.scan_pool != NULL) {
+    destroy_scan_pool(&scan_pool);
+  }
+  if (logging && close_wal(&wal) != 0) {
+    perror("Failed to close the log");
+  }
+  destroy_store(&store);
+  destroy_stats(&stats);
+  destroy_event_ring(&events);
+  destroy_arena(&statement_arena);
   exit(EXIT_SUCCESS);
 
 }
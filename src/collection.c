@@ -0,0 +1,1189 @@
+#include "collection.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define COLLECTION_INITIAL_CAPACITY 16
+#define SCAN_RESULTS_INITIAL_CAPACITY 64
+#define SCAN_SUBTREES_PER_WORKER 8
+
+/*
+ * deep copies the line string `geometry` into a new Shape, with the polygon of a closed ring. returns NULL when out of
+ * memory.
+ */
+static Shape *make_shape(const Geometry *geometry) {
+  Shape *shape = malloc(sizeof(Shape));
+  if (shape == NULL) {
+    return NULL;
+  }
+  Geometry copy;
+  if (copy_geometry(&copy, geometry) != 0) {
+    free(shape);
+    return NULL;
+  }
+  *shape = (Shape){ .line_string = copy.line_string, .rect = line_string_rect(&copy.line_string) };
+  if (copy.line_string.is_closed) {
+    shape->polygon = malloc(sizeof(Polygon));
+    if (shape->polygon == NULL || init_polygon(shape->polygon, &copy.line_string) != 0) {
+      free(shape->polygon);
+      free_geometry(&copy);
+      free(shape);
+      return NULL;
+    }
+  }
+  return shape;
+}
+
+static void free_shape(Shape *shape) {
+  if (shape == NULL) {
+    return;
+  }
+  free(shape->line_string.points);
+  if (shape->polygon != NULL) {
+    destroy_polygon(shape->polygon);
+    free(shape->polygon);
+  }
+  free(shape);
+}
+
+static Point slot_point(const Collection *collection, uint32_t slot) {
+  const PointColumns *points = &collection->points;
+  Point p;
+  if (points->quantized) {
+    p.x = dequantize_coordinate(points->qx[slot]);
+    p.y = dequantize_coordinate(points->qy[slot]);
+  } else {
+    p.x = points->x[slot];
+    p.y = points->y[slot];
+  }
+  p.z = points->z != NULL ? points->z[slot] : NAN;
+  p.has_z = !isnan(p.z);
+  if (!p.has_z) {
+    p.z = 0;
+  }
+  return p;
+}
+
+/*
+ * writes `p` into the columns, which `reserve_point` made ready for it.
+ */
+static void write_point(Collection *collection, uint32_t slot, const Point *p) {
+  PointColumns *points = &collection->points;
+  if (points->quantized) {
+    points->qx[slot] = quantize_coordinate(p->x);
+    points->qy[slot] = quantize_coordinate(p->y);
+  } else {
+    points->x[slot] = p->x;
+    points->y[slot] = p->y;
+  }
+  if (points->z != NULL) {
+    points->z[slot] = p->has_z ? p->z : NAN;
+  }
+}
+
+static Rect object_rect(const Collection *collection, const Object *o) {
+  if (o->type == GEOMETRY_POINT) {
+    Point p = slot_point(collection, o->id);
+    return point_rect(&p);
+  }
+  return o->shape->rect;
+}
+
+int init_collection(Collection *collection, const char *key, size_t key_length) {
+  *collection = (Collection){ 0 };
+
+  collection->key = malloc(key_length + 1);
+  if (collection->key == NULL) {
+    return STORE_OUT_OF_MEMORY;
+  }
+  memcpy(collection->key, key, key_length);
+  collection->key[key_length] = '\0';
+  collection->key_length = key_length;
+
+  if (init_intern_table(&collection->ids) != 0) {
+    free(collection->key);
+    return STORE_OUT_OF_MEMORY;
+  }
+  if (init_rtree(&collection->index) != 0) {
+    destroy_intern_table(&collection->ids);
+    free(collection->key);
+    return STORE_OUT_OF_MEMORY;
+  }
+  init_timer_wheel(&collection->expirations);
+  if (pthread_rwlock_init(&collection->lock, NULL) != 0) {
+    destroy_rtree(&collection->index);
+    destroy_intern_table(&collection->ids);
+    free(collection->key);
+    return STORE_OUT_OF_MEMORY;
+  }
+  return STORE_OK;
+}
+
+void destroy_collection(Collection *collection) {
+  for (uint32_t i = 0; i < collection->ids.handles_count; i++) {
+    Object *o = &collection->objects[i];
+    if (o->id != UINT32_MAX) {
+      free_shape(o->shape);
+    }
+  }
+  if (!collection->objects_borrowed) {
+    free(collection->objects);
+  }
+  PointColumns *points = &collection->points;
+  if (!points->borrowed) {
+    free(points->x);
+    free(points->y);
+    free(points->qx);
+    free(points->qy);
+  }
+  if (!points->z_borrowed) {
+    free(points->z);
+  }
+  for (uint32_t i = 0; i < collection->fields_count; i++) {
+    FieldColumn *column = &collection->fields[i];
+    free(column->name);
+    if (!column->values_borrowed) {
+      free(column->values);
+    }
+  }
+  free(collection->fields);
+  destroy_timer_wheel(&collection->expirations);
+  destroy_rtree(&collection->index);
+  destroy_intern_table(&collection->ids);
+  free(collection->key);
+  pthread_rwlock_destroy(&collection->lock);
+  *collection = (Collection){ 0 };
+}
+
+/*
+ * grows `array` (`count` elements long, `borrowed` when it is part of a snapshot) to a heap array of `capacity`
+ * elements. returns the new array, NULL when out of memory (`array` is left alone then).
+ */
+static void *grow_array(void *array, bool borrowed, size_t element_size, uint32_t count, uint32_t capacity) {
+  if (!borrowed) {
+    return realloc(array, element_size * capacity);
+  }
+  void *grown = malloc(element_size * capacity);
+  if (grown != NULL && count > 0) {
+    memcpy(grown, array, element_size * count);
+  }
+  return grown;
+}
+
+static void fill_nan(double *values, uint32_t from, uint32_t to) {
+  for (uint32_t i = from; i < to; i++) {
+    values[i] = NAN;
+  }
+}
+
+/*
+ * like `grow_array`, zeroing the new elements so that snapshots never write leftover heap bytes.
+ */
+static void *grow_zeroed(void *array, bool borrowed, size_t element_size, uint32_t count, uint32_t capacity) {
+  char *grown = grow_array(array, borrowed, element_size, count, capacity);
+  if (grown != NULL) {
+    memset(grown + element_size * count, 0, element_size * (capacity - count));
+  }
+  return grown;
+}
+
+/*
+ * grows the x and y columns to `capacity`. returns a StoreResult.
+ */
+static int grow_point_columns(PointColumns *points, uint32_t old_capacity, uint32_t capacity) {
+  size_t element_size = points->quantized ? sizeof(int32_t) : sizeof(double);
+  void *x = grow_zeroed(points->quantized ? (void *)points->qx : (void *)points->x, points->borrowed, element_size,
+                        old_capacity, capacity);
+  if (x == NULL) {
+    return STORE_OUT_OF_MEMORY;
+  }
+  void *y = grow_zeroed(points->quantized ? (void *)points->qy : (void *)points->y, points->borrowed, element_size,
+                        old_capacity, capacity);
+  if (y == NULL && points->borrowed) {
+    free(x);
+    return STORE_OUT_OF_MEMORY;
+  }
+  // a reallocated x has moved whether or not y could grow.
+  if (points->quantized) {
+    points->qx = x;
+  } else {
+    points->x = x;
+  }
+  if (y == NULL) {
+    return STORE_OUT_OF_MEMORY;
+  }
+  if (points->quantized) {
+    points->qy = y;
+  } else {
+    points->y = y;
+  }
+  points->borrowed = false;
+  return STORE_OK;
+}
+
+/*
+ * makes room for the object of handle `slot`, which is at most one past the slots seen so far. The point and field
+ * columns and the expiration schedule grow along with the slot array. returns a StoreResult.
+ */
+static int reserve_slot(Collection *collection, uint32_t slot) {
+  if (slot < collection->objects_capacity) {
+    return STORE_OK;
+  }
+  uint32_t old_capacity = collection->objects_capacity;
+  uint32_t capacity = old_capacity == 0 ? COLLECTION_INITIAL_CAPACITY : old_capacity * 2;
+  Object *objects =
+      grow_array(collection->objects, collection->objects_borrowed, sizeof(Object), old_capacity, capacity);
+  if (objects == NULL) {
+    return STORE_OUT_OF_MEMORY;
+  }
+  collection->objects = objects;
+  collection->objects_borrowed = false;
+
+  if (grow_point_columns(&collection->points, old_capacity, capacity) != STORE_OK) {
+    return STORE_OUT_OF_MEMORY;
+  }
+  if (collection->points.z != NULL) {
+    double *z = grow_array(collection->points.z, collection->points.z_borrowed, sizeof(double), old_capacity, capacity);
+    if (z == NULL) {
+      return STORE_OUT_OF_MEMORY;
+    }
+    fill_nan(z, old_capacity, capacity);
+    collection->points.z = z;
+    collection->points.z_borrowed = false;
+  }
+
+  // `objects_capacity` only moves once every column is as long, a column grown before a failure just grows again.
+  for (uint32_t i = 0; i < collection->fields_count; i++) {
+    FieldColumn *column = &collection->fields[i];
+    double *values = grow_array(column->values, column->values_borrowed, sizeof(double), old_capacity, capacity);
+    if (values == NULL) {
+      return STORE_OUT_OF_MEMORY;
+    }
+    fill_nan(values, old_capacity, capacity);
+    column->values = values;
+    column->values_borrowed = false;
+  }
+  if (collection->expirations.capacity > 0 && timer_wheel_reserve(&collection->expirations, capacity) != 0) {
+    return STORE_OUT_OF_MEMORY;
+  }
+  collection->objects_capacity = capacity;
+  return STORE_OK;
+}
+
+/*
+ * returns the index of column `name`, UINT32_MAX when the collection has none.
+ */
+static uint32_t find_field(const Collection *collection, const char *name, size_t name_length) {
+  for (uint32_t i = 0; i < collection->fields_count; i++) {
+    const FieldColumn *column = &collection->fields[i];
+    if (column->name_length == name_length && memcmp(column->name, name, name_length) == 0) {
+      return i;
+    }
+  }
+  return UINT32_MAX;
+}
+
+/*
+ * appends the column `name` holding `values`, a fresh one full of NAN when `values` is NULL. returns a StoreResult.
+ */
+static int add_field(Collection *collection, const char *name, size_t name_length, double *values) {
+  if (collection->fields_count == collection->fields_capacity) {
+    uint32_t capacity = collection->fields_capacity == 0 ? 8 : collection->fields_capacity * 2;
+    FieldColumn *fields = realloc(collection->fields, sizeof(FieldColumn) * capacity);
+    if (fields == NULL) {
+      return STORE_OUT_OF_MEMORY;
+    }
+    collection->fields = fields;
+    collection->fields_capacity = capacity;
+  }
+
+  FieldColumn column = { .name = malloc(name_length + 1), .name_length = name_length, .values = values,
+                         .values_borrowed = values != NULL };
+  if (column.name == NULL) {
+    return STORE_OUT_OF_MEMORY;
+  }
+  memcpy(column.name, name, name_length);
+  column.name[name_length] = '\0';
+  if (values == NULL && collection->objects_capacity > 0) {
+    column.values = malloc(sizeof(double) * collection->objects_capacity);
+    if (column.values == NULL) {
+      free(column.name);
+      return STORE_OUT_OF_MEMORY;
+    }
+    fill_nan(column.values, 0, collection->objects_capacity);
+  }
+  collection->fields[collection->fields_count++] = column;
+  return STORE_OK;
+}
+
+/*
+ * adds a column for every name of `fields` the collection doesn't have yet. returns a StoreResult.
+ */
+static int reserve_fields(Collection *collection, const FieldValue *fields, size_t fields_count) {
+  for (size_t i = 0; i < fields_count; i++) {
+    const Span *name = &fields[i].name;
+    if (find_field(collection, name->start, name->length) == UINT32_MAX &&
+        add_field(collection, name->start, name->length, NULL) != STORE_OK) {
+      return STORE_OUT_OF_MEMORY;
+    }
+  }
+  return STORE_OK;
+}
+
+/*
+ * writes `fields` into the columns, which `reserve_fields` made sure exist.
+ */
+static void write_fields(Collection *collection, uint32_t slot, const FieldValue *fields, size_t fields_count) {
+  for (size_t i = 0; i < fields_count; i++) {
+    uint32_t field = find_field(collection, fields[i].name.start, fields[i].name.length);
+    collection->fields[field].values[slot] = fields[i].value;
+  }
+}
+
+static void clear_fields(Collection *collection, uint32_t slot) {
+  for (uint32_t i = 0; i < collection->fields_count; i++) {
+    collection->fields[i].values[slot] = NAN;
+  }
+}
+
+/*
+ * makes sure the columns can hold `p`: a quantized collection can't hold coordinates out of range, the first z
+ * allocates the z column. returns a StoreResult.
+ */
+static int reserve_point(Collection *collection, const Point *p) {
+  PointColumns *points = &collection->points;
+  if (points->quantized && !(coordinate_quantizable(p->x) && coordinate_quantizable(p->y))) {
+    return STORE_INVALID_STATEMENT;
+  }
+  if (p->has_z && points->z == NULL) {
+    // a collection without slots yet gets a column of the size its first `reserve_slot` grows it to.
+    uint32_t capacity = collection->objects_capacity > 0 ? collection->objects_capacity : COLLECTION_INITIAL_CAPACITY;
+    points->z = malloc(sizeof(double) * capacity);
+    if (points->z == NULL) {
+      return STORE_OUT_OF_MEMORY;
+    }
+    fill_nan(points->z, 0, capacity);
+    points->z_borrowed = false;
+  }
+  return STORE_OK;
+}
+
+int collection_reserve(Collection *collection, size_t count) {
+  size_t needed = (size_t)collection->ids.handles_count + count;
+  if (needed > UINT32_MAX / 2 || intern_reserve(&collection->ids, count) != 0) {
+    return STORE_OUT_OF_MEMORY;
+  }
+  while (collection->objects_capacity < needed) {
+    if (reserve_slot(collection, collection->objects_capacity) != STORE_OK) {
+      return STORE_OUT_OF_MEMORY;
+    }
+  }
+  return STORE_OK;
+}
+
+int collection_set(Collection *collection, const char *id, size_t id_length, const Geometry *geometry,
+                   const FieldValue *fields, size_t fields_count) {
+  if (reserve_fields(collection, fields, fields_count) != STORE_OK) {
+    return STORE_OUT_OF_MEMORY;
+  }
+  Shape *shape = NULL;
+  Rect rect;
+  if (geometry->type == GEOMETRY_POINT) {
+    int rc = reserve_point(collection, &geometry->point);
+    if (rc != STORE_OK) {
+      return rc;
+    }
+    // the index holds the position as it reads back from the columns.
+    Point stored = geometry->point;
+    if (collection->points.quantized) {
+      stored.x = dequantize_coordinate(quantize_coordinate(stored.x));
+      stored.y = dequantize_coordinate(quantize_coordinate(stored.y));
+    }
+    rect = point_rect(&stored);
+  } else {
+    shape = make_shape(geometry);
+    if (shape == NULL) {
+      return STORE_OUT_OF_MEMORY;
+    }
+    rect = shape->rect;
+  }
+
+  // one probe finds the object or interns its id.
+  uint32_t slot;
+  bool inserted;
+  if (intern_string(&collection->ids, id, id_length, &slot, &inserted) != 0) {
+    free_shape(shape);
+    return STORE_OUT_OF_MEMORY;
+  }
+
+  if (!inserted) {
+    // replace in place: only the index entry has to move, and not even that for a tracker reporting the same position.
+    Object *o = &collection->objects[slot];
+    Rect old = object_rect(collection, o);
+    bool moved = old.min_x != rect.min_x || old.min_y != rect.min_y || old.max_x != rect.max_x ||
+                 old.max_y != rect.max_y;
+    if (moved && !collection->index_deferred && rtree_update(&collection->index, &old, &rect, slot) != 0) {
+      free_shape(shape);
+      return STORE_OUT_OF_MEMORY;
+    }
+    free_shape(o->shape);
+    o->type = geometry->type;
+    o->shape = shape;
+    if (shape == NULL) {
+      write_point(collection, slot, &geometry->point);
+    }
+    clear_fields(collection, slot);
+    write_fields(collection, slot, fields, fields_count);
+    timer_wheel_cancel(&collection->expirations, slot);
+    return STORE_OK;
+  }
+
+  if (reserve_slot(collection, slot) != STORE_OK) {
+    intern_remove(&collection->ids, slot);
+    free_shape(shape);
+    return STORE_OUT_OF_MEMORY;
+  }
+  collection->objects[slot].id = UINT32_MAX;
+  if (!collection->index_deferred && rtree_insert(&collection->index, &rect, slot) != 0) {
+    intern_remove(&collection->ids, slot);
+    free_shape(shape);
+    return STORE_OUT_OF_MEMORY;
+  }
+
+  collection->objects[slot] = (Object){ .id = slot, .type = geometry->type, .shape = shape };
+  if (shape == NULL) {
+    write_point(collection, slot, &geometry->point);
+  }
+  collection->count++;
+  // a reused slot was cleared by the delete that freed it, fresh ones start out NAN.
+  write_fields(collection, slot, fields, fields_count);
+  return STORE_OK;
+}
+
+int collection_set_fields(Collection *collection, const char *id, size_t id_length, const FieldValue *fields,
+                          size_t fields_count) {
+  uint32_t slot;
+  if (intern_lookup(&collection->ids, id, id_length, &slot) != 0) {
+    return STORE_ID_NOT_FOUND;
+  }
+  if (reserve_fields(collection, fields, fields_count) != STORE_OK) {
+    return STORE_OUT_OF_MEMORY;
+  }
+  write_fields(collection, slot, fields, fields_count);
+  return STORE_OK;
+}
+
+int collection_set_expiration(Collection *collection, const char *id, size_t id_length, uint64_t deadline,
+                              uint64_t now) {
+  uint32_t slot;
+  if (intern_lookup(&collection->ids, id, id_length, &slot) != 0) {
+    return STORE_ID_NOT_FOUND;
+  }
+  if (deadline == 0) {
+    timer_wheel_cancel(&collection->expirations, slot);
+    return STORE_OK;
+  }
+  if (timer_wheel_reserve(&collection->expirations, collection->objects_capacity) != 0) {
+    return STORE_OUT_OF_MEMORY;
+  }
+  timer_wheel_schedule(&collection->expirations, slot, deadline, now);
+  return STORE_OK;
+}
+
+uint64_t collection_object_expiration(const Collection *collection, const Object *object) {
+  return timer_wheel_deadline(&collection->expirations, object->id);
+}
+
+size_t collection_expired(Collection *collection, uint64_t now, uint32_t *expired, size_t capacity) {
+  return timer_wheel_advance(&collection->expirations, now, expired, capacity);
+}
+
+const Object *collection_get(const Collection *collection, const char *id, size_t id_length) {
+  uint32_t slot;
+  if (intern_lookup(&collection->ids, id, id_length, &slot) != 0) {
+    return NULL;
+  }
+  return &collection->objects[slot];
+}
+
+int collection_delete(Collection *collection, const char *id, size_t id_length) {
+  uint32_t slot;
+  if (intern_lookup(&collection->ids, id, id_length, &slot) != 0) {
+    return STORE_ID_NOT_FOUND;
+  }
+
+  Object *o = &collection->objects[slot];
+  if (!collection->index_deferred) {
+    Rect rect = object_rect(collection, o);
+    if (rtree_remove(&collection->index, &rect, slot) != 0) {
+      return STORE_OUT_OF_MEMORY;
+    }
+  }
+  free_shape(o->shape);
+  o->shape = NULL;
+  o->id = UINT32_MAX;
+  clear_fields(collection, slot);
+  timer_wheel_cancel(&collection->expirations, slot);
+  intern_remove(&collection->ids, slot);
+  collection->count--;
+  return STORE_OK;
+}
+
+int collection_build_index(Collection *collection) {
+  Rect *rects = malloc(sizeof(Rect) * (collection->count + 1));
+  uint32_t *items = malloc(sizeof(uint32_t) * (collection->count + 1));
+  if (rects == NULL || items == NULL) {
+    free(rects);
+    free(items);
+    return STORE_OUT_OF_MEMORY;
+  }
+  size_t count = 0;
+  for (uint32_t i = 0; i < collection->ids.handles_count; i++) {
+    if (collection->objects[i].id != UINT32_MAX) {
+      rects[count] = object_rect(collection, &collection->objects[i]);
+      items[count++] = i;
+    }
+  }
+
+  destroy_rtree(&collection->index);
+  int rc = init_rtree(&collection->index) != 0 || rtree_bulk_load(&collection->index, rects, items, count) != 0
+               ? STORE_OUT_OF_MEMORY
+               : STORE_OK;
+  free(rects);
+  free(items);
+  if (rc == STORE_OK) {
+    collection->index_deferred = false;
+  }
+  return rc;
+}
+
+int collection_attach_line_string(Collection *collection, uint32_t slot, const LineString *line_string) {
+  Geometry geometry = { .type = GEOMETRY_LINE_STRING, .line_string = *line_string };
+  Shape *shape = make_shape(&geometry);
+  if (shape == NULL) {
+    return STORE_OUT_OF_MEMORY;
+  }
+  collection->objects[slot].shape = shape;
+  return STORE_OK;
+}
+
+int collection_attach_field(Collection *collection, const char *name, size_t name_length, double *values) {
+  if (find_field(collection, name, name_length) != UINT32_MAX) {
+    return STORE_INVALID_SNAPSHOT;
+  }
+  return add_field(collection, name, name_length, values);
+}
+
+int collection_attach_expirations(Collection *collection, const uint64_t *deadlines, uint64_t now) {
+  if (timer_wheel_reserve(&collection->expirations, collection->objects_capacity) != 0) {
+    return STORE_OUT_OF_MEMORY;
+  }
+  for (uint32_t slot = 0; slot < collection->ids.handles_count; slot++) {
+    if (deadlines[slot] != 0 && collection->objects[slot].id != UINT32_MAX) {
+      timer_wheel_schedule(&collection->expirations, slot, deadlines[slot], now);
+    }
+  }
+  return STORE_OK;
+}
+
+double collection_object_field(const Collection *collection, const Object *object, uint32_t field) {
+  return collection->fields[field].values[object->id];
+}
+
+Point collection_object_point(const Collection *collection, const Object *object) {
+  return slot_point(collection, object->id);
+}
+
+Geometry collection_object_geometry(const Collection *collection, const Object *object) {
+  if (object->type == GEOMETRY_POINT) {
+    return (Geometry){ .type = GEOMETRY_POINT, .point = slot_point(collection, object->id) };
+  }
+  return (Geometry){ .type = GEOMETRY_LINE_STRING, .line_string = object->shape->line_string };
+}
+
+Span collection_object_id(const Collection *collection, const Object *object) {
+  return interned_span(&collection->ids, object->id);
+}
+
+size_t collection_memory_usage(const Collection *collection) {
+  const InternTable *ids = &collection->ids;
+  size_t bytes = (size_t)collection->objects_capacity * sizeof(Object);
+  bytes += (size_t)collection->objects_capacity * 2 * (collection->points.quantized ? sizeof(int32_t) : sizeof(double));
+  if (collection->points.z != NULL) {
+    bytes += (size_t)collection->objects_capacity * sizeof(double);
+  }
+  bytes += ids->slots_capacity * (sizeof(uint8_t) + sizeof(uint32_t)) + ids->handles_capacity * sizeof(Span);
+  bytes += ids->live_bytes;
+  bytes += (size_t)collection->index.nodes_capacity * sizeof(RTreeNode);
+  bytes += (size_t)collection->fields_capacity * sizeof(FieldColumn);
+  bytes += (size_t)collection->fields_count * collection->objects_capacity * sizeof(double);
+  bytes += (size_t)collection->expirations.capacity * (sizeof(uint64_t) + 2 * sizeof(uint32_t));
+  return bytes;
+}
+
+typedef struct {
+  const Collection *collection;
+  collection_search_callback cb;
+  void *user_data;
+} SearchContext;
+
+static int search_trampoline(uint32_t item, const Rect *rect, void *user_data) {
+  (void)rect;
+  SearchContext *ctx = user_data;
+  return ctx->cb(&ctx->collection->objects[item], ctx->user_data);
+}
+
+int collection_search(const Collection *collection, const Rect *rect, collection_search_callback cb, void *user_data) {
+  SearchContext ctx = { .collection = collection, .cb = cb, .user_data = user_data };
+  return rtree_search(&collection->index, rect, search_trampoline, &ctx);
+}
+
+/*
+ * candidates of a filtered query waiting for the filter, in the order the index produced them.
+ */
+typedef struct {
+  uint32_t items[FILTER_BLOCK_SIZE];
+  double distances[FILTER_BLOCK_SIZE]; // NEARBY only
+  size_t count;
+} CandidateBlock;
+
+static void add_candidate(CandidateBlock *block, uint32_t item, double distance) {
+  block->items[block->count] = item;
+  block->distances[block->count] = distance;
+  block->count++;
+}
+
+/*
+ * the matches of one subtree of a parallel scan. `distances` is only filled by NEARBY.
+ */
+typedef struct {
+  uint32_t *items;
+  double *distances;
+  size_t count;
+  size_t capacity;
+  bool out_of_memory;
+  uint64_t nodes_visited; // by the worker that searched the subtree, see `free_parallel_scan`
+} ScanResults;
+
+/*
+ * a parallel scan: the subtrees and their results, one task per subtree. `query` is a NearbyContext or a
+ * PolygonContext.
+ */
+typedef struct {
+  const void *query;
+  uint32_t subtrees[RTREE_MAX_PARTITION];
+  ScanResults results[RTREE_MAX_PARTITION];
+  size_t count;
+} ParallelScan;
+
+/*
+ * returns 1 (stopping the subtree) when out of memory.
+ */
+static int append_result(ScanResults *results, uint32_t item, double distance, bool with_distance) {
+  if (results->count == results->capacity) {
+    size_t capacity = results->capacity == 0 ? SCAN_RESULTS_INITIAL_CAPACITY : results->capacity * 2;
+    uint32_t *items = realloc(results->items, sizeof(uint32_t) * capacity);
+    if (items == NULL) {
+      results->out_of_memory = true;
+      return 1;
+    }
+    results->items = items;
+    if (with_distance) {
+      double *distances = realloc(results->distances, sizeof(double) * capacity);
+      if (distances == NULL) {
+        results->out_of_memory = true;
+        return 1;
+      }
+      results->distances = distances;
+    }
+    results->capacity = capacity;
+  }
+  results->items[results->count] = item;
+  if (with_distance) {
+    results->distances[results->count] = distance;
+  }
+  results->count++;
+  return 0;
+}
+
+/*
+ * splits the scan of `rect` into subtrees. returns false when the scan is estimated to visit too few objects to be
+ * worth splitting.
+ */
+static bool plan_parallel_scan(ParallelScan *scan, const Collection *collection, const Rect *rect,
+                               const ScanPool *pool) {
+  if (collection->count < pool->min_candidates || collection->index_deferred) {
+    return false;
+  }
+  uint16_t level;
+  scan->count = rtree_partition(&collection->index, rect, scan->subtrees,
+                                (size_t)pool->workers_count * SCAN_SUBTREES_PER_WORKER, &level);
+  // nodes are at least RTREE_MIN_ENTRIES full and mostly more, call it 8 entries: a subtree at `level` holds about
+  // 8^(level + 1) objects.
+  size_t estimate = level >= 16 ? SIZE_MAX : scan->count << (3 * (level + 1));
+  if (scan->count < 2 || estimate < pool->min_candidates) {
+    return false;
+  }
+  memset(scan->results, 0, sizeof(ScanResults) * scan->count);
+  return true;
+}
+
+static bool parallel_scan_out_of_memory(const ParallelScan *scan) {
+  for (size_t i = 0; i < scan->count; i++) {
+    if (scan->results[i].out_of_memory) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * called by the thread that ran the scan, the index nodes the workers visited are counted as its own.
+ */
+static void free_parallel_scan(ParallelScan *scan) {
+  for (size_t i = 0; i < scan->count; i++) {
+    free(scan->results[i].items);
+    free(scan->results[i].distances);
+    rtree_nodes_visited += scan->results[i].nodes_visited;
+  }
+  free(scan);
+}
+
+typedef struct {
+  const Collection *collection;
+  const Point *point;
+  DistanceQuery query; // from `point`, boxes further than `max_distance` come out at INFINITY
+  size_t limit;
+  size_t yielded;
+  double max_distance;
+  const Filter *filter; // NULL when unfiltered
+  CandidateBlock *block; // set with `filter`
+  bool done; // the limit was reached or `cb` stopped the query
+  collection_nearby_callback cb;
+  void *user_data;
+} NearbyContext;
+
+static void node_distances(const DistanceQuery *query, const RTreeNode *node, double *distances) {
+  rect_distances_meters(query, node->min_x, node->min_y, node->max_x, node->max_y, node->count, distances);
+}
+
+static void nearby_distance(const RTreeNode *node, double *distances, void *user_data) {
+  NearbyContext *ctx = user_data;
+  node_distances(&ctx->query, node, distances);
+}
+
+/*
+ * returns 1 once the query is done.
+ */
+static int yield_nearby(NearbyContext *ctx, uint32_t item, double distance) {
+  if (ctx->cb(&ctx->collection->objects[item], distance, ctx->user_data) != 0) {
+    ctx->done = true;
+    return 1;
+  }
+  ctx->yielded++;
+  ctx->done = ctx->limit != 0 && ctx->yielded >= ctx->limit;
+  return ctx->done;
+}
+
+/*
+ * yields the candidates of the block that pass the filter, still nearest first.
+ */
+static int flush_nearby_block(NearbyContext *ctx) {
+  CandidateBlock *block = ctx->block;
+  uint64_t passed = filter_block(ctx->filter, block->items, block->count);
+  block->count = 0;
+  for (; passed != 0; passed &= passed - 1) {
+    int i = __builtin_ctzll(passed);
+    if (yield_nearby(ctx, block->items[i], block->distances[i]) != 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int nearby_trampoline(uint32_t item, double distance, void *user_data) {
+  NearbyContext *ctx = user_data;
+  if (distance > ctx->max_distance) {
+    return 1;
+  }
+  if (ctx->filter == NULL) {
+    return yield_nearby(ctx, item, distance);
+  }
+  add_candidate(ctx->block, item, distance);
+  // with a limit, no more candidates are taken from the index than could still be yielded.
+  size_t wanted = FILTER_BLOCK_SIZE;
+  if (ctx->limit != 0 && ctx->limit - ctx->yielded < wanted) {
+    wanted = ctx->limit - ctx->yielded;
+  }
+  return ctx->block->count < wanted ? 0 : flush_nearby_block(ctx);
+}
+
+typedef struct {
+  const NearbyContext *ctx;
+  ScanResults *results;
+  CandidateBlock *block; // NULL when unfiltered
+} NearbyTask;
+
+/*
+ * moves the candidates of `block` that pass `filter` to `results`. returns 1 when out of memory.
+ */
+static int flush_block_to_results(CandidateBlock *block, const Filter *filter, ScanResults *results,
+                                  bool with_distance) {
+  uint64_t passed = filter_block(filter, block->items, block->count);
+  block->count = 0;
+  for (; passed != 0; passed &= passed - 1) {
+    int i = __builtin_ctzll(passed);
+    if (append_result(results, block->items[i], block->distances[i], with_distance) != 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void nearby_task_distance(const RTreeNode *node, double *distances, void *user_data) {
+  NearbyTask *task = user_data;
+  node_distances(&task->ctx->query, node, distances);
+}
+
+static int collect_nearby(uint32_t item, double distance, void *user_data) {
+  NearbyTask *task = user_data;
+  if (distance > task->ctx->max_distance) {
+    return 1;
+  }
+  if (task->block == NULL) {
+    return append_result(task->results, item, distance, true);
+  }
+  add_candidate(task->block, item, distance);
+  if (task->block->count < FILTER_BLOCK_SIZE) {
+    return 0;
+  }
+  return flush_block_to_results(task->block, task->ctx->filter, task->results, true);
+}
+
+/*
+ * every subtree yields its objects within `max_distance` in increasing distance.
+ */
+static void nearby_subtree(size_t subtree, void *user_data) {
+  ParallelScan *scan = user_data;
+  const NearbyContext *ctx = scan->query;
+  CandidateBlock block = { .count = 0 };
+  NearbyTask task = { .ctx = ctx, .results = &scan->results[subtree], .block = ctx->filter != NULL ? &block : NULL };
+  uint64_t visited = rtree_nodes_visited;
+  if (rtree_nearby_subtree(&ctx->collection->index, scan->subtrees[subtree], nearby_task_distance, collect_nearby,
+                           &task) != 0) {
+    task.results->out_of_memory = true;
+  }
+  task.results->nodes_visited = rtree_nodes_visited - visited;
+  rtree_nodes_visited = visited;
+  if (block.count > 0 && !task.results->out_of_memory) {
+    flush_block_to_results(&block, ctx->filter, task.results, true);
+  }
+}
+
+/*
+ * min heap of the subtrees that have results left, keyed on the distance of their next result.
+ */
+typedef struct {
+  const ParallelScan *scan;
+  size_t subtrees[RTREE_MAX_PARTITION];
+  size_t next[RTREE_MAX_PARTITION]; // next result of every subtree
+  size_t count;
+} MergeHeap;
+
+static double head_distance(const MergeHeap *heap, size_t i) {
+  size_t subtree = heap->subtrees[i];
+  return heap->scan->results[subtree].distances[heap->next[subtree]];
+}
+
+static void sift_down(MergeHeap *heap, size_t i) {
+  for (size_t child; (child = i * 2 + 1) < heap->count; i = child) {
+    if (child + 1 < heap->count && head_distance(heap, child + 1) < head_distance(heap, child)) {
+      child++;
+    }
+    if (head_distance(heap, i) <= head_distance(heap, child)) {
+      break;
+    }
+    size_t swap = heap->subtrees[i];
+    heap->subtrees[i] = heap->subtrees[child];
+    heap->subtrees[child] = swap;
+  }
+}
+
+/*
+ * merges the sorted results of the subtrees into `ctx->cb`.
+ */
+static void stream_nearby_results(const ParallelScan *scan, const NearbyContext *ctx) {
+  MergeHeap heap = { .scan = scan };
+  for (size_t i = 0; i < scan->count; i++) {
+    heap.next[i] = 0;
+    if (scan->results[i].count > 0) {
+      heap.subtrees[heap.count++] = i;
+    }
+  }
+  for (size_t i = heap.count / 2; i-- > 0;) {
+    sift_down(&heap, i);
+  }
+
+  while (heap.count > 0) {
+    size_t subtree = heap.subtrees[0];
+    const ScanResults *results = &scan->results[subtree];
+    size_t k = heap.next[subtree]++;
+    if (ctx->cb(&ctx->collection->objects[results->items[k]], results->distances[k], ctx->user_data) != 0) {
+      break;
+    }
+    if (heap.next[subtree] == results->count) {
+      heap.subtrees[0] = heap.subtrees[--heap.count];
+    }
+    sift_down(&heap, 0);
+  }
+}
+
+/*
+ * returns false when the query wasn't split, or ran out of memory before anything was streamed.
+ */
+static bool parallel_nearby(const NearbyContext *ctx, ScanPool *pool) {
+  // best first traversal only opens the nodes closer than the `limit`th object, while every subtree of a split query
+  // would find `limit` objects of its own: only queries without a limit are worth splitting.
+  if (ctx->limit != 0) {
+    return false;
+  }
+  ParallelScan *scan = malloc(sizeof(ParallelScan));
+  if (scan == NULL) {
+    return false;
+  }
+  scan->query = ctx;
+  Rect rect = circle_rect(ctx->point, ctx->max_distance);
+  if (!plan_parallel_scan(scan, ctx->collection, &rect, pool)) {
+    scan->count = 0;
+    free_parallel_scan(scan);
+    return false;
+  }
+  scan_pool_run(pool, scan->count, nearby_subtree, scan);
+  bool streamed = !parallel_scan_out_of_memory(scan);
+  if (streamed) {
+    stream_nearby_results(scan, ctx);
+  }
+  free_parallel_scan(scan);
+  return streamed;
+}
+
+int collection_nearby(const Collection *collection, const Point *point, size_t limit, double max_distance,
+                      const Filter *filter, ScanPool *pool, collection_nearby_callback cb, void *user_data) {
+  CandidateBlock block = { .count = 0 };
+  NearbyContext ctx = {
+    .collection = collection,
+    .point = point,
+    .limit = limit,
+    .max_distance = max_distance,
+    .filter = filter,
+    .block = &block,
+    .cb = cb,
+    .user_data = user_data,
+  };
+  init_distance_query(&ctx.query, point, max_distance);
+  if (pool != NULL && parallel_nearby(&ctx, pool)) {
+    return STORE_OK;
+  }
+  if (rtree_nearby(&collection->index, nearby_distance, nearby_trampoline, &ctx) != 0) {
+    return STORE_OUT_OF_MEMORY;
+  }
+  // the traversal ran out of objects (or past `max_distance`) with candidates left in the block.
+  if (filter != NULL && !ctx.done && block.count > 0) {
+    flush_nearby_block(&ctx);
+  }
+  return STORE_OK;
+}
+
+typedef struct {
+  const Collection *collection;
+  const Polygon *polygon;
+  bool within; // else intersects
+  const Filter *filter; // NULL when unfiltered
+  CandidateBlock *block; // set with `filter`
+  collection_search_callback cb;
+  void *user_data;
+} PolygonContext;
+
+static bool object_matches_polygon(const Collection *collection, const Object *o, const Polygon *polygon,
+                                   bool within) {
+  if (o->type == GEOMETRY_POINT) {
+    Point p = slot_point(collection, o->id);
+    return polygon_contains_point(polygon, &p);
+  }
+  const Shape *shape = o->shape;
+  if (shape->polygon != NULL) {
+    return within ? polygon_contains_polygon(polygon, shape->polygon) : polygons_intersect(polygon, shape->polygon);
+  }
+
+  // open line strings: every vertex inside for within, any vertex inside for intersects.
+  const LineString *ls = &shape->line_string;
+  for (size_t i = 0; i < ls->points_count; i++) {
+    bool inside = polygon_contains_point(polygon, &ls->points[i]);
+    if (inside != within) {
+      return inside;
+    }
+  }
+  return within;
+}
+
+/*
+ * an object can only be within the polygon if its box is within the polygon's box, a test cheap enough to run before
+ * the filter.
+ */
+static bool box_may_match(const PolygonContext *ctx, const Rect *rect) {
+  return !ctx->within || rect_contains(&ctx->polygon->rect, rect);
+}
+
+static bool polygon_matches(const PolygonContext *ctx, uint32_t item) {
+  return object_matches_polygon(ctx->collection, &ctx->collection->objects[item], ctx->polygon, ctx->within);
+}
+
+/*
+ * streams the candidates of the block that pass the filter and the polygon test. returns the non-zero value of
+ * `ctx->cb` when it stopped the query.
+ */
+static int flush_polygon_block(const PolygonContext *ctx) {
+  CandidateBlock *block = ctx->block;
+  uint64_t passed = filter_block(ctx->filter, block->items, block->count);
+  block->count = 0;
+  for (; passed != 0; passed &= passed - 1) {
+    uint32_t item = block->items[__builtin_ctzll(passed)];
+    if (polygon_matches(ctx, item)) {
+      int rc = ctx->cb(&ctx->collection->objects[item], ctx->user_data);
+      if (rc != 0) {
+        return rc;
+      }
+    }
+  }
+  return 0;
+}
+
+static int polygon_trampoline(uint32_t item, const Rect *rect, void *user_data) {
+  PolygonContext *ctx = user_data;
+  if (!box_may_match(ctx, rect)) {
+    return 0;
+  }
+  if (ctx->filter != NULL) {
+    add_candidate(ctx->block, item, 0);
+    return ctx->block->count < FILTER_BLOCK_SIZE ? 0 : flush_polygon_block(ctx);
+  }
+  if (!polygon_matches(ctx, item)) {
+    return 0;
+  }
+  return ctx->cb(&ctx->collection->objects[item], ctx->user_data);
+}
+
+typedef struct {
+  const PolygonContext *ctx;
+  ScanResults *results;
+  CandidateBlock *block; // NULL when unfiltered
+} PolygonTask;
+
+/*
+ * the polygon tests of the candidates of the block that pass the filter. returns 1 when out of memory.
+ */
+static int flush_polygon_task_block(PolygonTask *task) {
+  CandidateBlock *block = task->block;
+  uint64_t passed = filter_block(task->ctx->filter, block->items, block->count);
+  block->count = 0;
+  for (; passed != 0; passed &= passed - 1) {
+    uint32_t item = block->items[__builtin_ctzll(passed)];
+    if (polygon_matches(task->ctx, item) && append_result(task->results, item, 0, false) != 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int collect_polygon_match(uint32_t item, const Rect *rect, void *user_data) {
+  PolygonTask *task = user_data;
+  if (!box_may_match(task->ctx, rect)) {
+    return 0;
+  }
+  if (task->block != NULL) {
+    add_candidate(task->block, item, 0);
+    return task->block->count < FILTER_BLOCK_SIZE ? 0 : flush_polygon_task_block(task);
+  }
+  if (!polygon_matches(task->ctx, item)) {
+    return 0;
+  }
+  return append_result(task->results, item, 0, false);
+}
+
+static void polygon_subtree(size_t subtree, void *user_data) {
+  ParallelScan *scan = user_data;
+  const PolygonContext *ctx = scan->query;
+  CandidateBlock block = { .count = 0 };
+  PolygonTask task = { .ctx = ctx, .results = &scan->results[subtree], .block = ctx->filter != NULL ? &block : NULL };
+  uint64_t visited = rtree_nodes_visited;
+  rtree_search_subtree(&ctx->collection->index, scan->subtrees[subtree], &ctx->polygon->rect, collect_polygon_match,
+                       &task);
+  task.results->nodes_visited = rtree_nodes_visited - visited;
+  rtree_nodes_visited = visited;
+  if (block.count > 0 && !task.results->out_of_memory) {
+    flush_polygon_task_block(&task);
+  }
+}
+
+/*
+ * the point in polygon tests, which are most of the cost of a large query, run on the pool. The matches are then
+ * streamed to `ctx->cb` from the calling thread, subtree by subtree. returns false when the query wasn't split, or ran
+ * out of memory before anything was streamed, else sets `rc` to what `ctx->cb` stopped the query with.
+ */
+static bool parallel_polygon_search(const PolygonContext *ctx, ScanPool *pool, int *rc) {
+  ParallelScan *scan = malloc(sizeof(ParallelScan));
+  if (scan == NULL) {
+    return false;
+  }
+  scan->query = ctx;
+  if (!plan_parallel_scan(scan, ctx->collection, &ctx->polygon->rect, pool)) {
+    scan->count = 0;
+    free_parallel_scan(scan);
+    return false;
+  }
+  scan_pool_run(pool, scan->count, polygon_subtree, scan);
+  bool streamed = !parallel_scan_out_of_memory(scan);
+  *rc = 0;
+  for (size_t i = 0; streamed && *rc == 0 && i < scan->count; i++) {
+    const ScanResults *results = &scan->results[i];
+    for (size_t k = 0; *rc == 0 && k < results->count; k++) {
+      *rc = ctx->cb(&ctx->collection->objects[results->items[k]], ctx->user_data);
+    }
+  }
+  free_parallel_scan(scan);
+  return streamed;
+}
+
+static int polygon_search(const Collection *collection, const Polygon *polygon, bool within, const Filter *filter,
+                          ScanPool *pool, collection_search_callback cb, void *user_data) {
+  CandidateBlock block = { .count = 0 };
+  PolygonContext ctx = {
+    .collection = collection,
+    .polygon = polygon,
+    .within = within,
+    .filter = filter,
+    .block = &block,
+    .cb = cb,
+    .user_data = user_data,
+  };
+  int rc;
+  if (pool != NULL && parallel_polygon_search(&ctx, pool, &rc)) {
+    return rc;
+  }
+  rc = rtree_search(&collection->index, &polygon->rect, polygon_trampoline, &ctx);
+  if (rc == 0 && block.count > 0) {
+    rc = flush_polygon_block(&ctx);
+  }
+  return rc;
+}
+
+int collection_within(const Collection *collection, const Polygon *polygon, const Filter *filter, ScanPool *pool,
+                      collection_search_callback cb, void *user_data) {
+  return polygon_search(collection, polygon, true, filter, pool, cb, user_data);
+}
+
+int collection_intersects(const Collection *collection, const Polygon *polygon, const Filter *filter, ScanPool *pool,
+                          collection_search_callback cb, void *user_data) {
+  return polygon_search(collection, polygon, false, filter, pool, cb, user_data);
+}
@@ -0,0 +1,104 @@
+#include "event_ring.h"
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+int init_event_ring(EventRing *ring, size_t capacity, OverflowPolicy policy) {
+  size_t rounded = 2;
+  while (rounded < capacity) {
+    rounded <<= 1;
+  }
+
+  ring->events = malloc(sizeof(QueuedDetectEvent) * rounded);
+  if (ring->events == NULL) {
+    return 1;
+  }
+  ring->mask = rounded - 1;
+  ring->policy = policy;
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  atomic_init(&ring->dropped, 0);
+  return 0;
+}
+
+void destroy_event_ring(EventRing *ring) {
+  free(ring->events);
+  ring->events = NULL;
+}
+
+static size_t copy_span(char *out, Span span, bool *truncated) {
+  size_t n = span.length < QUEUED_EVENT_SPAN_LENGTH ? span.length : QUEUED_EVENT_SPAN_LENGTH;
+  memcpy(out, span.start, n);
+  *truncated |= n < span.length;
+  return n;
+}
+
+bool event_ring_publish(EventRing *ring, const DetectEvent *event) {
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  size_t capacity = ring->mask + 1;
+
+  for (;;) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (tail - head < capacity) {
+      break;
+    }
+
+    if (ring->policy == OVERFLOW_DROP_NEWEST) {
+      atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+      return false;
+    }
+    if (ring->policy == OVERFLOW_BLOCK) {
+      sched_yield();
+      continue;
+    }
+    // OVERFLOW_DROP_OLDEST: take the oldest slot away from the consumer. Failing means the consumer just freed it.
+    if (atomic_compare_exchange_strong_explicit(&ring->head, &head, head + 1, memory_order_acq_rel,
+                                                memory_order_acquire)) {
+      atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+      break;
+    }
+  }
+
+  QueuedDetectEvent *queued = &ring->events[tail & ring->mask];
+  queued->type = event->type;
+  queued->truncated = false;
+  queued->channel_length = copy_span(queued->channel, event->channel, &queued->truncated);
+  queued->key_length = copy_span(queued->key, event->key, &queued->truncated);
+  queued->id_length = copy_span(queued->id, event->id, &queued->truncated);
+  queued->point = event->point;
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+  return true;
+}
+
+size_t event_ring_drain(EventRing *ring, QueuedDetectEvent *out, size_t max) {
+  for (;;) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    size_t available = tail - head;
+    size_t n = available < max ? available : max;
+    if (n == 0) {
+      return 0;
+    }
+
+    // copy in at most two runs, the second one when the range wraps around the end of the array.
+    size_t first = head & ring->mask;
+    size_t run = ring->mask + 1 - first;
+    if (run > n) {
+      run = n;
+    }
+    memcpy(out, &ring->events[first], sizeof(QueuedDetectEvent) * run);
+    memcpy(out + run, ring->events, sizeof(QueuedDetectEvent) * (n - run));
+
+    // the copy is only valid if the producer didn't drop (and overwrite) any of these slots meanwhile. A torn copy is
+    // possible with OVERFLOW_DROP_OLDEST, but then head moved and the copy is thrown away.
+    if (atomic_compare_exchange_strong_explicit(&ring->head, &head, head + n, memory_order_acq_rel,
+                                                memory_order_acquire)) {
+      return n;
+    }
+  }
+}
+
+size_t event_ring_dropped(EventRing *ring) {
+  return atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+}
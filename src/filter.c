@@ -0,0 +1,98 @@
+#include "filter.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+int compile_filter(Filter *filter, const WhereClause *clauses, size_t clauses_count, const FieldColumn *fields,
+                   uint32_t fields_count) {
+  *filter = (Filter){ 0 };
+  if (clauses_count == 0) {
+    return 0;
+  }
+  filter->terms = malloc(sizeof(FilterTerm) * clauses_count);
+  if (filter->terms == NULL) {
+    return 1;
+  }
+  for (size_t i = 0; i < clauses_count; i++) {
+    const WhereClause *clause = &clauses[i];
+    FilterTerm *term = &filter->terms[i];
+    *term = (FilterTerm){ .min = clause->min, .max = clause->max, .starts_group = clause->starts_group };
+    for (uint32_t f = 0; f < fields_count; f++) {
+      if (fields[f].name_length == clause->field.length &&
+          memcmp(fields[f].name, clause->field.start, clause->field.length) == 0) {
+        term->values = fields[f].values;
+        break;
+      }
+    }
+  }
+  filter->terms_count = clauses_count;
+  return 0;
+}
+
+void destroy_filter(Filter *filter) {
+  free(filter->terms);
+  *filter = (Filter){ 0 };
+}
+
+/*
+ * bit i is set when the value of `slots[i]` is in the range of `term`. A missing value is NAN, which every ordered
+ * compare rejects.
+ */
+static uint64_t test_term(const FilterTerm *term, const uint32_t *slots, size_t count) {
+  const double *values = term->values;
+  uint64_t passed = 0;
+  size_t i = 0;
+
+#if defined(__AVX__)
+  __m256d vmin = _mm256_set1_pd(term->min);
+  __m256d vmax = _mm256_set1_pd(term->max);
+  for (; i + 4 <= count; i += 4) {
+#if defined(__AVX2__)
+    // slots are below 2^31: a collection never holds that many objects.
+    __m256d v = _mm256_i32gather_pd(values, _mm_loadu_si128((const __m128i *)(slots + i)), sizeof(double));
+#else
+    __m256d v = _mm256_set_pd(values[slots[i + 3]], values[slots[i + 2]], values[slots[i + 1]], values[slots[i]]);
+#endif
+    __m256d in = _mm256_and_pd(_mm256_cmp_pd(v, vmin, _CMP_GE_OQ), _mm256_cmp_pd(v, vmax, _CMP_LE_OQ));
+    passed |= (uint64_t)_mm256_movemask_pd(in) << i;
+  }
+#elif defined(__SSE2__)
+  __m128d vmin = _mm_set1_pd(term->min);
+  __m128d vmax = _mm_set1_pd(term->max);
+  for (; i + 2 <= count; i += 2) {
+    __m128d v = _mm_set_pd(values[slots[i + 1]], values[slots[i]]);
+    __m128d in = _mm_and_pd(_mm_cmpge_pd(v, vmin), _mm_cmple_pd(v, vmax));
+    passed |= (uint64_t)_mm_movemask_pd(in) << i;
+  }
+#endif
+
+  for (; i < count; i++) {
+    double v = values[slots[i]];
+    passed |= (uint64_t)(v >= term->min && v <= term->max) << i;
+  }
+  return passed;
+}
+
+uint64_t filter_block(const Filter *filter, const uint32_t *slots, size_t count) {
+  uint64_t all = count >= 64 ? UINT64_MAX : ((uint64_t)1 << count) - 1;
+  uint64_t passed = 0;
+  uint64_t group = all;
+  for (size_t i = 0; i < filter->terms_count; i++) {
+    const FilterTerm *term = &filter->terms[i];
+    if (term->starts_group) {
+      passed |= group;
+      group = all & ~passed; // candidates that passed already can't pass more
+    }
+    if (group == 0) {
+      continue;
+    }
+    group = term->values == NULL ? 0 : group & test_term(term, slots, count);
+  }
+  return passed | group;
+}
@@ -0,0 +1,274 @@
+#include "geofence.h"
+#include "collection.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GEOFENCES_INITIAL_CAPACITY 16
+
+static const char * const DETECT_TYPE_TO_STRING[] = {
+  "enter",
+  "exit",
+  "inside",
+  "outside",
+};
+
+const char *detect_type_to_string(DetectType type) {
+  return DETECT_TYPE_TO_STRING[type];
+}
+
+int init_geofences(Geofences *geofences) {
+  *geofences = (Geofences){ 0 };
+  if (init_hashmap(&geofences->names, GEOFENCES_INITIAL_CAPACITY) != 0) {
+    return STORE_OUT_OF_MEMORY;
+  }
+  if (init_rtree(&geofences->index) != 0) {
+    destroy_hashmap(&geofences->names);
+    return STORE_OUT_OF_MEMORY;
+  }
+  return STORE_OK;
+}
+
+static void destroy_fence(Fence *fence) {
+  free(fence->name);
+  free(fence->key);
+  if (fence->type == FENCE_WITHIN) {
+    destroy_polygon(&fence->polygon);
+  }
+}
+
+void destroy_geofences(Geofences *geofences) {
+  for (uint32_t i = 0; i < geofences->fences_count; i++) {
+    destroy_fence(&geofences->fences[i]);
+  }
+  free(geofences->fences);
+  destroy_rtree(&geofences->index);
+  destroy_hashmap(&geofences->names);
+  *geofences = (Geofences){ 0 };
+}
+
+static char *copy_bytes(const char *bytes, size_t length) {
+  char *copy = malloc(length + 1);
+  if (copy != NULL) {
+    memcpy(copy, bytes, length);
+    copy[length] = '\0';
+  }
+  return copy;
+}
+
+/*
+ * takes ownership of `fence` (its strings and polygon), freeing it on failure.
+ */
+static int put_fence(Geofences *geofences, Fence *fence) {
+  if (fence->name == NULL || fence->key == NULL) {
+    destroy_fence(fence);
+    return STORE_OUT_OF_MEMORY;
+  }
+
+  uint32_t index;
+  if (hashmap_get(&geofences->names, fence->name, fence->name_length, &index) == 0) {
+    Fence *old = &geofences->fences[index];
+    // the new box goes in before the old one comes out, so a failure leaves the old fence indexed.
+    if (rtree_insert(&geofences->index, &fence->rect, index) != 0) {
+      destroy_fence(fence);
+      return STORE_OUT_OF_MEMORY;
+    }
+    if (rtree_remove(&geofences->index, &old->rect, index) != 0) {
+      rtree_remove(&geofences->index, &fence->rect, index);
+      destroy_fence(fence);
+      return STORE_OUT_OF_MEMORY;
+    }
+    // the map must reference the new copy of the name, drop the entry before the old name is freed.
+    hashmap_remove(&geofences->names, old->name, old->name_length);
+    destroy_fence(old);
+    *old = *fence;
+    hashmap_put(&geofences->names, old->name, old->name_length, index);
+    return STORE_OK;
+  }
+
+  if (geofences->fences_count == geofences->fences_capacity) {
+    uint32_t capacity =
+        geofences->fences_capacity == 0 ? GEOFENCES_INITIAL_CAPACITY : geofences->fences_capacity * 2;
+    Fence *fences = realloc(geofences->fences, sizeof(Fence) * capacity);
+    if (fences == NULL) {
+      destroy_fence(fence);
+      return STORE_OUT_OF_MEMORY;
+    }
+    geofences->fences = fences;
+    geofences->fences_capacity = capacity;
+  }
+
+  index = geofences->fences_count;
+  if (hashmap_put(&geofences->names, fence->name, fence->name_length, index) != 0) {
+    destroy_fence(fence);
+    return STORE_OUT_OF_MEMORY;
+  }
+  if (rtree_insert(&geofences->index, &fence->rect, index) != 0) {
+    hashmap_remove(&geofences->names, fence->name, fence->name_length);
+    destroy_fence(fence);
+    return STORE_OUT_OF_MEMORY;
+  }
+  geofences->fences[geofences->fences_count++] = *fence;
+  return STORE_OK;
+}
+
+int geofences_set_nearby(Geofences *geofences, const char *name, size_t name_length, const char *key, size_t key_length,
+                         const Point *center, double radius) {
+  Fence fence = {
+    .name = copy_bytes(name, name_length),
+    .name_length = name_length,
+    .key = copy_bytes(key, key_length),
+    .key_length = key_length,
+    .type = FENCE_NEARBY,
+    .center = *center,
+    .radius = radius,
+    .rect = circle_rect(center, radius),
+  };
+  return put_fence(geofences, &fence);
+}
+
+int geofences_set_within(Geofences *geofences, const char *name, size_t name_length, const char *key, size_t key_length,
+                         const LineString *ring) {
+  Fence fence = {
+    .name = copy_bytes(name, name_length),
+    .name_length = name_length,
+    .key = copy_bytes(key, key_length),
+    .key_length = key_length,
+    .type = FENCE_WITHIN,
+  };
+  if (init_polygon(&fence.polygon, ring) != 0) {
+    fence.type = FENCE_NEARBY;
+    destroy_fence(&fence);
+    return STORE_OUT_OF_MEMORY;
+  }
+  fence.rect = fence.polygon.rect;
+  return put_fence(geofences, &fence);
+}
+
+int geofences_delete(Geofences *geofences, const char *name, size_t name_length) {
+  uint32_t index;
+  if (hashmap_get(&geofences->names, name, name_length, &index) != 0) {
+    return STORE_KEY_NOT_FOUND;
+  }
+
+  // keep the array dense, the last fence moves into the slot so its index entry and name mapping are rewritten. Its new
+  // entry goes in first, so running out of memory leaves the index as it was.
+  Fence *fence = &geofences->fences[index];
+  uint32_t last = geofences->fences_count - 1;
+  Fence *moved = &geofences->fences[last];
+  if (index != last && rtree_insert(&geofences->index, &moved->rect, index) != 0) {
+    return STORE_OUT_OF_MEMORY;
+  }
+  if (rtree_remove(&geofences->index, &fence->rect, index) != 0) {
+    if (index != last) {
+      rtree_remove(&geofences->index, &moved->rect, index);
+    }
+    return STORE_OUT_OF_MEMORY;
+  }
+  if (index != last && rtree_remove(&geofences->index, &moved->rect, last) != 0) {
+    rtree_insert(&geofences->index, &fence->rect, index);
+    rtree_remove(&geofences->index, &moved->rect, index);
+    return STORE_OUT_OF_MEMORY;
+  }
+  hashmap_remove(&geofences->names, fence->name, fence->name_length);
+  destroy_fence(fence);
+
+  geofences->fences_count--;
+  if (index != last) {
+    geofences->fences[index] = *moved;
+    hashmap_put(&geofences->names, geofences->fences[index].name, geofences->fences[index].name_length, index);
+  }
+  return STORE_OK;
+}
+
+static bool fence_contains(const Fence *fence, const Point *p) {
+  if (fence->type == FENCE_NEARBY) {
+    return point_distance_meters(&fence->center, p) <= fence->radius;
+  }
+  return polygon_contains_point(&fence->polygon, p);
+}
+
+typedef struct {
+  const Geofences *geofences;
+  const char *key;
+  size_t key_length;
+  const char *id;
+  size_t id_length;
+  const Point *previous;
+  const Point *current;
+  bool previous_pass; // second search, around the previous position
+  detect_callback cb;
+  void *user_data;
+} DetectContext;
+
+static void emit(const DetectContext *ctx, const Fence *fence, DetectType type, const Point *p) {
+  DetectEvent event = {
+    .type = type,
+    .channel = { fence->name, fence->name_length },
+    .key = { ctx->key, ctx->key_length },
+    .id = { ctx->id, ctx->id_length },
+    .point = *p,
+  };
+  ctx->cb(&event, ctx->user_data);
+}
+
+static int detect_fence(uint32_t item, const Rect *rect, void *user_data) {
+  DetectContext *ctx = user_data;
+  const Fence *fence = &ctx->geofences->fences[item];
+  if (fence->key_length != ctx->key_length || memcmp(fence->key, ctx->key, ctx->key_length) != 0) {
+    return 0;
+  }
+
+  if (ctx->previous_pass) {
+    // fences around the current position were handled by the first pass, only exits are left.
+    if (ctx->current != NULL && ctx->current->x >= rect->min_x && ctx->current->x <= rect->max_x &&
+        ctx->current->y >= rect->min_y && ctx->current->y <= rect->max_y) {
+      return 0;
+    }
+    if (fence_contains(fence, ctx->previous)) {
+      emit(ctx, fence, DETECT_EXIT, ctx->current != NULL ? ctx->current : ctx->previous);
+    }
+    return 0;
+  }
+
+  bool was_inside = ctx->previous != NULL && fence_contains(fence, ctx->previous);
+  bool is_inside = fence_contains(fence, ctx->current);
+  DetectType type;
+  if (is_inside) {
+    type = was_inside ? DETECT_INSIDE : DETECT_ENTER;
+  } else {
+    type = was_inside ? DETECT_EXIT : DETECT_OUTSIDE;
+  }
+  emit(ctx, fence, type, ctx->current);
+  return 0;
+}
+
+void geofences_detect(const Geofences *geofences, const char *key, size_t key_length, const char *id, size_t id_length,
+                      const Point *previous, const Point *current, detect_callback cb, void *user_data) {
+  if (geofences->fences_count == 0 || cb == NULL) {
+    return;
+  }
+
+  DetectContext ctx = {
+    .geofences = geofences,
+    .key = key,
+    .key_length = key_length,
+    .id = id,
+    .id_length = id_length,
+    .previous = previous,
+    .current = current,
+    .cb = cb,
+    .user_data = user_data,
+  };
+
+  if (current != NULL) {
+    Rect r = point_rect(current);
+    rtree_search(&geofences->index, &r, detect_fence, &ctx);
+  }
+  if (previous != NULL) {
+    ctx.previous_pass = true;
+    Rect r = point_rect(previous);
+    rtree_search(&geofences->index, &r, detect_fence, &ctx);
+  }
+}
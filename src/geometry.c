@@ -1,5 +1,13 @@
 #include <math.h>
+#include <pthread.h>
 #include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DISTANCE_KERNELS_X86
+#endif
 
 #include "geometry.h"
 
@@ -7,7 +15,18 @@
 #define FLOATING_POINT_PRECISION 0.000001
 #endif
 
-int points_equal(Point *p1, Point *p2) {
+#define EARTH_RADIUS_METERS 6371008.8
+#define DEGREES_TO_RADIANS 0.017453292519943295
+#define PI_HIGH 3.141592653589793116 // pi split in two for an exact argument reduction
+#define PI_LOW 1.2246467991473532e-16
+#define DISTANCE_BLOCK_SIZE 64 // boxes `rect_distances_meters` measures per kernel call
+#define DISTANCE_QUERY_MARGIN 1e-9 // relative widening of the shortcut, so rounding never rejects a point on the circle
+
+/*
+ * returns 0 if the points are equal within FLOATING_POINT_PRECISION, else 1. A point with a z value is never equal to a
+ * point without one.
+ */
+int points_equal(const Point *p1, const Point *p2) {
   if (fabs(p1->x - p2->x) > FLOATING_POINT_PRECISION) {
     return 1;
   }
@@ -15,15 +34,508 @@ int points_equal(Point *p1, Point *p2) {
     return 1;
   }
 
-  if (p1->has_z && p2->has_z && (fabs(p1->y - p2->y) < FLOATING_POINT_PRECISION)) {
+  if (p1->has_z != p2->has_z) {
+    return 1;
+  }
+
+  if (p1->has_z && (fabs(p1->z - p2->z) > FLOATING_POINT_PRECISION)) {
+    return 1;
+  }
+
+  return 0;
+}
+
+int copy_geometry(Geometry *dst, const Geometry *src) {
+  *dst = *src;
+  if (src->type != GEOMETRY_LINE_STRING || src->line_string.points_count == 0) {
     return 0;
   }
 
-  return 1;
+  size_t size = sizeof(Point) * src->line_string.points_count;
+  dst->line_string.points = malloc(size);
+  if (dst->line_string.points == NULL) {
+    dst->line_string.points_count = 0;
+    return 1;
+  }
+  memcpy(dst->line_string.points, src->line_string.points, size);
+  return 0;
+}
+
+void free_geometry(Geometry *geometry) {
+  if (geometry->type == GEOMETRY_LINE_STRING) {
+    free(geometry->line_string.points);
+    geometry->line_string.points = NULL;
+    geometry->line_string.points_count = 0;
+  }
+}
+
+Rect point_rect(const Point *p) {
+  return (Rect){ .min_x = p->x, .min_y = p->y, .max_x = p->x, .max_y = p->y };
+}
+
+Rect line_string_rect(const LineString *ls) {
+  if (ls->points_count == 0) {
+    return (Rect){ 0 };
+  }
+
+  Rect r = point_rect(&ls->points[0]);
+  for (size_t i = 1; i < ls->points_count; i++) {
+    const Point *p = &ls->points[i];
+    if (p->x < r.min_x) r.min_x = p->x;
+    if (p->x > r.max_x) r.max_x = p->x;
+    if (p->y < r.min_y) r.min_y = p->y;
+    if (p->y > r.max_y) r.max_y = p->y;
+  }
+  return r;
+}
+
+Rect geometry_rect(const Geometry *g) {
+  if (g->type == GEOMETRY_POINT) {
+    return point_rect(&g->point);
+  }
+  return line_string_rect(&g->line_string);
+}
+
+bool rects_intersect(const Rect *a, const Rect *b) {
+  return a->min_x <= b->max_x && b->min_x <= a->max_x && a->min_y <= b->max_y && b->min_y <= a->max_y;
+}
+
+bool rect_contains(const Rect *outer, const Rect *inner) {
+  return outer->min_x <= inner->min_x && outer->min_y <= inner->min_y && outer->max_x >= inner->max_x &&
+         outer->max_y >= inner->max_y;
+}
+
+/*
+ * plain comparisons rather than fmin/fmax: those are libm calls (they have to handle NaN) and this runs dozens of
+ * times per index insert.
+ */
+Rect rects_union(const Rect *a, const Rect *b) {
+  return (Rect){
+    .min_x = a->min_x < b->min_x ? a->min_x : b->min_x,
+    .min_y = a->min_y < b->min_y ? a->min_y : b->min_y,
+    .max_x = a->max_x > b->max_x ? a->max_x : b->max_x,
+    .max_y = a->max_y > b->max_y ? a->max_y : b->max_y,
+  };
+}
+
+double rect_area(const Rect *r) {
+  return (r->max_x - r->min_x) * (r->max_y - r->min_y);
+}
+
+double point_distance_meters(const Point *a, const Point *b) {
+  double lat1 = a->y * DEGREES_TO_RADIANS;
+  double lat2 = b->y * DEGREES_TO_RADIANS;
+  double sin_dlat = sin((lat2 - lat1) / 2);
+  double sin_dlon = sin((b->x - a->x) * DEGREES_TO_RADIANS / 2);
+  double h = sin_dlat * sin_dlat + cos(lat1) * cos(lat2) * sin_dlon * sin_dlon;
+  if (h > 1) {
+    h = 1;
+  }
+  return 2 * EARTH_RADIUS_METERS * asin(sqrt(h));
+}
+
+/*
+ * the point of the box closest to (`x`, `y`) on the sphere, `tan_lat` the tangent of `y` in radians.
+ *
+ * longitudes are compared wrapped around, so a box across the antimeridian from the point is reached the short way.
+ * When the point's longitude is within the box, its closest point is straight north or south. Otherwise it is on the
+ * meridian of the box edge nearest in longitude, `dlon` away. Along that meridian the distance only shrinks towards
+ * the latitude of closest approach, atan(tan(y) / cos(dlon)), which is further from the equator than `y` itself: a
+ * box on the same side of the equator but closer to it is reached at its edge nearest the pole, not at the latitude
+ * clamped into it. Past 90 degrees of longitude the closest approach is beyond a pole and one end of the edge is
+ * closest.
+ */
+static void rect_closest_point(double x, double y, double tan_lat, double min_x, double min_y, double max_x,
+                               double max_y, double *closest_x, double *closest_y) {
+  double east = x - min_x; // how far east of the box's west edge the point is, in [0, 360)
+  east -= 360 * floor(east / 360);
+  double width = max_x - min_x;
+  if (east <= width) {
+    *closest_x = x;
+    *closest_y = y < min_y ? min_y : (y > max_y ? max_y : y);
+    return;
+  }
+
+  double dlon;
+  if (east - width <= 360 - east) {
+    *closest_x = max_x;
+    dlon = east - width;
+  } else {
+    *closest_x = min_x;
+    dlon = 360 - east;
+  }
+  if (min_y == max_y) { // a point, every leaf entry of a point collection
+    *closest_y = min_y;
+    return;
+  }
+  if (dlon >= 90) {
+    // the distance along the meridian then peaks inside [-90, 90], the closest point is whichever end is closer.
+    double lat = y * DEGREES_TO_RADIANS;
+    double cos_dlon = cos(dlon * DEGREES_TO_RADIANS);
+    double low = sin(lat) * sin(min_y * DEGREES_TO_RADIANS) + cos(lat) * cos(min_y * DEGREES_TO_RADIANS) * cos_dlon;
+    double high = sin(lat) * sin(max_y * DEGREES_TO_RADIANS) + cos(lat) * cos(max_y * DEGREES_TO_RADIANS) * cos_dlon;
+    *closest_y = high >= low ? max_y : min_y;
+    return;
+  }
+  // the closest approach is at least as far from the equator as the point, so no trig when the box is all closer.
+  if (y >= 0 && max_y <= y) {
+    *closest_y = max_y;
+  } else if (y <= 0 && min_y >= y) {
+    *closest_y = min_y;
+  } else {
+    double lat = atan(tan_lat / cos(dlon * DEGREES_TO_RADIANS)) / DEGREES_TO_RADIANS;
+    *closest_y = lat < min_y ? min_y : (lat > max_y ? max_y : lat);
+  }
+}
+
+double rect_distance_meters(const Point *p, const Rect *r) {
+  Point closest;
+  rect_closest_point(p->x, p->y, tan(p->y * DEGREES_TO_RADIANS), r->min_x, r->min_y, r->max_x, r->max_y, &closest.x,
+                     &closest.y);
+  return point_distance_meters(p, &closest);
+}
+
+/*
+ * how many degrees of latitude and longitude the circle of `max_distance` meters around latitude `lat` spans either
+ * way, widened a little so rounding never rejects a point on the circle. INFINITY when it is unbounded: the latitude
+ * when the circle is, the longitude also when it covers a pole.
+ */
+static void circle_deltas(double lat, double max_distance, double *lat_delta, double *lon_delta) {
+  *lat_delta = INFINITY;
+  *lon_delta = INFINITY;
+  if (!(max_distance < INFINITY) || !(fabs(lat) <= 90)) {
+    return;
+  }
+  // the circle spans `angle` of latitude either way, and as much longitude as its meridian tangents reach unless it
+  // covers a pole.
+  double angle = max_distance / EARTH_RADIUS_METERS * (1 + DISTANCE_QUERY_MARGIN) + DISTANCE_QUERY_MARGIN;
+  *lat_delta = angle / DEGREES_TO_RADIANS;
+  if (fabs(lat) + *lat_delta < 90) {
+    *lon_delta = asin(sin(angle) / cos(lat * DEGREES_TO_RADIANS)) / DEGREES_TO_RADIANS;
+  }
+}
+
+Rect circle_rect(const Point *center, double radius) {
+  double lat_delta;
+  double lon_delta;
+  circle_deltas(center->y, radius, &lat_delta, &lon_delta);
+  Rect rect = {
+    .min_x = center->x - lon_delta,
+    .min_y = fmax(center->y - lat_delta, -90),
+    .max_x = center->x + lon_delta,
+    .max_y = fmin(center->y + lat_delta, 90),
+  };
+  // points just across the antimeridian are 360 degrees of longitude away.
+  if (!(rect.min_x >= -180 && rect.max_x <= 180)) {
+    rect.min_x = -180;
+    rect.max_x = 180;
+  }
+  return rect;
 }
 
 /*
-void make_line_string(Point *points, size_t points_count) {
-  
+ * Taylor coefficients of sin(r) / r and cos(r) in powers of r^2, accurate to about 1e-16 over the reduced range
+ * [-pi/2, pi/2].
+ */
+static const double SIN_COEFFICIENTS[] = {
+  1.0 / 1, -1.0 / 6, 1.0 / 120, -1.0 / 5040, 1.0 / 362880, -1.0 / 39916800, 1.0 / 6227020800, -1.0 / 1307674368000,
+  1.0 / 355687428096000, -1.0 / 121645100408832000,
+};
+static const double COS_COEFFICIENTS[] = {
+  1.0 / 1, -1.0 / 2, 1.0 / 24, -1.0 / 720, 1.0 / 40320, -1.0 / 3628800, 1.0 / 479001600, -1.0 / 87178291200,
+  1.0 / 20922789888000, -1.0 / 6402373705728000, 1.0 / 2432902008176640000,
+};
+
+/*
+ * Taylor coefficients of (asin(u) - u) / u^3 in powers of u^2, used for u in [0, 1/2] where they are accurate to about
+ * 1e-12. Larger values go through asin(s) = pi/2 - 2 asin(sqrt((1 - s) / 2)).
+ */
+static const double ASIN_COEFFICIENTS[] = {
+  1.0 / 6, 3.0 / 40, 5.0 / 112, 35.0 / 1152, 63.0 / 2816, 231.0 / 13312, 143.0 / 10240, 6435.0 / 557056,
+  12155.0 / 1245184, 46189.0 / 5505024, 88179.0 / 12058624, 676039.0 / 104857600, 1300075.0 / 226492416,
+  5014575.0 / 973078528, 9694845.0 / 2080374784, 100180065.0 / 23622320128,
+};
+
+#define COEFFICIENTS_COUNT(c) (sizeof(c) / sizeof((c)[0]))
+
+/*
+ * true when the candidate is outside the box the query's circle fits in.
+ */
+static bool out_of_reach(const DistanceQuery *query, double x, double y) {
+  double dx = fabs(x - query->x);
+  dx = fabs(dx - 360 * nearbyint(dx / 360));
+  return fabs(y - query->y) > query->lat_delta || dx > query->lon_delta;
+}
+
+/*
+ * the reference formula of `point_distance_meters` with the query's half of it computed once.
+ */
+static void distances_scalar(const DistanceQuery *query, const double *xs, const double *ys, size_t count,
+                             double *distances) {
+  for (size_t i = 0; i < count; i++) {
+    if (out_of_reach(query, xs[i], ys[i])) {
+      distances[i] = INFINITY;
+      continue;
+    }
+    double lat = ys[i] * DEGREES_TO_RADIANS;
+    double sin_dlat = sin((lat - query->lat) / 2);
+    double sin_dlon = sin((xs[i] - query->x) * DEGREES_TO_RADIANS / 2);
+    double h = sin_dlat * sin_dlat + query->cos_lat * cos(lat) * sin_dlon * sin_dlon;
+    if (h > 1) {
+      h = 1;
+    }
+    distances[i] = 2 * EARTH_RADIUS_METERS * asin(sqrt(h));
+  }
+}
+
+#ifdef DISTANCE_KERNELS_X86
+
+__attribute__((target("avx2,fma"))) static inline __m256d polynomial_avx2(__m256d x, const double *c, size_t n) {
+  __m256d r = _mm256_set1_pd(c[n - 1]);
+  for (size_t i = n - 1; i-- > 0;) {
+    r = _mm256_fmadd_pd(r, x, _mm256_set1_pd(c[i]));
+  }
+  return r;
+}
+
+/*
+ * x - k pi, k the integer closest to x / pi, written into `k`.
+ */
+__attribute__((target("avx2,fma"))) static inline __m256d reduce_avx2(__m256d x, __m256d *k) {
+  *k = _mm256_round_pd(_mm256_mul_pd(x, _mm256_set1_pd(1 / M_PI)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+  __m256d r = _mm256_fnmadd_pd(*k, _mm256_set1_pd(PI_HIGH), x);
+  return _mm256_fnmadd_pd(*k, _mm256_set1_pd(PI_LOW), r);
+}
+
+/*
+ * sin(x)^2, which doesn't care about the sign flip of every odd multiple of pi the reduction removed.
+ */
+__attribute__((target("avx2,fma"))) static inline __m256d sin_squared_avx2(__m256d x) {
+  __m256d k;
+  __m256d r = reduce_avx2(x, &k);
+  __m256d sin = _mm256_mul_pd(r, polynomial_avx2(_mm256_mul_pd(r, r), SIN_COEFFICIENTS,
+                                                 COEFFICIENTS_COUNT(SIN_COEFFICIENTS)));
+  return _mm256_mul_pd(sin, sin);
+}
+
+__attribute__((target("avx2,fma"))) static inline __m256d cos_avx2(__m256d x) {
+  __m256d k;
+  __m256d r = reduce_avx2(x, &k);
+  __m256d cos = polynomial_avx2(_mm256_mul_pd(r, r), COS_COEFFICIENTS, COEFFICIENTS_COUNT(COS_COEFFICIENTS));
+  // an odd k flips the sign: its low bit moves to the sign bit.
+  __m256i odd = _mm256_slli_epi64(_mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(k)), 63);
+  return _mm256_xor_pd(cos, _mm256_castsi256_pd(odd));
+}
+
+/*
+ * asin(sqrt(h)) for h in [0, 1].
+ */
+__attribute__((target("avx2,fma"))) static inline __m256d asin_sqrt_avx2(__m256d h) {
+  __m256d s = _mm256_sqrt_pd(h);
+  __m256d large = _mm256_cmp_pd(s, _mm256_set1_pd(0.5), _CMP_GT_OQ);
+  __m256d z = _mm256_blendv_pd(h, _mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(1), s), _mm256_set1_pd(0.5)), large);
+  __m256d u = _mm256_blendv_pd(s, _mm256_sqrt_pd(z), large);
+  __m256d p = _mm256_fmadd_pd(_mm256_mul_pd(u, z),
+                              polynomial_avx2(z, ASIN_COEFFICIENTS, COEFFICIENTS_COUNT(ASIN_COEFFICIENTS)), u);
+  __m256d reflected = _mm256_fnmadd_pd(_mm256_set1_pd(2), p, _mm256_set1_pd(M_PI / 2));
+  return _mm256_blendv_pd(p, reflected, large);
+}
+
+__attribute__((target("avx2,fma"))) static void distances_avx2(const DistanceQuery *query, const double *xs,
+                                                                const double *ys, size_t count, double *distances) {
+  const __m256d sign = _mm256_set1_pd(-0.0);
+  const __m256d qx = _mm256_set1_pd(query->x);
+  const __m256d qy = _mm256_set1_pd(query->y);
+  const __m256d lat_delta = _mm256_set1_pd(query->lat_delta);
+  const __m256d lon_delta = _mm256_set1_pd(query->lon_delta);
+  const __m256d to_radians = _mm256_set1_pd(DEGREES_TO_RADIANS);
+  const __m256d qlat = _mm256_set1_pd(query->lat);
+  const __m256d half = _mm256_set1_pd(0.5);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m256d x = _mm256_loadu_pd(xs + i);
+    __m256d y = _mm256_loadu_pd(ys + i);
+    __m256d dx = _mm256_andnot_pd(sign, _mm256_sub_pd(x, qx));
+    __m256d turns =
+        _mm256_round_pd(_mm256_div_pd(dx, _mm256_set1_pd(360)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    dx = _mm256_andnot_pd(sign, _mm256_fnmadd_pd(turns, _mm256_set1_pd(360), dx));
+    __m256d out = _mm256_or_pd(_mm256_cmp_pd(_mm256_andnot_pd(sign, _mm256_sub_pd(y, qy)), lat_delta, _CMP_GT_OQ),
+                               _mm256_cmp_pd(dx, lon_delta, _CMP_GT_OQ));
+    if (_mm256_movemask_pd(out) == 0xf) {
+      _mm256_storeu_pd(distances + i, _mm256_set1_pd(INFINITY));
+      continue;
+    }
+    __m256d lat = _mm256_mul_pd(y, to_radians);
+    __m256d sin_dlat = sin_squared_avx2(_mm256_mul_pd(_mm256_sub_pd(lat, qlat), half));
+    __m256d sin_dlon = sin_squared_avx2(_mm256_mul_pd(_mm256_mul_pd(_mm256_sub_pd(x, qx), to_radians), half));
+    __m256d h = _mm256_fmadd_pd(_mm256_mul_pd(_mm256_set1_pd(query->cos_lat), cos_avx2(lat)), sin_dlon, sin_dlat);
+    h = _mm256_min_pd(h, _mm256_set1_pd(1));
+    __m256d d = _mm256_mul_pd(asin_sqrt_avx2(h), _mm256_set1_pd(2 * EARTH_RADIUS_METERS));
+    _mm256_storeu_pd(distances + i, _mm256_blendv_pd(d, _mm256_set1_pd(INFINITY), out));
+  }
+  distances_scalar(query, xs + i, ys + i, count - i, distances + i);
+}
+
+/*
+ * the same on 2 lanes, without FMA nor a rounding instruction: those are not part of SSE2.
+ */
+__attribute__((target("sse2"))) static inline __m128d polynomial_sse2(__m128d x, const double *c, size_t n) {
+  __m128d r = _mm_set1_pd(c[n - 1]);
+  for (size_t i = n - 1; i-- > 0;) {
+    r = _mm_add_pd(_mm_mul_pd(r, x), _mm_set1_pd(c[i]));
+  }
+  return r;
+}
+
+/*
+ * adding and subtracting 1.5 * 2^52 leaves no bits for a fraction, the addition rounds to the nearest integer.
+ */
+__attribute__((target("sse2"))) static inline __m128d round_sse2(__m128d x) {
+  const __m128d magic = _mm_set1_pd(6755399441055744.0);
+  return _mm_sub_pd(_mm_add_pd(x, magic), magic);
+}
+
+__attribute__((target("sse2"))) static inline __m128d reduce_sse2(__m128d x, __m128d *k) {
+  *k = round_sse2(_mm_mul_pd(x, _mm_set1_pd(1 / M_PI)));
+  __m128d r = _mm_sub_pd(x, _mm_mul_pd(*k, _mm_set1_pd(PI_HIGH)));
+  return _mm_sub_pd(r, _mm_mul_pd(*k, _mm_set1_pd(PI_LOW)));
+}
+
+__attribute__((target("sse2"))) static inline __m128d sin_squared_sse2(__m128d x) {
+  __m128d k;
+  __m128d r = reduce_sse2(x, &k);
+  __m128d sin =
+      _mm_mul_pd(r, polynomial_sse2(_mm_mul_pd(r, r), SIN_COEFFICIENTS, COEFFICIENTS_COUNT(SIN_COEFFICIENTS)));
+  return _mm_mul_pd(sin, sin);
+}
+
+__attribute__((target("sse2"))) static inline __m128d cos_sse2(__m128d x) {
+  __m128d k;
+  __m128d r = reduce_sse2(x, &k);
+  __m128d cos = polynomial_sse2(_mm_mul_pd(r, r), COS_COEFFICIENTS, COEFFICIENTS_COUNT(COS_COEFFICIENTS));
+  // both int32 of k doubled up into 64 bit lanes, the low bit of the high copy shifted into the sign bit.
+  __m128i odd = _mm_slli_epi64(_mm_shuffle_epi32(_mm_cvtpd_epi32(k), _MM_SHUFFLE(1, 1, 0, 0)), 63);
+  return _mm_xor_pd(cos, _mm_castsi128_pd(odd));
+}
+
+__attribute__((target("sse2"))) static inline __m128d select_sse2(__m128d mask, __m128d a, __m128d b) {
+  return _mm_or_pd(_mm_and_pd(mask, b), _mm_andnot_pd(mask, a));
+}
+
+__attribute__((target("sse2"))) static inline __m128d asin_sqrt_sse2(__m128d h) {
+  __m128d s = _mm_sqrt_pd(h);
+  __m128d large = _mm_cmpgt_pd(s, _mm_set1_pd(0.5));
+  __m128d z = select_sse2(large, h, _mm_mul_pd(_mm_sub_pd(_mm_set1_pd(1), s), _mm_set1_pd(0.5)));
+  __m128d u = select_sse2(large, s, _mm_sqrt_pd(z));
+  __m128d p = _mm_add_pd(_mm_mul_pd(_mm_mul_pd(u, z),
+                                    polynomial_sse2(z, ASIN_COEFFICIENTS, COEFFICIENTS_COUNT(ASIN_COEFFICIENTS))),
+                         u);
+  __m128d reflected = _mm_sub_pd(_mm_set1_pd(M_PI / 2), _mm_mul_pd(_mm_set1_pd(2), p));
+  return select_sse2(large, p, reflected);
+}
+
+__attribute__((target("sse2"))) static void distances_sse2(const DistanceQuery *query, const double *xs,
+                                                            const double *ys, size_t count, double *distances) {
+  const __m128d sign = _mm_set1_pd(-0.0);
+  const __m128d qx = _mm_set1_pd(query->x);
+  const __m128d qy = _mm_set1_pd(query->y);
+  const __m128d lat_delta = _mm_set1_pd(query->lat_delta);
+  const __m128d lon_delta = _mm_set1_pd(query->lon_delta);
+  const __m128d to_radians = _mm_set1_pd(DEGREES_TO_RADIANS);
+  const __m128d qlat = _mm_set1_pd(query->lat);
+  const __m128d half = _mm_set1_pd(0.5);
+  size_t i = 0;
+  for (; i + 2 <= count; i += 2) {
+    __m128d x = _mm_loadu_pd(xs + i);
+    __m128d y = _mm_loadu_pd(ys + i);
+    __m128d dx = _mm_andnot_pd(sign, _mm_sub_pd(x, qx));
+    __m128d turns = round_sse2(_mm_div_pd(dx, _mm_set1_pd(360)));
+    dx = _mm_andnot_pd(sign, _mm_sub_pd(dx, _mm_mul_pd(turns, _mm_set1_pd(360))));
+    __m128d out = _mm_or_pd(_mm_cmpgt_pd(_mm_andnot_pd(sign, _mm_sub_pd(y, qy)), lat_delta),
+                            _mm_cmpgt_pd(dx, lon_delta));
+    if (_mm_movemask_pd(out) == 0x3) {
+      _mm_storeu_pd(distances + i, _mm_set1_pd(INFINITY));
+      continue;
+    }
+    __m128d lat = _mm_mul_pd(y, to_radians);
+    __m128d sin_dlat = sin_squared_sse2(_mm_mul_pd(_mm_sub_pd(lat, qlat), half));
+    __m128d sin_dlon = sin_squared_sse2(_mm_mul_pd(_mm_mul_pd(_mm_sub_pd(x, qx), to_radians), half));
+    __m128d h = _mm_add_pd(_mm_mul_pd(_mm_mul_pd(_mm_set1_pd(query->cos_lat), cos_sse2(lat)), sin_dlon), sin_dlat);
+    h = _mm_min_pd(h, _mm_set1_pd(1));
+    __m128d d = _mm_mul_pd(asin_sqrt_sse2(h), _mm_set1_pd(2 * EARTH_RADIUS_METERS));
+    _mm_storeu_pd(distances + i, select_sse2(out, d, _mm_set1_pd(INFINITY)));
+  }
+  distances_scalar(query, xs + i, ys + i, count - i, distances + i);
+}
+
+#endif
+
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+static distance_kernel selected_kernel = distances_scalar;
+static const char *selected_kernel_name = "scalar";
+
+static void select_kernel(void) {
+#ifdef DISTANCE_KERNELS_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    selected_kernel = distances_avx2;
+    selected_kernel_name = "avx2";
+  } else if (__builtin_cpu_supports("sse2")) {
+    selected_kernel = distances_sse2;
+    selected_kernel_name = "sse2";
+  }
+#endif
+}
+
+distance_kernel distance_kernel_by_name(const char *name) {
+  if (strcmp(name, "scalar") == 0) {
+    return distances_scalar;
+  }
+#ifdef DISTANCE_KERNELS_X86
+  __builtin_cpu_init();
+  if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return distances_avx2;
+  }
+  if (strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2")) {
+    return distances_sse2;
+  }
+#endif
+  return NULL;
+}
+
+const char *distance_kernel_name(void) {
+  pthread_once(&kernel_once, select_kernel);
+  return selected_kernel_name;
+}
+
+void init_distance_query(DistanceQuery *query, const Point *p, double max_distance) {
+  pthread_once(&kernel_once, select_kernel);
+  *query = (DistanceQuery){
+    .x = p->x,
+    .y = p->y,
+    .lat = p->y * DEGREES_TO_RADIANS,
+    .cos_lat = cos(p->y * DEGREES_TO_RADIANS),
+    .tan_lat = tan(p->y * DEGREES_TO_RADIANS),
+    .kernel = selected_kernel,
+  };
+  circle_deltas(p->y, max_distance, &query->lat_delta, &query->lon_delta);
+}
+
+void point_distances_meters(const DistanceQuery *query, const double *xs, const double *ys, size_t count,
+                            double *distances) {
+  query->kernel(query, xs, ys, count, distances);
+}
+
+void rect_distances_meters(const DistanceQuery *query, const double *min_x, const double *min_y, const double *max_x,
+                           const double *max_y, size_t count, double *distances) {
+  double xs[DISTANCE_BLOCK_SIZE];
+  double ys[DISTANCE_BLOCK_SIZE];
+  for (size_t start = 0; start < count; start += DISTANCE_BLOCK_SIZE) {
+    size_t n = count - start < DISTANCE_BLOCK_SIZE ? count - start : DISTANCE_BLOCK_SIZE;
+    for (size_t i = 0; i < n; i++) {
+      rect_closest_point(query->x, query->y, query->tan_lat, min_x[start + i], min_y[start + i], max_x[start + i],
+                         max_y[start + i], &xs[i], &ys[i]);
+    }
+    query->kernel(query, xs, ys, n, distances + start);
+  }
 }
-*/
@@ -0,0 +1,170 @@
+#include "hashmap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define HASHMAP_MIN_CAPACITY 16
+
+/*
+ * 8 bytes per multiply, then a murmur3 style finalizer: the low bits pick the group and the top 7 bits are the tag, so
+ * both ends of the hash have to be well mixed.
+ */
+uint64_t hash_bytes(const char *bytes, size_t length) {
+  uint64_t hash = 0x9e3779b97f4a7c15ULL ^ length;
+  size_t i = 0;
+  for (; i + 8 <= length; i += 8) {
+    uint64_t word;
+    memcpy(&word, bytes + i, sizeof(word));
+    hash = (hash ^ word) * 0x9fb21c651e98df25ULL;
+    hash ^= hash >> 29;
+  }
+  uint64_t tail = 0;
+  memcpy(&tail, bytes + i, length - i);
+  hash = (hash ^ tail) * 0x9fb21c651e98df25ULL;
+
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+static size_t round_up_pow2(size_t n) {
+  size_t cap = HASHMAP_MIN_CAPACITY;
+  while (cap < n) {
+    cap <<= 1;
+  }
+  return cap;
+}
+
+/*
+ * tables are rebuilt once 7/8 of the slots have been used.
+ */
+static size_t max_load(size_t capacity) {
+  return capacity - capacity / 8;
+}
+
+static int allocate_table(HashMap *map, size_t capacity) {
+  uint8_t *control = malloc(capacity);
+  HashMapEntry *entries = malloc(sizeof(HashMapEntry) * capacity);
+  if (control == NULL || entries == NULL) {
+    free(control);
+    free(entries);
+    return 1;
+  }
+  memset(control, SWISS_EMPTY, capacity);
+  map->control = control;
+  map->entries = entries;
+  map->capacity = capacity;
+  map->growth_left = max_load(capacity) - map->count;
+  return 0;
+}
+
+int init_hashmap(HashMap *map, size_t initial_capacity) {
+  *map = (HashMap){ 0 };
+  return allocate_table(map, round_up_pow2(initial_capacity));
+}
+
+void destroy_hashmap(HashMap *map) {
+  free(map->control);
+  free(map->entries);
+  *map = (HashMap){ 0 };
+}
+
+/*
+ * returns the slot holding the key, or SIZE_MAX.
+ */
+static size_t find_slot(const HashMap *map, const char *key, size_t key_length, uint64_t hash) {
+  uint8_t tag = swiss_tag(hash);
+  size_t groups_mask = map->capacity / SWISS_GROUP_WIDTH - 1;
+  for (size_t g = hash & groups_mask, step = 1;; g = (g + step++) & groups_mask) {
+    const uint8_t *group = map->control + g * SWISS_GROUP_WIDTH;
+    for (uint32_t matches = swiss_match(group, tag); matches != 0; matches &= matches - 1) {
+      size_t slot = g * SWISS_GROUP_WIDTH + (size_t)__builtin_ctz(matches);
+      const HashMapEntry *e = &map->entries[slot];
+      if (e->key_length == key_length && memcmp(e->key, key, key_length) == 0) {
+        return slot;
+      }
+    }
+    if (swiss_match(group, SWISS_EMPTY) != 0) {
+      return SIZE_MAX;
+    }
+  }
+}
+
+/*
+ * moves every entry into a fresh table of `capacity` slots, which also drops the tombstones.
+ */
+static int rebuild(HashMap *map, size_t capacity) {
+  uint8_t *old_control = map->control;
+  HashMapEntry *old_entries = map->entries;
+  size_t old_capacity = map->capacity;
+  if (allocate_table(map, capacity) != 0) {
+    return 1;
+  }
+
+  for (size_t i = 0; i < old_capacity; i++) {
+    if (old_control[i] & SWISS_EMPTY) {
+      continue;
+    }
+    size_t slot = swiss_find_free(map->control, map->capacity, hash_bytes(old_entries[i].key, old_entries[i].key_length));
+    map->control[slot] = old_control[i];
+    map->entries[slot] = old_entries[i];
+  }
+  free(old_control);
+  free(old_entries);
+  return 0;
+}
+
+int hashmap_get(const HashMap *map, const char *key, size_t key_length, uint32_t *value) {
+  if (map->count == 0) {
+    return 1;
+  }
+  size_t slot = find_slot(map, key, key_length, hash_bytes(key, key_length));
+  if (slot == SIZE_MAX) {
+    return 1;
+  }
+  *value = map->entries[slot].value;
+  return 0;
+}
+
+int hashmap_put(HashMap *map, const char *key, size_t key_length, uint32_t value) {
+  uint64_t hash = hash_bytes(key, key_length);
+  size_t slot = find_slot(map, key, key_length, hash);
+  if (slot != SIZE_MAX) {
+    map->entries[slot] = (HashMapEntry){ .key = key, .key_length = key_length, .value = value };
+    return 0;
+  }
+
+  slot = swiss_find_free(map->control, map->capacity, hash);
+  if (map->control[slot] == SWISS_EMPTY && map->growth_left == 0) {
+    // mostly tombstones: rebuilding at the same size is enough.
+    size_t capacity = map->count >= map->capacity * 7 / 16 ? map->capacity * 2 : map->capacity;
+    if (rebuild(map, capacity) != 0) {
+      return 1;
+    }
+    slot = swiss_find_free(map->control, map->capacity, hash);
+  }
+
+  if (map->control[slot] == SWISS_EMPTY) {
+    map->growth_left--;
+  }
+  map->control[slot] = swiss_tag(hash);
+  map->entries[slot] = (HashMapEntry){ .key = key, .key_length = key_length, .value = value };
+  map->count++;
+  return 0;
+}
+
+int hashmap_remove(HashMap *map, const char *key, size_t key_length) {
+  if (map->count == 0) {
+    return 1;
+  }
+  size_t slot = find_slot(map, key, key_length, hash_bytes(key, key_length));
+  if (slot == SIZE_MAX) {
+    return 1;
+  }
+  swiss_erase(map->control, slot, &map->growth_left);
+  map->count--;
+  return 0;
+}
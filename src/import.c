@@ -0,0 +1,1027 @@
+#include "import.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "number.h"
+
+#define SPAN_IS(span, literal) \
+  ((span).length == sizeof(literal) - 1 && memcmp((span).start, literal, (span).length) == 0)
+#define CSV_NO_COLUMN SIZE_MAX
+
+/*
+ * one feature or row as parsed. Its points and fields are runs of the arrays of its chunk, referenced by offset as
+ * those grow while the chunk is parsed.
+ */
+typedef struct {
+  Span id; // NULL start when the record has none
+  bool skipped; // no geometry the collection can hold
+  GeometryType type;
+  uint32_t points_offset;
+  uint32_t points_count;
+  uint32_t fields_offset;
+  uint32_t fields_count;
+} ImportRecord;
+
+typedef struct {
+  const char *start;
+  const char *stop; // parsing stops at the first record starting at or after it
+  const char *next; // set by parsing: the start of the first record left to the next chunk
+  bool last; // set by parsing: no record follows
+  int result; // StoreResult of parsing
+  const char *error; // where parsing failed
+  ImportRecord *records;
+  size_t records_count;
+  size_t records_capacity;
+  Point *points;
+  size_t points_count;
+  size_t points_capacity;
+  FieldValue *fields;
+  size_t fields_count;
+  size_t fields_capacity;
+  Arena strings; // ids and names that had escapes, unescaped
+} ImportChunk;
+
+/*
+ * the columns of a CSV file, by index.
+ */
+typedef struct {
+  Span *names;
+  size_t count;
+  size_t id;
+  size_t x;
+  size_t y;
+  size_t z;
+} CsvHeader;
+
+typedef struct {
+  ImportFormat format;
+  const char *end; // of the file
+  const CsvHeader *header;
+  ImportChunk *chunks;
+} ImportJob;
+
+typedef struct {
+  const char *p;
+  const char *end;
+} Cursor;
+
+ImportFormat import_format_for_path(const char *path) {
+  size_t length = strlen(path);
+  return length >= 4 && strncmpci(path + length - 4, ".csv", 4) == 0 ? IMPORT_CSV : IMPORT_GEOJSON;
+}
+
+/*
+ * makes room for `count` elements in `*array`. returns 0 on success, else 1 (out of memory).
+ */
+static int reserve(void **array, size_t *capacity, size_t count, size_t element_size) {
+  if (count <= *capacity) {
+    return 0;
+  }
+  size_t grown = *capacity == 0 ? 256 : *capacity * 2;
+  while (grown < count) {
+    grown *= 2;
+  }
+  void *resized = realloc(*array, grown * element_size);
+  if (resized == NULL) {
+    return 1;
+  }
+  *array = resized;
+  *capacity = grown;
+  return 0;
+}
+
+static int add_point(ImportChunk *chunk, const Point *point) {
+  if (reserve((void **)&chunk->points, &chunk->points_capacity, chunk->points_count + 1, sizeof(Point)) != 0) {
+    return STORE_OUT_OF_MEMORY;
+  }
+  chunk->points[chunk->points_count++] = *point;
+  return STORE_OK;
+}
+
+static int add_field(ImportChunk *chunk, Span name, double value) {
+  if (reserve((void **)&chunk->fields, &chunk->fields_capacity, chunk->fields_count + 1, sizeof(FieldValue)) != 0) {
+    return STORE_OUT_OF_MEMORY;
+  }
+  chunk->fields[chunk->fields_count++] = (FieldValue){ .name = name, .value = value };
+  return STORE_OK;
+}
+
+static int add_record(ImportChunk *chunk, const ImportRecord *record) {
+  if (reserve((void **)&chunk->records, &chunk->records_capacity, chunk->records_count + 1, sizeof(ImportRecord)) !=
+      0) {
+    return STORE_OUT_OF_MEMORY;
+  }
+  chunk->records[chunk->records_count++] = *record;
+  return STORE_OK;
+}
+
+static void skip_whitespace(Cursor *c) {
+  while (c->p < c->end && (*c->p == ' ' || *c->p == '\n' || *c->p == '\r' || *c->p == '\t')) {
+    c->p++;
+  }
+}
+
+/*
+ * skips whitespace, then consumes `expected` if it is next. returns whether it was.
+ */
+static bool consume(Cursor *c, char expected) {
+  skip_whitespace(c);
+  if (c->p < c->end && *c->p == expected) {
+    c->p++;
+    return true;
+  }
+  return false;
+}
+
+static bool peek(Cursor *c, char expected) {
+  skip_whitespace(c);
+  return c->p < c->end && *c->p == expected;
+}
+
+static int hex_digit(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+static bool read_hex4(const char *p, const char *end, uint32_t *value) {
+  if (end - p < 4) {
+    return false;
+  }
+  *value = 0;
+  for (int i = 0; i < 4; i++) {
+    int digit = hex_digit(p[i]);
+    if (digit < 0) {
+      return false;
+    }
+    *value = *value << 4 | (uint32_t)digit;
+  }
+  return true;
+}
+
+static char *append_utf8(char *out, uint32_t code_point) {
+  if (code_point < 0x80) {
+    *out++ = (char)code_point;
+  } else if (code_point < 0x800) {
+    *out++ = (char)(0xc0 | code_point >> 6);
+    *out++ = (char)(0x80 | (code_point & 0x3f));
+  } else if (code_point < 0x10000) {
+    *out++ = (char)(0xe0 | code_point >> 12);
+    *out++ = (char)(0x80 | (code_point >> 6 & 0x3f));
+    *out++ = (char)(0x80 | (code_point & 0x3f));
+  } else {
+    *out++ = (char)(0xf0 | code_point >> 18);
+    *out++ = (char)(0x80 | (code_point >> 12 & 0x3f));
+    *out++ = (char)(0x80 | (code_point >> 6 & 0x3f));
+    *out++ = (char)(0x80 | (code_point & 0x3f));
+  }
+  return out;
+}
+
+/*
+ * reads the string at the cursor into `string`: a span of the file when it has no escape, else a copy unescaped into
+ * `arena` (never longer than the escaped text). returns a StoreResult.
+ */
+static int read_string(Cursor *c, Arena *arena, Span *string) {
+  if (!consume(c, '"')) {
+    return STORE_INVALID_IMPORT;
+  }
+  const char *start = c->p;
+  const char *q = start;
+  while (q < c->end && *q != '"' && *q != '\\') {
+    q++;
+  }
+  if (q < c->end && *q == '"') {
+    *string = (Span){ .start = start, .length = (size_t)(q - start) };
+    c->p = q + 1;
+    return STORE_OK;
+  }
+  const char *close = q;
+  while (close < c->end && *close != '"') {
+    close += *close == '\\' ? 2 : 1;
+  }
+  if (close >= c->end) {
+    return STORE_INVALID_IMPORT;
+  }
+  char *copy = arena_alloc(arena, (size_t)(close - start) + 1);
+  if (copy == NULL) {
+    return STORE_OUT_OF_MEMORY;
+  }
+  char *out = copy;
+  for (const char *p = start; p < close;) {
+    if (*p != '\\') {
+      *out++ = *p++;
+      continue;
+    }
+    p++;
+    switch (*p++) {
+      case '"': *out++ = '"'; break;
+      case '\\': *out++ = '\\'; break;
+      case '/': *out++ = '/'; break;
+      case 'b': *out++ = '\b'; break;
+      case 'f': *out++ = '\f'; break;
+      case 'n': *out++ = '\n'; break;
+      case 'r': *out++ = '\r'; break;
+      case 't': *out++ = '\t'; break;
+      case 'u': {
+        uint32_t code_point;
+        if (!read_hex4(p, close, &code_point)) {
+          return STORE_INVALID_IMPORT;
+        }
+        p += 4;
+        uint32_t low;
+        // a high surrogate followed by a low one is a single code point, a lone one is kept as it is.
+        if (code_point >= 0xd800 && code_point < 0xdc00 && close - p >= 6 && p[0] == '\\' && p[1] == 'u' &&
+            read_hex4(p + 2, close, &low) && low >= 0xdc00 && low < 0xe000) {
+          code_point = 0x10000 + ((code_point - 0xd800) << 10) + (low - 0xdc00);
+          p += 6;
+        }
+        out = append_utf8(out, code_point);
+        break;
+      }
+      default: return STORE_INVALID_IMPORT;
+    }
+  }
+  *string = (Span){ .start = copy, .length = (size_t)(out - copy) };
+  c->p = close + 1;
+  return STORE_OK;
+}
+
+static bool number_character(char c) {
+  return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+}
+
+/*
+ * the text of the number at the cursor, empty when there is none.
+ */
+static Span number_token(Cursor *c) {
+  skip_whitespace(c);
+  const char *start = c->p;
+  while (c->p < c->end && number_character(*c->p)) {
+    c->p++;
+  }
+  return (Span){ .start = start, .length = (size_t)(c->p - start) };
+}
+
+static int read_number(Cursor *c, double *value) {
+  Span token = number_token(c);
+  return token.length > 0 && parse_double(token.start, token.length, value) == 0 ? STORE_OK : STORE_INVALID_IMPORT;
+}
+
+static bool starts_number(Cursor *c) {
+  skip_whitespace(c);
+  return c->p < c->end && ((*c->p >= '0' && *c->p <= '9') || *c->p == '-');
+}
+
+/*
+ * skips the value at the cursor. Objects and arrays are only matched bracket for bracket, strings aside, not checked.
+ */
+static int skip_value(Cursor *c) {
+  skip_whitespace(c);
+  if (c->p >= c->end) {
+    return STORE_INVALID_IMPORT;
+  }
+  if (*c->p != '{' && *c->p != '[' && *c->p != '"') {
+    const char *start = c->p;
+    while (c->p < c->end && (isalnum((unsigned char)*c->p) || number_character(*c->p))) {
+      c->p++;
+    }
+    return c->p > start ? STORE_OK : STORE_INVALID_IMPORT;
+  }
+  size_t depth = 0;
+  while (c->p < c->end) {
+    char ch = *c->p++;
+    if (ch == '"') {
+      while (c->p < c->end && *c->p != '"') {
+        c->p += *c->p == '\\' ? 2 : 1;
+      }
+      if (c->p >= c->end) {
+        return STORE_INVALID_IMPORT;
+      }
+      c->p++;
+    } else if (ch == '{' || ch == '[') {
+      depth++;
+    } else if (ch == '}' || ch == ']') {
+      depth--;
+    }
+    if (depth == 0) {
+      return STORE_OK;
+    }
+  }
+  return STORE_INVALID_IMPORT;
+}
+
+/*
+ * [x, y] or [x, y, z], further coordinates are ignored.
+ */
+static int read_position(Cursor *c, Point *point) {
+  *point = (Point){ 0 };
+  if (!consume(c, '[') || read_number(c, &point->x) != STORE_OK || !consume(c, ',') ||
+      read_number(c, &point->y) != STORE_OK) {
+    return STORE_INVALID_IMPORT;
+  }
+  if (consume(c, ',')) {
+    if (read_number(c, &point->z) != STORE_OK) {
+      return STORE_INVALID_IMPORT;
+    }
+    point->has_z = true;
+    while (consume(c, ',')) {
+      if (skip_value(c) != STORE_OK) {
+        return STORE_INVALID_IMPORT;
+      }
+    }
+  }
+  return consume(c, ']') ? STORE_OK : STORE_INVALID_IMPORT;
+}
+
+/*
+ * the outer ring of the polygon coordinates at the cursor, appended to the points of `chunk`.
+ */
+static int read_outer_ring(Cursor *c, ImportChunk *chunk, ImportRecord *record) {
+  if (!consume(c, '[') || !consume(c, '[')) {
+    return STORE_INVALID_IMPORT;
+  }
+  record->points_offset = (uint32_t)chunk->points_count;
+  do {
+    Point point;
+    int rc = read_position(c, &point);
+    if (rc == STORE_OK) {
+      rc = add_point(chunk, &point);
+    }
+    if (rc != STORE_OK) {
+      return rc;
+    }
+  } while (consume(c, ','));
+  if (!consume(c, ']')) {
+    return STORE_INVALID_IMPORT;
+  }
+  record->points_count = (uint32_t)(chunk->points_count - record->points_offset);
+  const Point *first = &chunk->points[record->points_offset];
+  const Point *last = &chunk->points[chunk->points_count - 1];
+  // the same rings SET BOUNDS accepts.
+  return record->points_count >= 4 && points_equal(first, last) == 0 ? STORE_OK : STORE_INVALID_IMPORT;
+}
+
+/*
+ * the geometry object at the cursor. Its members may come in any order, so the coordinates are only read once its type
+ * is known. A geometry the collection can't hold leaves `record` skipped.
+ */
+static int read_geometry(Cursor *c, ImportChunk *chunk, ImportRecord *record) {
+  if (!peek(c, '{')) {
+    return skip_value(c); // null
+  }
+  c->p++;
+  Span type = { 0 };
+  const char *coordinates = NULL;
+  if (!peek(c, '}')) {
+    do {
+      Span name;
+      int rc = read_string(c, &chunk->strings, &name);
+      if (rc != STORE_OK) {
+        return rc;
+      }
+      if (!consume(c, ':')) {
+        return STORE_INVALID_IMPORT;
+      }
+      if (SPAN_IS(name, "type") && peek(c, '"')) {
+        rc = read_string(c, &chunk->strings, &type);
+      } else {
+        if (SPAN_IS(name, "coordinates")) {
+          skip_whitespace(c);
+          coordinates = c->p;
+        }
+        rc = skip_value(c);
+      }
+      if (rc != STORE_OK) {
+        return rc;
+      }
+    } while (consume(c, ','));
+  }
+  if (!consume(c, '}')) {
+    return STORE_INVALID_IMPORT;
+  }
+  if (coordinates == NULL) {
+    return STORE_OK;
+  }
+
+  Cursor k = { .p = coordinates, .end = c->end };
+  size_t points_mark = chunk->points_count;
+  int rc = STORE_INVALID_IMPORT;
+  if (SPAN_IS(type, "Point")) {
+    Point point;
+    rc = read_position(&k, &point);
+    if (rc == STORE_OK) {
+      record->points_offset = (uint32_t)chunk->points_count;
+      record->points_count = 1;
+      rc = add_point(chunk, &point);
+    }
+    record->type = GEOMETRY_POINT;
+  } else if (SPAN_IS(type, "Polygon")) {
+    rc = read_outer_ring(&k, chunk, record);
+    record->type = GEOMETRY_LINE_STRING;
+  }
+  if (rc == STORE_OUT_OF_MEMORY) {
+    return rc;
+  }
+  // the value is well formed, only its coordinates are not what a point or a ring needs.
+  record->skipped = rc != STORE_OK;
+  if (record->skipped) {
+    chunk->points_count = points_mark;
+  }
+  return STORE_OK;
+}
+
+/*
+ * numeric properties become fields, the others are skipped.
+ */
+static int read_properties(Cursor *c, ImportChunk *chunk) {
+  if (!consume(c, '{')) {
+    return skip_value(c); // null
+  }
+  if (consume(c, '}')) {
+    return STORE_OK;
+  }
+  do {
+    Span name;
+    int rc = read_string(c, &chunk->strings, &name);
+    if (rc != STORE_OK) {
+      return rc;
+    }
+    if (!consume(c, ':')) {
+      return STORE_INVALID_IMPORT;
+    }
+    double value;
+    if (starts_number(c)) {
+      rc = read_number(c, &value);
+      if (rc == STORE_OK) {
+        rc = add_field(chunk, name, value);
+      }
+    } else {
+      rc = skip_value(c);
+    }
+    if (rc != STORE_OK) {
+      return rc;
+    }
+  } while (consume(c, ','));
+  return consume(c, '}') ? STORE_OK : STORE_INVALID_IMPORT;
+}
+
+static int read_feature(Cursor *c, ImportChunk *chunk) {
+  ImportRecord record = { .skipped = true, .fields_offset = (uint32_t)chunk->fields_count };
+  size_t points_mark = chunk->points_count;
+  if (!consume(c, '{')) {
+    return STORE_INVALID_IMPORT;
+  }
+  if (!peek(c, '}')) {
+    do {
+      Span name;
+      int rc = read_string(c, &chunk->strings, &name);
+      if (rc != STORE_OK) {
+        return rc;
+      }
+      if (!consume(c, ':')) {
+        return STORE_INVALID_IMPORT;
+      }
+      if (SPAN_IS(name, "geometry")) {
+        rc = read_geometry(c, chunk, &record);
+      } else if (SPAN_IS(name, "properties")) {
+        rc = read_properties(c, chunk);
+      } else if (SPAN_IS(name, "id") && peek(c, '"')) {
+        rc = read_string(c, &chunk->strings, &record.id);
+      } else if (SPAN_IS(name, "id") && starts_number(c)) {
+        record.id = number_token(c);
+      } else {
+        rc = skip_value(c);
+      }
+      if (rc != STORE_OK) {
+        return rc;
+      }
+    } while (consume(c, ','));
+  }
+  if (!consume(c, '}')) {
+    return STORE_INVALID_IMPORT;
+  }
+  if (record.skipped) {
+    chunk->points_count = points_mark;
+    chunk->fields_count = record.fields_offset;
+  }
+  record.fields_count = (uint32_t)(chunk->fields_count - record.fields_offset);
+  return add_record(chunk, &record);
+}
+
+/*
+ * reads features up to the end of the features array, or up to the first one starting at or after `stop`.
+ */
+static void parse_geojson_chunk(ImportChunk *chunk, const char *end) {
+  Cursor c = { .p = chunk->start, .end = end };
+  for (;;) {
+    if (peek(&c, ']')) {
+      chunk->last = true;
+      break;
+    }
+    if (c.p >= chunk->stop) {
+      break;
+    }
+    chunk->result = read_feature(&c, chunk);
+    if (chunk->result == STORE_OK && !consume(&c, ',') && !peek(&c, ']')) {
+      chunk->result = STORE_INVALID_IMPORT;
+    }
+    if (chunk->result != STORE_OK) {
+      chunk->error = c.p;
+      return;
+    }
+  }
+  chunk->next = c.p;
+}
+
+/*
+ * the first feature of the FeatureCollection, or the `]` of an empty one. NULL when there is no features array.
+ */
+static const char *first_feature(Cursor *c, Arena *arena) {
+  if (!consume(c, '{')) {
+    return NULL;
+  }
+  do {
+    Span name;
+    if (read_string(c, arena, &name) != STORE_OK || !consume(c, ':')) {
+      return NULL;
+    }
+    if (SPAN_IS(name, "features")) {
+      if (!consume(c, '[')) {
+        return NULL;
+      }
+      skip_whitespace(c);
+      return c->p;
+    }
+    if (skip_value(c) != STORE_OK) {
+      return NULL;
+    }
+  } while (consume(c, ','));
+  return NULL;
+}
+
+/*
+ * where a chunk starting after `from` likely starts: the `{` of the first `}` `,` `{` at or after it, the usual
+ * separation of two features. The end of the file when there is none.
+ */
+static const char *guess_feature(const char *from, const char *end) {
+  const char *p = from;
+  while (p < end && (p = memchr(p, '}', (size_t)(end - p))) != NULL) {
+    Cursor c = { .p = p + 1, .end = end };
+    if (consume(&c, ',') && peek(&c, '{')) {
+      return c.p;
+    }
+    p++;
+  }
+  return end;
+}
+
+/*
+ * the cell at `*p` in the line ending at `line_end`, moving `*p` past its comma. A quoted cell with doubled quotes is
+ * unquoted into `arena`. returns a StoreResult.
+ */
+static int read_cell(const char **p, const char *line_end, Arena *arena, Span *cell) {
+  const char *start = *p;
+  if (start < line_end && *start == '"') {
+    const char *q = start + 1;
+    bool doubled = false;
+    for (;;) {
+      q = memchr(q, '"', (size_t)(line_end - q));
+      if (q == NULL) {
+        return STORE_INVALID_IMPORT;
+      }
+      if (q + 1 < line_end && q[1] == '"') {
+        doubled = true;
+        q += 2;
+        continue;
+      }
+      break;
+    }
+    *cell = (Span){ .start = start + 1, .length = (size_t)(q - start - 1) };
+    if (doubled) {
+      char *copy = arena_alloc(arena, cell->length);
+      if (copy == NULL) {
+        return STORE_OUT_OF_MEMORY;
+      }
+      size_t n = 0;
+      for (size_t i = 0; i < cell->length; i++) {
+        copy[n++] = cell->start[i];
+        i += cell->start[i] == '"';
+      }
+      *cell = (Span){ .start = copy, .length = n };
+    }
+    q++;
+    *p = q < line_end && *q == ',' ? q + 1 : q;
+    return q == line_end || *q == ',' ? STORE_OK : STORE_INVALID_IMPORT;
+  }
+  const char *comma = memchr(start, ',', (size_t)(line_end - start));
+  const char *cell_end = comma == NULL ? line_end : comma;
+  *cell = (Span){ .start = start, .length = (size_t)(cell_end - start) };
+  *p = comma == NULL ? line_end : comma + 1;
+  return STORE_OK;
+}
+
+/*
+ * the end of the line starting at `p`, before its "\r\n" or "\n".
+ */
+static const char *line_end_of(const char *p, const char *end, const char **next) {
+  const char *newline = memchr(p, '\n', (size_t)(end - p));
+  *next = newline == NULL ? end : newline + 1;
+  const char *line_end = newline == NULL ? end : newline;
+  return line_end > p && line_end[-1] == '\r' ? line_end - 1 : line_end;
+}
+
+static bool blank(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t')) {
+    p++;
+  }
+  return p == end;
+}
+
+static int read_cell_number(Span cell, double *value) {
+  while (cell.length > 0 && (*cell.start == ' ' || *cell.start == '\t')) {
+    cell.start++;
+    cell.length--;
+  }
+  while (cell.length > 0 && (cell.start[cell.length - 1] == ' ' || cell.start[cell.length - 1] == '\t')) {
+    cell.length--;
+  }
+  return cell.length > 0 && parse_double(cell.start, cell.length, value) == 0 ? STORE_OK : STORE_INVALID_IMPORT;
+}
+
+static bool column_is(Span name, const char *const *names) {
+  for (; *names != NULL; names++) {
+    size_t length = strlen(*names);
+    if (name.length == length && strncmpci(name.start, *names, length) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static int read_header(const char **p, const char *end, Arena *arena, CsvHeader *header) {
+  static const char *const ID_NAMES[] = { "id", NULL };
+  static const char *const X_NAMES[] = { "lon", "lng", "longitude", "x", NULL };
+  static const char *const Y_NAMES[] = { "lat", "latitude", "y", NULL };
+  static const char *const Z_NAMES[] = { "z", "alt", "altitude", NULL };
+  *header = (CsvHeader){ .id = CSV_NO_COLUMN, .x = CSV_NO_COLUMN, .y = CSV_NO_COLUMN, .z = CSV_NO_COLUMN };
+  const char *next;
+  const char *line_end = line_end_of(*p, end, &next);
+  size_t capacity = 0;
+  do {
+    if (reserve((void **)&header->names, &capacity, header->count + 1, sizeof(Span)) != 0) {
+      return STORE_OUT_OF_MEMORY;
+    }
+    Span name;
+    int rc = read_cell(p, line_end, arena, &name);
+    if (rc != STORE_OK) {
+      return rc;
+    }
+    size_t column = header->count++;
+    header->names[column] = name;
+    size_t *role = column_is(name, ID_NAMES)  ? &header->id
+                   : column_is(name, X_NAMES) ? &header->x
+                   : column_is(name, Y_NAMES) ? &header->y
+                   : column_is(name, Z_NAMES) ? &header->z
+                                              : NULL;
+    if (role != NULL && *role == CSV_NO_COLUMN) {
+      *role = column;
+    }
+  } while (*p < line_end);
+  *p = next;
+  return header->x == CSV_NO_COLUMN || header->y == CSV_NO_COLUMN ? STORE_INVALID_IMPORT : STORE_OK;
+}
+
+static int read_row(ImportChunk *chunk, const CsvHeader *header, const char *p, const char *line_end) {
+  ImportRecord record = { .type = GEOMETRY_POINT, .fields_offset = (uint32_t)chunk->fields_count };
+  Point point = { 0 };
+  bool has_x = false;
+  bool has_y = false;
+  for (size_t column = 0; column < header->count && p <= line_end; column++) {
+    Span cell;
+    const char *cell_start = p;
+    int rc = read_cell(&p, line_end, &chunk->strings, &cell);
+    if (rc != STORE_OK) {
+      chunk->error = cell_start;
+      return rc;
+    }
+    if (column == header->id) {
+      record.id = cell.length > 0 ? cell : (Span){ 0 };
+    } else if (column == header->x) {
+      has_x = read_cell_number(cell, &point.x) == STORE_OK;
+    } else if (column == header->y) {
+      has_y = read_cell_number(cell, &point.y) == STORE_OK;
+    } else if (column == header->z) {
+      point.has_z = read_cell_number(cell, &point.z) == STORE_OK;
+    } else {
+      double value;
+      if (read_cell_number(cell, &value) == STORE_OK && add_field(chunk, header->names[column], value) != STORE_OK) {
+        return STORE_OUT_OF_MEMORY;
+      }
+    }
+    if (p == line_end && (p == cell_start || p[-1] != ',')) {
+      break;
+    }
+  }
+  record.skipped = !has_x || !has_y;
+  if (record.skipped) {
+    chunk->fields_count = record.fields_offset;
+  } else {
+    record.points_offset = (uint32_t)chunk->points_count;
+    record.points_count = 1;
+    if (add_point(chunk, &point) != STORE_OK) {
+      return STORE_OUT_OF_MEMORY;
+    }
+  }
+  record.fields_count = (uint32_t)(chunk->fields_count - record.fields_offset);
+  return add_record(chunk, &record);
+}
+
+/*
+ * reads the rows of the lines in [start, stop), `stop` being right after a newline or the end of the file.
+ */
+static void parse_csv_chunk(ImportChunk *chunk, const CsvHeader *header, const char *end) {
+  const char *p = chunk->start;
+  while (p < chunk->stop) {
+    const char *next;
+    const char *line_end = line_end_of(p, chunk->stop, &next);
+    if (!blank(p, line_end)) {
+      chunk->result = read_row(chunk, header, p, line_end);
+      if (chunk->result != STORE_OK) {
+        if (chunk->error == NULL) {
+          chunk->error = p;
+        }
+        return;
+      }
+    }
+    p = next;
+  }
+  chunk->next = chunk->stop;
+  chunk->last = chunk->stop == end;
+}
+
+/*
+ * where a chunk starting after `from` starts: the next line. The end of the file when there is none.
+ */
+static const char *next_line(const char *from, const char *end) {
+  const char *newline = memchr(from - 1, '\n', (size_t)(end - from + 1));
+  return newline == NULL ? end : newline + 1;
+}
+
+static void reset_chunk(ImportChunk *chunk, const char *start, const char *stop) {
+  chunk->start = start;
+  chunk->stop = stop;
+  chunk->next = NULL;
+  chunk->last = false;
+  chunk->result = STORE_OK;
+  chunk->error = NULL;
+  chunk->records_count = 0;
+  chunk->points_count = 0;
+  chunk->fields_count = 0;
+  arena_reset(&chunk->strings);
+}
+
+static void parse_chunk(const ImportJob *job, ImportChunk *chunk) {
+  if (job->format == IMPORT_CSV) {
+    parse_csv_chunk(chunk, job->header, job->end);
+  } else {
+    parse_geojson_chunk(chunk, job->end);
+  }
+}
+
+static void parse_task(size_t task, void *user_data) {
+  const ImportJob *job = user_data;
+  parse_chunk(job, &job->chunks[task]);
+}
+
+/*
+ * sets the records of a parsed chunk. A record without an id is named after `report->records`, the records of the file
+ * so far.
+ */
+static int set_records(Store *store, Collection *collection, const ImportChunk *chunk, ImportReport *report,
+                       uint64_t *lsn) {
+  for (size_t i = 0; i < chunk->records_count; i++) {
+    const ImportRecord *record = &chunk->records[i];
+    report->records++;
+    if (record->skipped) {
+      report->skipped++;
+      continue;
+    }
+    Geometry geometry = { .type = record->type };
+    if (record->type == GEOMETRY_POINT) {
+      geometry.point = chunk->points[record->points_offset];
+    } else {
+      geometry.line_string = (LineString){ .points = &chunk->points[record->points_offset],
+                                           .points_count = record->points_count,
+                                           .is_closed = true };
+    }
+    char ordinal[24];
+    Span id = record->id;
+    if (id.start == NULL) {
+      id = (Span){ .start = ordinal, .length = (size_t)snprintf(ordinal, sizeof(ordinal), "%zu", report->records) };
+    }
+    const FieldValue *fields = &chunk->fields[record->fields_offset];
+    int rc = collection_set(collection, id.start, id.length, &geometry, fields, record->fields_count);
+    if (rc == STORE_INVALID_STATEMENT) {
+      // a point out of the range of a quantized collection.
+      report->skipped++;
+      continue;
+    }
+    if (rc != STORE_OK) {
+      return rc;
+    }
+    report->imported++;
+    if (store->wal != NULL) {
+      WalRecord logged = {
+        .op = WAL_SET,
+        .key = { .start = collection->key, .length = collection->key_length },
+        .id = id,
+        .geometry = &geometry,
+        .fields = fields,
+        .fields_count = record->fields_count,
+      };
+      if (wal_append(store->wal, &logged, lsn) != 0) {
+        return STORE_IO_ERROR;
+      }
+    }
+  }
+  return STORE_OK;
+}
+
+static int import_map(Store *store, Collection *collection, const char *map, size_t size, ImportFormat format,
+                      ImportReport *report) {
+  const char *end = map + size;
+  const char *next = map;
+  if (size >= 3 && memcmp(map, "\xef\xbb\xbf", 3) == 0) {
+    next += 3;
+  }
+
+  Arena header_strings;
+  if (init_arena(&header_strings, 0) != 0) {
+    return STORE_OUT_OF_MEMORY;
+  }
+  CsvHeader header = { 0 };
+  int rc = STORE_OK;
+  if (format == IMPORT_CSV) {
+    rc = read_header(&next, end, &header_strings, &header);
+  } else {
+    Cursor c = { .p = next, .end = end };
+    next = first_feature(&c, &header_strings);
+    if (next == NULL) {
+      next = c.p;
+      rc = STORE_INVALID_IMPORT;
+    }
+  }
+  if (rc != STORE_OK) {
+    report->error_offset = (size_t)(next - map);
+    free(header.names);
+    destroy_arena(&header_strings);
+    return rc;
+  }
+
+  ScanPool *pool = store->scan_pool;
+  size_t round = (pool != NULL ? pool->workers_count + 1 : 1) * IMPORT_CHUNKS_PER_WORKER;
+  ImportChunk *chunks = calloc(round, sizeof(ImportChunk));
+  size_t initialized = 0;
+  while (chunks != NULL && initialized < round && init_arena(&chunks[initialized].strings, 0) == 0) {
+    initialized++;
+  }
+  if (initialized < round) {
+    rc = STORE_OUT_OF_MEMORY;
+  }
+  ImportJob job = { .format = format, .end = end, .header = &header, .chunks = chunks };
+
+  uint64_t lsn = 0;
+  bool reserved = false;
+  bool done = rc != STORE_OK;
+  while (!done) {
+    // chunk boundaries are planned from `next`, the exact start of the records left.
+    size_t n = 0;
+    for (const char *start = next; n < round && start < end; n++) {
+      const char *from = end - start > IMPORT_CHUNK_SIZE ? start + IMPORT_CHUNK_SIZE : end;
+      const char *stop = from == end ? end : format == IMPORT_CSV ? next_line(from, end) : guess_feature(from, end);
+      reset_chunk(&chunks[n], start, stop);
+      start = stop;
+    }
+    if (n == 0) {
+      // the end of the file before the end of the features array.
+      if (format == IMPORT_GEOJSON) {
+        rc = STORE_INVALID_IMPORT;
+        report->error_offset = size;
+      }
+      break;
+    }
+    if (pool != NULL && n > 1) {
+      scan_pool_run(pool, n, parse_task, &job);
+    } else {
+      for (size_t i = 0; i < n; i++) {
+        parse_chunk(&job, &chunks[i]);
+      }
+    }
+
+    if (!reserved && n == round) {
+      // the records of the file extrapolated from the first round, so the collection grows once.
+      size_t records = 0;
+      for (size_t i = 0; i < n; i++) {
+        records += chunks[i].records_count;
+      }
+      double ratio = (double)(end - chunks[0].start) / (double)(chunks[n - 1].stop - chunks[0].start);
+      rc = collection_reserve(collection, (size_t)((double)records * ratio));
+      if (rc != STORE_OK) {
+        break;
+      }
+    }
+    reserved = true;
+
+    for (size_t i = 0; i < n && !done; i++) {
+      ImportChunk *chunk = &chunks[i];
+      if (chunk->start != next) {
+        // the guess was off: the previous chunk stopped elsewhere.
+        reset_chunk(chunk, next, chunk->stop);
+        parse_chunk(&job, chunk);
+      }
+      if (chunk->result != STORE_OK) {
+        rc = chunk->result;
+        report->error_offset = (size_t)((chunk->error != NULL ? chunk->error : chunk->start) - map);
+        done = true;
+      } else {
+        rc = set_records(store, collection, chunk, report, &lsn);
+        next = chunk->next;
+        done = rc != STORE_OK || chunk->last;
+      }
+    }
+  }
+
+  if (store->wal != NULL && lsn != 0 && wal_commit(store->wal, lsn) != 0 && rc == STORE_OK) {
+    rc = STORE_IO_ERROR;
+  }
+  for (size_t i = 0; i < initialized; i++) {
+    free(chunks[i].records);
+    free(chunks[i].points);
+    free(chunks[i].fields);
+    destroy_arena(&chunks[i].strings);
+  }
+  free(chunks);
+  free(header.names);
+  destroy_arena(&header_strings);
+  return rc;
+}
+
+int store_import(Store *store, const char *key, size_t key_length, const char *path, ImportFormat format,
+                 ImportReport *report) {
+  *report = (ImportReport){ 0 };
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return STORE_IO_ERROR;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return STORE_IO_ERROR;
+  }
+  size_t size = (size_t)st.st_size;
+  if (size == 0) {
+    close(fd);
+    return STORE_INVALID_IMPORT;
+  }
+  const char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return STORE_IO_ERROR;
+  }
+  // read once front to back.
+  madvise((void *)map, size, MADV_SEQUENTIAL);
+
+  bool existed = store_get_collection(store, key, key_length) != NULL;
+  Collection *collection = store_get_or_create_collection(store, key, key_length);
+  if (collection == NULL) {
+    munmap((void *)map, size);
+    return STORE_OUT_OF_MEMORY;
+  }
+  // the index is rebuilt from every object of the collection, those it held before included.
+  collection->index_deferred = true;
+  int rc = import_map(store, collection, map, size, format, report);
+  munmap((void *)map, size);
+  if (!existed && collection->count == 0) {
+    // a file that was unreadable or held no object doesn't leave an empty key behind.
+    store_drop_collection(store, key, key_length);
+    return rc;
+  }
+  int index_rc = collection_build_index(collection);
+  return rc != STORE_OK ? rc : index_rc;
+}
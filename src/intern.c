@@ -0,0 +1,295 @@
+#include "intern.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define INTERN_INITIAL_CAPACITY 64
+
+/*
+ * the hash table is rebuilt once 7/8 of the slots have been used.
+ */
+static size_t max_load(size_t capacity) {
+  return capacity - capacity / 8;
+}
+
+static int allocate_slots(InternTable *table, size_t capacity) {
+  uint8_t *control = malloc(capacity);
+  uint32_t *slots = malloc(sizeof(uint32_t) * capacity);
+  if (control == NULL || slots == NULL) {
+    free(control);
+    free(slots);
+    return 1;
+  }
+  memset(control, SWISS_EMPTY, capacity);
+  table->control = control;
+  table->slots = slots;
+  table->slots_capacity = capacity;
+  table->growth_left = max_load(capacity) - table->count;
+  return 0;
+}
+
+int init_intern_table(InternTable *table) {
+  *table = (InternTable){ 0 };
+  table->free_handle = UINT32_MAX;
+  return allocate_slots(table, INTERN_INITIAL_CAPACITY);
+}
+
+static void free_blocks(char *block) {
+  while (block != NULL) {
+    char *previous;
+    memcpy(&previous, block, sizeof(char *));
+    free(block);
+    block = previous;
+  }
+}
+
+void destroy_intern_table(InternTable *table) {
+  free_blocks(table->block);
+  free(table->strings);
+  if (!table->slots_borrowed) {
+    free(table->control);
+    free(table->slots);
+  }
+  *table = (InternTable){ 0 };
+}
+
+/*
+ * returns the slot holding `bytes`, or SIZE_MAX.
+ */
+static size_t find_slot(const InternTable *table, const char *bytes, size_t length, uint64_t hash) {
+  uint8_t tag = swiss_tag(hash);
+  size_t groups_mask = table->slots_capacity / SWISS_GROUP_WIDTH - 1;
+  for (size_t g = hash & groups_mask, step = 1;; g = (g + step++) & groups_mask) {
+    const uint8_t *group = table->control + g * SWISS_GROUP_WIDTH;
+    for (uint32_t matches = swiss_match(group, tag); matches != 0; matches &= matches - 1) {
+      size_t slot = g * SWISS_GROUP_WIDTH + (size_t)__builtin_ctz(matches);
+      const Span *s = &table->strings[table->slots[slot]];
+      if (s->length == length && memcmp(s->start, bytes, length) == 0) {
+        return slot;
+      }
+    }
+    if (swiss_match(group, SWISS_EMPTY) != 0) {
+      return SIZE_MAX;
+    }
+  }
+}
+
+/*
+ * returns the slot holding `handle`, which must be live. Same probe sequence as `find_slot` but comparing handles.
+ */
+static size_t find_handle_slot(const InternTable *table, uint32_t handle) {
+  const Span *s = &table->strings[handle];
+  uint64_t hash = hash_bytes(s->start, s->length);
+  uint8_t tag = swiss_tag(hash);
+  size_t groups_mask = table->slots_capacity / SWISS_GROUP_WIDTH - 1;
+  for (size_t g = hash & groups_mask, step = 1;; g = (g + step++) & groups_mask) {
+    for (uint32_t matches = swiss_match(table->control + g * SWISS_GROUP_WIDTH, tag); matches != 0;
+         matches &= matches - 1) {
+      size_t slot = g * SWISS_GROUP_WIDTH + (size_t)__builtin_ctz(matches);
+      if (table->slots[slot] == handle) {
+        return slot;
+      }
+    }
+  }
+}
+
+/*
+ * moves every handle into a fresh hash table of `capacity` slots, which also drops the tombstones.
+ */
+static int rebuild(InternTable *table, size_t capacity) {
+  uint8_t *old_control = table->control;
+  uint32_t *old_slots = table->slots;
+  size_t old_capacity = table->slots_capacity;
+  bool borrowed = table->slots_borrowed;
+  if (allocate_slots(table, capacity) != 0) {
+    return 1;
+  }
+
+  for (size_t i = 0; i < old_capacity; i++) {
+    if (old_control[i] & SWISS_EMPTY) {
+      continue;
+    }
+    const Span *s = &table->strings[old_slots[i]];
+    size_t slot = swiss_find_free(table->control, table->slots_capacity, hash_bytes(s->start, s->length));
+    table->control[slot] = old_control[i];
+    table->slots[slot] = old_slots[i];
+  }
+  if (!borrowed) {
+    free(old_control);
+    free(old_slots);
+  }
+  table->slots_borrowed = false;
+  return 0;
+}
+
+int intern_reserve(InternTable *table, size_t count) {
+  size_t needed = table->count + count;
+  if (needed > UINT32_MAX) {
+    return 1;
+  }
+  size_t capacity = table->slots_capacity;
+  while (max_load(capacity) < needed) {
+    capacity *= 2;
+  }
+  if (capacity > table->slots_capacity && rebuild(table, capacity) != 0) {
+    return 1;
+  }
+  if (needed > table->handles_capacity) {
+    Span *strings = realloc(table->strings, sizeof(Span) * needed);
+    if (strings == NULL) {
+      return 1;
+    }
+    table->strings = strings;
+    table->handles_capacity = (uint32_t)needed;
+  }
+  return 0;
+}
+
+/*
+ * returns `length + 1` bytes of storage or NULL when out of memory. Strings larger than a block get a block of their
+ * own.
+ */
+static char *allocate_string(InternTable *table, size_t length) {
+  size_t needed = length + 1;
+  if (table->block == NULL || table->block_used + needed > table->block_size) {
+    size_t size = sizeof(char *) + needed > INTERN_BLOCK_SIZE ? sizeof(char *) + needed : INTERN_BLOCK_SIZE;
+    char *block = malloc(size);
+    if (block == NULL) {
+      return NULL;
+    }
+    memcpy(block, &table->block, sizeof(char *));
+    table->block = block;
+    table->block_used = sizeof(char *);
+    table->block_size = size;
+  }
+  char *s = table->block + table->block_used;
+  table->block_used += needed;
+  return s;
+}
+
+int intern_string(InternTable *table, const char *bytes, size_t length, uint32_t *handle, bool *inserted) {
+  uint64_t hash = hash_bytes(bytes, length);
+  size_t slot = find_slot(table, bytes, length, hash);
+  if (slot != SIZE_MAX) {
+    *handle = table->slots[slot];
+    if (inserted != NULL) {
+      *inserted = false;
+    }
+    return 0;
+  }
+
+  // everything that can fail happens before the table is modified.
+  slot = swiss_find_free(table->control, table->slots_capacity, hash);
+  if (table->control[slot] == SWISS_EMPTY && table->growth_left == 0) {
+    // mostly tombstones: rebuilding at the same size is enough.
+    size_t capacity = table->count >= table->slots_capacity * 7 / 16 ? table->slots_capacity * 2 : table->slots_capacity;
+    if (rebuild(table, capacity) != 0) {
+      return 1;
+    }
+    slot = swiss_find_free(table->control, table->slots_capacity, hash);
+  }
+
+  if (table->free_handle == UINT32_MAX && table->handles_count == table->handles_capacity) {
+    if (table->handles_capacity > UINT32_MAX / 2) {
+      return 1;
+    }
+    uint32_t capacity = table->handles_capacity == 0 ? INTERN_INITIAL_CAPACITY : table->handles_capacity * 2;
+    Span *strings = realloc(table->strings, sizeof(Span) * capacity);
+    if (strings == NULL) {
+      return 1;
+    }
+    table->strings = strings;
+    table->handles_capacity = capacity;
+  }
+
+  char *copy = allocate_string(table, length);
+  if (copy == NULL) {
+    return 1;
+  }
+  memcpy(copy, bytes, length);
+  copy[length] = '\0';
+
+  uint32_t h;
+  if (table->free_handle != UINT32_MAX) {
+    h = table->free_handle;
+    table->free_handle = (uint32_t)table->strings[h].length;
+  } else {
+    h = table->handles_count++;
+  }
+  table->strings[h] = (Span){ .start = copy, .length = length };
+  table->live_bytes += length + 1;
+  table->count++;
+
+  if (table->control[slot] == SWISS_EMPTY) {
+    table->growth_left--;
+  }
+  table->control[slot] = swiss_tag(hash);
+  table->slots[slot] = h;
+
+  *handle = h;
+  if (inserted != NULL) {
+    *inserted = true;
+  }
+  return 0;
+}
+
+int intern_lookup(const InternTable *table, const char *bytes, size_t length, uint32_t *handle) {
+  if (table->count == 0) {
+    return 1;
+  }
+  size_t slot = find_slot(table, bytes, length, hash_bytes(bytes, length));
+  if (slot == SIZE_MAX) {
+    return 1;
+  }
+  *handle = table->slots[slot];
+  return 0;
+}
+
+/*
+ * copies the live strings into a single block and frees the old ones. Nothing changes when the block can't be
+ * allocated, compaction is retried on a later removal.
+ */
+static void compact(InternTable *table) {
+  char *block = malloc(sizeof(char *) + table->live_bytes);
+  if (block == NULL) {
+    return;
+  }
+  char *previous = NULL;
+  memcpy(block, &previous, sizeof(char *));
+
+  size_t used = sizeof(char *);
+  for (uint32_t h = 0; h < table->handles_count; h++) {
+    Span *s = &table->strings[h];
+    if (s->start != NULL) {
+      memcpy(block + used, s->start, s->length + 1);
+      s->start = block + used;
+      used += s->length + 1;
+    }
+  }
+
+  free_blocks(table->block);
+  table->block = block;
+  table->block_used = used;
+  table->block_size = used;
+  table->garbage_bytes = 0;
+}
+
+void intern_remove(InternTable *table, uint32_t handle) {
+  swiss_erase(table->control, find_handle_slot(table, handle), &table->growth_left);
+
+  size_t bytes = table->strings[handle].length + 1;
+  table->live_bytes -= bytes;
+  table->garbage_bytes += bytes;
+  table->count--;
+  table->strings[handle] = (Span){ .start = NULL, .length = table->free_handle };
+  table->free_handle = handle;
+
+  // amortized: every compaction is paid for by at least as many removed bytes as it copies.
+  if (table->garbage_bytes > INTERN_BLOCK_SIZE && table->garbage_bytes > table->live_bytes) {
+    compact(table);
+  }
+}
+
+Span interned_span(const InternTable *table, uint32_t handle) {
+  return table->strings[handle];
+}
@@ -1,39 +1,145 @@
 #include "geometry.h"
+#include "number.h"
 #include "parse.h"
 
-#include <ctype.h>
+#include <math.h>
 #include <stdio.h>
-#include <errno.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 
-/* 
- * Implement look up tables to optimize the to upper, to lower, is alnum, is digit functions
- * #define to_upper(x) (x & ~(x & 0x20))
+/*
+ * character classes used by the tokenizer, same idea as sqlite's normalize.c: one table lookup per byte instead of a
+ * chain of isspace/isdigit calls (which also depend on the locale).
  */
+#define CC_SPACE 0  /* space, \t, \v, \f, \r */
+#define CC_DIGIT 1  /* 0-9 */
+#define CC_DOT 2    /* . */
+#define CC_SIGN 3   /* + - */
+#define CC_QUOTE 4  /* ' " ` */
+#define CC_EXP 5    /* e E */
+#define CC_NUL 6    /* end of the statement: NUL or \n */
+#define CC_OTHER 7  /* anything else, part of a word */
+#define CC_PARAMETER 8 /* ?, a placeholder when it stands alone */
+
+static const unsigned char CHAR_CLASS[256] = {
+  6, 7, 7, 7, 7, 7, 7, 7, 7, 0, 6, 0, 0, 0, 7, 7,  /* 0x00..0x0f */
+  7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,  /* 0x10..0x1f */
+  0, 7, 4, 7, 7, 7, 7, 4, 7, 7, 7, 3, 7, 3, 2, 7,  /* 0x20..0x2f */
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 7, 7, 7, 7, 7, 8,  /* 0x30..0x3f */
+  7, 7, 7, 7, 7, 5, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,  /* 0x40..0x4f */
+  7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,  /* 0x50..0x5f */
+  4, 7, 7, 7, 7, 5, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,  /* 0x60..0x6f */
+  7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,  /* 0x70..0x7f */
+  7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,  /* 0x80..0x8f */
+  7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,  /* 0x90..0x9f */
+  7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,  /* 0xa0..0xaf */
+  7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,  /* 0xb0..0xbf */
+  7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,  /* 0xc0..0xcf */
+  7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,  /* 0xd0..0xdf */
+  7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,  /* 0xe0..0xef */
+  7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,  /* 0xf0..0xff */
+};
+
+#define IS_DIGIT(c) (CHAR_CLASS[(unsigned char)(c)] == CC_DIGIT)
 
 /*
- * FIXME move to lookup table with switch/case instead of if statements and built in functions if optimizing to get the 'class' of the char (space = 7, illegal = 27, digit = 2, ... ) like in example from sqlite: https://github.com/sqlite/sqlite/blob/f722d91fa8e8e6e03308736696d67e77b71e4b39/ext/misc/normalize.c#L77 
+ * keywords are recognized with a switch on the token length followed by a single comparison, instead of comparing the
+ * token against every reserved word.
  */
+typedef enum {
+  KW_NONE,
+  KW_SET,
+  KW_GET,
+  KW_DEL,
+  KW_DROP,
+  KW_POINT,
+  KW_BOUNDS,
+  KW_NEARBY,
+  KW_LIMIT,
+  KW_WITHIN,
+  KW_INTERSECTS,
+  KW_SETCHAN,
+  KW_DELCHAN,
+  KW_FENCE,
+  KW_FIELD,
+  KW_FSET,
+  KW_WITHFIELDS,
+  KW_WHERE,
+  KW_OR,
+  KW_EX,
+} Keyword;
 
-#define RESERVED_WORDS_COUNT 6
-
-static const char SET_KEYWORD[] = "SET";
-static const char GET_KEYWORD[] = "GET";
-static const char DELETE_KEYWORD[] = "DEL";
-static const char DROP_KEYWORD[] = "DROP";
-static const char POINT_KEYWORD[] = "POINT";
-static const char BOUND_KEYWORD[] = "BOUND";
-
-static const char *const RESERVED_WORDS[RESERVED_WORDS_COUNT] = {
-  SET_KEYWORD,
-  GET_KEYWORD,
-  DELETE_KEYWORD,
-  DROP_KEYWORD,
-  POINT_KEYWORD,
-  BOUND_KEYWORD,
-};
+/*
+ * case insensitive compare of the token against an upper case keyword of the same length. Clearing bit 0x20 upper
+ * cases ascii letters and can't turn anything else into one, so no tolower is needed.
+ */
+static inline bool keyword_matches(const char *pch, const char *keyword, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    if ((pch[i] & ~0x20) != keyword[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static Keyword lookup_keyword(const char *pch, size_t len) {
+  switch (len) {
+    case 2:
+      switch (pch[0] & ~0x20) {
+        case 'O': return keyword_matches(pch, "OR", 2) ? KW_OR : KW_NONE;
+        case 'E': return keyword_matches(pch, "EX", 2) ? KW_EX : KW_NONE;
+        default: return KW_NONE;
+      }
+    case 3:
+      switch (pch[0] & ~0x20) {
+        case 'S': return keyword_matches(pch, "SET", 3) ? KW_SET : KW_NONE;
+        case 'G': return keyword_matches(pch, "GET", 3) ? KW_GET : KW_NONE;
+        case 'D': return keyword_matches(pch, "DEL", 3) ? KW_DEL : KW_NONE;
+        default: return KW_NONE;
+      }
+    case 4:
+      switch (pch[0] & ~0x20) {
+        case 'D': return keyword_matches(pch, "DROP", 4) ? KW_DROP : KW_NONE;
+        case 'F': return keyword_matches(pch, "FSET", 4) ? KW_FSET : KW_NONE;
+        default: return KW_NONE;
+      }
+    case 5:
+      switch (pch[0] & ~0x20) {
+        case 'P': return keyword_matches(pch, "POINT", 5) ? KW_POINT : KW_NONE;
+        case 'L': return keyword_matches(pch, "LIMIT", 5) ? KW_LIMIT : KW_NONE;
+        case 'F':
+          if (keyword_matches(pch, "FENCE", 5)) {
+            return KW_FENCE;
+          }
+          return keyword_matches(pch, "FIELD", 5) ? KW_FIELD : KW_NONE;
+        case 'W': return keyword_matches(pch, "WHERE", 5) ? KW_WHERE : KW_NONE;
+        default: return KW_NONE;
+      }
+    case 6:
+      switch (pch[0] & ~0x20) {
+        case 'B': return keyword_matches(pch, "BOUNDS", 6) ? KW_BOUNDS : KW_NONE;
+        case 'N': return keyword_matches(pch, "NEARBY", 6) ? KW_NEARBY : KW_NONE;
+        case 'W': return keyword_matches(pch, "WITHIN", 6) ? KW_WITHIN : KW_NONE;
+        default: return KW_NONE;
+      }
+    case 7:
+      switch (pch[0] & ~0x20) {
+        case 'S': return keyword_matches(pch, "SETCHAN", 7) ? KW_SETCHAN : KW_NONE;
+        case 'D': return keyword_matches(pch, "DELCHAN", 7) ? KW_DELCHAN : KW_NONE;
+        default: return KW_NONE;
+      }
+    case 10:
+      switch (pch[0] & ~0x20) {
+        case 'I': return keyword_matches(pch, "INTERSECTS", 10) ? KW_INTERSECTS : KW_NONE;
+        case 'W': return keyword_matches(pch, "WITHFIELDS", 10) ? KW_WITHFIELDS : KW_NONE;
+        default: return KW_NONE;
+      }
+    default:
+      return KW_NONE;
+  }
+}
 
 typedef enum {
   TOKEN_ERROR,
@@ -41,62 +147,115 @@ typedef enum {
   TOKEN_SPACE,
   TOKEN_INTEGER,
   TOKEN_DOUBLE,
-  TOKEN_STRING
+  TOKEN_STRING,
+  TOKEN_PARAMETER
 } TokenType;
 
-static size_t get_next_token_len(const char *pch, TokenType *token_type) {
-  size_t len;
-  if (isspace(pch[0])) {
-    for(len=1; isspace(pch[len]); len++) {}
-    *token_type = TOKEN_SPACE;
-  } else if (isdigit((unsigned char) pch[0]) || ((pch[0] == '.' || pch[0] == '+' || pch[0] == '-') && isdigit(pch[1]))) {
-    // FIXME this is messy and has redundant checks but without a fallthrough of a case statement, we need to recheck why the statement was entered with something like `pch[0] == '.'` or `has_dot` boolean. This can be cleaned up when the above mentioned lookup table and switch/case optimzation is being implemented but for now, this is good enough. This also doesn't allow the ',' instead of '.' for decimal point. This is common internationally.
-    *token_type = TOKEN_INTEGER; 
-    bool has_dot = false;
-    if (pch[0] == '.') {
-      has_dot = true;
-      *token_type = TOKEN_DOUBLE;
-    }
-    for(len=1; isdigit((unsigned char) pch[len]); len++) {} 
+/*
+ * scans a number starting at `pch`, `len` being the index of its first digit or of a leading '.' (after an optional
+ * sign). Only whole number exponents are allowed. This doesn't allow ',' as the decimal point, which is common
+ * internationally.
+ *
+ * the digits are accumulated into `number` on the way so the value never has to be scanned a second time.
+ */
+static size_t scan_number(const char *pch, size_t len, TokenType *token_type, DecimalNumber *number) {
+  *token_type = TOKEN_INTEGER;
+  if (pch[len] != '.') {
+    for (; IS_DIGIT(pch[len]); len++) {
+      decimal_add_digit(number, pch[len], false);
+    }
+  }
+  if (pch[len] == '.') {
+    if (!IS_DIGIT(pch[len + 1])) {
+      *token_type = TOKEN_ERROR;
+      return len;
+    }
+    *token_type = TOKEN_DOUBLE;
+    for (len++; IS_DIGIT(pch[len]); len++) {
+      decimal_add_digit(number, pch[len], true);
+    }
     if (pch[len] == '.') {
-      if (has_dot || !isdigit(pch[len+1])) {
-        *token_type = TOKEN_ERROR;
-        return len;
+      *token_type = TOKEN_ERROR;
+      return len;
+    }
+  }
+
+  if (CHAR_CLASS[(unsigned char)pch[len]] == CC_EXP) {
+    bool negative = pch[len + 1] == '-';
+    size_t digits = CHAR_CLASS[(unsigned char)pch[len + 1]] == CC_SIGN ? len + 2 : len + 1;
+    if (!IS_DIGIT(pch[digits])) {
+      *token_type = TOKEN_ERROR;
+      return len;
+    }
+    *token_type = TOKEN_DOUBLE;
+    int64_t exponent = 0;
+    for (len = digits; IS_DIGIT(pch[len]); len++) {
+      // past this the value is 0 or out of range anyway, stop before the exponent itself overflows.
+      if (exponent < 100000) {
+        exponent = exponent * 10 + (pch[len] - '0');
       }
-      *token_type = TOKEN_DOUBLE;
-      len++;
-      for(; isdigit((unsigned char) pch[len]); len++) {}
     }
+    number->exponent += negative ? -exponent : exponent;
+  }
+  return len;
+}
 
-    // only allow whole number exponential notation
-    if (pch[len] == 'e' || pch[len] == 'E') {
-      if (isdigit((unsigned char) pch[len+1]) || ((pch[len+1] == '-' || pch[len+1] == '+') && isdigit((unsigned char) pch[len+2]))) {
-        *token_type = TOKEN_DOUBLE;
-        len+=2;
-        for(; isdigit((unsigned char) pch[len]); len++) {}
-      } else {
+/*
+ * `number` is only filled for TOKEN_INTEGER and TOKEN_DOUBLE tokens.
+ */
+static size_t get_next_token_len(const char *pch, TokenType *token_type, DecimalNumber *number) {
+  size_t len;
+  switch (CHAR_CLASS[(unsigned char)pch[0]]) {
+    case CC_SPACE: {
+      for (len = 1; CHAR_CLASS[(unsigned char)pch[len]] == CC_SPACE; len++) {}
+      *token_type = TOKEN_SPACE;
+      return len;
+    }
+    case CC_SIGN: {
+      if (IS_DIGIT(pch[1]) || (pch[1] == '.' && IS_DIGIT(pch[2]))) {
+        *number = (DecimalNumber){ .negative = pch[0] == '-' };
+        return scan_number(pch, 1, token_type, number);
+      }
+      break;
+    }
+    case CC_DOT: {
+      if (IS_DIGIT(pch[1])) {
+        *number = (DecimalNumber){ 0 };
+        return scan_number(pch, 0, token_type, number);
+      }
+      break;
+    }
+    case CC_DIGIT: {
+      *number = (DecimalNumber){ 0 };
+      return scan_number(pch, 0, token_type, number);
+    }
+    case CC_QUOTE: {
+      char delim = pch[0];
+      for (len = 1; CHAR_CLASS[(unsigned char)pch[len]] != CC_NUL && pch[len] != delim; len++) {}
+      if (pch[len] != delim) {
+        // reached the end of the statement without finding delim
         *token_type = TOKEN_ERROR;
         return len;
       }
+      *token_type = TOKEN_STRING;
+      return len + 1;
     }
-  } else if (pch[0] == '\'' || pch[0] == '`' || pch[0] == '"') {
-    *token_type = TOKEN_STRING;
-    char delim = pch[0];
-    
-    for(len=1; pch[len]!= '\0'; len++) {
-      if (pch[len] == delim) {
-        len++;
-        break; 
+    case CC_PARAMETER: {
+      // "?" on its own, a '?' inside a word is just part of it.
+      if (CHAR_CLASS[(unsigned char)pch[1]] == CC_SPACE || CHAR_CLASS[(unsigned char)pch[1]] == CC_NUL) {
+        *token_type = TOKEN_PARAMETER;
+        return 1;
       }
+      break;
     }
-    if (pch[len] == '\0') {
-      // exited for statement due to being at end of string without finding delim
-      *token_type = TOKEN_ERROR;
+    default: {
+      break;
     }
-  } else {
-    for(len=1; !isspace(pch[len]); len++) {}
-    *token_type = TOKEN_STRING;
   }
+
+  // words run until the next space or the end of the statement.
+  for (len = 1; CHAR_CLASS[(unsigned char)pch[len]] > CC_SPACE && CHAR_CLASS[(unsigned char)pch[len]] != CC_NUL; len++) {}
+  *token_type = TOKEN_STRING;
   return len;
 }
 
@@ -110,6 +269,20 @@ typedef enum {
   X_VALUE,
   Y_VALUE,
   Z_VALUE,
+  LIMIT_OR_POINT,
+  LIMIT_VALUE,
+  DISTANCE_VALUE,
+  CHANNEL,
+  FENCE_COMMAND,
+  FENCE,
+  FIELD_NAME,
+  FIELD_VALUE,
+  WHERE_KEYWORD,
+  WHERE_FIELD,
+  WHERE_MIN,
+  WHERE_MAX,
+  EXPIRE_VALUE,
+  END_OF_STATEMENT,
 } Step;
 
 /*
@@ -142,6 +315,17 @@ typedef enum {
   INVALID_Z_VALUE,
   END_OF_TOKENS_REACHED,                             // 5
   EXPECTED_END_OF_TOKENS,                            // 6
+  INVALID_RING,
+  INVALID_LIMIT_VALUE,
+  INVALID_DISTANCE_VALUE,
+  INVALID_CHANNEL_VALUE,
+  INVALID_FENCE,
+  INVALID_PARAMETER,
+  INVALID_FIELD_NAME,
+  INVALID_FIELD_VALUE,
+  INVALID_WHERE_CLAUSE,
+  INVALID_WHERE_VALUE,
+  INVALID_EXPIRE_VALUE,
 } ParserResult;
 
 #define PARSER_RESULTS_ENUM_COUNT // TODO
@@ -160,7 +344,18 @@ static const char * const PARSER_RESULT_TO_STRING[PARSER_RESULTS_ENUM_COUNT] = {
   "INVALID_Y_VALUE",
   "INVALID_Z_VALUE",
   "END_OF_TOKENS_REACHED",
-  "EXPECTED_END_OF_TOKENS"
+  "EXPECTED_END_OF_TOKENS",
+  "INVALID_RING",
+  "INVALID_LIMIT_VALUE",
+  "INVALID_DISTANCE_VALUE",
+  "INVALID_CHANNEL_VALUE",
+  "INVALID_FENCE",
+  "INVALID_PARAMETER",
+  "INVALID_FIELD_NAME",
+  "INVALID_FIELD_VALUE",
+  "INVALID_WHERE_CLAUSE",
+  "INVALID_WHERE_VALUE",
+  "INVALID_EXPIRE_VALUE"
 };
 
 #define ERROR_MESSAGE_MAX_BUFFER_SIZE 512
@@ -189,42 +384,247 @@ static void internal_error_callback_handler(error_callback ec, int error_code, c
 }
 
 /*
- * returns 0 if `word` is in the reserved word list, else 1.
- * NOTE doesn't account for negative ptrdiff_t values
+ * converts the integer or double token at `pch`, already scanned into `number`. returns NULL on success, else a short
+ * cause of the failure.
  */
-static int is_reserved_word(const char *pch, size_t len) {
-  for (int i = 0; i < RESERVED_WORDS_COUNT; i++) {
-    // check case insensitive compare
-    if (strncmpci(pch, RESERVED_WORDS[i], len) == 0) {
-      return 0;
+static const char *parse_number(const DecimalNumber *number, const char *pch, size_t len, double *value) {
+  if (decimal_to_double(number, pch, len, value) != 0) {
+    return "Number out of range.";
+  }
+  return NULL;
+}
+
+/*
+ * appends `p` to the ring, doubling its capacity in `arena` when full. returns 0 on success, else 1 (out of memory).
+ */
+static int append_ring_point(Arena *arena, LineString *ring, size_t *capacity, const Point *p) {
+  if (ring->points_count == *capacity) {
+    size_t new_capacity = *capacity == 0 ? 8 : *capacity * 2;
+    Point *points = arena_grow(arena, ring->points, sizeof(Point) * *capacity, sizeof(Point) * new_capacity);
+    if (points == NULL) {
+      return 1;
     }
+    ring->points = points;
+    *capacity = new_capacity;
   }
-  return 1;
+  ring->points[ring->points_count++] = *p;
+  return 0;
 }
 
 /*
- * creates a prepared statement from a given command string.
- *
- * parameters:
- *  - `cmd` is command to be transformed into a PreparedStatement
- *  - `prepared_statement` out param which contains the fully created PreparedStatement from the command string. If the function returns a non-zero value, this value is NULL.
- *  - `error_callback` function of type `void FUNC_NAME(int error_code, const char *error_message)` which is used to handle any logging that the user wants to do.
- *
- * returns a int (ParserResult enum value). Follows c common practice of:
- *  - 0 if successful
- *  - else, error where the return value matches the error_code (reason of failure).
- *
+ * appends a field named `name` to the statement, doubling its fields array in `arena` when full. Its value is filled in
+ * once read. returns 0 on success, else 1 (out of memory).
  */
-int make_prepared_statement(const char *cmd, PreparedStatement *prepared_statement, error_callback ec_func) {
-  
+static int append_field(Arena *arena, PreparedStatement *prepared_statement, size_t *capacity, const char *name,
+                        size_t name_length) {
+  if (prepared_statement->fields_count == *capacity) {
+    size_t new_capacity = *capacity == 0 ? 4 : *capacity * 2;
+    FieldValue *fields = arena_grow(arena, prepared_statement->fields, sizeof(FieldValue) * *capacity,
+                                    sizeof(FieldValue) * new_capacity);
+    if (fields == NULL) {
+      return 1;
+    }
+    prepared_statement->fields = fields;
+    *capacity = new_capacity;
+  }
+  prepared_statement->fields[prepared_statement->fields_count++] = (FieldValue){
+    .name = { .start = name, .length = name_length },
+  };
+  return 0;
+}
+
+/*
+ * appends a WHERE clause on the field named `name`, doubling the wheres array in `arena` when full. Its bounds are
+ * filled in once read. returns 0 on success, else 1 (out of memory).
+ */
+static int append_where(Arena *arena, PreparedStatement *prepared_statement, size_t *capacity, const char *name,
+                        size_t name_length, bool starts_group) {
+  if (prepared_statement->wheres_count == *capacity) {
+    size_t new_capacity = *capacity == 0 ? 4 : *capacity * 2;
+    WhereClause *wheres = arena_grow(arena, prepared_statement->wheres, sizeof(WhereClause) * *capacity,
+                                     sizeof(WhereClause) * new_capacity);
+    if (wheres == NULL) {
+      return 1;
+    }
+    prepared_statement->wheres = wheres;
+    *capacity = new_capacity;
+  }
+  prepared_statement->wheres[prepared_statement->wheres_count++] = (WhereClause){
+    .field = { .start = name, .length = name_length },
+    .starts_group = starts_group,
+  };
+  return 0;
+}
+
+/*
+ * reads a WHERE bound: a number or an infinity spelled `inf`, `+inf` or `-inf` (any case). returns NULL on success,
+ * else a short cause of the failure.
+ */
+static const char *parse_where_bound(TokenType tt, const DecimalNumber *number, const char *pch, size_t len,
+                                     double *value) {
+  if (tt == TOKEN_DOUBLE || tt == TOKEN_INTEGER) {
+    return parse_number(number, pch, len, value);
+  }
+  bool negative = pch[0] == '-';
+  size_t sign = pch[0] == '-' || pch[0] == '+';
+  if (tt == TOKEN_STRING && len == sign + 3 && keyword_matches(pch + sign, "INF", 3)) {
+    *value = negative ? -INFINITY : INFINITY;
+    return NULL;
+  }
+  return "Expected integer, double or inf bound";
+}
+
+/*
+ * records a `?` placeholder for `target`, growing the parameters array in `arena`. Ring coordinates remember the index
+ * of the point being read. returns PARSE_OK or OUT_OF_MEMORY.
+ */
+static int add_parameter(Arena *arena, PreparedStatement *prepared_statement, size_t *capacity, ParameterTarget target,
+                         error_callback ec_func, int position) {
+  if (prepared_statement->parameters_count == *capacity) {
+    size_t new_capacity = *capacity == 0 ? 4 : *capacity * 2;
+    Parameter *parameters = arena_grow(arena, prepared_statement->parameters, sizeof(Parameter) * *capacity,
+                                       sizeof(Parameter) * new_capacity);
+    if (parameters == NULL) {
+      if (ec_func != NULL) {
+        internal_error_callback_handler(ec_func, OUT_OF_MEMORY, "Failed to allocate parameters.", position);
+      }
+      return OUT_OF_MEMORY;
+    }
+    prepared_statement->parameters = parameters;
+    *capacity = new_capacity;
+  }
+
+  const Geometry *geometry = &prepared_statement->geometry;
+  prepared_statement->parameters[prepared_statement->parameters_count++] = (Parameter){
+    .target = target,
+    .point = geometry->type == GEOMETRY_LINE_STRING ? geometry->line_string.points_count : 0,
+  };
+  prepared_statement->unbound_count++;
+  return PARSE_OK;
+}
+
+static bool ring_has_parameters(const PreparedStatement *prepared_statement) {
+  for (size_t i = 0; i < prepared_statement->parameters_count; i++) {
+    ParameterTarget target = prepared_statement->parameters[i].target;
+    if (target == PARAM_X || target == PARAM_Y) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * called once the tokens ran out to check that the statement isn't missing anything for its command type.
+ */
+static int check_statement_complete(PreparedStatement *prepared_statement, Step step, error_callback ec_func, int position) {
+  CommandType ct = prepared_statement->command_type;
+  bool complete = false;
+  switch (step) {
+    case ID:
+      complete = ct == DROP;
+      break;
+    case BOUNDS_OR_POINT:
+      complete = ct == GET || ct == DELETE;
+      break;
+    case FIELD_NAME:
+      complete = ct == FSET && prepared_statement->fields_count > 0;
+      break;
+    case Y_VALUE:
+      complete = prepared_statement->geometry.type == GEOMETRY_LINE_STRING;
+      break;
+    case Z_VALUE:
+    case END_OF_STATEMENT:
+      complete = true;
+      break;
+    case CHANNEL:
+      complete = ct == DELCHAN;
+      break;
+    case DISTANCE_VALUE:
+      if (ct == SETCHAN) {
+        break;
+      }
+      // NEARBY key POINT lat lon distance: the single value after lon is the distance, not z.
+      if (prepared_statement->geometry.point.z < 0) {
+        if (ec_func != NULL) {
+          internal_error_callback_handler(ec_func, INVALID_DISTANCE_VALUE, "Distance must not be negative", position);
+        }
+        return INVALID_DISTANCE_VALUE;
+      }
+      prepared_statement->distance = prepared_statement->geometry.point.z;
+      prepared_statement->geometry.point.z = 0;
+      prepared_statement->geometry.point.has_z = false;
+      if (prepared_statement->parameters_count > 0 &&
+          prepared_statement->parameters[prepared_statement->parameters_count - 1].target == PARAM_Z) {
+        prepared_statement->parameters[prepared_statement->parameters_count - 1].target = PARAM_DISTANCE;
+      }
+      complete = true;
+      break;
+    default:
+      break;
+  }
+
+  if (!complete) {
+    if (ec_func != NULL) {
+      internal_error_callback_handler(ec_func, END_OF_TOKENS_REACHED, "Statement ended unexpectedly", position);
+    }
+    return END_OF_TOKENS_REACHED;
+  }
+
+  if (step == Y_VALUE) {
+    LineString *ring = &prepared_statement->geometry.line_string;
+    // a ring needs at least 3 distinct points plus the closing point. Placeholder coordinates are checked once bound.
+    bool placeholders = ring_has_parameters(prepared_statement);
+    if (ring->points_count < 4 ||
+        (!placeholders && points_equal(&ring->points[0], &ring->points[ring->points_count - 1]) != 0)) {
+      if (ec_func != NULL) {
+        internal_error_callback_handler(ec_func, INVALID_RING, "BOUNDS must be a ring where the last point equals the first", position);
+      }
+      return INVALID_RING;
+    }
+    ring->is_closed = !placeholders;
+  }
+  return PARSE_OK;
+}
+
+/*
+ * `make_prepared_statement` that also points `end` at where the tokenizer stopped: the NUL or newline ending the
+ * statement when it was read through, else the start of the token it failed on.
+ */
+static int parse_statement(const char *cmd, const char **end, PreparedStatement *prepared_statement, Arena *arena,
+                           error_callback ec_func) {
   TokenType tt = 0;
+  DecimalNumber number = { 0 };
   size_t len;
   const char *cursor = cmd;
-  Point *cur_point;
+  Point cur_point = { 0 };
+  size_t ring_capacity = 0;
+  size_t parameters_capacity = 0;
+  size_t fields_capacity = 0;
+  size_t wheres_capacity = 0;
+  bool has_limit = false;
+  bool or_pending = false; // the next WHERE starts a group
+  bool expires = false;
   Step step = UNKNOWN_STEP;
+
+  prepared_statement->key = (Span){ 0 };
+  prepared_statement->id = (Span){ 0 };
+  prepared_statement->channel = (Span){ 0 };
+  prepared_statement->geometry = (Geometry){ .type = GEOMETRY_POINT };
+  prepared_statement->limit = 0;
+  prepared_statement->distance = INFINITY;
+  prepared_statement->fields = NULL;
+  prepared_statement->fields_count = 0;
+  prepared_statement->with_fields = false;
+  prepared_statement->expire_seconds = 0;
+  prepared_statement->wheres = NULL;
+  prepared_statement->wheres_count = 0;
+  prepared_statement->parameters = NULL;
+  prepared_statement->parameters_count = 0;
+  prepared_statement->unbound_count = 0;
   
-  while (*cursor != '\0') {
-    len = get_next_token_len(cursor, &tt);
+  while (CHAR_CLASS[(unsigned char)*cursor] != CC_NUL) {
+    *end = cursor;
+    len = get_next_token_len(cursor, &tt, &number);
     if (tt == TOKEN_ERROR) {
       if (ec_func != NULL) {
         internal_error_callback_handler(ec_func, INVALID_TOKEN, "Invalid token in statement", (cursor-cmd));
@@ -237,23 +637,43 @@ int make_prepared_statement(const char *cmd, PreparedStatement *prepared_stateme
       continue;
     }
 
+    Keyword kw = tt == TOKEN_STRING ? lookup_keyword(cursor, len) : KW_NONE;
+
     switch(step) {
       case UNKNOWN_STEP: {
-        if (strncmpci(cursor, GET_KEYWORD, len) == 0) {
+        if (kw == KW_GET) {
           prepared_statement->command_type = GET;
           step = KEY;
-        } else if (strncmpci(cursor, SET_KEYWORD, len) == 0) {
+        } else if (kw == KW_SET) {
           prepared_statement->command_type = SET;
           step = KEY;
-        } else if (strncmpci(cursor, DELETE_KEYWORD, len) == 0) {
+        } else if (kw == KW_DEL) {
           prepared_statement->command_type = DELETE;
           step = KEY;
-        } else if (strncmpci(cursor, DROP_KEYWORD, len) == 0) {
+        } else if (kw == KW_DROP) {
           prepared_statement->command_type = DROP;
           step = KEY;
+        } else if (kw == KW_NEARBY) {
+          prepared_statement->command_type = NEARBY;
+          step = KEY;
+        } else if (kw == KW_WITHIN) {
+          prepared_statement->command_type = WITHIN;
+          step = KEY;
+        } else if (kw == KW_INTERSECTS) {
+          prepared_statement->command_type = INTERSECTS;
+          step = KEY;
+        } else if (kw == KW_SETCHAN) {
+          prepared_statement->command_type = SETCHAN;
+          step = CHANNEL;
+        } else if (kw == KW_DELCHAN) {
+          prepared_statement->command_type = DELCHAN;
+          step = CHANNEL;
+        } else if (kw == KW_FSET) {
+          prepared_statement->command_type = FSET;
+          step = KEY;
         }
         // didn't set next step
-        if (step != KEY) {
+        if (step != KEY && step != CHANNEL) {
           if (ec_func != NULL) {
             internal_error_callback_handler(ec_func, INVALID_COMMAND_TYPE, "Invalid command type keyword", (cursor-cmd));
           }
@@ -264,7 +684,12 @@ int make_prepared_statement(const char *cmd, PreparedStatement *prepared_stateme
         break;
       }
       case KEY: {
-        if (tt == TOKEN_INTEGER || tt == TOKEN_DOUBLE || ((tt == TOKEN_STRING) && (is_reserved_word(cursor, len) != 0))) {
+        if (tt == TOKEN_PARAMETER) {
+          int rc = add_parameter(arena, prepared_statement, &parameters_capacity, PARAM_KEY, ec_func, (cursor-cmd));
+          if (rc != PARSE_OK) {
+            return rc;
+          }
+        } else if (tt == TOKEN_INTEGER || tt == TOKEN_DOUBLE || ((tt == TOKEN_STRING) && kw == KW_NONE)) {
           /* Changing to Span
           char *key = malloc(sizeof(char) * len + 1);
           if (key == NULL) {
@@ -287,7 +712,59 @@ int make_prepared_statement(const char *cmd, PreparedStatement *prepared_stateme
         }
         // increment cursor
         cursor += len;
-        step = ID;
+        if (prepared_statement->command_type == SETCHAN) {
+          step = FENCE;
+        } else if (prepared_statement->command_type == NEARBY) {
+          step = LIMIT_OR_POINT;
+        } else if (prepared_statement->command_type == WITHIN || prepared_statement->command_type == INTERSECTS) {
+          step = BOUNDS;
+        } else {
+          step = ID;
+        }
+        break;
+      }
+      case CHANNEL: {
+        if (tt == TOKEN_PARAMETER) {
+          int rc = add_parameter(arena, prepared_statement, &parameters_capacity, PARAM_CHANNEL, ec_func, (cursor-cmd));
+          if (rc != PARSE_OK) {
+            return rc;
+          }
+        } else if (tt == TOKEN_INTEGER || tt == TOKEN_DOUBLE || (tt == TOKEN_STRING && kw == KW_NONE)) {
+          prepared_statement->channel = (Span){ .start = cursor, .length = len };
+        } else {
+          if (ec_func != NULL) {
+            internal_error_callback_handler(ec_func, INVALID_CHANNEL_VALUE, "Invalid channel name", (cursor-cmd));
+          }
+          return INVALID_CHANNEL_VALUE;
+        }
+        cursor += len;
+        step = prepared_statement->command_type == SETCHAN ? FENCE_COMMAND : END_OF_STATEMENT;
+        break;
+      }
+      case FENCE_COMMAND: {
+        if (kw == KW_NEARBY) {
+          prepared_statement->fence_command = NEARBY;
+        } else if (kw == KW_WITHIN) {
+          prepared_statement->fence_command = WITHIN;
+        } else {
+          if (ec_func != NULL) {
+            internal_error_callback_handler(ec_func, INVALID_FENCE, "Expected NEARBY or WITHIN keyword", (cursor-cmd));
+          }
+          return INVALID_FENCE;
+        }
+        cursor += len;
+        step = KEY;
+        break;
+      }
+      case FENCE: {
+        if (kw != KW_FENCE) {
+          if (ec_func != NULL) {
+            internal_error_callback_handler(ec_func, INVALID_FENCE, "Expected FENCE keyword", (cursor-cmd));
+          }
+          return INVALID_FENCE;
+        }
+        cursor += len;
+        step = prepared_statement->fence_command == NEARBY ? POINT : BOUNDS;
         break;
       }
       case ID: {
@@ -299,7 +776,12 @@ int make_prepared_statement(const char *cmd, PreparedStatement *prepared_stateme
           return EXPECTED_END_OF_TOKENS;
         }
 
-        if (tt == TOKEN_INTEGER || tt == TOKEN_DOUBLE || (tt == TOKEN_STRING && (is_reserved_word(cursor, len) != 0))) {
+        if (tt == TOKEN_PARAMETER) {
+          int rc = add_parameter(arena, prepared_statement, &parameters_capacity, PARAM_ID, ec_func, (cursor-cmd));
+          if (rc != PARSE_OK) {
+            return rc;
+          }
+        } else if (tt == TOKEN_INTEGER || tt == TOKEN_DOUBLE || (tt == TOKEN_STRING && kw == KW_NONE)) {
           /* Changing to Span
           char *id = malloc(sizeof(char) * len + 1);
           if (id == NULL) {
@@ -313,7 +795,7 @@ int make_prepared_statement(const char *cmd, PreparedStatement *prepared_stateme
           prepared_statement->id = id;
           */
 
-          prepared_statement->key = (Span){ .start = cursor, .length = len };
+          prepared_statement->id = (Span){ .start = cursor, .length = len };
         } else {
           if (ec_func != NULL) {
             internal_error_callback_handler(ec_func, INVALID_ID_VALUE, "Invalid id value", (cursor-cmd));
@@ -323,139 +805,381 @@ int make_prepared_statement(const char *cmd, PreparedStatement *prepared_stateme
 
 
         cursor += len;
-        step = BOUNDS_OR_POINT;
+        step = prepared_statement->command_type == FSET ? FIELD_NAME : BOUNDS_OR_POINT;
         break;
       }
       case BOUNDS_OR_POINT: {
+        if (prepared_statement->command_type == GET && kw == KW_WITHFIELDS) {
+          prepared_statement->with_fields = true;
+          cursor += len;
+          step = END_OF_STATEMENT;
+          break;
+        }
         if (prepared_statement->command_type == GET || prepared_statement->command_type == DELETE) {
           if (ec_func != NULL) {
             internal_error_callback_handler(ec_func, EXPECTED_END_OF_TOKENS, "Expected end of tokens in GET/DELETE statement.", (cursor-cmd));
           }
           return EXPECTED_END_OF_TOKENS;
+        }
+
+        // fields and the expiration come before the geometry: SET key id FIELD speed 90 EX 120 POINT lat lon.
+        if (kw == KW_FIELD) {
+          cursor += len;
+          step = FIELD_NAME;
+          break;
+        }
+        if (kw == KW_EX && !expires) {
+          expires = true;
+          cursor += len;
+          step = EXPIRE_VALUE;
+          break;
+        }
+        if (kw == KW_BOUNDS) {
+          prepared_statement->geometry = (Geometry){ .type = GEOMETRY_LINE_STRING };
+        } else if (kw == KW_POINT) {
+          prepared_statement->geometry = (Geometry){ .type = GEOMETRY_POINT };
         } else {
-          
+          if (ec_func != NULL) {
+            internal_error_callback_handler(ec_func, INVALID_BOUNDS_OR_POINT, "Expected BOUNDS or POINT keyword", (cursor-cmd));
+          }
+          return INVALID_BOUNDS_OR_POINT;
+        }
 
-          if ((strncmpci(cursor, BOUND_KEYWORD, len) != 0) && (strncmpci(cursor, POINT_KEYWORD, len) != 0)) {
+        // lat (y) comes first, see README.
+        step = Y_VALUE;
+        cursor += len;
+        break;
+      }
+      case FIELD_NAME: {
+        // any word goes, its position tells it is a field name.
+        if (tt != TOKEN_STRING) {
+          if (ec_func != NULL) {
+            internal_error_callback_handler(ec_func, INVALID_FIELD_NAME, "Invalid field name", (cursor-cmd));
+          }
+          return INVALID_FIELD_NAME;
+        }
+        if (append_field(arena, prepared_statement, &fields_capacity, cursor, len) != 0) {
+          if (ec_func != NULL) {
+            internal_error_callback_handler(ec_func, OUT_OF_MEMORY, "Failed to allocate fields.", (cursor-cmd));
+          }
+          return OUT_OF_MEMORY;
+        }
+        cursor += len;
+        step = FIELD_VALUE;
+        break;
+      }
+      case FIELD_VALUE: {
+        FieldValue *field = &prepared_statement->fields[prepared_statement->fields_count - 1];
+        if (tt == TOKEN_PARAMETER) {
+          int rc = add_parameter(arena, prepared_statement, &parameters_capacity, PARAM_FIELD, ec_func, (cursor-cmd));
+          if (rc != PARSE_OK) {
+            return rc;
+          }
+          prepared_statement->parameters[prepared_statement->parameters_count - 1].point =
+              prepared_statement->fields_count - 1;
+        } else {
+          const char *cause = "Expected integer or double field value";
+          if (tt == TOKEN_DOUBLE || tt == TOKEN_INTEGER) {
+            cause = parse_number(&number, cursor, len, &field->value);
+          }
+          if (cause != NULL) {
             if (ec_func != NULL) {
-              internal_error_callback_handler(ec_func, INVALID_BOUNDS_OR_POINT, "Expected BOUND or POINT keyword", (cursor-cmd));
+              internal_error_callback_handler(ec_func, INVALID_FIELD_VALUE, cause, (cursor-cmd));
             }
-            return INVALID_BOUNDS_OR_POINT;
+            return INVALID_FIELD_VALUE;
           }
         }
-
-        // FIXME uses heap :(
-        cur_point = malloc(sizeof(Point));
-        if (cur_point == NULL) {
+        cursor += len;
+        step = prepared_statement->command_type == FSET ? FIELD_NAME : BOUNDS_OR_POINT;
+        break;
+      }
+      case EXPIRE_VALUE: {
+        if (tt == TOKEN_PARAMETER) {
+          int rc = add_parameter(arena, prepared_statement, &parameters_capacity, PARAM_EXPIRE, ec_func, (cursor-cmd));
+          if (rc != PARSE_OK) {
+            return rc;
+          }
+        } else {
+          const char *cause = "Expected integer or double seconds";
+          if (tt == TOKEN_DOUBLE || tt == TOKEN_INTEGER) {
+            cause = parse_number(&number, cursor, len, &prepared_statement->expire_seconds);
+          }
+          if (cause == NULL && !(prepared_statement->expire_seconds > 0 &&
+                                 prepared_statement->expire_seconds <= MAX_EXPIRE_SECONDS)) {
+            cause = "Seconds out of range";
+          }
+          if (cause != NULL) {
+            if (ec_func != NULL) {
+              internal_error_callback_handler(ec_func, INVALID_EXPIRE_VALUE, cause, (cursor-cmd));
+            }
+            return INVALID_EXPIRE_VALUE;
+          }
+        }
+        cursor += len;
+        step = BOUNDS_OR_POINT;
+        break;
+      }
+      case LIMIT_OR_POINT: {
+        if (kw == KW_WHERE || kw == KW_OR) {
+          step = WHERE_KEYWORD;
+          break;
+        }
+        if (kw == KW_LIMIT && !has_limit) {
+          has_limit = true;
+          step = LIMIT_VALUE;
+        } else if (kw == KW_POINT) {
+          step = Y_VALUE;
+        } else {
+          if (ec_func != NULL) {
+            internal_error_callback_handler(ec_func, INVALID_BOUNDS_OR_POINT, "Expected LIMIT, WHERE or POINT keyword", (cursor-cmd));
+          }
+          return INVALID_BOUNDS_OR_POINT;
+        }
+        cursor += len;
+        break;
+      }
+      case WHERE_KEYWORD: {
+        // OR only goes between two WHERE clauses: NEARBY key WHERE a 1 1 OR WHERE b 1 1 POINT lat lon.
+        if (kw == KW_OR && !or_pending && prepared_statement->wheres_count > 0) {
+          or_pending = true;
+          cursor += len;
+          break;
+        }
+        if (kw != KW_WHERE) {
           if (ec_func != NULL) {
-            internal_error_callback_handler(ec_func, OUT_OF_MEMORY, "Malloc returned NULL for point.", (cursor-cmd));
+            internal_error_callback_handler(ec_func, INVALID_WHERE_CLAUSE, "Expected WHERE keyword", (cursor-cmd));
+          }
+          return INVALID_WHERE_CLAUSE;
+        }
+        cursor += len;
+        step = WHERE_FIELD;
+        break;
+      }
+      case WHERE_FIELD: {
+        if (tt != TOKEN_STRING) {
+          if (ec_func != NULL) {
+            internal_error_callback_handler(ec_func, INVALID_FIELD_NAME, "Invalid field name", (cursor-cmd));
+          }
+          return INVALID_FIELD_NAME;
+        }
+        if (append_where(arena, prepared_statement, &wheres_capacity, cursor, len, or_pending) != 0) {
+          if (ec_func != NULL) {
+            internal_error_callback_handler(ec_func, OUT_OF_MEMORY, "Failed to allocate where clauses.", (cursor-cmd));
           }
           return OUT_OF_MEMORY;
         }
-
-        step = X_VALUE;
+        or_pending = false;
         cursor += len;
+        step = WHERE_MIN;
         break;
       }
-      case X_VALUE: {
-        if (tt != TOKEN_DOUBLE && tt != TOKEN_INTEGER) {
+      case WHERE_MIN:
+      case WHERE_MAX: {
+        WhereClause *where = &prepared_statement->wheres[prepared_statement->wheres_count - 1];
+        if (tt == TOKEN_PARAMETER) {
+          int rc = add_parameter(arena, prepared_statement, &parameters_capacity,
+                                 step == WHERE_MIN ? PARAM_WHERE_MIN : PARAM_WHERE_MAX, ec_func, (cursor-cmd));
+          if (rc != PARSE_OK) {
+            return rc;
+          }
+          prepared_statement->parameters[prepared_statement->parameters_count - 1].point =
+              prepared_statement->wheres_count - 1;
+        } else {
+          const char *cause = parse_where_bound(tt, &number, cursor, len, step == WHERE_MIN ? &where->min : &where->max);
+          if (cause != NULL) {
+            if (ec_func != NULL) {
+              internal_error_callback_handler(ec_func, INVALID_WHERE_VALUE, cause, (cursor-cmd));
+            }
+            return INVALID_WHERE_VALUE;
+          }
+        }
+        cursor += len;
+        if (step == WHERE_MIN) {
+          step = WHERE_MAX;
+        } else {
+          step = prepared_statement->command_type == NEARBY ? LIMIT_OR_POINT : BOUNDS;
+        }
+        break;
+      }
+      case LIMIT_VALUE: {
+        if (tt == TOKEN_PARAMETER) {
+          int rc = add_parameter(arena, prepared_statement, &parameters_capacity, PARAM_LIMIT, ec_func, (cursor-cmd));
+          if (rc != PARSE_OK) {
+            return rc;
+          }
+          cursor += len;
+          step = LIMIT_OR_POINT;
+          break;
+        }
+        // an integer token with more than 19 significant digits keeps a positive exponent and is rejected.
+        if (tt != TOKEN_INTEGER || number.negative || number.exponent != 0 || number.mantissa == 0 ||
+            (size_t)number.mantissa != number.mantissa) {
           if (ec_func != NULL) {
-            internal_error_callback_handler(ec_func, INVALID_X_VALUE, "Expected integer or double x value", (cursor-cmd));
+            internal_error_callback_handler(ec_func, INVALID_LIMIT_VALUE, "Expected positive integer limit", (cursor-cmd));
           }
-          return INVALID_X_VALUE;
+          return INVALID_LIMIT_VALUE;
         }
-        char *tail;
-        errno = 0;
-        double val = strtod(cursor, &tail);        
-
-        // check if errno got set (overflow happened).
-        if (errno != 0) {
+        prepared_statement->limit = (size_t)number.mantissa;
+        cursor += len;
+        step = LIMIT_OR_POINT;
+        break;
+      }
+      case BOUNDS: {
+        // fences don't filter.
+        bool filtered = prepared_statement->command_type == WITHIN || prepared_statement->command_type == INTERSECTS;
+        if (filtered && (kw == KW_WHERE || kw == KW_OR)) {
+          step = WHERE_KEYWORD;
+          break;
+        }
+        if (kw != KW_BOUNDS) {
           if (ec_func != NULL) {
-            // FIXME strerror -> strerror_s?
-            internal_error_callback_handler(ec_func, INVALID_X_VALUE, strerror(errno), (cursor-cmd));
+            internal_error_callback_handler(ec_func, INVALID_BOUNDS_OR_POINT,
+                                            filtered ? "Expected WHERE or BOUNDS keyword" : "Expected BOUNDS keyword",
+                                            (cursor-cmd));
           }
-          return INVALID_X_VALUE;
+          return INVALID_BOUNDS_OR_POINT;
         }
-
-        //check we get the whole expected number parsed.
-        if (*tail != *(cursor + len)) {
+        prepared_statement->geometry = (Geometry){ .type = GEOMETRY_LINE_STRING };
+        cursor += len;
+        step = Y_VALUE;
+        break;
+      }
+      case POINT: {
+        if (kw != KW_POINT) {
           if (ec_func != NULL) {
-            internal_error_callback_handler(ec_func, INVALID_X_VALUE, "Failed to parse entire x value.", (cursor-cmd));
+            internal_error_callback_handler(ec_func, INVALID_BOUNDS_OR_POINT, "Expected POINT keyword", (cursor-cmd));
           }
-          return INVALID_X_VALUE;
+          return INVALID_BOUNDS_OR_POINT;
         }
-
-        cur_point->x = val;
         cursor += len;
         step = Y_VALUE;
         break;
       }
       case Y_VALUE: {
+        if (tt == TOKEN_PARAMETER) {
+          int rc = add_parameter(arena, prepared_statement, &parameters_capacity, PARAM_Y, ec_func, (cursor-cmd));
+          if (rc != PARSE_OK) {
+            return rc;
+          }
+          cur_point.y = 0;
+          cursor += len;
+          step = X_VALUE;
+          break;
+        }
         if (tt != TOKEN_DOUBLE && tt != TOKEN_INTEGER) {
           if (ec_func != NULL) {
             internal_error_callback_handler(ec_func, INVALID_Y_VALUE, "Expected integer or double y value", (cursor-cmd));
           }
           return INVALID_Y_VALUE;
         }
-        char *tail;
-        errno = 0;
-        double val = strtod(cursor, &tail);        
 
-        // check if errno got set (overflow happened).
-        if (errno != 0) {
+        const char *cause = parse_number(&number, cursor, len, &cur_point.y);
+        if (cause != NULL) {
           if (ec_func != NULL) {
-            // FIXME strerror -> strerror_s?
-            internal_error_callback_handler(ec_func, INVALID_Y_VALUE, strerror(errno), (cursor-cmd));
+            internal_error_callback_handler(ec_func, INVALID_Y_VALUE, cause, (cursor-cmd));
           }
           return INVALID_Y_VALUE;
         }
 
-        //check we get the whole expected number parsed.
-        if (*tail != *(cursor + len)) {
+        cursor += len;
+        step = X_VALUE;
+        break;
+      }
+      case X_VALUE: {
+        if (tt == TOKEN_PARAMETER) {
+          int rc = add_parameter(arena, prepared_statement, &parameters_capacity, PARAM_X, ec_func, (cursor-cmd));
+          if (rc != PARSE_OK) {
+            return rc;
+          }
+          cur_point.x = 0;
+        } else if (tt != TOKEN_DOUBLE && tt != TOKEN_INTEGER) {
           if (ec_func != NULL) {
-            internal_error_callback_handler(ec_func, INVALID_Y_VALUE, "Failed to parse entire y value.", (cursor-cmd));
+            internal_error_callback_handler(ec_func, INVALID_X_VALUE, "Expected integer or double x value", (cursor-cmd));
+          }
+          return INVALID_X_VALUE;
+        } else {
+          const char *cause = parse_number(&number, cursor, len, &cur_point.x);
+          if (cause != NULL) {
+            if (ec_func != NULL) {
+              internal_error_callback_handler(ec_func, INVALID_X_VALUE, cause, (cursor-cmd));
+            }
+            return INVALID_X_VALUE;
           }
-          return INVALID_Y_VALUE;
         }
 
-        cur_point->y = val;
         cursor += len;
-        step = Z_VALUE;
+        if (prepared_statement->geometry.type == GEOMETRY_POINT) {
+          prepared_statement->geometry.point = cur_point;
+          // a NEARBY fence is a circle on the lat/lon plane, it takes its radius straight away.
+          step = prepared_statement->command_type == SETCHAN ? DISTANCE_VALUE : Z_VALUE;
+        } else {
+          if (append_ring_point(arena, &prepared_statement->geometry.line_string, &ring_capacity, &cur_point) != 0) {
+            if (ec_func != NULL) {
+              internal_error_callback_handler(ec_func, OUT_OF_MEMORY, "Failed to allocate ring points.", (cursor-cmd));
+            }
+            return OUT_OF_MEMORY;
+          }
+          step = Y_VALUE;
+        }
         break;
       }
       case Z_VALUE: {
-        cur_point->has_z = true;
-        if (tt != TOKEN_DOUBLE && tt != TOKEN_INTEGER) {
+        if (tt == TOKEN_PARAMETER) {
+          int rc = add_parameter(arena, prepared_statement, &parameters_capacity, PARAM_Z, ec_func, (cursor-cmd));
+          if (rc != PARSE_OK) {
+            return rc;
+          }
+        } else if (tt != TOKEN_DOUBLE && tt != TOKEN_INTEGER) {
           if (ec_func != NULL) {
             internal_error_callback_handler(ec_func, INVALID_Z_VALUE, "Expected integer or double z value", (cursor-cmd));
           }
           return INVALID_Z_VALUE;
+        } else {
+          const char *cause = parse_number(&number, cursor, len, &prepared_statement->geometry.point.z);
+          if (cause != NULL) {
+            if (ec_func != NULL) {
+              internal_error_callback_handler(ec_func, INVALID_Z_VALUE, cause, (cursor-cmd));
+            }
+            return INVALID_Z_VALUE;
+          }
         }
-        char *tail;
-        errno = 0;
-        double val = strtod(cursor, &tail);        
 
-        // check if errno got set (overflow happened).
-        if (errno != 0) {
-          if (ec_func != NULL) {
-            // FIXME strerror -> strerror_s?
-            internal_error_callback_handler(ec_func, INVALID_Z_VALUE, strerror(errno), (cursor-cmd));
+        prepared_statement->geometry.point.has_z = true;
+        cursor += len;
+        // NEARBY takes a distance after the optional z. If no distance follows, the value was the distance.
+        step = prepared_statement->command_type == NEARBY ? DISTANCE_VALUE : END_OF_STATEMENT;
+        break;
+      }
+      case DISTANCE_VALUE: {
+        if (tt == TOKEN_PARAMETER) {
+          int rc = add_parameter(arena, prepared_statement, &parameters_capacity, PARAM_DISTANCE, ec_func, (cursor-cmd));
+          if (rc != PARSE_OK) {
+            return rc;
           }
-          return INVALID_Z_VALUE;
+          cursor += len;
+          step = END_OF_STATEMENT;
+          break;
         }
-
-        //check we get the whole expected number parsed.
-        if (*tail != *(cursor + len)) {
+        const char *cause = "Expected integer or double distance value";
+        if (tt == TOKEN_DOUBLE || tt == TOKEN_INTEGER) {
+          cause = parse_number(&number, cursor, len, &prepared_statement->distance);
+        }
+        if (cause != NULL || prepared_statement->distance < 0) {
           if (ec_func != NULL) {
-            internal_error_callback_handler(ec_func, INVALID_Z_VALUE, "Failed to parse entire z value.", (cursor-cmd));
+            internal_error_callback_handler(ec_func, INVALID_DISTANCE_VALUE, cause != NULL ? cause : "Distance must not be negative", (cursor-cmd));
           }
-          return INVALID_Z_VALUE;
+          return INVALID_DISTANCE_VALUE;
         }
-
-        cur_point->y = val;
         cursor += len;
-        step = Z_VALUE;
+        step = END_OF_STATEMENT;
         break;
       }
+      case END_OF_STATEMENT: {
+        if (ec_func != NULL) {
+          internal_error_callback_handler(ec_func, EXPECTED_END_OF_TOKENS, "Expected end of statement.", (cursor-cmd));
+        }
+        return EXPECTED_END_OF_TOKENS;
+      }
 
       default: {
         if (ec_func != NULL) {
@@ -465,5 +1189,175 @@ int make_prepared_statement(const char *cmd, PreparedStatement *prepared_stateme
       }
     }
   }
-  return PARSE_OK;
+
+  *end = cursor;
+  return check_statement_complete(prepared_statement, step, ec_func, (cursor-cmd));
+}
+
+/*
+ * creates a prepared statement from a given command string.
+ *
+ * parameters:
+ *  - `cmd` is command to be transformed into a PreparedStatement, it ends at the first NUL or newline.
+ *  - `prepared_statement` out param which contains the fully created PreparedStatement from the command string. Its spans point into `cmd`.
+ *  - `arena` which every allocation of the statement (ring points) is carved from. The statement is released along with them by `arena_reset`, whatever the return value.
+ *  - `error_callback` function of type `void FUNC_NAME(int error_code, const char *error_message)` which is used to handle any logging that the user wants to do.
+ *
+ * returns a int (ParserResult enum value). Follows c common practice of:
+ *  - 0 if successful
+ *  - else, error where the return value matches the error_code (reason of failure).
+ *
+ */
+int make_prepared_statement(const char *cmd, PreparedStatement *prepared_statement, Arena *arena, error_callback ec_func) {
+  const char *end;
+  return parse_statement(cmd, &end, prepared_statement, arena, ec_func);
+}
+
+int make_next_prepared_statement(const char *cmd, const char **next, PreparedStatement *prepared_statement, Arena *arena,
+                                 error_callback ec_func) {
+  const char *end = cmd;
+  int rc = parse_statement(cmd, &end, prepared_statement, arena, ec_func);
+  // a statement that failed part way is skipped from where parsing stopped, its bytes before that aren't read again.
+  while (*end != '\0' && *end != '\n') {
+    end++;
+  }
+  *next = *end == '\n' ? end + 1 : end;
+  return rc;
+}
+
+/*
+ * marks placeholder `index` bound. returns its parameter, or NULL when there is no such placeholder or it doesn't take
+ * a value of the given kind.
+ */
+static Parameter *bind_parameter(PreparedStatement *prepared_statement, size_t index, bool span) {
+  if (index >= prepared_statement->parameters_count) {
+    return NULL;
+  }
+  Parameter *parameter = &prepared_statement->parameters[index];
+  ParameterTarget target = parameter->target;
+  bool takes_span = target == PARAM_KEY || target == PARAM_ID || target == PARAM_CHANNEL;
+  if (takes_span != span) {
+    return NULL;
+  }
+  return parameter;
+}
+
+static void mark_bound(PreparedStatement *prepared_statement, Parameter *parameter) {
+  if (!parameter->bound) {
+    parameter->bound = true;
+    prepared_statement->unbound_count--;
+  }
+}
+
+int bind_span(PreparedStatement *prepared_statement, size_t index, const char *bytes, size_t length) {
+  Parameter *parameter = bind_parameter(prepared_statement, index, true);
+  if (parameter == NULL) {
+    return 1;
+  }
+
+  Span span = { .start = bytes, .length = length };
+  if (parameter->target == PARAM_KEY) {
+    prepared_statement->key = span;
+  } else if (parameter->target == PARAM_ID) {
+    prepared_statement->id = span;
+  } else {
+    prepared_statement->channel = span;
+  }
+  mark_bound(prepared_statement, parameter);
+  return 0;
+}
+
+int bind_double(PreparedStatement *prepared_statement, size_t index, double value) {
+  Parameter *parameter = bind_parameter(prepared_statement, index, false);
+  if (parameter == NULL || isnan(value)) {
+    return 1;
+  }
+  bool where_bound = parameter->target == PARAM_WHERE_MIN || parameter->target == PARAM_WHERE_MAX;
+  if (!where_bound && isinf(value)) {
+    return 1;
+  }
+
+  Geometry *geometry = &prepared_statement->geometry;
+  switch (parameter->target) {
+    case PARAM_Y:
+    case PARAM_X: {
+      Point *p = geometry->type == GEOMETRY_POINT ? &geometry->point : &geometry->line_string.points[parameter->point];
+      if (parameter->target == PARAM_Y) {
+        p->y = value;
+      } else {
+        p->x = value;
+      }
+      if (geometry->type == GEOMETRY_LINE_STRING) {
+        LineString *ring = &geometry->line_string;
+        ring->is_closed = points_equal(&ring->points[0], &ring->points[ring->points_count - 1]) == 0;
+      }
+      break;
+    }
+    case PARAM_Z: {
+      geometry->point.z = value;
+      break;
+    }
+    case PARAM_LIMIT: {
+      // a whole number that fits size_t (SIZE_MAX itself rounds up to a power of 2 as a double).
+      if (value < 1 || value >= (double)SIZE_MAX || value != floor(value)) {
+        return 1;
+      }
+      prepared_statement->limit = (size_t)value;
+      break;
+    }
+    case PARAM_DISTANCE: {
+      if (value < 0) {
+        return 1;
+      }
+      prepared_statement->distance = value;
+      break;
+    }
+    case PARAM_FIELD: {
+      prepared_statement->fields[parameter->point].value = value;
+      break;
+    }
+    case PARAM_WHERE_MIN: {
+      prepared_statement->wheres[parameter->point].min = value;
+      break;
+    }
+    case PARAM_WHERE_MAX: {
+      prepared_statement->wheres[parameter->point].max = value;
+      break;
+    }
+    case PARAM_EXPIRE: {
+      if (value <= 0 || value > MAX_EXPIRE_SECONDS) {
+        return 1;
+      }
+      prepared_statement->expire_seconds = value;
+      break;
+    }
+    default: {
+      return 1;
+    }
+  }
+  mark_bound(prepared_statement, parameter);
+  return 0;
+}
+
+void reset_prepared_statement(PreparedStatement *prepared_statement) {
+  for (size_t i = 0; i < prepared_statement->parameters_count; i++) {
+    prepared_statement->parameters[i].bound = false;
+  }
+  prepared_statement->unbound_count = prepared_statement->parameters_count;
+}
+
+const char *command_type_to_string(CommandType command_type) {
+  static const char *const names[COMMAND_TYPES_COUNT] = {
+    [DELETE] = "DEL",
+    [GET] = "GET",
+    [SET] = "SET",
+    [DROP] = "DROP",
+    [NEARBY] = "NEARBY",
+    [WITHIN] = "WITHIN",
+    [INTERSECTS] = "INTERSECTS",
+    [SETCHAN] = "SETCHAN",
+    [DELCHAN] = "DELCHAN",
+    [FSET] = "FSET",
+  };
+  return (unsigned)command_type < COMMAND_TYPES_COUNT ? names[command_type] : "UNKNOWN";
 }
@@ -0,0 +1,378 @@
+#include "polygon.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define POLYGON_EDGES_PER_BUCKET 8
+
+static int build_buckets(Polygon *polygon) {
+  size_t edges = polygon->count - 1;
+  uint32_t buckets = (uint32_t)(edges / POLYGON_EDGES_PER_BUCKET);
+  double height = (polygon->rect.max_y - polygon->rect.min_y) / buckets;
+  if (buckets == 0 || height <= 0) {
+    return 0;
+  }
+
+  uint32_t *offsets = calloc(buckets + 1, sizeof(uint32_t));
+  if (offsets == NULL) {
+    return 1;
+  }
+
+  // first pass counts the edges per band, second pass fills them in (counting sort).
+  for (int pass = 0; pass < 2; pass++) {
+    uint32_t *cursor = NULL;
+    if (pass == 1) {
+      for (uint32_t b = 0; b < buckets; b++) {
+        offsets[b + 1] += offsets[b];
+      }
+      polygon->bucket_edges = malloc(sizeof(uint32_t) * (offsets[buckets] + 1));
+      cursor = malloc(sizeof(uint32_t) * buckets);
+      if (polygon->bucket_edges == NULL || cursor == NULL) {
+        free(polygon->bucket_edges);
+        polygon->bucket_edges = NULL;
+        free(cursor);
+        free(offsets);
+        return 1;
+      }
+      memcpy(cursor, offsets, sizeof(uint32_t) * buckets);
+    }
+
+    // horizontal edges never cross the ray but are kept, the edge intersection tests look them up too.
+    for (size_t i = 0; i < edges; i++) {
+      double y1 = polygon->ys[i];
+      double y2 = polygon->ys[i + 1];
+      double lo = y1 < y2 ? y1 : y2;
+      double hi = y1 < y2 ? y2 : y1;
+      uint32_t first = (uint32_t)((lo - polygon->rect.min_y) / height);
+      uint32_t last = (uint32_t)((hi - polygon->rect.min_y) / height);
+      // the top of the ring falls just past the last band.
+      if (first >= buckets) {
+        first = buckets - 1;
+      }
+      if (last >= buckets) {
+        last = buckets - 1;
+      }
+      for (uint32_t b = first; b <= last; b++) {
+        if (pass == 0) {
+          offsets[b + 1]++;
+        } else {
+          polygon->bucket_edges[cursor[b]++] = (uint32_t)i;
+        }
+      }
+    }
+    free(cursor);
+  }
+
+  polygon->buckets_count = buckets;
+  polygon->bucket_height = height;
+  polygon->bucket_offsets = offsets;
+  return 0;
+}
+
+int init_polygon(Polygon *polygon, const LineString *ring) {
+  *polygon = (Polygon){ 0 };
+  polygon->xs = malloc(sizeof(double) * (ring->points_count + 1));
+  polygon->ys = malloc(sizeof(double) * (ring->points_count + 1));
+  if (polygon->xs == NULL || polygon->ys == NULL) {
+    destroy_polygon(polygon);
+    return 1;
+  }
+
+  for (size_t i = 0; i < ring->points_count; i++) {
+    polygon->xs[i] = ring->points[i].x;
+    polygon->ys[i] = ring->points[i].y;
+  }
+  polygon->count = ring->points_count;
+  polygon->rect = line_string_rect(ring);
+
+  if (polygon->count >= POLYGON_BUCKETS_MIN_VERTICES && build_buckets(polygon) != 0) {
+    destroy_polygon(polygon);
+    return 1;
+  }
+  return 0;
+}
+
+void destroy_polygon(Polygon *polygon) {
+  free(polygon->xs);
+  free(polygon->ys);
+  free(polygon->bucket_offsets);
+  free(polygon->bucket_edges);
+  *polygon = (Polygon){ 0 };
+}
+
+/*
+ * 1 if the ray going from (px, py) towards +x crosses the edge starting at vertex i. Written with the same operation
+ * order as the SIMD kernels so both give identical answers.
+ */
+static inline int edge_crossing(const double *xs, const double *ys, size_t i, double px, double py) {
+  double y1 = ys[i];
+  double y2 = ys[i + 1];
+  if ((y1 > py) == (y2 > py)) {
+    return 0;
+  }
+  double t = (py - y1) / (y2 - y1);
+  return px < xs[i] + t * (xs[i + 1] - xs[i]);
+}
+
+/*
+ * number of ring edges crossed by the ray, visiting every edge.
+ */
+static unsigned int crossings_all_edges(const double *xs, const double *ys, size_t edges, double px, double py) {
+  unsigned int crossings = 0;
+  size_t i = 0;
+
+#if defined(__AVX__)
+  __m256d vpx = _mm256_set1_pd(px);
+  __m256d vpy = _mm256_set1_pd(py);
+  for (; i + 4 <= edges; i += 4) {
+    __m256d x1 = _mm256_loadu_pd(xs + i);
+    __m256d y1 = _mm256_loadu_pd(ys + i);
+    __m256d x2 = _mm256_loadu_pd(xs + i + 1);
+    __m256d y2 = _mm256_loadu_pd(ys + i + 1);
+    __m256d straddles = _mm256_xor_pd(_mm256_cmp_pd(y1, vpy, _CMP_GT_OQ), _mm256_cmp_pd(y2, vpy, _CMP_GT_OQ));
+    __m256d t = _mm256_div_pd(_mm256_sub_pd(vpy, y1), _mm256_sub_pd(y2, y1));
+    __m256d x = _mm256_add_pd(x1, _mm256_mul_pd(t, _mm256_sub_pd(x2, x1)));
+    __m256d left = _mm256_cmp_pd(vpx, x, _CMP_LT_OQ);
+    crossings += (unsigned int)__builtin_popcount(_mm256_movemask_pd(_mm256_and_pd(straddles, left)));
+  }
+#elif defined(__SSE2__)
+  __m128d vpx = _mm_set1_pd(px);
+  __m128d vpy = _mm_set1_pd(py);
+  for (; i + 2 <= edges; i += 2) {
+    __m128d x1 = _mm_loadu_pd(xs + i);
+    __m128d y1 = _mm_loadu_pd(ys + i);
+    __m128d x2 = _mm_loadu_pd(xs + i + 1);
+    __m128d y2 = _mm_loadu_pd(ys + i + 1);
+    __m128d straddles = _mm_xor_pd(_mm_cmpgt_pd(y1, vpy), _mm_cmpgt_pd(y2, vpy));
+    __m128d t = _mm_div_pd(_mm_sub_pd(vpy, y1), _mm_sub_pd(y2, y1));
+    __m128d x = _mm_add_pd(x1, _mm_mul_pd(t, _mm_sub_pd(x2, x1)));
+    __m128d left = _mm_cmplt_pd(vpx, x);
+    int mask = _mm_movemask_pd(_mm_and_pd(straddles, left));
+    crossings += (unsigned int)((mask & 1) + (mask >> 1));
+  }
+#endif
+
+  for (; i < edges; i++) {
+    crossings += (unsigned int)edge_crossing(xs, ys, i, px, py);
+  }
+  return crossings;
+}
+
+bool polygon_contains_point(const Polygon *polygon, const Point *p) {
+  const Rect *r = &polygon->rect;
+  if (polygon->count < 4 || p->x < r->min_x || p->x > r->max_x || p->y < r->min_y || p->y > r->max_y) {
+    return false;
+  }
+
+  if (polygon->buckets_count == 0) {
+    return crossings_all_edges(polygon->xs, polygon->ys, polygon->count - 1, p->x, p->y) & 1;
+  }
+
+  uint32_t b = (uint32_t)((p->y - r->min_y) / polygon->bucket_height);
+  if (b >= polygon->buckets_count) {
+    b = polygon->buckets_count - 1;
+  }
+  unsigned int crossings = 0;
+  for (uint32_t e = polygon->bucket_offsets[b]; e < polygon->bucket_offsets[b + 1]; e++) {
+    crossings += (unsigned int)edge_crossing(polygon->xs, polygon->ys, polygon->bucket_edges[e], p->x, p->y);
+  }
+  return crossings & 1;
+}
+
+static double orientation(double ax, double ay, double bx, double by, double cx, double cy) {
+  return (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+}
+
+static bool on_segment(double ax, double ay, double bx, double by, double px, double py) {
+  return px >= (ax < bx ? ax : bx) && px <= (ax < bx ? bx : ax) && py >= (ay < by ? ay : by) &&
+         py <= (ay < by ? by : ay);
+}
+
+/*
+ * true if segment a (vertex i of `pa`) and segment b (vertex j of `pb`) cross at a single point inside both.
+ */
+static bool edges_cross(const Polygon *pa, size_t i, const Polygon *pb, size_t j) {
+  double d1 = orientation(pb->xs[j], pb->ys[j], pb->xs[j + 1], pb->ys[j + 1], pa->xs[i], pa->ys[i]);
+  double d2 = orientation(pb->xs[j], pb->ys[j], pb->xs[j + 1], pb->ys[j + 1], pa->xs[i + 1], pa->ys[i + 1]);
+  double d3 = orientation(pa->xs[i], pa->ys[i], pa->xs[i + 1], pa->ys[i + 1], pb->xs[j], pb->ys[j]);
+  double d4 = orientation(pa->xs[i], pa->ys[i], pa->xs[i + 1], pa->ys[i + 1], pb->xs[j + 1], pb->ys[j + 1]);
+  return ((d1 > 0 && d2 < 0) || (d1 < 0 && d2 > 0)) && ((d3 > 0 && d4 < 0) || (d3 < 0 && d4 > 0));
+}
+
+/*
+ * true if segment a (vertex i of `pa`) and segment b (vertex j of `pb`) share at least one point.
+ */
+static bool edges_intersect(const Polygon *pa, size_t i, const Polygon *pb, size_t j) {
+  if (edges_cross(pa, i, pb, j)) {
+    return true;
+  }
+  double ax1 = pa->xs[i], ay1 = pa->ys[i], ax2 = pa->xs[i + 1], ay2 = pa->ys[i + 1];
+  double bx1 = pb->xs[j], by1 = pb->ys[j], bx2 = pb->xs[j + 1], by2 = pb->ys[j + 1];
+  return (orientation(bx1, by1, bx2, by2, ax1, ay1) == 0 && on_segment(bx1, by1, bx2, by2, ax1, ay1)) ||
+         (orientation(bx1, by1, bx2, by2, ax2, ay2) == 0 && on_segment(bx1, by1, bx2, by2, ax2, ay2)) ||
+         (orientation(ax1, ay1, ax2, ay2, bx1, by1) == 0 && on_segment(ax1, ay1, ax2, ay2, bx1, by1)) ||
+         (orientation(ax1, ay1, ax2, ay2, bx2, by2) == 0 && on_segment(ax1, ay1, ax2, ay2, bx2, by2));
+}
+
+/*
+ * the edges of a polygon whose y span may overlap a range: `edges[k]` for k in `first` .. `end - 1` when the polygon
+ * has buckets (an edge spanning several bands is listed more than once), else k itself for every edge.
+ */
+typedef struct {
+  const uint32_t *edges;
+  size_t first;
+  size_t end;
+} EdgeRange;
+
+static inline size_t edge_at(const EdgeRange *range, size_t k) {
+  return range->edges == NULL ? k : range->edges[k];
+}
+
+static EdgeRange edges_near(const Polygon *polygon, double min_y, double max_y) {
+  if (polygon->buckets_count == 0) {
+    return (EdgeRange){ .edges = NULL, .first = 0, .end = polygon->count - 1 };
+  }
+  const Rect *r = &polygon->rect;
+  if (max_y < r->min_y || min_y > r->max_y) {
+    return (EdgeRange){ .edges = NULL, .first = 0, .end = 0 };
+  }
+  uint32_t first = min_y <= r->min_y ? 0 : (uint32_t)((min_y - r->min_y) / polygon->bucket_height);
+  uint32_t last = (uint32_t)((max_y - r->min_y) / polygon->bucket_height);
+  if (first >= polygon->buckets_count) {
+    first = polygon->buckets_count - 1;
+  }
+  if (last >= polygon->buckets_count) {
+    last = polygon->buckets_count - 1;
+  }
+  // the bands are stored one after the other, so consecutive bands are one run of `bucket_edges`.
+  return (EdgeRange){
+    .edges = polygon->bucket_edges,
+    .first = polygon->bucket_offsets[first],
+    .end = polygon->bucket_offsets[last + 1],
+  };
+}
+
+static bool any_edges_intersect(const Polygon *a, const Polygon *b) {
+  // walk the edges of one ring and look up those of the other, through its buckets when it has them.
+  if (a->buckets_count > 0 && b->buckets_count == 0) {
+    const Polygon *swap = a;
+    a = b;
+    b = swap;
+  }
+  for (size_t i = 0; i + 1 < a->count; i++) {
+    Rect ea = {
+      .min_x = a->xs[i] < a->xs[i + 1] ? a->xs[i] : a->xs[i + 1],
+      .min_y = a->ys[i] < a->ys[i + 1] ? a->ys[i] : a->ys[i + 1],
+      .max_x = a->xs[i] < a->xs[i + 1] ? a->xs[i + 1] : a->xs[i],
+      .max_y = a->ys[i] < a->ys[i + 1] ? a->ys[i + 1] : a->ys[i],
+    };
+    if (!rects_intersect(&ea, &b->rect)) {
+      continue;
+    }
+    EdgeRange range = edges_near(b, ea.min_y, ea.max_y);
+    for (size_t k = range.first; k < range.end; k++) {
+      if (edges_intersect(a, i, b, edge_at(&range, k))) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+/*
+ * true if (x, y) is inside `polygon` or on one of the edges of `range`.
+ */
+static bool covers_point(const Polygon *polygon, const EdgeRange *range, double x, double y) {
+  for (size_t k = range->first; k < range->end; k++) {
+    size_t j = edge_at(range, k);
+    double x1 = polygon->xs[j], y1 = polygon->ys[j], x2 = polygon->xs[j + 1], y2 = polygon->ys[j + 1];
+    if (orientation(x1, y1, x2, y2, x, y) == 0 && on_segment(x1, y1, x2, y2, x, y)) {
+      return true;
+    }
+  }
+  Point p = { .x = x, .y = y };
+  return polygon_contains_point(polygon, &p);
+}
+
+/*
+ * true if edge i of `inner` is inside `outer` or on its boundary. Without a crossing the edge can only go in and out
+ * where a vertex of `outer` touches it, so it is cut at those points and every piece is either along a collinear edge
+ * of `outer` or has its midpoint tested.
+ */
+static bool edge_within(const Polygon *outer, const Polygon *inner, size_t i) {
+  double ax = inner->xs[i], ay = inner->ys[i], bx = inner->xs[i + 1], by = inner->ys[i + 1];
+  EdgeRange range = edges_near(outer, ay < by ? ay : by, ay < by ? by : ay);
+  double dx = bx - ax;
+  double dy = by - ay;
+  double length2 = dx * dx + dy * dy;
+  if (length2 == 0) {
+    return covers_point(outer, &range, ax, ay);
+  }
+  for (size_t k = range.first; k < range.end; k++) {
+    if (edges_cross(inner, i, outer, edge_at(&range, k))) {
+      return false;
+    }
+  }
+
+  for (double t = 0; t < 1;) {
+    double next = 1;
+    for (size_t k = range.first; k < range.end; k++) {
+      size_t j = edge_at(&range, k);
+      for (size_t v = j; v <= j + 1; v++) {
+        double tv = ((outer->xs[v] - ax) * dx + (outer->ys[v] - ay) * dy) / length2;
+        if (tv > t && tv < next && orientation(ax, ay, bx, by, outer->xs[v], outer->ys[v]) == 0) {
+          next = tv;
+        }
+      }
+    }
+    bool on_boundary = false;
+    for (size_t k = range.first; k < range.end && !on_boundary; k++) {
+      size_t j = edge_at(&range, k);
+      if (orientation(ax, ay, bx, by, outer->xs[j], outer->ys[j]) == 0 &&
+          orientation(ax, ay, bx, by, outer->xs[j + 1], outer->ys[j + 1]) == 0) {
+        double t1 = ((outer->xs[j] - ax) * dx + (outer->ys[j] - ay) * dy) / length2;
+        double t2 = ((outer->xs[j + 1] - ax) * dx + (outer->ys[j + 1] - ay) * dy) / length2;
+        on_boundary = (t1 < t2 ? t1 : t2) <= t && (t1 < t2 ? t2 : t1) >= next;
+      }
+    }
+    if (!on_boundary) {
+      Point middle = { .x = ax + dx * (t + next) / 2, .y = ay + dy * (t + next) / 2 };
+      if (!polygon_contains_point(outer, &middle)) {
+        return false;
+      }
+    }
+    t = next;
+  }
+  return true;
+}
+
+bool polygon_contains_polygon(const Polygon *outer, const Polygon *inner) {
+  if (!rect_contains(&outer->rect, &inner->rect) || outer->count < 4) {
+    return false;
+  }
+  for (size_t i = 0; i + 1 < inner->count; i++) {
+    if (!edge_within(outer, inner, i)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool polygons_intersect(const Polygon *a, const Polygon *b) {
+  if (!rects_intersect(&a->rect, &b->rect)) {
+    return false;
+  }
+  if (any_edges_intersect(a, b)) {
+    return true;
+  }
+  // no edges cross, so either one ring is entirely inside the other or they are disjoint.
+  Point pa = { .x = a->xs[0], .y = a->ys[0] };
+  Point pb = { .x = b->xs[0], .y = b->ys[0] };
+  return polygon_contains_point(b, &pa) || polygon_contains_point(a, &pb);
+}
@@ -0,0 +1,279 @@
+#include "resp.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RESP_BUFFER_INITIAL_CAPACITY 4096
+#define RESP_MAX_NUMBER_DIGITS 18
+
+/*
+ * reads the number of a "*<count>\r\n" or "$<length>\r\n" line starting at `*pos` and moves `*pos` past the line.
+ * returns RESP_REQUEST when it was read.
+ */
+static RespFrame read_number(const char *buffer, size_t length, size_t *pos, long long *value) {
+  size_t i = *pos;
+  bool negative = i < length && buffer[i] == '-';
+  if (negative) {
+    i++;
+  }
+  long long n = 0;
+  size_t digits = 0;
+  for (; i < length && buffer[i] >= '0' && buffer[i] <= '9'; i++) {
+    if (++digits > RESP_MAX_NUMBER_DIGITS) {
+      return RESP_PROTOCOL_ERROR;
+    }
+    n = n * 10 + (buffer[i] - '0');
+  }
+  if (i + 1 >= length) {
+    return RESP_INCOMPLETE;
+  }
+  if (digits == 0 || buffer[i] != '\r' || buffer[i + 1] != '\n') {
+    return RESP_PROTOCOL_ERROR;
+  }
+  *value = negative ? -n : n;
+  *pos = i + 2;
+  return RESP_REQUEST;
+}
+
+/*
+ * the statement tokenizer splits words on whitespace, ends the statement at a newline or a NUL, reads a lone `?` as a
+ * placeholder and a leading quote as the start of a quoted string (quotes included): arguments like these are bound
+ * instead.
+ */
+static bool needs_binding(const char *bytes, size_t length) {
+  if (length == 0 || (length == 1 && bytes[0] == '?') || bytes[0] == '\'' || bytes[0] == '"' || bytes[0] == '`') {
+    return true;
+  }
+  for (size_t i = 0; i < length; i++) {
+    char c = bytes[i];
+    if (c == ' ' || c == '\t' || c == '\v' || c == '\f' || c == '\r' || c == '\n' || c == '\0') {
+      return true;
+    }
+  }
+  return false;
+}
+
+static Span next_word(const char **cursor) {
+  const char *s = *cursor;
+  while (*s == ' ' || *s == '\t') {
+    s++;
+  }
+  const char *start = s;
+  while (*s != '\0' && *s != ' ' && *s != '\t') {
+    s++;
+  }
+  *cursor = s;
+  return (Span){ .start = start, .length = (size_t)(s - start) };
+}
+
+static RespFrame inline_request(char *buffer, size_t length, RespRequest *request, size_t *consumed) {
+  size_t scanned = length < RESP_MAX_INLINE_LENGTH ? length : RESP_MAX_INLINE_LENGTH;
+  char *newline = memchr(buffer, '\n', scanned);
+  if (newline == NULL) {
+    return length < RESP_MAX_INLINE_LENGTH ? RESP_INCOMPLETE : RESP_PROTOCOL_ERROR;
+  }
+  *consumed = (size_t)(newline - buffer) + 1;
+  if (newline > buffer && newline[-1] == '\r') {
+    newline--;
+  }
+  *newline = '\0';
+
+  request->statement = buffer;
+  const char *cursor = buffer;
+  for (Span word = next_word(&cursor); word.length > 0; word = next_word(&cursor)) {
+    if (request->arguments_count == 0) {
+      request->name = word;
+    } else if (request->arguments_count == 1) {
+      request->argument = word;
+    }
+    request->arguments_count++;
+  }
+  return RESP_REQUEST;
+}
+
+RespFrame resp_next_request(char *buffer, size_t length, Arena *arena, RespRequest *request, size_t *consumed) {
+  *request = (RespRequest){ .statement = buffer };
+  if (length == 0) {
+    return RESP_INCOMPLETE;
+  }
+  if (buffer[0] != '*') {
+    return inline_request(buffer, length, request, consumed);
+  }
+
+  size_t pos = 1;
+  long long count;
+  RespFrame frame = read_number(buffer, length, &pos, &count);
+  if (frame != RESP_REQUEST) {
+    return frame;
+  }
+  if (count > RESP_MAX_ARGUMENTS) {
+    return RESP_PROTOCOL_ERROR;
+  }
+  if (count < 0) {
+    count = 0;
+  }
+
+  // nothing is rewritten before the whole request is in the buffer, an incomplete one is framed again from the start
+  // once more bytes arrived.
+  size_t arguments_start = pos;
+  size_t parameters_count = 0;
+  for (long long i = 0; i < count; i++) {
+    if (pos >= length) {
+      return RESP_INCOMPLETE;
+    }
+    if (buffer[pos++] != '$') {
+      return RESP_PROTOCOL_ERROR;
+    }
+    long long argument_length;
+    frame = read_number(buffer, length, &pos, &argument_length);
+    if (frame != RESP_REQUEST) {
+      return frame;
+    }
+    if (argument_length < 0 || argument_length > RESP_MAX_BULK_LENGTH) {
+      return RESP_PROTOCOL_ERROR;
+    }
+    if (length - pos < (size_t)argument_length + 2) {
+      return RESP_INCOMPLETE;
+    }
+    if (buffer[pos + argument_length] != '\r' || buffer[pos + argument_length + 1] != '\n') {
+      return RESP_PROTOCOL_ERROR;
+    }
+    parameters_count += needs_binding(buffer + pos, argument_length);
+    pos += argument_length + 2;
+  }
+  *consumed = pos;
+  request->arguments_count = (size_t)count;
+  if (parameters_count > 0) {
+    request->parameters = arena_alloc(arena, sizeof(Span) * parameters_count);
+    if (request->parameters == NULL) {
+      return RESP_OUT_OF_MEMORY;
+    }
+  }
+
+  size_t end = 0; // the statement so far is buffer[0, end)
+  pos = arguments_start;
+  for (long long i = 0; i < count; i++) {
+    pos++;
+    long long argument_length;
+    read_number(buffer, length, &pos, &argument_length);
+    char *bytes = buffer + pos;
+    Span argument = { .start = bytes, .length = (size_t)argument_length };
+    memset(buffer + end, ' ', pos - end);
+    if (needs_binding(bytes, argument.length)) {
+      char *copy = arena_alloc(arena, argument.length + 1);
+      if (copy == NULL) {
+        return RESP_OUT_OF_MEMORY;
+      }
+      memcpy(copy, bytes, argument.length);
+      argument.start = copy;
+      request->parameters[request->parameters_count++] = argument;
+      memset(bytes, ' ', argument.length);
+      bytes[-1] = '?';
+    }
+    if (i == 0) {
+      request->name = argument;
+    } else if (i == 1) {
+      request->argument = argument;
+    }
+    end = pos + argument_length;
+    pos += argument_length + 2;
+  }
+  buffer[end] = '\0';
+  return RESP_REQUEST;
+}
+
+void init_resp_buffer(RespBuffer *buffer) {
+  *buffer = (RespBuffer){ 0 };
+}
+
+void destroy_resp_buffer(RespBuffer *buffer) {
+  free(buffer->data);
+  *buffer = (RespBuffer){ 0 };
+}
+
+/*
+ * makes room for `length` more bytes. returns false when out of memory.
+ */
+static bool reserve(RespBuffer *buffer, size_t length) {
+  if (buffer->out_of_memory) {
+    return false;
+  }
+  if (buffer->capacity - buffer->length >= length) {
+    return true;
+  }
+  size_t capacity = buffer->capacity == 0 ? RESP_BUFFER_INITIAL_CAPACITY : buffer->capacity;
+  while (capacity - buffer->length < length) {
+    capacity *= 2;
+  }
+  char *data = realloc(buffer->data, capacity);
+  if (data == NULL) {
+    buffer->out_of_memory = true;
+    return false;
+  }
+  buffer->data = data;
+  buffer->capacity = capacity;
+  return true;
+}
+
+static void append(RespBuffer *buffer, const char *bytes, size_t length) {
+  if (reserve(buffer, length)) {
+    memcpy(buffer->data + buffer->length, bytes, length);
+    buffer->length += length;
+  }
+}
+
+void resp_append_simple(RespBuffer *buffer, const char *string) {
+  append(buffer, "+", 1);
+  append(buffer, string, strlen(string));
+  append(buffer, "\r\n", 2);
+}
+
+void resp_append_error(RespBuffer *buffer, const char *message) {
+  append(buffer, "-ERR ", 5);
+  // a newline would end the error early and desync the client.
+  for (const char *s = message; *s != '\0'; s++) {
+    append(buffer, *s == '\r' || *s == '\n' ? " " : s, 1);
+  }
+  append(buffer, "\r\n", 2);
+}
+
+void resp_append_bulk(RespBuffer *buffer, const char *bytes, size_t length) {
+  char header[32];
+  int n = snprintf(header, sizeof(header), "$%zu\r\n", length);
+  append(buffer, header, (size_t)n);
+  append(buffer, bytes, length);
+  append(buffer, "\r\n", 2);
+}
+
+void resp_append_null(RespBuffer *buffer) {
+  append(buffer, "$-1\r\n", 5);
+}
+
+void resp_append_double(RespBuffer *buffer, double value) {
+  char digits[32];
+  int n = snprintf(digits, sizeof(digits), "%.15g", value);
+  resp_append_bulk(buffer, digits, (size_t)n);
+}
+
+void resp_append_array_header(RespBuffer *buffer, size_t count) {
+  char header[32];
+  int n = snprintf(header, sizeof(header), "*%zu\r\n", count);
+  append(buffer, header, (size_t)n);
+}
+
+size_t resp_begin_array(RespBuffer *buffer) {
+  return buffer->length;
+}
+
+void resp_end_array(RespBuffer *buffer, size_t start, size_t count) {
+  char header[32];
+  size_t n = (size_t)snprintf(header, sizeof(header), "*%zu\r\n", count);
+  if (!reserve(buffer, n)) {
+    return;
+  }
+  memmove(buffer->data + start + n, buffer->data + start, buffer->length - start);
+  memcpy(buffer->data + start, header, n);
+  buffer->length += n;
+}
@@ -0,0 +1,929 @@
+#include "rtree.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RTREE_INITIAL_NODES_CAPACITY 16
+#define RTREE_SEARCH_STACK_SIZE (RTREE_MAX_HEIGHT * RTREE_MAX_ENTRIES)
+
+_Thread_local uint64_t rtree_nodes_visited;
+
+Rect rtree_node_entry_rect(const RTreeNode *node, int index) {
+  return (Rect){
+    .min_x = node->min_x[index],
+    .min_y = node->min_y[index],
+    .max_x = node->max_x[index],
+    .max_y = node->max_y[index],
+  };
+}
+
+static void set_entry(RTreeNode *node, int index, const Rect *rect, uint32_t child) {
+  node->min_x[index] = rect->min_x;
+  node->min_y[index] = rect->min_y;
+  node->max_x[index] = rect->max_x;
+  node->max_y[index] = rect->max_y;
+  node->children[index] = child;
+}
+
+/*
+ * removes entry `index` by moving the last entry into its place. Entry order inside a node carries no meaning.
+ */
+static void remove_entry(RTreeNode *node, int index) {
+  int last = node->count - 1;
+  if (index != last) {
+    Rect r = rtree_node_entry_rect(node, last);
+    set_entry(node, index, &r, node->children[last]);
+  }
+  node->count--;
+}
+
+/*
+ * bounding box of all the entries. Works on the coordinate arrays directly, this runs for every level an insert or
+ * remove goes through.
+ */
+static Rect node_rect(const RTreeNode *node) {
+  Rect r = rtree_node_entry_rect(node, 0);
+  for (int i = 1; i < node->count; i++) {
+    r.min_x = node->min_x[i] < r.min_x ? node->min_x[i] : r.min_x;
+    r.min_y = node->min_y[i] < r.min_y ? node->min_y[i] : r.min_y;
+    r.max_x = node->max_x[i] > r.max_x ? node->max_x[i] : r.max_x;
+    r.max_y = node->max_y[i] > r.max_y ? node->max_y[i] : r.max_y;
+  }
+  return r;
+}
+
+/*
+ * grows the node array to `capacity` nodes. returns 0 on success, else 1 (out of memory).
+ */
+static int reserve_nodes(RTree *tree, size_t capacity) {
+  if (capacity > UINT32_MAX) {
+    return 1;
+  }
+  RTreeNode *nodes;
+  if (tree->nodes_borrowed) {
+    nodes = malloc(sizeof(RTreeNode) * capacity);
+    if (nodes != NULL) {
+      memcpy(nodes, tree->nodes, sizeof(RTreeNode) * tree->nodes_count);
+    }
+  } else {
+    nodes = realloc(tree->nodes, sizeof(RTreeNode) * capacity);
+  }
+  if (nodes == NULL) {
+    return 1;
+  }
+  tree->nodes = nodes;
+  tree->nodes_capacity = (uint32_t)capacity;
+  tree->nodes_borrowed = false;
+  return 0;
+}
+
+/*
+ * returns the index of a zeroed node or RTREE_NULL_NODE when out of memory. NOTE may realloc `tree->nodes` so any
+ * RTreeNode pointer held by the caller is invalid afterwards.
+ */
+static uint32_t alloc_node(RTree *tree, uint16_t level) {
+  uint32_t index;
+  if (tree->free_list != RTREE_NULL_NODE) {
+    index = tree->free_list;
+    tree->free_list = tree->nodes[index].children[0];
+  } else {
+    if (tree->nodes_count == tree->nodes_capacity) {
+      size_t capacity = tree->nodes_capacity == 0 ? RTREE_INITIAL_NODES_CAPACITY : (size_t)tree->nodes_capacity * 2;
+      if (reserve_nodes(tree, capacity) != 0) {
+        return RTREE_NULL_NODE;
+      }
+    }
+    index = tree->nodes_count++;
+  }
+  tree->nodes[index].count = 0;
+  tree->nodes[index].level = level;
+  return index;
+}
+
+static void free_node(RTree *tree, uint32_t index) {
+  tree->nodes[index].count = 0;
+  tree->nodes[index].children[0] = tree->free_list;
+  tree->free_list = index;
+}
+
+int init_rtree(RTree *tree) {
+  tree->nodes = NULL;
+  tree->nodes_count = 0;
+  tree->nodes_capacity = 0;
+  tree->nodes_borrowed = false;
+  tree->free_list = RTREE_NULL_NODE;
+  tree->items_count = 0;
+  tree->root = alloc_node(tree, 0);
+  return tree->root == RTREE_NULL_NODE ? 1 : 0;
+}
+
+void destroy_rtree(RTree *tree) {
+  if (!tree->nodes_borrowed) {
+    free(tree->nodes);
+  }
+  tree->nodes = NULL;
+  tree->nodes_count = 0;
+  tree->nodes_capacity = 0;
+  tree->nodes_borrowed = false;
+  tree->free_list = RTREE_NULL_NODE;
+  tree->root = RTREE_NULL_NODE;
+  tree->items_count = 0;
+}
+
+/*
+ * local versions of rect_area/rects_union, the split and subtree choice call them hundreds of times per insert.
+ */
+static inline double area_of(const Rect *r) {
+  return (r->max_x - r->min_x) * (r->max_y - r->min_y);
+}
+
+static inline Rect union_of(const Rect *a, const Rect *b) {
+  return (Rect){
+    .min_x = a->min_x < b->min_x ? a->min_x : b->min_x,
+    .min_y = a->min_y < b->min_y ? a->min_y : b->min_y,
+    .max_x = a->max_x > b->max_x ? a->max_x : b->max_x,
+    .max_y = a->max_y > b->max_y ? a->max_y : b->max_y,
+  };
+}
+
+/*
+ * index of the entry needing the least area enlargement to include `rect`, ties resolved by the smallest area.
+ */
+static int choose_subtree(const RTreeNode *node, const Rect *rect) {
+  // branch free pass over the coordinate arrays (vectorizable), then a scan for the minimum.
+  double areas[RTREE_MAX_ENTRIES];
+  double enlargements[RTREE_MAX_ENTRIES];
+  for (int i = 0; i < node->count; i++) {
+    double min_x = node->min_x[i];
+    double min_y = node->min_y[i];
+    double max_x = node->max_x[i];
+    double max_y = node->max_y[i];
+    areas[i] = (max_x - min_x) * (max_y - min_y);
+    enlargements[i] = ((rect->max_x > max_x ? rect->max_x : max_x) - (rect->min_x < min_x ? rect->min_x : min_x)) *
+                          ((rect->max_y > max_y ? rect->max_y : max_y) - (rect->min_y < min_y ? rect->min_y : min_y)) -
+                      areas[i];
+  }
+
+  int best = 0;
+  for (int i = 1; i < node->count; i++) {
+    if (enlargements[i] < enlargements[best] || (enlargements[i] == enlargements[best] && areas[i] < areas[best])) {
+      best = i;
+    }
+  }
+  return best;
+}
+
+/*
+ * Guttman's quadratic split. `node` holds RTREE_MAX_ENTRIES entries and (`rect`, `child`) is the entry that overflowed
+ * it. The entries are distributed between `node` and the (empty) `sibling`.
+ */
+static void split_node(RTreeNode *node, RTreeNode *sibling, const Rect *rect, uint32_t child) {
+  const int total = RTREE_MAX_ENTRIES + 1;
+  Rect rects[RTREE_MAX_ENTRIES + 1];
+  uint32_t children[RTREE_MAX_ENTRIES + 1];
+  bool assigned[RTREE_MAX_ENTRIES + 1] = { false };
+
+  for (int i = 0; i < RTREE_MAX_ENTRIES; i++) {
+    rects[i] = rtree_node_entry_rect(node, i);
+    children[i] = node->children[i];
+  }
+  rects[RTREE_MAX_ENTRIES] = *rect;
+  children[RTREE_MAX_ENTRIES] = child;
+
+  double areas[RTREE_MAX_ENTRIES + 1];
+  for (int i = 0; i < total; i++) {
+    areas[i] = area_of(&rects[i]);
+  }
+
+  // pick the two seeds that would waste the most area if put in the same node.
+  int seed_a = 0;
+  int seed_b = 1;
+  double worst = -1;
+  for (int i = 0; i < total; i++) {
+    for (int j = i + 1; j < total; j++) {
+      Rect u = union_of(&rects[i], &rects[j]);
+      double waste = area_of(&u) - areas[i] - areas[j];
+      if (waste > worst) {
+        worst = waste;
+        seed_a = i;
+        seed_b = j;
+      }
+    }
+  }
+
+  node->count = 0;
+  sibling->count = 0;
+  set_entry(node, node->count++, &rects[seed_a], children[seed_a]);
+  set_entry(sibling, sibling->count++, &rects[seed_b], children[seed_b]);
+  assigned[seed_a] = true;
+  assigned[seed_b] = true;
+  Rect rect_a = rects[seed_a];
+  Rect rect_b = rects[seed_b];
+  int remaining = total - 2;
+
+  while (remaining > 0) {
+    // one group must take everything that is left to reach the minimum fill.
+    RTreeNode *forced = NULL;
+    if (node->count + remaining == RTREE_MIN_ENTRIES) {
+      forced = node;
+    } else if (sibling->count + remaining == RTREE_MIN_ENTRIES) {
+      forced = sibling;
+    }
+    if (forced != NULL) {
+      for (int i = 0; i < total; i++) {
+        if (!assigned[i]) {
+          set_entry(forced, forced->count++, &rects[i], children[i]);
+        }
+      }
+      break;
+    }
+
+    // pick the entry with the strongest preference for one of the groups.
+    int next = -1;
+    double next_diff = -1;
+    double next_d_a = 0;
+    double next_d_b = 0;
+    for (int i = 0; i < total; i++) {
+      if (assigned[i]) {
+        continue;
+      }
+      Rect ua = union_of(&rect_a, &rects[i]);
+      Rect ub = union_of(&rect_b, &rects[i]);
+      double d_a = area_of(&ua) - area_of(&rect_a);
+      double d_b = area_of(&ub) - area_of(&rect_b);
+      double diff = d_a > d_b ? d_a - d_b : d_b - d_a;
+      if (diff > next_diff) {
+        next = i;
+        next_diff = diff;
+        next_d_a = d_a;
+        next_d_b = d_b;
+      }
+    }
+
+    bool to_a;
+    if (next_d_a != next_d_b) {
+      to_a = next_d_a < next_d_b;
+    } else if (area_of(&rect_a) != area_of(&rect_b)) {
+      to_a = area_of(&rect_a) < area_of(&rect_b);
+    } else {
+      to_a = node->count <= sibling->count;
+    }
+
+    if (to_a) {
+      set_entry(node, node->count++, &rects[next], children[next]);
+      rect_a = union_of(&rect_a, &rects[next]);
+    } else {
+      set_entry(sibling, sibling->count++, &rects[next], children[next]);
+      rect_b = union_of(&rect_b, &rects[next]);
+    }
+    assigned[next] = true;
+    remaining--;
+  }
+}
+
+/*
+ * inserts an entry into a node at `level` (0 = leaf). returns 0 on success, else 1 (out of memory).
+ */
+static int insert_at_level(RTree *tree, const Rect *rect, uint32_t child, uint16_t level) {
+  uint32_t path[RTREE_MAX_HEIGHT];
+  int slots[RTREE_MAX_HEIGHT];
+  int depth = 0;
+
+  uint32_t current = tree->root;
+  while (tree->nodes[current].level > level) {
+    path[depth] = current;
+    slots[depth] = choose_subtree(&tree->nodes[current], rect);
+    current = tree->nodes[current].children[slots[depth]];
+    depth++;
+  }
+
+  // allocate the worst case number of split nodes (one per level plus a new root) up front so that running out of
+  // memory can't leave the tree half updated.
+  uint32_t spare[RTREE_MAX_HEIGHT + 1];
+  int spare_count = 0;
+  int needed = 0;
+  for (int d = depth; d >= 0; d--) {
+    uint32_t n = d == depth ? current : path[d];
+    if (tree->nodes[n].count < RTREE_MAX_ENTRIES) {
+      break;
+    }
+    needed++;
+    if (d == 0) {
+      needed++;
+    }
+  }
+  for (; spare_count < needed; spare_count++) {
+    spare[spare_count] = alloc_node(tree, 0);
+    if (spare[spare_count] == RTREE_NULL_NODE) {
+      while (spare_count > 0) {
+        free_node(tree, spare[--spare_count]);
+      }
+      return 1;
+    }
+  }
+
+  Rect new_rect = *rect;
+  uint32_t new_child = child;
+  bool has_new_entry = true;
+  uint32_t node = current;
+
+  for (int d = depth;; d--) {
+    RTreeNode *n = &tree->nodes[node];
+    uint32_t sibling = RTREE_NULL_NODE;
+    if (has_new_entry) {
+      if (n->count < RTREE_MAX_ENTRIES) {
+        set_entry(n, n->count++, &new_rect, new_child);
+        has_new_entry = false;
+      } else {
+        sibling = spare[--spare_count];
+        tree->nodes[sibling].level = n->level;
+        split_node(n, &tree->nodes[sibling], &new_rect, new_child);
+      }
+    }
+
+    if (d == 0) {
+      if (sibling != RTREE_NULL_NODE) {
+        uint32_t root = spare[--spare_count];
+        RTreeNode *r = &tree->nodes[root];
+        r->level = tree->nodes[node].level + 1;
+        Rect a = node_rect(&tree->nodes[node]);
+        Rect b = node_rect(&tree->nodes[sibling]);
+        set_entry(r, r->count++, &a, node);
+        set_entry(r, r->count++, &b, sibling);
+        tree->root = root;
+      }
+      break;
+    }
+
+    uint32_t parent = path[d - 1];
+    RTreeNode *p = &tree->nodes[parent];
+    int slot = slots[d - 1];
+    if (sibling == RTREE_NULL_NODE) {
+      // the subtree only gained `rect`. Once an entry already covers it, so does every entry above it.
+      if (p->min_x[slot] <= rect->min_x && p->min_y[slot] <= rect->min_y && p->max_x[slot] >= rect->max_x &&
+          p->max_y[slot] >= rect->max_y) {
+        break;
+      }
+      Rect e = rtree_node_entry_rect(p, slot);
+      Rect updated = union_of(&e, rect);
+      set_entry(p, slot, &updated, node);
+    } else {
+      Rect updated = node_rect(&tree->nodes[node]);
+      set_entry(p, slot, &updated, node);
+      new_rect = node_rect(&tree->nodes[sibling]);
+      new_child = sibling;
+      has_new_entry = true;
+    }
+    node = parent;
+  }
+  return 0;
+}
+
+int rtree_insert(RTree *tree, const Rect *rect, uint32_t item) {
+  if (insert_at_level(tree, rect, item, 0) != 0) {
+    return 1;
+  }
+  tree->items_count++;
+  return 0;
+}
+
+typedef struct {
+  uint64_t key;
+  uint32_t index;
+} SortEntry;
+
+#define RADIX_BITS 11
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_PASSES ((64 + RADIX_BITS - 1) / RADIX_BITS)
+
+/*
+ * maps a double to a uint64_t with the same order, so coordinates can be radix sorted.
+ */
+static inline uint64_t sortable_bits(double d) {
+  uint64_t bits;
+  memcpy(&bits, &d, sizeof(bits));
+  return bits >> 63 ? ~bits : bits | 0x8000000000000000ULL;
+}
+
+/*
+ * LSD radix sort on `key`. Digits every key shares (the sign and exponent of coordinates from one region) are skipped,
+ * so sorting a few million points is typically 3 or 4 passes. `scratch` must hold `count` entries.
+ */
+static void radix_sort(SortEntry *entries, SortEntry *scratch, size_t count) {
+  if (count <= 32) {
+    for (size_t i = 1; i < count; i++) {
+      SortEntry e = entries[i];
+      size_t j = i;
+      for (; j > 0 && entries[j - 1].key > e.key; j--) {
+        entries[j] = entries[j - 1];
+      }
+      entries[j] = e;
+    }
+    return;
+  }
+
+  uint32_t histograms[RADIX_PASSES][RADIX_BUCKETS];
+  memset(histograms, 0, sizeof(histograms));
+  for (size_t i = 0; i < count; i++) {
+    for (int pass = 0; pass < RADIX_PASSES; pass++) {
+      histograms[pass][(entries[i].key >> (pass * RADIX_BITS)) & (RADIX_BUCKETS - 1)]++;
+    }
+  }
+
+  SortEntry *from = entries;
+  SortEntry *to = scratch;
+  for (int pass = 0; pass < RADIX_PASSES; pass++) {
+    int shift = pass * RADIX_BITS;
+    uint32_t *offsets = histograms[pass];
+    if (offsets[(from[0].key >> shift) & (RADIX_BUCKETS - 1)] == count) {
+      continue;
+    }
+    uint32_t sum = 0;
+    for (int b = 0; b < RADIX_BUCKETS; b++) {
+      uint32_t c = offsets[b];
+      offsets[b] = sum;
+      sum += c;
+    }
+    for (size_t i = 0; i < count; i++) {
+      to[offsets[(from[i].key >> shift) & (RADIX_BUCKETS - 1)]++] = from[i];
+    }
+    SortEntry *t = from;
+    from = to;
+    to = t;
+  }
+  if (from != entries) {
+    memcpy(entries, from, sizeof(SortEntry) * count);
+  }
+}
+
+/*
+ * number of vertical slices STR cuts `count` entries into: the square root of the number of full nodes they fill.
+ */
+static size_t str_slices(size_t count) {
+  size_t nodes = (count + RTREE_MAX_ENTRIES - 1) / RTREE_MAX_ENTRIES;
+  size_t slices = 1;
+  while (slices * slices < nodes) {
+    slices++;
+  }
+  return slices;
+}
+
+/*
+ * Sort-Tile-Recursive packing of one level: the entries are sorted into vertical slices by the x of their center, each
+ * slice by the y of the center, and every slice is cut into runs of at most RTREE_MAX_ENTRIES. Runs are spread evenly
+ * so no node ends up below RTREE_MIN_ENTRIES. The new nodes are written to `parent_rects`/`parent_children`, which
+ * must hold `count / RTREE_MAX_ENTRIES + str_slices(count) + 1` entries. returns their number, 0 when out of memory.
+ */
+static size_t pack_level(RTree *tree, uint16_t level, const Rect *rects, const uint32_t *children, size_t count,
+                         SortEntry *sorted, SortEntry *scratch, Rect *parent_rects, uint32_t *parent_children) {
+  for (size_t i = 0; i < count; i++) {
+    sorted[i] = (SortEntry){ .key = sortable_bits(rects[i].min_x + rects[i].max_x), .index = (uint32_t)i };
+  }
+  radix_sort(sorted, scratch, count);
+
+  size_t slices = str_slices(count);
+  size_t parents = 0;
+  for (size_t s = 0; s < slices; s++) {
+    size_t lo = count * s / slices;
+    size_t hi = count * (s + 1) / slices;
+    size_t k = hi - lo;
+    if (k == 0) {
+      continue;
+    }
+    for (size_t j = lo; j < hi; j++) {
+      const Rect *r = &rects[sorted[j].index];
+      sorted[j].key = sortable_bits(r->min_y + r->max_y);
+    }
+    radix_sort(sorted + lo, scratch, k);
+
+    size_t nodes = (k + RTREE_MAX_ENTRIES - 1) / RTREE_MAX_ENTRIES;
+    for (size_t t = 0; t < nodes; t++) {
+      uint32_t n = alloc_node(tree, level);
+      if (n == RTREE_NULL_NODE) {
+        return 0;
+      }
+      RTreeNode *node = &tree->nodes[n];
+      for (size_t j = lo + k * t / nodes; j < lo + k * (t + 1) / nodes; j++) {
+        set_entry(node, node->count++, &rects[sorted[j].index], children[sorted[j].index]);
+      }
+      parent_rects[parents] = node_rect(node);
+      parent_children[parents++] = n;
+    }
+  }
+  return parents;
+}
+
+int rtree_bulk_load(RTree *tree, const Rect *rects, const uint32_t *items, size_t count) {
+  if (tree->items_count != 0) {
+    return 1;
+  }
+  if (count == 0) {
+    return 0;
+  }
+
+  size_t bound = count / RTREE_MAX_ENTRIES + str_slices(count) + 1;
+  SortEntry *sorted = malloc(sizeof(SortEntry) * count);
+  SortEntry *scratch = malloc(sizeof(SortEntry) * count);
+  Rect *level_rects[2] = { malloc(sizeof(Rect) * bound), malloc(sizeof(Rect) * bound) };
+  uint32_t *level_children[2] = { malloc(sizeof(uint32_t) * bound), malloc(sizeof(uint32_t) * bound) };
+  int rc = sorted == NULL || scratch == NULL || level_rects[0] == NULL || level_rects[1] == NULL ||
+           level_children[0] == NULL || level_children[1] == NULL;
+
+  // reserve about what the tree needs at once instead of doubling the node array over and over, `alloc_node` still
+  // grows it if the estimate falls short.
+  size_t nodes = tree->nodes_count + bound + bound / 4 + RTREE_MAX_HEIGHT;
+  if (rc == 0 && nodes > tree->nodes_capacity) {
+    rc = reserve_nodes(tree, nodes);
+  }
+
+  if (rc == 0) {
+    // the empty root is rebuilt from the bottom up.
+    free_node(tree, tree->root);
+    const Rect *in_rects = rects;
+    const uint32_t *in_children = items;
+    size_t in_count = count;
+    for (uint16_t level = 0;; level++) {
+      int out = level & 1;
+      size_t n = pack_level(tree, level, in_rects, in_children, in_count, sorted, scratch, level_rects[out],
+                            level_children[out]);
+      if (n == 0) {
+        destroy_rtree(tree);
+        init_rtree(tree);
+        rc = 1;
+        break;
+      }
+      if (n == 1) {
+        tree->root = level_children[out][0];
+        tree->items_count = count;
+        break;
+      }
+      in_rects = level_rects[out];
+      in_children = level_children[out];
+      in_count = n;
+    }
+  }
+
+  free(sorted);
+  free(scratch);
+  free(level_rects[0]);
+  free(level_rects[1]);
+  free(level_children[0]);
+  free(level_children[1]);
+  return rc;
+}
+
+/*
+ * depth first search for the leaf holding `item` with exactly `rect`. On success `path`/`slots` describe the route from
+ * the root and the leaf depth is returned, else -1.
+ */
+static int find_leaf(const RTree *tree, uint32_t node, const Rect *rect, uint32_t item, uint32_t *path, int *slots,
+                     int depth) {
+  const RTreeNode *n = &tree->nodes[node];
+  path[depth] = node;
+  for (int i = 0; i < n->count; i++) {
+    if (n->level == 0) {
+      if (n->children[i] == item && n->min_x[i] == rect->min_x && n->min_y[i] == rect->min_y &&
+          n->max_x[i] == rect->max_x && n->max_y[i] == rect->max_y) {
+        slots[depth] = i;
+        return depth;
+      }
+    } else if (n->min_x[i] <= rect->min_x && n->min_y[i] <= rect->min_y && n->max_x[i] >= rect->max_x &&
+               n->max_y[i] >= rect->max_y) {
+      slots[depth] = i;
+      int found = find_leaf(tree, n->children[i], rect, item, path, slots, depth + 1);
+      if (found >= 0) {
+        return found;
+      }
+    }
+  }
+  return -1;
+}
+
+/*
+ * appends every leaf entry under `node` to `rects`/`items` and frees the nodes of the subtree.
+ */
+static void collect_and_free(RTree *tree, uint32_t node, Rect *rects, uint32_t *items, size_t *count) {
+  RTreeNode *n = &tree->nodes[node];
+  for (int i = 0; i < n->count; i++) {
+    if (n->level == 0) {
+      rects[*count] = rtree_node_entry_rect(n, i);
+      items[*count] = n->children[i];
+      (*count)++;
+    } else {
+      collect_and_free(tree, n->children[i], rects, items, count);
+    }
+  }
+  free_node(tree, node);
+}
+
+static size_t subtree_items_count(const RTree *tree, uint32_t node) {
+  const RTreeNode *n = &tree->nodes[node];
+  if (n->level == 0) {
+    return n->count;
+  }
+  size_t total = 0;
+  for (int i = 0; i < n->count; i++) {
+    total += subtree_items_count(tree, n->children[i]);
+  }
+  return total;
+}
+
+/*
+ * removes the leaf entry found by `find_leaf` and condenses the tree, leaving room for `inserts` more entries to go in
+ * without allocating. returns 0 on success, else 1 (out of memory, the tree is unchanged).
+ */
+static int remove_at(RTree *tree, const uint32_t *path, const int *slots, int leaf_depth, size_t inserts) {
+  // find the nodes that will end up underfull first: what reinserting their entries needs is set aside before the tree
+  // changes.
+  bool orphaned[RTREE_MAX_HEIGHT] = { false };
+  int shallowest = 0;
+  for (int d = leaf_depth; d > 0; d--) {
+    int count = tree->nodes[path[d]].count - (d == leaf_depth || orphaned[d + 1]);
+    if (count < RTREE_MIN_ENTRIES) {
+      orphaned[d] = true;
+      shallowest = d;
+    }
+  }
+  // every orphaned entry is in the subtree of the shallowest orphan, the removed one included.
+  size_t total = shallowest > 0 ? subtree_items_count(tree, path[shallowest]) : 0;
+
+  // an insert splits at most one node per level and adds a new root. The reinserted entries come from below the root,
+  // too few to raise the tree by more than a level.
+  size_t levels = (size_t)tree->nodes[tree->root].level + 1;
+  size_t capacity = tree->nodes_count + (total + inserts) * (levels + 2);
+  if (capacity > tree->nodes_capacity) {
+    size_t doubled = (size_t)tree->nodes_capacity * 2;
+    if (reserve_nodes(tree, capacity > doubled ? capacity : doubled) != 0) {
+      return 1;
+    }
+  }
+  // usually a single underfull leaf, which fits on the stack.
+  Rect stack_rects[RTREE_MAX_ENTRIES];
+  uint32_t stack_items[RTREE_MAX_ENTRIES];
+  bool on_stack = total <= RTREE_MAX_ENTRIES;
+  Rect *rects = on_stack ? stack_rects : malloc(sizeof(Rect) * total);
+  uint32_t *items = on_stack ? stack_items : malloc(sizeof(uint32_t) * total);
+  if (rects == NULL || items == NULL) {
+    if (!on_stack) {
+      free(rects);
+      free(items);
+    }
+    return 1;
+  }
+
+  remove_entry(&tree->nodes[path[leaf_depth]], slots[leaf_depth]);
+  tree->items_count--;
+
+  // condense: unlink underfull nodes on the way up and remember them for reinsertion.
+  uint32_t orphans[RTREE_MAX_HEIGHT];
+  int orphans_count = 0;
+  for (int d = leaf_depth; d > 0; d--) {
+    uint32_t node = path[d];
+    RTreeNode *parent = &tree->nodes[path[d - 1]];
+    if (orphaned[d]) {
+      remove_entry(parent, slots[d - 1]);
+      orphans[orphans_count++] = node;
+    } else {
+      Rect updated = node_rect(&tree->nodes[node]);
+      set_entry(parent, slots[d - 1], &updated, node);
+    }
+  }
+
+  // shorten the tree while the root is an internal node with a single child.
+  while (tree->nodes[tree->root].level > 0 && tree->nodes[tree->root].count == 1) {
+    uint32_t old_root = tree->root;
+    tree->root = tree->nodes[old_root].children[0];
+    free_node(tree, old_root);
+  }
+  if (tree->nodes[tree->root].count == 0) {
+    tree->nodes[tree->root].level = 0;
+  }
+
+  // orphaned entries are reinserted as leaf entries, which keeps the tree balanced regardless of its new height. The
+  // nodes were reserved above so this can't run out of memory.
+  size_t count = 0;
+  for (int i = 0; i < orphans_count; i++) {
+    collect_and_free(tree, orphans[i], rects, items, &count);
+  }
+  for (size_t i = 0; i < count; i++) {
+    insert_at_level(tree, &rects[i], items[i], 0);
+  }
+  if (!on_stack) {
+    free(rects);
+    free(items);
+  }
+  return 0;
+}
+
+int rtree_remove(RTree *tree, const Rect *rect, uint32_t item) {
+  uint32_t path[RTREE_MAX_HEIGHT];
+  int slots[RTREE_MAX_HEIGHT];
+
+  int leaf_depth = find_leaf(tree, tree->root, rect, item, path, slots, 0);
+  if (leaf_depth < 0) {
+    return 1;
+  }
+  return remove_at(tree, path, slots, leaf_depth, 0);
+}
+
+int rtree_update(RTree *tree, const Rect *old_rect, const Rect *rect, uint32_t item) {
+  uint32_t path[RTREE_MAX_HEIGHT];
+  int slots[RTREE_MAX_HEIGHT];
+
+  int leaf_depth = find_leaf(tree, tree->root, old_rect, item, path, slots, 0);
+  if (leaf_depth < 0) {
+    return 1;
+  }
+
+  // still inside the box its parent has for the leaf: rewrite the entry and leave the boxes above as they are. They may
+  // end up a little larger than needed, which costs nothing but some pruning.
+  RTreeNode *leaf = &tree->nodes[path[leaf_depth]];
+  const RTreeNode *parent = leaf_depth > 0 ? &tree->nodes[path[leaf_depth - 1]] : NULL;
+  int slot = leaf_depth > 0 ? slots[leaf_depth - 1] : 0;
+  if (parent == NULL || (parent->min_x[slot] <= rect->min_x && parent->min_y[slot] <= rect->min_y &&
+                         parent->max_x[slot] >= rect->max_x && parent->max_y[slot] >= rect->max_y)) {
+    set_entry(leaf, slots[leaf_depth], rect, item);
+    return 0;
+  }
+
+  // the removal leaves room for the insert, which then can't fail.
+  if (remove_at(tree, path, slots, leaf_depth, 1) != 0) {
+    return 1;
+  }
+  return rtree_insert(tree, rect, item);
+}
+
+int rtree_search(const RTree *tree, const Rect *rect, rtree_search_callback cb, void *user_data) {
+  return rtree_search_subtree(tree, tree->root, rect, cb, user_data);
+}
+
+int rtree_search_subtree(const RTree *tree, uint32_t node, const Rect *rect, rtree_search_callback cb,
+                         void *user_data) {
+  uint32_t stack[RTREE_SEARCH_STACK_SIZE];
+  int top = 0;
+  stack[top++] = node;
+  uint64_t visited = 0;
+
+  while (top > 0) {
+    const RTreeNode *n = &tree->nodes[stack[--top]];
+    visited++;
+    for (int i = 0; i < n->count; i++) {
+      if (n->min_x[i] > rect->max_x || n->max_x[i] < rect->min_x || n->min_y[i] > rect->max_y ||
+          n->max_y[i] < rect->min_y) {
+        continue;
+      }
+      if (n->level == 0) {
+        Rect e = rtree_node_entry_rect(n, i);
+        int rc = cb(n->children[i], &e, user_data);
+        if (rc != 0) {
+          rtree_nodes_visited += visited;
+          return rc;
+        }
+      } else {
+        stack[top++] = n->children[i];
+      }
+    }
+  }
+  rtree_nodes_visited += visited;
+  return 0;
+}
+
+size_t rtree_partition(const RTree *tree, const Rect *rect, uint32_t *subtrees, size_t max_subtrees,
+                       uint16_t *level) {
+  uint32_t next[RTREE_MAX_PARTITION];
+  size_t count = 1;
+  subtrees[0] = tree->root;
+  *level = tree->nodes[tree->root].level;
+  if (max_subtrees > RTREE_MAX_PARTITION) {
+    max_subtrees = RTREE_MAX_PARTITION;
+  }
+
+  while (*level > 0) {
+    size_t next_count = 0;
+    rtree_nodes_visited += count;
+    for (size_t s = 0; s < count; s++) {
+      const RTreeNode *n = &tree->nodes[subtrees[s]];
+      for (int i = 0; i < n->count; i++) {
+        if (n->min_x[i] > rect->max_x || n->max_x[i] < rect->min_x || n->min_y[i] > rect->max_y ||
+            n->max_y[i] < rect->min_y) {
+          continue;
+        }
+        if (next_count == max_subtrees) {
+          return count;
+        }
+        next[next_count++] = n->children[i];
+      }
+    }
+    memcpy(subtrees, next, sizeof(uint32_t) * next_count);
+    count = next_count;
+    (*level)--;
+  }
+  return count;
+}
+
+typedef struct {
+  double distance;
+  uint32_t index; // node index, or the item when `is_item`
+  bool is_item;
+} HeapEntry;
+
+typedef struct {
+  HeapEntry *entries;
+  size_t count;
+  size_t capacity;
+} Heap;
+
+static int heap_push(Heap *heap, HeapEntry entry) {
+  if (heap->count == heap->capacity) {
+    size_t capacity = heap->capacity == 0 ? RTREE_SEARCH_STACK_SIZE : heap->capacity * 2;
+    HeapEntry *entries = realloc(heap->entries, sizeof(HeapEntry) * capacity);
+    if (entries == NULL) {
+      return 1;
+    }
+    heap->entries = entries;
+    heap->capacity = capacity;
+  }
+
+  size_t i = heap->count++;
+  while (i > 0) {
+    size_t parent = (i - 1) / 2;
+    if (heap->entries[parent].distance <= entry.distance) {
+      break;
+    }
+    heap->entries[i] = heap->entries[parent];
+    i = parent;
+  }
+  heap->entries[i] = entry;
+  return 0;
+}
+
+static HeapEntry heap_pop(Heap *heap) {
+  HeapEntry top = heap->entries[0];
+  HeapEntry last = heap->entries[--heap->count];
+  size_t i = 0;
+  for (;;) {
+    size_t child = i * 2 + 1;
+    if (child >= heap->count) {
+      break;
+    }
+    if (child + 1 < heap->count && heap->entries[child + 1].distance < heap->entries[child].distance) {
+      child++;
+    }
+    if (last.distance <= heap->entries[child].distance) {
+      break;
+    }
+    heap->entries[i] = heap->entries[child];
+    i = child;
+  }
+  if (heap->count > 0) {
+    heap->entries[i] = last;
+  }
+  return top;
+}
+
+int rtree_nearby(const RTree *tree, rtree_distance_function dist, rtree_nearby_callback cb, void *user_data) {
+  return rtree_nearby_subtree(tree, tree->root, dist, cb, user_data);
+}
+
+int rtree_nearby_subtree(const RTree *tree, uint32_t node, rtree_distance_function dist, rtree_nearby_callback cb,
+                         void *user_data) {
+  Heap heap = { 0 };
+  int rc = 0;
+  uint64_t visited = 0;
+  if (heap_push(&heap, (HeapEntry){ .distance = 0, .index = node, .is_item = false }) != 0) {
+    return 1;
+  }
+
+  while (heap.count > 0) {
+    HeapEntry top = heap_pop(&heap);
+    if (top.is_item) {
+      if (cb(top.index, top.distance, user_data) != 0) {
+        break;
+      }
+      continue;
+    }
+
+    const RTreeNode *n = &tree->nodes[top.index];
+    visited++;
+    double distances[RTREE_MAX_ENTRIES];
+    dist(n, distances, user_data);
+    for (int i = 0; i < n->count; i++) {
+      if (distances[i] == INFINITY) {
+        continue;
+      }
+      HeapEntry entry = { .distance = distances[i], .index = n->children[i], .is_item = n->level == 0 };
+      if (heap_push(&heap, entry) != 0) {
+        rc = 1;
+        break;
+      }
+    }
+    if (rc != 0) {
+      break;
+    }
+  }
+  free(heap.entries);
+  rtree_nodes_visited += visited;
+  return rc;
+}
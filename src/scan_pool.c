@@ -0,0 +1,141 @@
+#include "scan_pool.h"
+
+#include <errno.h>
+#include <stdlib.h>
+
+struct ScanJob {
+  scan_task_function fn;
+  void *user_data;
+  size_t tasks_count;
+  size_t next_task; // first unclaimed task
+  size_t done_count;
+  pthread_cond_t done; // signaled when the last task is done
+  ScanJob *next;
+};
+
+/*
+ * called with the lock held. takes `job` off the queue, once all of its tasks are claimed.
+ */
+static void unlink_job(ScanPool *pool, ScanJob *job) {
+  ScanJob *previous = NULL;
+  for (ScanJob *j = pool->jobs; j != job; j = j->next) {
+    previous = j;
+  }
+  if (previous == NULL) {
+    pool->jobs = job->next;
+  } else {
+    previous->next = job->next;
+  }
+  if (pool->last_job == job) {
+    pool->last_job = previous;
+  }
+}
+
+/*
+ * called with the lock held, the pool must have a job. returns the next task of the oldest job.
+ */
+static size_t claim_task(ScanPool *pool, ScanJob **job) {
+  *job = pool->jobs;
+  size_t task = (*job)->next_task++;
+  if ((*job)->next_task == (*job)->tasks_count) {
+    unlink_job(pool, *job);
+  }
+  return task;
+}
+
+/*
+ * called with the lock held, released while the task runs.
+ */
+static void run_task(ScanPool *pool, ScanJob *job, size_t task) {
+  pthread_mutex_unlock(&pool->lock);
+  job->fn(task, job->user_data);
+  pthread_mutex_lock(&pool->lock);
+  if (++job->done_count == job->tasks_count) {
+    pthread_cond_signal(&job->done);
+  }
+}
+
+static void *work(void *arg) {
+  ScanPool *pool = arg;
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (pool->jobs == NULL && !pool->closing) {
+      pthread_cond_wait(&pool->wakeup, &pool->lock);
+    }
+    if (pool->jobs == NULL) {
+      break;
+    }
+    ScanJob *job;
+    size_t task = claim_task(pool, &job);
+    run_task(pool, job, task);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+int init_scan_pool(ScanPool *pool, unsigned int workers_count, size_t min_candidates) {
+  *pool = (ScanPool){ .min_candidates = min_candidates };
+  if (workers_count == 0) {
+    workers_count = 1;
+  }
+  pool->workers = malloc(sizeof(pthread_t) * workers_count);
+  if (pool->workers == NULL) {
+    return 1;
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->wakeup, NULL);
+  for (; pool->workers_count < workers_count; pool->workers_count++) {
+    int rc = pthread_create(&pool->workers[pool->workers_count], NULL, work, pool);
+    if (rc != 0) {
+      destroy_scan_pool(pool);
+      errno = rc;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void destroy_scan_pool(ScanPool *pool) {
+  pthread_mutex_lock(&pool->lock);
+  pool->closing = true;
+  pthread_cond_broadcast(&pool->wakeup);
+  pthread_mutex_unlock(&pool->lock);
+  for (unsigned int i = 0; i < pool->workers_count; i++) {
+    pthread_join(pool->workers[i], NULL);
+  }
+  free(pool->workers);
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->wakeup);
+  *pool = (ScanPool){ 0 };
+}
+
+void scan_pool_run(ScanPool *pool, size_t tasks_count, scan_task_function fn, void *user_data) {
+  if (tasks_count == 0) {
+    return;
+  }
+  ScanJob job = { .fn = fn, .user_data = user_data, .tasks_count = tasks_count };
+  pthread_cond_init(&job.done, NULL);
+
+  pthread_mutex_lock(&pool->lock);
+  if (pool->last_job == NULL) {
+    pool->jobs = &job;
+  } else {
+    pool->last_job->next = &job;
+  }
+  pool->last_job = &job;
+  pthread_cond_broadcast(&pool->wakeup);
+
+  // the submitting thread only works on its own job, whatever else is queued.
+  while (job.next_task < job.tasks_count) {
+    size_t task = job.next_task++;
+    if (job.next_task == job.tasks_count) {
+      unlink_job(pool, &job);
+    }
+    run_task(pool, &job, task);
+  }
+  while (job.done_count < job.tasks_count) {
+    pthread_cond_wait(&job.done, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  pthread_cond_destroy(&job.done);
+}
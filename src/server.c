@@ -0,0 +1,677 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <math.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "geoqlite.h"
+#include "resp.h"
+#include "store.h"
+
+#define SERVER_DEFAULT_PORT "9851"
+#define SERVER_DEFAULT_BIND "127.0.0.1"
+#define SERVER_LISTEN_BACKLOG 511
+#define SERVER_EPOLL_EVENTS 256
+#define SERVER_INPUT_INITIAL_CAPACITY (16 << 10)
+#define SERVER_MAX_INPUT_LENGTH ((size_t)1 << 30)
+#define SERVER_MAX_LISTENERS 2
+#define SERVER_PARSE_ERROR_MAX_LENGTH 256
+#define LOG_COMPACT_MIN_SIZE (64 << 20)
+#define SERVER_EXPIRE_INTERVAL_MS 100
+
+/*
+ * geoqlite-server: one store shared over TCP and/or a unix socket, speaking RESP so redis-cli, redis-benchmark and
+ * the redis client libraries can talk to it.
+ *
+ * every thread runs its own epoll loop over the listening sockets (EPOLLEXCLUSIVE, so a new connection wakes a single
+ * thread) and the connections it accepted. Statements of different connections execute in parallel, the store locks
+ * the collections they touch. A connection reads into its own buffer and every complete request in it is executed
+ * right away, pipelined ones included, the replies are collected in one output buffer and sent with a single write.
+ * While replies are pending the connection isn't read from, so a client that doesn't read can't grow them forever.
+ */
+
+typedef enum {
+  ENDPOINT_LISTENER,
+  ENDPOINT_STOP,
+  ENDPOINT_CONNECTION,
+} EndpointKind;
+
+/*
+ * what an epoll event points at.
+ */
+typedef struct {
+  EndpointKind kind;
+  int fd;
+} Endpoint;
+
+typedef struct Connection {
+  Endpoint endpoint;
+  char *input; // requests read but not executed yet, the last one may be incomplete
+  size_t input_length;
+  size_t input_capacity;
+  RespBuffer output;
+  size_t output_sent;
+  bool writing; // waiting for EPOLLOUT rather than EPOLLIN
+  bool closing; // closed once the output is sent (QUIT, protocol error, peer closed)
+  Arena arena;
+  struct Connection *previous;
+  struct Connection *next;
+} Connection;
+
+typedef struct {
+  pthread_t thread;
+  int epoll_fd;
+  Store *store;
+  Connection *connections;
+} EventLoop;
+
+/*
+ * `make_prepared_statement` reports errors through a callback without user data, the message is stashed here.
+ */
+static _Thread_local char parse_error[SERVER_PARSE_ERROR_MAX_LENGTH];
+
+static void record_parse_error(int error_code, const char *error_message) {
+  (void)error_code;
+  snprintf(parse_error, sizeof(parse_error), "%s", error_message);
+}
+
+typedef struct {
+  RespBuffer *output;
+  const ExecuteResult *result;
+  bool with_distance;
+  bool with_fields;
+} ReplyContext;
+
+static void append_point(RespBuffer *output, const Point *p) {
+  resp_append_double(output, p->y);
+  resp_append_double(output, p->x);
+  if (p->has_z) {
+    resp_append_double(output, p->z);
+  }
+}
+
+/*
+ * an object is [id, geometry] and [id, geometry, distance] for NEARBY. The geometry is ["POINT", lat, lon] or
+ * ["BOUNDS", lat1, lon1, lat2, lon2, ...], z following lon when the point has one.
+ */
+static int append_object(const Object *object, double distance, void *user_data) {
+  ReplyContext *ctx = user_data;
+  RespBuffer *output = ctx->output;
+  Span id = collection_object_id(ctx->result->collection, object);
+  resp_append_array_header(output, ctx->with_distance || ctx->with_fields ? 3 : 2);
+  resp_append_bulk(output, id.start, id.length);
+
+  size_t start = resp_begin_array(output);
+  size_t count = 1;
+  Geometry geometry = collection_object_geometry(ctx->result->collection, object);
+  if (geometry.type == GEOMETRY_POINT) {
+    resp_append_bulk(output, "POINT", 5);
+    append_point(output, &geometry.point);
+    count += geometry.point.has_z ? 3 : 2;
+  } else {
+    resp_append_bulk(output, "BOUNDS", 6);
+    const LineString *ls = &geometry.line_string;
+    for (size_t i = 0; i < ls->points_count; i++) {
+      append_point(output, &ls->points[i]);
+      count += ls->points[i].has_z ? 3 : 2;
+    }
+  }
+  resp_end_array(output, start, count);
+
+  if (ctx->with_distance) {
+    resp_append_double(output, distance);
+  }
+  if (ctx->with_fields) {
+    // the fields the object has values for, as name value pairs.
+    const Collection *collection = ctx->result->collection;
+    start = resp_begin_array(output);
+    count = 0;
+    for (uint32_t i = 0; i < collection->fields_count; i++) {
+      double value = collection_object_field(collection, object, i);
+      if (!isnan(value)) {
+        resp_append_bulk(output, collection->fields[i].name, collection->fields[i].name_length);
+        resp_append_double(output, value);
+        count += 2;
+      }
+    }
+    resp_end_array(output, start, count);
+  }
+  return 0;
+}
+
+static bool is_command(const Span *name, const char *command) {
+  size_t length = strlen(command);
+  return name->length == length && strncmpci(name->start, command, length) == 0;
+}
+
+static void execute_request(Store *store, Connection *c, const RespRequest *request) {
+  RespBuffer *output = &c->output;
+  PreparedStatement prepared_statement;
+  parse_error[0] = '\0';
+  size_t arena_before = arena_used(&c->arena);
+  uint64_t parse_start = stats_now_ns();
+  int parse_result = make_prepared_statement(request->statement, &prepared_statement, &c->arena, record_parse_error);
+  stats_record_parse(store->stats, stats_now_ns() - parse_start, arena_used(&c->arena) - arena_before, parse_result != 0);
+  if (parse_result != 0) {
+    resp_append_error(output, parse_error[0] != '\0' ? parse_error : "invalid statement");
+    return;
+  }
+  for (size_t i = 0; i < request->parameters_count; i++) {
+    if (bind_span(&prepared_statement, i, request->parameters[i].start, request->parameters[i].length) != 0) {
+      resp_append_error(output, "argument can only be a key, id or channel");
+      return;
+    }
+  }
+
+  CommandType command_type = prepared_statement.command_type;
+  bool query = command_type == NEARBY || command_type == WITHIN || command_type == INTERSECTS;
+  ExecuteResult result = { .on_object = append_object };
+  ReplyContext ctx = {
+    .output = output,
+    .result = &result,
+    .with_distance = command_type == NEARBY,
+    .with_fields = prepared_statement.with_fields,
+  };
+  result.user_data = &ctx;
+
+  // query results are streamed straight into the output, their count is only known at the end.
+  size_t start = resp_begin_array(output);
+  int rc = execute_prepared_statement(store, &prepared_statement, &result);
+  if (rc != STORE_OK) {
+    output->length = start;
+  }
+  if (rc == STORE_OK) {
+    if (query) {
+      resp_end_array(output, start, result.objects_count);
+    } else if (command_type != GET) {
+      resp_append_simple(output, "OK");
+    }
+  } else if (command_type == GET && (rc == STORE_KEY_NOT_FOUND || rc == STORE_ID_NOT_FOUND)) {
+    resp_append_null(output);
+  } else {
+    resp_append_error(output, store_result_to_string(rc));
+  }
+}
+
+/*
+ * STATS and INFO reply the report of `format_stats` as a bulk string, like redis INFO.
+ */
+static void append_stats(Store *store, RespBuffer *output) {
+  StatsReport *report = malloc(sizeof(StatsReport));
+  SlowQuery *slow_queries = malloc(sizeof(SlowQuery) * SLOW_LOG_CAPACITY);
+  char *text = NULL;
+  size_t length = 0;
+  if (report != NULL && slow_queries != NULL) {
+    store_stats(store, report);
+    size_t slow_queries_count = stats_slow_queries(store->stats, slow_queries, SLOW_LOG_CAPACITY);
+    length = format_stats(report, slow_queries, slow_queries_count, NULL, 0);
+    if ((text = malloc(length + 1)) != NULL) {
+      format_stats(report, slow_queries, slow_queries_count, text, length + 1);
+    }
+  }
+  if (text != NULL) {
+    resp_append_bulk(output, text, length);
+  } else {
+    resp_append_error(output, store_result_to_string(STORE_OUT_OF_MEMORY));
+  }
+  free(text);
+  free(slow_queries);
+  free(report);
+}
+
+/*
+ * the few redis commands clients and tools send on their own are answered here, everything else is a statement.
+ */
+static void handle_request(Store *store, Connection *c, const RespRequest *request) {
+  const Span *name = &request->name;
+  if (request->arguments_count == 0) {
+    return;
+  }
+  if (is_command(name, "PING")) {
+    if (request->arguments_count > 1) {
+      resp_append_bulk(&c->output, request->argument.start, request->argument.length);
+    } else {
+      resp_append_simple(&c->output, "PONG");
+    }
+  } else if (is_command(name, "ECHO") && request->arguments_count == 2) {
+    resp_append_bulk(&c->output, request->argument.start, request->argument.length);
+  } else if (is_command(name, "QUIT")) {
+    resp_append_simple(&c->output, "OK");
+    c->closing = true;
+  } else if (is_command(name, "STATS") || is_command(name, "INFO")) {
+    append_stats(store, &c->output);
+  } else if (is_command(name, "COMMAND") || is_command(name, "CONFIG")) {
+    // redis-cli and redis-benchmark ask for these on connect and carry on without them.
+    resp_append_array_header(&c->output, 0);
+  } else {
+    execute_request(store, c, request);
+  }
+}
+
+/*
+ * executes every complete request in the input and keeps the incomplete rest for the next read.
+ */
+static void process_input(Store *store, Connection *c) {
+  size_t offset = 0;
+  while (!c->closing && offset < c->input_length) {
+    RespRequest request;
+    size_t consumed;
+    RespFrame frame = resp_next_request(c->input + offset, c->input_length - offset, &c->arena, &request, &consumed);
+    if (frame == RESP_INCOMPLETE) {
+      break;
+    }
+    if (frame == RESP_PROTOCOL_ERROR) {
+      resp_append_error(&c->output, "Protocol error");
+      c->closing = true;
+      break;
+    }
+    if (frame == RESP_OUT_OF_MEMORY) {
+      resp_append_error(&c->output, store_result_to_string(STORE_OUT_OF_MEMORY));
+    } else {
+      handle_request(store, c, &request);
+    }
+    arena_reset(&c->arena);
+    offset += consumed;
+  }
+  memmove(c->input, c->input + offset, c->input_length - offset);
+  c->input_length -= offset;
+}
+
+static void close_connection(EventLoop *loop, Connection *c) {
+  if (c->previous == NULL) {
+    loop->connections = c->next;
+  } else {
+    c->previous->next = c->next;
+  }
+  if (c->next != NULL) {
+    c->next->previous = c->previous;
+  }
+  close(c->endpoint.fd);
+  free(c->input);
+  destroy_resp_buffer(&c->output);
+  destroy_arena(&c->arena);
+  free(c);
+}
+
+/*
+ * sends as much of the output as the socket takes and switches between waiting to read and waiting to write. returns
+ * false when the connection has to be closed.
+ */
+static bool flush_output(EventLoop *loop, Connection *c) {
+  if (c->output.out_of_memory) {
+    return false;
+  }
+  while (c->output_sent < c->output.length) {
+    ssize_t n = write(c->endpoint.fd, c->output.data + c->output_sent, c->output.length - c->output_sent);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    if (n < 0) {
+      return false;
+    }
+    c->output_sent += (size_t)n;
+  }
+  bool pending = c->output_sent < c->output.length;
+  if (!pending) {
+    c->output.length = 0;
+    c->output_sent = 0;
+    if (c->closing) {
+      return false;
+    }
+  }
+  if (pending != c->writing) {
+    struct epoll_event event = { .events = pending ? EPOLLOUT : EPOLLIN, .data.ptr = c };
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, c->endpoint.fd, &event) != 0) {
+      return false;
+    }
+    c->writing = pending;
+  }
+  return true;
+}
+
+/*
+ * returns false when the connection has to be closed.
+ */
+static bool read_input(Connection *c) {
+  if (c->input_length == c->input_capacity) {
+    // only a single request larger than the buffer fills it, everything complete has been executed.
+    size_t capacity = c->input_capacity * 2;
+    char *input = capacity > SERVER_MAX_INPUT_LENGTH ? NULL : realloc(c->input, capacity);
+    if (input == NULL) {
+      return false;
+    }
+    c->input = input;
+    c->input_capacity = capacity;
+  }
+  ssize_t n;
+  do {
+    n = read(c->endpoint.fd, c->input + c->input_length, c->input_capacity - c->input_length);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0) {
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+  }
+  if (n == 0) {
+    // the peer closed: what it sent still gets executed, the replies are sent if it only shut down its side.
+    c->closing = true;
+  }
+  c->input_length += (size_t)n;
+  return true;
+}
+
+static void accept_connections(EventLoop *loop, int listener) {
+  for (;;) {
+    int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        perror("accept");
+      }
+      return;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // fails harmlessly on unix sockets
+
+    Connection *c = calloc(1, sizeof(Connection));
+    if (c == NULL || (c->input = malloc(SERVER_INPUT_INITIAL_CAPACITY)) == NULL ||
+        init_arena(&c->arena, 0) != 0) {
+      if (c != NULL) {
+        free(c->input);
+      }
+      free(c);
+      close(fd);
+      continue;
+    }
+    c->endpoint = (Endpoint){ .kind = ENDPOINT_CONNECTION, .fd = fd };
+    c->input_capacity = SERVER_INPUT_INITIAL_CAPACITY;
+    init_resp_buffer(&c->output);
+    c->next = loop->connections;
+    if (c->next != NULL) {
+      c->next->previous = c;
+    }
+    loop->connections = c;
+
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = c };
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+      close_connection(loop, c);
+    }
+  }
+}
+
+static void *run_event_loop(void *arg) {
+  EventLoop *loop = arg;
+  struct epoll_event events[SERVER_EPOLL_EVENTS];
+  for (;;) {
+    int n = epoll_wait(loop->epoll_fd, events, SERVER_EPOLL_EVENTS, -1);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("epoll_wait");
+      break;
+    }
+    for (int i = 0; i < n; i++) {
+      Endpoint *endpoint = events[i].data.ptr;
+      if (endpoint->kind == ENDPOINT_STOP) {
+        goto stop;
+      }
+      if (endpoint->kind == ENDPOINT_LISTENER) {
+        accept_connections(loop, endpoint->fd);
+        continue;
+      }
+
+      Connection *c = (Connection *)endpoint;
+      bool open = true;
+      if (events[i].events & EPOLLIN) {
+        open = read_input(c);
+        if (open) {
+          process_input(loop->store, c);
+        }
+      } else if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+        open = false;
+      }
+      if (open) {
+        open = flush_output(loop, c);
+      }
+      if (!open) {
+        close_connection(loop, c);
+      }
+    }
+  }
+
+stop:
+  while (loop->connections != NULL) {
+    close_connection(loop, loop->connections);
+  }
+  return NULL;
+}
+
+static int listen_tcp(const char *address, const char *port) {
+  struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, .ai_flags = AI_PASSIVE };
+  struct addrinfo *addresses;
+  int rc = getaddrinfo(address, port, &hints, &addresses);
+  if (rc != 0) {
+    fprintf(stderr, "Failed to resolve %s: %s\n", address, gai_strerror(rc));
+    return -1;
+  }
+  int fd = -1;
+  for (struct addrinfo *a = addresses; a != NULL && fd < 0; a = a->ai_next) {
+    fd = socket(a->ai_family, a->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, a->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, a->ai_addr, a->ai_addrlen) != 0 || listen(fd, SERVER_LISTEN_BACKLOG) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(addresses);
+  if (fd < 0) {
+    perror("Failed to listen on the tcp port");
+  }
+  return fd;
+}
+
+static int listen_unix(const char *path) {
+  struct sockaddr_un address = { .sun_family = AF_UNIX };
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "The unix socket path is too long\n");
+    return -1;
+  }
+  strcpy(address.sun_path, path);
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    perror("Failed to create the unix socket");
+    return -1;
+  }
+  // a socket file left behind by a previous run would make bind fail.
+  unlink(path);
+  if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, SERVER_LISTEN_BACKLOG) != 0) {
+    perror("Failed to listen on the unix socket");
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static void usage(const char *program) {
+  fprintf(stderr,
+          "usage: %s [-b address] [-p port] [-s unix socket path] [-t threads] [-l log path] [-q slow usec] [-Q]\n"
+          "  -b  address to listen on, default " SERVER_DEFAULT_BIND "\n"
+          "  -p  tcp port, default " SERVER_DEFAULT_PORT ", 0 to only listen on the unix socket\n"
+          "  -s  also listen on a unix socket\n"
+          "  -t  event loop threads, default one per cpu\n"
+          "  -l  persist the store to a log, synced once per second\n"
+          "  -q  keep statements taking at least this many microseconds in the slow log STATS shows\n"
+          "  -Q  store the points of new keys as 1e-7 degree fixed point, half the memory of doubles\n",
+          program);
+}
+
+int main(int argc, char **argv) {
+  const char *address = SERVER_DEFAULT_BIND;
+  const char *port = SERVER_DEFAULT_PORT;
+  const char *unix_path = NULL;
+  const char *log_path = NULL;
+  double slow_usec = 0;
+  bool quantize = false;
+  long threads_count = sysconf(_SC_NPROCESSORS_ONLN);
+  int option;
+  while ((option = getopt(argc, argv, "b:p:s:t:l:q:Q")) != -1) {
+    switch (option) {
+      case 'b': address = optarg; break;
+      case 'p': port = optarg; break;
+      case 's': unix_path = optarg; break;
+      case 't': threads_count = strtol(optarg, NULL, 10); break;
+      case 'l': log_path = optarg; break;
+      case 'q': slow_usec = strtod(optarg, NULL); break;
+      case 'Q': quantize = true; break;
+      default: usage(argv[0]); return EXIT_FAILURE;
+    }
+  }
+  if (threads_count < 1) {
+    threads_count = 1;
+  }
+
+  Store store;
+  Stats stats;
+  if (init_store(&store) != STORE_OK || init_stats(&stats) != 0) {
+    fprintf(stderr, "Failed to initialize the store\n");
+    return EXIT_FAILURE;
+  }
+  stats_set_slow_threshold(&stats, slow_usec > 0 ? (uint64_t)(slow_usec * 1000) : 0);
+  store_quantize_points(&store, quantize);
+  Wal wal;
+  if (log_path != NULL) {
+    if (open_wal(&wal, log_path, WAL_SYNC_INTERVAL, 1000) != 0) {
+      perror("Failed to open the log");
+      return EXIT_FAILURE;
+    }
+    int rc = store_replay_wal(&store, &wal);
+    if (rc != STORE_OK) {
+      fprintf(stderr, "Failed to replay the log: %s\n", store_result_to_string(rc));
+      return EXIT_FAILURE;
+    }
+    store_log_writes(&store, &wal);
+    wal_auto_compact(&wal, LOG_COMPACT_MIN_SIZE);
+  }
+  store_record_stats(&store, &stats);
+
+  Endpoint listeners[SERVER_MAX_LISTENERS];
+  size_t listeners_count = 0;
+  if (strcmp(port, "0") != 0) {
+    listeners[listeners_count++] = (Endpoint){ .kind = ENDPOINT_LISTENER, .fd = listen_tcp(address, port) };
+  }
+  if (unix_path != NULL) {
+    listeners[listeners_count++] = (Endpoint){ .kind = ENDPOINT_LISTENER, .fd = listen_unix(unix_path) };
+  }
+  for (size_t i = 0; i < listeners_count; i++) {
+    if (listeners[i].fd < 0) {
+      return EXIT_FAILURE;
+    }
+  }
+  if (listeners_count == 0) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  // every loop watches the stop eventfd, nobody reads it so a single write wakes all of them.
+  Endpoint stop = { .kind = ENDPOINT_STOP, .fd = eventfd(0, EFD_CLOEXEC) };
+  if (stop.fd < 0) {
+    perror("Failed to create the stop event");
+    return EXIT_FAILURE;
+  }
+
+  // signals are only taken by sigtimedwait below, the loops never see them. Writes to closed connections fail with EPIPE.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  EventLoop *loops = calloc((size_t)threads_count, sizeof(EventLoop));
+  if (loops == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    return EXIT_FAILURE;
+  }
+  long started = 0;
+  for (; started < threads_count; started++) {
+    EventLoop *loop = &loops[started];
+    loop->store = &store;
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd < 0) {
+      perror("Failed to create an event loop");
+      break;
+    }
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = &stop };
+    bool added = epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, stop.fd, &event) == 0;
+    for (size_t i = 0; added && i < listeners_count; i++) {
+      event = (struct epoll_event){ .events = EPOLLIN | EPOLLEXCLUSIVE, .data.ptr = &listeners[i] };
+      added = epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, listeners[i].fd, &event) == 0;
+    }
+    if (!added || pthread_create(&loop->thread, NULL, run_event_loop, loop) != 0) {
+      perror("Failed to start an event loop");
+      close(loop->epoll_fd);
+      break;
+    }
+  }
+
+  if (started == threads_count) {
+    printf("geoqlite server v%s ready with %ld threads\n", GEOQLITE_VERSION, threads_count);
+    fflush(stdout);
+    // the main thread expires objects between signals, the loops never wait behind a sweep of their own.
+    struct timespec interval = { .tv_sec = 0, .tv_nsec = SERVER_EXPIRE_INTERVAL_MS * 1000000L };
+    while (sigtimedwait(&signals, NULL, &interval) < 0) {
+      if (errno == EAGAIN) {
+        int rc = store_expire(&store, store_now_ms(), NULL);
+        if (rc != STORE_OK) {
+          fprintf(stderr, "Failed to expire objects: %s\n", store_result_to_string(rc));
+        }
+      }
+    }
+  }
+
+  uint64_t one = 1;
+  if (write(stop.fd, &one, sizeof(one)) != sizeof(one)) {
+    perror("Failed to stop the event loops");
+  }
+  for (long i = 0; i < started; i++) {
+    pthread_join(loops[i].thread, NULL);
+    close(loops[i].epoll_fd);
+  }
+  free(loops);
+  close(stop.fd);
+  for (size_t i = 0; i < listeners_count; i++) {
+    close(listeners[i].fd);
+  }
+  if (unix_path != NULL) {
+    unlink(unix_path);
+  }
+
+  int status = started == threads_count ? EXIT_SUCCESS : EXIT_FAILURE;
+  if (log_path != NULL && close_wal(&wal) != 0) {
+    perror("Failed to close the log");
+    status = EXIT_FAILURE;
+  }
+  destroy_store(&store);
+  destroy_stats(&stats);
+  return status;
+}
@@ -0,0 +1,570 @@
+#include "snapshot.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define SNAPSHOT_MAGIC 0x4e534751 // "GQSN" read as a little endian uint32_t
+#define SNAPSHOT_VERSION 4
+#define SNAPSHOT_ALIGNMENT 64
+#define SNAPSHOT_WRITE_BUFFER_SIZE (1 << 20)
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t object_size; // sizes of the structs written as they are in memory
+  uint32_t point_size;
+  uint32_t node_size;
+  uint32_t collections_count;
+  uint64_t collections_offset; // SnapshotCollection table
+  uint64_t file_size;
+  uint64_t log_id;
+  uint64_t log_offset;
+  uint32_t crc; // crc32c of the collection table, continued over this header with `crc` zeroed
+  uint32_t reserved;
+} SnapshotHeader;
+
+typedef struct {
+  uint64_t key_offset;
+  uint64_t key_length;
+  uint64_t slots_capacity;
+  uint64_t growth_left;
+  uint64_t control_offset;
+  uint64_t slots_offset;
+  uint64_t strings_offset; // bytes of the live ids, each followed by a NUL
+  uint64_t strings_size;
+  uint64_t spans_offset; // SnapshotSpan per handle
+  uint64_t live_bytes;
+  uint32_t handles_count;
+  uint32_t free_handle;
+  uint32_t count;
+  uint32_t root;
+  uint64_t objects_offset; // Object per handle, with NULL shapes
+  uint64_t quantized;
+  uint64_t point_x_offset; // the point columns, per handle: int32_t when `quantized`, else double
+  uint64_t point_y_offset;
+  uint64_t point_z_offset; // double per handle, only when `has_z`
+  uint64_t has_z;
+  uint64_t line_strings_offset; // SnapshotLineString per line string object
+  uint64_t line_strings_count;
+  uint64_t points_offset; // points of all the line strings back to back
+  uint64_t points_count;
+  uint64_t nodes_offset;
+  uint64_t items_count;
+  uint32_t nodes_count;
+  uint32_t free_list;
+  uint64_t fields_count;
+  uint64_t field_names_offset; // names of the field columns, each followed by a NUL
+  uint64_t field_names_size;
+  uint64_t field_values_offset; // the columns, `handles_count` doubles each, every one starting a section
+  uint64_t expirations_offset; // deadline per handle (0 when it doesn't expire), only when `has_expirations`
+  uint64_t has_expirations;
+} SnapshotCollection;
+
+typedef struct {
+  uint64_t offset; // into the id bytes, UINT64_MAX for a free handle
+  uint64_t length; // the next free handle for a free handle
+} SnapshotSpan;
+
+typedef struct {
+  uint32_t slot;
+  uint32_t is_closed;
+  uint64_t first_point;
+  uint64_t points_count;
+} SnapshotLineString;
+
+typedef struct {
+  FILE *file;
+  uint64_t offset; // of the next byte written
+  bool failed;
+} SnapshotWriter;
+
+static void put(SnapshotWriter *w, const void *bytes, size_t length) {
+  if (length > 0 && fwrite(bytes, 1, length, w->file) != length) {
+    w->failed = true;
+  }
+  w->offset += length;
+}
+
+/*
+ * pads up to the next section boundary and returns its offset.
+ */
+static uint64_t align(SnapshotWriter *w) {
+  static const char zeros[SNAPSHOT_ALIGNMENT];
+  put(w, zeros, (size_t)(-w->offset & (SNAPSHOT_ALIGNMENT - 1)));
+  return w->offset;
+}
+
+/*
+ * the object as it goes into the file: no pointers and no leftovers of whatever used a free slot before.
+ */
+static Object snapshot_object(const Object *o) {
+  Object copy;
+  memset(&copy, 0, sizeof(copy));
+  copy.id = o->id;
+  if (o->id != UINT32_MAX) {
+    copy.type = o->type;
+  }
+  return copy;
+}
+
+static bool is_line_string(const Object *o) {
+  return o->id != UINT32_MAX && o->type == GEOMETRY_LINE_STRING;
+}
+
+static size_t coordinate_size(bool quantized) {
+  return quantized ? sizeof(int32_t) : sizeof(double);
+}
+
+static void write_collection(SnapshotWriter *w, const Collection *c, SnapshotCollection *entry) {
+  const InternTable *ids = &c->ids;
+  *entry = (SnapshotCollection){
+    .key_length = c->key_length,
+    .slots_capacity = ids->slots_capacity,
+    .growth_left = ids->growth_left,
+    .live_bytes = ids->live_bytes,
+    .handles_count = ids->handles_count,
+    .free_handle = ids->free_handle,
+    .count = ids->count,
+    .root = c->index.root,
+    .items_count = c->index.items_count,
+    .nodes_count = c->index.nodes_count,
+    .free_list = c->index.free_list,
+  };
+
+  entry->key_offset = align(w);
+  put(w, c->key, c->key_length);
+  entry->control_offset = align(w);
+  put(w, ids->control, ids->slots_capacity);
+  entry->slots_offset = align(w);
+  put(w, ids->slots, sizeof(uint32_t) * ids->slots_capacity);
+
+  entry->strings_offset = align(w);
+  for (uint32_t h = 0; h < ids->handles_count; h++) {
+    const Span *s = &ids->strings[h];
+    if (s->start != NULL) {
+      put(w, s->start, s->length + 1);
+      entry->strings_size += s->length + 1;
+    }
+  }
+  entry->spans_offset = align(w);
+  uint64_t string_offset = 0;
+  for (uint32_t h = 0; h < ids->handles_count; h++) {
+    const Span *s = &ids->strings[h];
+    SnapshotSpan span = { .offset = UINT64_MAX, .length = s->length };
+    if (s->start != NULL) {
+      span.offset = string_offset;
+      string_offset += s->length + 1;
+    }
+    put(w, &span, sizeof(span));
+  }
+
+  entry->objects_offset = align(w);
+  for (uint32_t slot = 0; slot < ids->handles_count; slot++) {
+    Object o = snapshot_object(&c->objects[slot]);
+    put(w, &o, sizeof(o));
+  }
+  const PointColumns *points = &c->points;
+  size_t column_size = coordinate_size(points->quantized) * ids->handles_count;
+  entry->quantized = points->quantized;
+  entry->point_x_offset = align(w);
+  put(w, points->quantized ? (const void *)points->qx : (const void *)points->x, column_size);
+  entry->point_y_offset = align(w);
+  put(w, points->quantized ? (const void *)points->qy : (const void *)points->y, column_size);
+  entry->has_z = points->z != NULL;
+  entry->point_z_offset = align(w);
+  if (entry->has_z) {
+    put(w, points->z, sizeof(double) * ids->handles_count);
+  }
+  entry->line_strings_offset = align(w);
+  for (uint32_t slot = 0; slot < ids->handles_count; slot++) {
+    const Object *o = &c->objects[slot];
+    if (is_line_string(o)) {
+      SnapshotLineString ls = {
+        .slot = slot,
+        .is_closed = o->shape->line_string.is_closed,
+        .first_point = entry->points_count,
+        .points_count = o->shape->line_string.points_count,
+      };
+      put(w, &ls, sizeof(ls));
+      entry->line_strings_count++;
+      entry->points_count += ls.points_count;
+    }
+  }
+  entry->points_offset = align(w);
+  for (uint32_t slot = 0; slot < ids->handles_count; slot++) {
+    const Object *o = &c->objects[slot];
+    if (is_line_string(o)) {
+      put(w, o->shape->line_string.points, sizeof(Point) * o->shape->line_string.points_count);
+    }
+  }
+
+  entry->nodes_offset = align(w);
+  put(w, c->index.nodes, sizeof(RTreeNode) * c->index.nodes_count);
+
+  entry->fields_count = c->fields_count;
+  entry->field_names_offset = align(w);
+  for (uint32_t i = 0; i < c->fields_count; i++) {
+    put(w, c->fields[i].name, c->fields[i].name_length + 1);
+    entry->field_names_size += c->fields[i].name_length + 1;
+  }
+  entry->field_values_offset = align(w);
+  for (uint32_t i = 0; i < c->fields_count; i++) {
+    put(w, c->fields[i].values, sizeof(double) * ids->handles_count);
+    align(w);
+  }
+
+  // the buckets of the timer wheel are rebuilt at load time, only the deadlines are written.
+  entry->has_expirations = c->expirations.count > 0;
+  entry->expirations_offset = align(w);
+  if (entry->has_expirations) {
+    put(w, c->expirations.deadlines, sizeof(uint64_t) * ids->handles_count);
+  }
+}
+
+/*
+ * distance between two field columns of a collection in the file.
+ */
+static uint64_t column_stride(uint32_t handles_count) {
+  return ((uint64_t)handles_count * sizeof(double) + SNAPSHOT_ALIGNMENT - 1) & ~(uint64_t)(SNAPSHOT_ALIGNMENT - 1);
+}
+
+static int write_snapshot(const Store *store, FILE *file, uint64_t log_id, uint64_t log_offset) {
+  SnapshotCollection *entries = malloc(sizeof(SnapshotCollection) * (store->collections_count + 1));
+  if (entries == NULL) {
+    return STORE_OUT_OF_MEMORY;
+  }
+
+  SnapshotWriter w = { .file = file };
+  SnapshotHeader header = { 0 };
+  put(&w, &header, sizeof(header));
+  for (uint32_t i = 0; i < store->collections_count; i++) {
+    write_collection(&w, store->collections[i], &entries[i]);
+  }
+  size_t table_size = sizeof(SnapshotCollection) * store->collections_count;
+  header = (SnapshotHeader){
+    .magic = SNAPSHOT_MAGIC,
+    .version = SNAPSHOT_VERSION,
+    .object_size = sizeof(Object),
+    .point_size = sizeof(Point),
+    .node_size = sizeof(RTreeNode),
+    .collections_count = store->collections_count,
+    .collections_offset = align(&w),
+    .log_id = log_id,
+    .log_offset = log_offset,
+  };
+  put(&w, entries, table_size);
+  header.file_size = w.offset;
+  header.crc = crc32c(crc32c(0, entries, table_size), &header, sizeof(header));
+  free(entries);
+
+  if (fseek(file, 0, SEEK_SET) != 0) {
+    return STORE_IO_ERROR;
+  }
+  put(&w, &header, sizeof(header));
+  return w.failed ? STORE_IO_ERROR : STORE_OK;
+}
+
+int store_write_snapshot(const Store *store, const char *path, uint64_t log_id, uint64_t log_offset) {
+  size_t path_length = strlen(path);
+  char *temporary = malloc(path_length + sizeof(".tmp"));
+  if (temporary == NULL) {
+    return STORE_OUT_OF_MEMORY;
+  }
+  memcpy(temporary, path, path_length);
+  memcpy(temporary + path_length, ".tmp", sizeof(".tmp"));
+
+  FILE *file = fopen(temporary, "wb");
+  if (file == NULL) {
+    free(temporary);
+    return STORE_IO_ERROR;
+  }
+  setvbuf(file, NULL, _IOFBF, SNAPSHOT_WRITE_BUFFER_SIZE);
+  int rc = write_snapshot(store, file, log_id, log_offset);
+  if (rc == STORE_OK && (fflush(file) != 0 || fsync(fileno(file)) != 0)) {
+    rc = STORE_IO_ERROR;
+  }
+  if (fclose(file) != 0 && rc == STORE_OK) {
+    rc = STORE_IO_ERROR;
+  }
+  if (rc == STORE_OK && (rename(temporary, path) != 0 || sync_parent_directory(path) != 0)) {
+    rc = STORE_IO_ERROR;
+  }
+  if (rc != STORE_OK) {
+    unlink(temporary);
+  }
+  free(temporary);
+  return rc;
+}
+
+pid_t store_snapshot_in_background(Store *store, const char *path) {
+  uint64_t log_id = 0;
+  uint64_t log_offset = 0;
+  // no statement runs while the store is locked for writing, so the log ends exactly where the store is at.
+  pthread_rwlock_wrlock(&store->lock);
+  if (store->wal != NULL) {
+    if (wal_sync(store->wal) != 0) {
+      pthread_rwlock_unlock(&store->lock);
+      return -1;
+    }
+    log_id = store->wal->id;
+    log_offset = wal_end_offset(store->wal);
+  }
+
+  pid_t pid = fork();
+  if (pid == 0) {
+    // the child only has this thread: it must not touch the log, whose lock may have been held by another one.
+    _exit(store_write_snapshot(store, path, log_id, log_offset) == STORE_OK ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
+  pthread_rwlock_unlock(&store->lock);
+  return pid;
+}
+
+int store_wait_snapshot(pid_t pid) {
+  int status;
+  while (waitpid(pid, &status, 0) < 0) {
+    if (errno != EINTR) {
+      return STORE_IO_ERROR;
+    }
+  }
+  return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS ? STORE_OK : STORE_IO_ERROR;
+}
+
+/*
+ * true when `count` elements of `element_size` bytes at `offset` are inside the file and aligned.
+ */
+static bool section_fits(size_t file_size, uint64_t offset, uint64_t count, size_t element_size) {
+  return offset % SNAPSHOT_ALIGNMENT == 0 && offset <= file_size && count <= (file_size - offset) / element_size;
+}
+
+static bool collection_fits(const SnapshotCollection *e, size_t file_size) {
+  return e->slots_capacity >= SWISS_GROUP_WIDTH && (e->slots_capacity & (e->slots_capacity - 1)) == 0 &&
+         e->growth_left < e->slots_capacity && e->count <= e->handles_count &&
+         (e->free_handle == UINT32_MAX || e->free_handle < e->handles_count) && e->root < e->nodes_count &&
+         (e->free_list == RTREE_NULL_NODE || e->free_list < e->nodes_count) &&
+         section_fits(file_size, e->key_offset, e->key_length, 1) &&
+         section_fits(file_size, e->control_offset, e->slots_capacity, 1) &&
+         section_fits(file_size, e->slots_offset, e->slots_capacity, sizeof(uint32_t)) &&
+         section_fits(file_size, e->strings_offset, e->strings_size, 1) &&
+         section_fits(file_size, e->spans_offset, e->handles_count, sizeof(SnapshotSpan)) &&
+         section_fits(file_size, e->objects_offset, e->handles_count, sizeof(Object)) && e->quantized <= 1 &&
+         section_fits(file_size, e->point_x_offset, e->handles_count, coordinate_size(e->quantized)) &&
+         section_fits(file_size, e->point_y_offset, e->handles_count, coordinate_size(e->quantized)) &&
+         (!e->has_z || section_fits(file_size, e->point_z_offset, e->handles_count, sizeof(double))) &&
+         section_fits(file_size, e->line_strings_offset, e->line_strings_count, sizeof(SnapshotLineString)) &&
+         section_fits(file_size, e->points_offset, e->points_count, sizeof(Point)) &&
+         section_fits(file_size, e->nodes_offset, e->nodes_count, sizeof(RTreeNode)) &&
+         e->fields_count <= e->field_names_size &&
+         section_fits(file_size, e->field_names_offset, e->field_names_size, 1) &&
+         (e->handles_count == 0 ||
+          section_fits(file_size, e->field_values_offset, e->fields_count, column_stride(e->handles_count))) &&
+         (!e->has_expirations || section_fits(file_size, e->expirations_offset, e->handles_count, sizeof(uint64_t)));
+}
+
+static int check_header(const SnapshotHeader *header, size_t file_size, const Wal *wal) {
+  if (header->magic != SNAPSHOT_MAGIC || header->version != SNAPSHOT_VERSION || header->object_size != sizeof(Object) ||
+      header->point_size != sizeof(Point) || header->node_size != sizeof(RTreeNode) ||
+      header->file_size != file_size ||
+      !section_fits(file_size, header->collections_offset, header->collections_count, sizeof(SnapshotCollection))) {
+    return STORE_INVALID_SNAPSHOT;
+  }
+  SnapshotHeader unsigned_header = *header;
+  unsigned_header.crc = 0;
+  const char *table = (const char *)header + header->collections_offset;
+  uint32_t crc = crc32c(0, table, sizeof(SnapshotCollection) * header->collections_count);
+  if (crc32c(crc, &unsigned_header, sizeof(unsigned_header)) != header->crc) {
+    return STORE_INVALID_SNAPSHOT;
+  }
+  // a snapshot ahead of the end of the log was taken from writes that log no longer has.
+  if (wal != NULL && (header->log_id != wal->id || header->log_offset > wal->end_offset)) {
+    return STORE_INVALID_SNAPSHOT;
+  }
+  return STORE_OK;
+}
+
+/*
+ * points `collection`, fresh and empty, at the arrays of `e` in the mapped file `map`. returns a StoreResult.
+ */
+static int attach_collection(Collection *collection, char *map, const SnapshotCollection *e, uint64_t now) {
+  // the span table is rebuilt rather than mapped, spans hold pointers.
+  Span *strings = malloc(sizeof(Span) * e->handles_count);
+  if (strings == NULL) {
+    return STORE_OUT_OF_MEMORY;
+  }
+  const char *bytes = map + e->strings_offset;
+  const SnapshotSpan *spans = (const SnapshotSpan *)(map + e->spans_offset);
+  for (uint32_t h = 0; h < e->handles_count; h++) {
+    if (spans[h].offset == UINT64_MAX) {
+      strings[h] = (Span){ .start = NULL, .length = spans[h].length };
+    } else if (spans[h].offset < e->strings_size && spans[h].length < e->strings_size - spans[h].offset &&
+               bytes[spans[h].offset + spans[h].length] == '\0') {
+      strings[h] = (Span){ .start = bytes + spans[h].offset, .length = spans[h].length };
+    } else {
+      free(strings);
+      return STORE_INVALID_SNAPSHOT;
+    }
+  }
+
+  destroy_intern_table(&collection->ids);
+  collection->ids = (InternTable){
+    .control = (uint8_t *)(map + e->control_offset),
+    .slots = (uint32_t *)(map + e->slots_offset),
+    .slots_capacity = e->slots_capacity,
+    .slots_borrowed = true,
+    .growth_left = e->growth_left,
+    .strings = strings,
+    .count = e->count,
+    .handles_count = e->handles_count,
+    .handles_capacity = e->handles_count,
+    .free_handle = e->free_handle,
+    .live_bytes = e->live_bytes,
+  };
+  collection->objects = (Object *)(map + e->objects_offset);
+  collection->objects_capacity = e->handles_count;
+  collection->objects_borrowed = true;
+  collection->count = e->count;
+  PointColumns *columns = &collection->points;
+  *columns = (PointColumns){ .quantized = e->quantized != 0, .borrowed = true, .z_borrowed = true };
+  if (columns->quantized) {
+    columns->qx = (int32_t *)(map + e->point_x_offset);
+    columns->qy = (int32_t *)(map + e->point_y_offset);
+  } else {
+    columns->x = (double *)(map + e->point_x_offset);
+    columns->y = (double *)(map + e->point_y_offset);
+  }
+  if (e->has_z) {
+    columns->z = (double *)(map + e->point_z_offset);
+  }
+
+  destroy_rtree(&collection->index);
+  collection->index = (RTree){
+    .nodes = (RTreeNode *)(map + e->nodes_offset),
+    .nodes_count = e->nodes_count,
+    .nodes_capacity = e->nodes_count,
+    .nodes_borrowed = true,
+    .free_list = e->free_list,
+    .root = e->root,
+    .items_count = e->items_count,
+  };
+
+  const char *names = map + e->field_names_offset;
+  const char *names_end = names + e->field_names_size;
+  for (uint64_t i = 0; i < e->fields_count; i++) {
+    size_t name_length = strnlen(names, (size_t)(names_end - names));
+    if (names + name_length == names_end) {
+      return STORE_INVALID_SNAPSHOT;
+    }
+    double *values = (double *)(map + e->field_values_offset + i * column_stride(e->handles_count));
+    int rc = collection_attach_field(collection, names, name_length, values);
+    if (rc != STORE_OK) {
+      return rc;
+    }
+    names += name_length + 1;
+  }
+
+  if (e->has_expirations) {
+    int rc = collection_attach_expirations(collection, (const uint64_t *)(map + e->expirations_offset), now);
+    if (rc != STORE_OK) {
+      return rc;
+    }
+  }
+
+  const SnapshotLineString *line_strings = (const SnapshotLineString *)(map + e->line_strings_offset);
+  Point *points = (Point *)(map + e->points_offset);
+  for (uint64_t i = 0; i < e->line_strings_count; i++) {
+    const SnapshotLineString *ls = &line_strings[i];
+    if (ls->slot >= e->handles_count || !is_line_string(&collection->objects[ls->slot]) ||
+        collection->objects[ls->slot].shape != NULL ||
+        ls->first_point > e->points_count || ls->points_count > e->points_count - ls->first_point) {
+      return STORE_INVALID_SNAPSHOT;
+    }
+    LineString line_string = {
+      .points = points + ls->first_point,
+      .points_count = ls->points_count,
+      .is_closed = ls->is_closed != 0,
+    };
+    int rc = collection_attach_line_string(collection, ls->slot, &line_string);
+    if (rc != STORE_OK) {
+      return rc;
+    }
+  }
+  return STORE_OK;
+}
+
+static int load_collections(Store *store, char *map, size_t file_size, const SnapshotHeader *header) {
+  uint64_t now = store_now_ms();
+  const SnapshotCollection *entries = (const SnapshotCollection *)(map + header->collections_offset);
+  for (uint32_t i = 0; i < header->collections_count; i++) {
+    const SnapshotCollection *e = &entries[i];
+    if (!collection_fits(e, file_size)) {
+      return STORE_INVALID_SNAPSHOT;
+    }
+    uint32_t collections_count = store->collections_count;
+    Collection *collection = store_get_or_create_collection(store, map + e->key_offset, e->key_length);
+    if (collection == NULL) {
+      return STORE_OUT_OF_MEMORY;
+    }
+    if (store->collections_count == collections_count) {
+      // the key was already seen.
+      return STORE_INVALID_SNAPSHOT;
+    }
+    if (e->handles_count > 0) {
+      int rc = attach_collection(collection, map, e, now);
+      if (rc != STORE_OK) {
+        return rc;
+      }
+    }
+  }
+  return STORE_OK;
+}
+
+int store_load_snapshot(Store *store, const char *path, const Wal *wal) {
+  if (store->collections_count != 0 || store->snapshot != NULL) {
+    return STORE_INVALID_SNAPSHOT;
+  }
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return STORE_IO_ERROR;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return STORE_IO_ERROR;
+  }
+  size_t size = (size_t)st.st_size;
+  if (size < sizeof(SnapshotHeader)) {
+    close(fd);
+    return STORE_INVALID_SNAPSHOT;
+  }
+  // private and writable: the loaded collections are modified in place, the kernel copies the pages they write to.
+  char *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return STORE_IO_ERROR;
+  }
+
+  const SnapshotHeader *header = (const SnapshotHeader *)map;
+  int rc = check_header(header, size, wal);
+  if (rc == STORE_OK) {
+    rc = load_collections(store, map, size, header);
+  }
+  if (rc != STORE_OK) {
+    while (store->collections_count > 0) {
+      Collection *last = store->collections[store->collections_count - 1];
+      store_drop_collection(store, last->key, last->key_length);
+    }
+    munmap(map, size);
+    return rc;
+  }
+
+  store->snapshot = map;
+  store->snapshot_size = size;
+  store->log_offset = wal != NULL ? header->log_offset : 0;
+  return STORE_OK;
+}
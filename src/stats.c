@@ -0,0 +1,357 @@
+#include "stats.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "store.h"
+
+/*
+ * the counters of one command type in one shard. Only the owning thread writes them, reports read them concurrently,
+ * hence atomics accessed with relaxed loads and stores: no locked instruction on the recording side.
+ */
+typedef struct {
+  atomic_uint_fast64_t calls;
+  atomic_uint_fast64_t errors;
+  atomic_uint_fast64_t results;
+  atomic_uint_fast64_t nodes_visited;
+  atomic_uint_fast64_t arena_bytes;
+  atomic_uint_fast64_t arena_bytes_max;
+  atomic_uint_fast64_t total;
+  atomic_uint_fast64_t max;
+  atomic_uint_fast64_t buckets[HISTOGRAM_BUCKETS];
+} ShardCounters;
+
+struct StatsShard {
+  StatsShard *next;
+  Stats *stats;
+  bool owned; // by a live thread, guarded by `stats->lock`
+  ShardCounters parse;
+  ShardCounters commands[COMMAND_TYPES_COUNT];
+};
+
+static unsigned histogram_bucket(uint64_t value) {
+  if (value < HISTOGRAM_SUB_BUCKETS) {
+    return (unsigned)value;
+  }
+  unsigned exponent = 63 - (unsigned)__builtin_clzll(value);
+  if (exponent >= HISTOGRAM_MAX_BITS) {
+    return HISTOGRAM_BUCKETS - 1;
+  }
+  unsigned sub = (unsigned)(value >> (exponent - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1);
+  return (exponent - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS + sub;
+}
+
+/*
+ * the largest value that lands in `bucket`.
+ */
+static uint64_t histogram_bucket_max(unsigned bucket) {
+  if (bucket < HISTOGRAM_SUB_BUCKETS) {
+    return bucket;
+  }
+  unsigned exponent = bucket / HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BITS - 1;
+  uint64_t sub = bucket % HISTOGRAM_SUB_BUCKETS;
+  uint64_t width = (uint64_t)1 << (exponent - HISTOGRAM_SUB_BITS);
+  return ((HISTOGRAM_SUB_BUCKETS + sub) << (exponent - HISTOGRAM_SUB_BITS)) + width - 1;
+}
+
+void histogram_record(LatencyHistogram *histogram, uint64_t value) {
+  histogram->counts[histogram_bucket(value)]++;
+  histogram->count++;
+  histogram->total += value;
+  if (value > histogram->max) {
+    histogram->max = value;
+  }
+}
+
+void histogram_merge(LatencyHistogram *into, const LatencyHistogram *histogram) {
+  for (unsigned bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+    into->counts[bucket] += histogram->counts[bucket];
+  }
+  into->count += histogram->count;
+  into->total += histogram->total;
+  if (histogram->max > into->max) {
+    into->max = histogram->max;
+  }
+}
+
+uint64_t histogram_percentile(const LatencyHistogram *histogram, double percentile) {
+  if (histogram->count == 0) {
+    return 0;
+  }
+  uint64_t rank = (uint64_t)(percentile / 100.0 * (double)histogram->count + 0.999999);
+  uint64_t seen = 0;
+  for (unsigned bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+    seen += histogram->counts[bucket];
+    if (seen >= rank && seen > 0) {
+      uint64_t value = histogram_bucket_max(bucket);
+      return value < histogram->max ? value : histogram->max;
+    }
+  }
+  return histogram->max;
+}
+
+uint64_t stats_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * runs when a thread that recorded exits: its shard goes to the next thread that records.
+ */
+static void release_shard(void *value) {
+  StatsShard *shard = value;
+  pthread_mutex_lock(&shard->stats->lock);
+  shard->owned = false;
+  pthread_mutex_unlock(&shard->stats->lock);
+}
+
+int init_stats(Stats *stats) {
+  memset(stats, 0, sizeof(Stats));
+  if (pthread_key_create(&stats->key, release_shard) != 0) {
+    return 1;
+  }
+  if (pthread_mutex_init(&stats->lock, NULL) != 0) {
+    pthread_key_delete(stats->key);
+    return 1;
+  }
+  atomic_init(&stats->slow_threshold, 0);
+  return 0;
+}
+
+void destroy_stats(Stats *stats) {
+  pthread_key_delete(stats->key);
+  StatsShard *shard = stats->shards;
+  while (shard != NULL) {
+    StatsShard *next = shard->next;
+    free(shard);
+    shard = next;
+  }
+  pthread_mutex_destroy(&stats->lock);
+}
+
+void stats_set_slow_threshold(Stats *stats, uint64_t threshold) {
+  atomic_store_explicit(&stats->slow_threshold, threshold, memory_order_relaxed);
+}
+
+/*
+ * the shard of the calling thread, NULL when out of memory (nothing is recorded then).
+ */
+static StatsShard *current_shard(Stats *stats) {
+  StatsShard *shard = pthread_getspecific(stats->key);
+  if (shard != NULL) {
+    return shard;
+  }
+  pthread_mutex_lock(&stats->lock);
+  for (shard = stats->shards; shard != NULL && shard->owned; shard = shard->next) {
+  }
+  if (shard == NULL && (shard = calloc(1, sizeof(StatsShard))) != NULL) {
+    shard->stats = stats;
+    shard->next = stats->shards;
+    stats->shards = shard;
+  }
+  if (shard != NULL) {
+    if (pthread_setspecific(stats->key, shard) == 0) {
+      shard->owned = true;
+    } else {
+      shard = NULL;
+    }
+  }
+  pthread_mutex_unlock(&stats->lock);
+  return shard;
+}
+
+static inline void add(atomic_uint_fast64_t *counter, uint64_t value) {
+  atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+static inline void raise_to(atomic_uint_fast64_t *counter, uint64_t value) {
+  if (value > atomic_load_explicit(counter, memory_order_relaxed)) {
+    atomic_store_explicit(counter, value, memory_order_relaxed);
+  }
+}
+
+static void record(ShardCounters *counters, uint64_t duration, bool failed) {
+  add(&counters->calls, 1);
+  add(&counters->errors, failed);
+  add(&counters->total, duration);
+  raise_to(&counters->max, duration);
+  add(&counters->buckets[histogram_bucket(duration)], 1);
+}
+
+void stats_record_parse(Stats *stats, uint64_t duration, size_t arena_bytes, bool failed) {
+  StatsShard *shard = current_shard(stats);
+  if (shard == NULL) {
+    return;
+  }
+  record(&shard->parse, duration, failed);
+  add(&shard->parse.arena_bytes, arena_bytes);
+  raise_to(&shard->parse.arena_bytes_max, arena_bytes);
+}
+
+static void copy_span(char *into, size_t *length, const Span *span) {
+  *length = span->start == NULL ? 0 : span->length < SLOW_LOG_SPAN_LENGTH ? span->length : SLOW_LOG_SPAN_LENGTH;
+  if (*length > 0) {
+    memcpy(into, span->start, *length);
+  }
+}
+
+static void log_slow_query(Stats *stats, const PreparedStatement *prepared_statement, uint64_t duration,
+                           int store_result, uint64_t results, uint64_t nodes_visited) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  CommandType command_type = prepared_statement->command_type;
+  bool channel = command_type == SETCHAN || command_type == DELCHAN;
+  pthread_mutex_lock(&stats->lock);
+  SlowQuery *query = &stats->slow_log[stats->slow_count++ % SLOW_LOG_CAPACITY];
+  *query = (SlowQuery){
+    .timestamp = (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000,
+    .duration = duration,
+    .command_type = command_type,
+    .store_result = store_result,
+    .results = results,
+    .nodes_visited = nodes_visited,
+  };
+  copy_span(query->key, &query->key_length, &prepared_statement->key);
+  copy_span(query->id, &query->id_length, channel ? &prepared_statement->channel : &prepared_statement->id);
+  pthread_mutex_unlock(&stats->lock);
+}
+
+void stats_record_command(Stats *stats, const PreparedStatement *prepared_statement, uint64_t duration,
+                          int store_result, uint64_t results, uint64_t nodes_visited) {
+  StatsShard *shard = current_shard(stats);
+  if (shard != NULL && (unsigned)prepared_statement->command_type < COMMAND_TYPES_COUNT) {
+    ShardCounters *counters = &shard->commands[prepared_statement->command_type];
+    record(counters, duration, store_result != STORE_OK);
+    add(&counters->results, results);
+    add(&counters->nodes_visited, nodes_visited);
+  }
+  uint64_t threshold = atomic_load_explicit(&stats->slow_threshold, memory_order_relaxed);
+  if (threshold != 0 && duration >= threshold) {
+    log_slow_query(stats, prepared_statement, duration, store_result, results, nodes_visited);
+  }
+}
+
+static uint64_t load(const atomic_uint_fast64_t *counter) {
+  return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+static void sum_counters(CommandStats *into, const ShardCounters *counters) {
+  into->calls += load(&counters->calls);
+  into->errors += load(&counters->errors);
+  into->results += load(&counters->results);
+  into->nodes_visited += load(&counters->nodes_visited);
+  into->arena_bytes += load(&counters->arena_bytes);
+  uint64_t arena_bytes_max = load(&counters->arena_bytes_max);
+  if (arena_bytes_max > into->arena_bytes_max) {
+    into->arena_bytes_max = arena_bytes_max;
+  }
+  LatencyHistogram *latency = &into->latency;
+  for (unsigned bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+    uint64_t count = load(&counters->buckets[bucket]);
+    latency->counts[bucket] += count;
+    latency->count += count;
+  }
+  latency->total += load(&counters->total);
+  uint64_t max = load(&counters->max);
+  if (max > latency->max) {
+    latency->max = max;
+  }
+}
+
+void stats_report(Stats *stats, StatsReport *report) {
+  memset(report, 0, sizeof(StatsReport));
+  pthread_mutex_lock(&stats->lock);
+  for (const StatsShard *shard = stats->shards; shard != NULL; shard = shard->next) {
+    sum_counters(&report->parse, &shard->parse);
+    for (unsigned i = 0; i < COMMAND_TYPES_COUNT; i++) {
+      sum_counters(&report->commands[i], &shard->commands[i]);
+    }
+  }
+  report->slow_count = stats->slow_count;
+  pthread_mutex_unlock(&stats->lock);
+  report->slow_threshold = atomic_load_explicit(&stats->slow_threshold, memory_order_relaxed);
+}
+
+size_t stats_slow_queries(Stats *stats, SlowQuery *queries, size_t capacity) {
+  pthread_mutex_lock(&stats->lock);
+  size_t count = stats->slow_count < SLOW_LOG_CAPACITY ? stats->slow_count : SLOW_LOG_CAPACITY;
+  if (count > capacity) {
+    count = capacity;
+  }
+  for (size_t i = 0; i < count; i++) {
+    queries[i] = stats->slow_log[(stats->slow_count - 1 - i) % SLOW_LOG_CAPACITY];
+  }
+  pthread_mutex_unlock(&stats->lock);
+  return count;
+}
+
+typedef struct {
+  char *buffer;
+  size_t capacity;
+  size_t length;
+} Text;
+
+static void append(Text *text, const char *format, ...) {
+  va_list arguments;
+  va_start(arguments, format);
+  bool fits = text->length < text->capacity;
+  int n = vsnprintf(fits ? text->buffer + text->length : NULL, fits ? text->capacity - text->length : 0, format,
+                    arguments);
+  va_end(arguments);
+  if (n > 0) {
+    text->length += (size_t)n;
+  }
+}
+
+static void append_latency(Text *text, const LatencyHistogram *latency) {
+  append(text, ",usec_mean=%.2f,usec_p50=%.2f,usec_p99=%.2f,usec_p999=%.2f,usec_max=%.2f",
+         latency->count > 0 ? (double)latency->total / latency->count / 1e3 : 0.0,
+         histogram_percentile(latency, 50) / 1e3, histogram_percentile(latency, 99) / 1e3,
+         histogram_percentile(latency, 99.9) / 1e3, latency->max / 1e3);
+}
+
+size_t format_stats(const StatsReport *report, const SlowQuery *slow_queries, size_t slow_queries_count, char *buffer,
+                    size_t capacity) {
+  Text text = { .buffer = buffer, .capacity = capacity };
+  if (capacity > 0) {
+    buffer[0] = '\0';
+  }
+  append(&text, "# store\ncollections:%u\nobjects:%zu\nmemory_bytes:%zu\n", report->collections, report->objects,
+         report->memory_bytes);
+
+  // redis INFO style: a `name:field=value,...` line per command that ran.
+  const CommandStats *parse = &report->parse;
+  append(&text, "# commands\nparse:calls=%llu,errors=%llu,arena_bytes_mean=%.1f,arena_bytes_max=%llu",
+         (unsigned long long)parse->calls, (unsigned long long)parse->errors,
+         parse->calls > 0 ? (double)parse->arena_bytes / parse->calls : 0.0,
+         (unsigned long long)parse->arena_bytes_max);
+  append_latency(&text, &parse->latency);
+  append(&text, "\n");
+  for (unsigned i = 0; i < COMMAND_TYPES_COUNT; i++) {
+    const CommandStats *command = &report->commands[i];
+    if (command->calls == 0) {
+      continue;
+    }
+    append(&text, "%s:calls=%llu,errors=%llu,results=%llu,nodes_visited=%llu", command_type_to_string(i),
+           (unsigned long long)command->calls, (unsigned long long)command->errors,
+           (unsigned long long)command->results, (unsigned long long)command->nodes_visited);
+    append_latency(&text, &command->latency);
+    append(&text, "\n");
+  }
+
+  append(&text, "# slowlog\nslowlog_usec_threshold:%.2f\nslowlog_count:%llu\n", report->slow_threshold / 1e3,
+         (unsigned long long)report->slow_count);
+  for (size_t i = 0; i < slow_queries_count; i++) {
+    const SlowQuery *query = &slow_queries[i];
+    append(&text, "slow%zu:timestamp=%llu,usec=%.2f,command=%s,key=%.*s,id=%.*s,results=%llu,nodes_visited=%llu,%s\n",
+           i, (unsigned long long)query->timestamp, query->duration / 1e3,
+           command_type_to_string(query->command_type), (int)query->key_length, query->key, (int)query->id_length,
+           query->id, (unsigned long long)query->results, (unsigned long long)query->nodes_visited,
+           store_result_to_string(query->store_result));
+  }
+  return text.length;
+}
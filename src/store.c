@@ -0,0 +1,785 @@
+#include "store.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#define STORE_INITIAL_CAPACITY 16
+#define LOGGED_FIELDS_ON_STACK 16
+#define EXPIRED_BATCH_SIZE 256
+
+static const char * const STORE_RESULT_TO_STRING[] = {
+  "STORE_OK",
+  "STORE_OUT_OF_MEMORY",
+  "STORE_KEY_NOT_FOUND",
+  "STORE_ID_NOT_FOUND",
+  "STORE_INVALID_STATEMENT",
+  "STORE_IO_ERROR",
+  "STORE_INVALID_SNAPSHOT",
+  "STORE_INVALID_IMPORT",
+};
+
+uint64_t store_now_ms(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+const char *store_result_to_string(int store_result) {
+  if (store_result < 0 || (size_t)store_result >= sizeof(STORE_RESULT_TO_STRING) / sizeof(STORE_RESULT_TO_STRING[0])) {
+    return "UNKNOWN_STORE_RESULT";
+  }
+  return STORE_RESULT_TO_STRING[store_result];
+}
+
+int init_store(Store *store) {
+  store->collections = NULL;
+  store->drops = 0;
+  store->collections_count = 0;
+  store->collections_capacity = 0;
+  store->on_detect = NULL;
+  store->detect_user_data = NULL;
+  store->wal = NULL;
+  store->scan_pool = NULL;
+  store->stats = NULL;
+  store->quantize_points = false;
+  store->snapshot = NULL;
+  store->snapshot_size = 0;
+  store->log_offset = 0;
+  if (init_hashmap(&store->keys, STORE_INITIAL_CAPACITY) != 0) {
+    return STORE_OUT_OF_MEMORY;
+  }
+  store->events = NULL;
+  if (init_geofences(&store->geofences) != STORE_OK) {
+    destroy_hashmap(&store->keys);
+    return STORE_OUT_OF_MEMORY;
+  }
+  pthread_rwlock_init(&store->lock, NULL);
+  pthread_rwlock_init(&store->geofences_lock, NULL);
+  pthread_mutex_init(&store->events_lock, NULL);
+  return STORE_OK;
+}
+
+void destroy_store(Store *store) {
+  for (uint32_t i = 0; i < store->collections_count; i++) {
+    destroy_collection(store->collections[i]);
+    free(store->collections[i]);
+  }
+  free(store->collections);
+  store->collections = NULL;
+  store->collections_count = 0;
+  store->collections_capacity = 0;
+  destroy_hashmap(&store->keys);
+  destroy_geofences(&store->geofences);
+  if (store->snapshot != NULL) {
+    munmap(store->snapshot, store->snapshot_size);
+    store->snapshot = NULL;
+  }
+  pthread_rwlock_destroy(&store->lock);
+  pthread_rwlock_destroy(&store->geofences_lock);
+  pthread_mutex_destroy(&store->events_lock);
+}
+
+/*
+ * detect_callback used by `store_publish_events`.
+ */
+static void publish_detect_event(const DetectEvent *event, void *user_data) {
+  Store *store = user_data;
+  pthread_mutex_lock(&store->events_lock);
+  event_ring_publish(store->events, event);
+  pthread_mutex_unlock(&store->events_lock);
+}
+
+void store_publish_events(Store *store, EventRing *events) {
+  store->events = events;
+  store->on_detect = publish_detect_event;
+  store->detect_user_data = store;
+}
+
+Collection *store_get_collection(const Store *store, const char *key, size_t key_length) {
+  uint32_t index;
+  if (hashmap_get(&store->keys, key, key_length, &index) != 0) {
+    return NULL;
+  }
+  return store->collections[index];
+}
+
+Collection *store_get_or_create_collection(Store *store, const char *key, size_t key_length) {
+  Collection *collection = store_get_collection(store, key, key_length);
+  if (collection != NULL) {
+    return collection;
+  }
+
+  if (store->collections_count == store->collections_capacity) {
+    uint32_t capacity = store->collections_capacity == 0 ? STORE_INITIAL_CAPACITY : store->collections_capacity * 2;
+    Collection **collections = realloc(store->collections, sizeof(Collection *) * capacity);
+    if (collections == NULL) {
+      return NULL;
+    }
+    store->collections = collections;
+    store->collections_capacity = capacity;
+  }
+
+  collection = malloc(sizeof(Collection));
+  if (collection == NULL) {
+    return NULL;
+  }
+  if (init_collection(collection, key, key_length) != STORE_OK) {
+    free(collection);
+    return NULL;
+  }
+  collection->points.quantized = store->quantize_points;
+  if (hashmap_put(&store->keys, collection->key, collection->key_length, store->collections_count) != 0) {
+    destroy_collection(collection);
+    free(collection);
+    return NULL;
+  }
+  store->collections[store->collections_count++] = collection;
+  return collection;
+}
+
+int store_drop_collection(Store *store, const char *key, size_t key_length) {
+  uint32_t index;
+  if (hashmap_get(&store->keys, key, key_length, &index) != 0) {
+    return STORE_KEY_NOT_FOUND;
+  }
+
+  Collection *collection = store->collections[index];
+  hashmap_remove(&store->keys, collection->key, collection->key_length);
+  destroy_collection(collection);
+  free(collection);
+  store->drops++;
+
+  // fill the hole with the last collection so the array stays dense.
+  uint32_t last = --store->collections_count;
+  if (index != last) {
+    Collection *moved = store->collections[last];
+    store->collections[index] = moved;
+    hashmap_put(&store->keys, moved->key, moved->key_length, index);
+  }
+  return STORE_OK;
+}
+
+void store_log_writes(Store *store, Wal *wal) {
+  store->wal = wal;
+}
+
+void store_parallel_scans(Store *store, ScanPool *pool) {
+  store->scan_pool = pool;
+}
+
+void store_record_stats(Store *store, Stats *stats) {
+  store->stats = stats;
+}
+
+void store_quantize_points(Store *store, bool quantize) {
+  store->quantize_points = quantize;
+}
+
+void store_stats(Store *store, StatsReport *report) {
+  if (store->stats != NULL) {
+    stats_report(store->stats, report);
+  } else {
+    memset(report, 0, sizeof(StatsReport));
+  }
+  pthread_rwlock_rdlock(&store->lock);
+  report->collections = store->collections_count;
+  for (uint32_t i = 0; i < store->collections_count; i++) {
+    Collection *collection = store->collections[i];
+    pthread_rwlock_rdlock(&collection->lock);
+    report->objects += collection->count;
+    report->memory_bytes += collection_memory_usage(collection);
+    pthread_rwlock_unlock(&collection->lock);
+  }
+  pthread_rwlock_unlock(&store->lock);
+}
+
+typedef struct {
+  Store *store;
+  Collection *collection; // collection of the previous record, logs are mostly runs on the same key
+  uint64_t now; // deadlines passed while the store was down are scheduled for right away
+} ReplayContext;
+
+static Collection *replay_collection(ReplayContext *ctx, const Span *key, bool create) {
+  Collection *c = ctx->collection;
+  if (c == NULL || c->key_length != key->length || memcmp(c->key, key->start, key->length) != 0) {
+    c = create ? store_get_or_create_collection(ctx->store, key->start, key->length)
+               : store_get_collection(ctx->store, key->start, key->length);
+    // a collection loaded from a snapshot already has its index, the few writes of the log tail go straight into it.
+    if (c != NULL && c->count == 0) {
+      c->index_deferred = true;
+    }
+    ctx->collection = c;
+  }
+  return c;
+}
+
+static int replay_record(const WalRecord *record, void *user_data) {
+  ReplayContext *ctx = user_data;
+  switch (record->op) {
+    case WAL_SET: {
+      Collection *collection = replay_collection(ctx, &record->key, true);
+      if (collection == NULL) {
+        return STORE_OUT_OF_MEMORY;
+      }
+      int rc = collection_set(collection, record->id.start, record->id.length, record->geometry, record->fields,
+                              record->fields_count);
+      if (rc == STORE_OK && record->expires_at != 0) {
+        rc = collection_set_expiration(collection, record->id.start, record->id.length, record->expires_at, ctx->now);
+      }
+      return rc;
+    }
+    case WAL_DELETE: {
+      Collection *collection = replay_collection(ctx, &record->key, false);
+      // an id that is already gone is fine, running out of memory is not.
+      if (collection != NULL &&
+          collection_delete(collection, record->id.start, record->id.length) == STORE_OUT_OF_MEMORY) {
+        return STORE_OUT_OF_MEMORY;
+      }
+      return 0;
+    }
+    case WAL_DROP: {
+      ctx->collection = NULL;
+      store_drop_collection(ctx->store, record->key.start, record->key.length);
+      return 0;
+    }
+  }
+  return 0;
+}
+
+int store_replay_wal(Store *store, Wal *wal) {
+  ReplayContext ctx = { .store = store, .now = store_now_ms() };
+  int rc = wal_replay(wal, store->log_offset, replay_record, &ctx);
+  // indexes are built even when the replay stopped early, so the store is consistent with whatever was applied.
+  for (uint32_t i = 0; i < store->collections_count; i++) {
+    Collection *collection = store->collections[i];
+    if (collection->index_deferred && collection_build_index(collection) != STORE_OK && rc == 0) {
+      rc = STORE_OUT_OF_MEMORY;
+    }
+  }
+  return rc < 0 ? STORE_IO_ERROR : rc;
+}
+
+static int stream_to_result(const Object *object, double distance, void *user_data) {
+  ExecuteResult *result = user_data;
+  result->objects_count++;
+  return result->on_object == NULL ? 0 : result->on_object(object, distance, result->user_data);
+}
+
+/*
+ * copies the position of point object `id` into `point`. returns false when there is no such point object.
+ */
+static bool get_object_point(const Collection *collection, const Span *id, Point *point) {
+  const Object *object = collection_get(collection, id->start, id->length);
+  if (object == NULL || object->type != GEOMETRY_POINT) {
+    return false;
+  }
+  *point = collection_object_point(collection, object);
+  return true;
+}
+
+static int stream_object_to_result(const Object *object, void *user_data) {
+  return stream_to_result(object, 0, user_data);
+}
+
+/*
+ * false when placeholders are left unbound, or bound ring coordinates don't close the ring.
+ */
+static bool statement_ready(const PreparedStatement *prepared_statement) {
+  const Geometry *geometry = &prepared_statement->geometry;
+  return prepared_statement->unbound_count == 0 &&
+         (geometry->type != GEOMETRY_LINE_STRING || geometry->line_string.is_closed);
+}
+
+/*
+ * appends the write `prepared_statement` just applied to the log and sets `lsn` to its sequence number. `expires_at` is
+ * the deadline a SET gave its object. returns a StoreResult: STORE_IO_ERROR means the write is applied in memory but
+ * not logged.
+ */
+static int log_write(Store *store, const PreparedStatement *prepared_statement, uint64_t expires_at, uint64_t *lsn) {
+  if (store->wal == NULL) {
+    return STORE_OK;
+  }
+  WalRecord record = { .key = prepared_statement->key, .id = prepared_statement->id };
+  switch (prepared_statement->command_type) {
+    case SET:
+      record.op = WAL_SET;
+      record.geometry = &prepared_statement->geometry;
+      record.fields = prepared_statement->fields;
+      record.fields_count = prepared_statement->fields_count;
+      record.expires_at = expires_at;
+      break;
+    case DELETE:
+      record.op = WAL_DELETE;
+      break;
+    default:
+      record.op = WAL_DROP;
+      break;
+  }
+  return wal_append(store->wal, &record, lsn) == 0 ? STORE_OK : STORE_IO_ERROR;
+}
+
+/*
+ * appends object `id` of `collection` as it is now, all its fields included, as a SET. FSET is logged this way so that
+ * the last SET of an object in the log is always the whole object, which is all compaction keeps of it. Called with
+ * the collection locked. returns a StoreResult like `log_write`.
+ */
+static int log_object(Store *store, const Collection *collection, const Span *key, const Span *id, uint64_t *lsn) {
+  if (store->wal == NULL) {
+    return STORE_OK;
+  }
+  const Object *object = collection_get(collection, id->start, id->length);
+  FieldValue fields_on_stack[LOGGED_FIELDS_ON_STACK];
+  FieldValue *fields = fields_on_stack;
+  if (collection->fields_count > LOGGED_FIELDS_ON_STACK) {
+    fields = malloc(sizeof(FieldValue) * collection->fields_count);
+    if (fields == NULL) {
+      return STORE_IO_ERROR;
+    }
+  }
+  size_t fields_count = 0;
+  for (uint32_t i = 0; i < collection->fields_count; i++) {
+    double value = collection_object_field(collection, object, i);
+    if (!isnan(value)) {
+      const FieldColumn *column = &collection->fields[i];
+      fields[fields_count++] = (FieldValue){
+        .name = { .start = column->name, .length = column->name_length },
+        .value = value,
+      };
+    }
+  }
+  Geometry geometry = collection_object_geometry(collection, object);
+  WalRecord record = {
+    .op = WAL_SET,
+    .key = *key,
+    .id = *id,
+    .geometry = &geometry,
+    .fields = fields,
+    .fields_count = fields_count,
+    .expires_at = collection_object_expiration(collection, object),
+  };
+  int rc = wal_append(store->wal, &record, lsn) == 0 ? STORE_OK : STORE_IO_ERROR;
+  if (fields != fields_on_stack) {
+    free(fields);
+  }
+  return rc;
+}
+
+/*
+ * called with the store lock held for reading, returns with it held. returns the collection for `key`, NULL when there
+ * is none, or when `create` is set and out of memory. Creating it takes the store lock for writing in between.
+ */
+static Collection *find_collection(Store *store, const Span *key, bool create) {
+  Collection *collection = store_get_collection(store, key->start, key->length);
+  while (collection == NULL && create) {
+    pthread_rwlock_unlock(&store->lock);
+    pthread_rwlock_wrlock(&store->lock);
+    collection = store_get_or_create_collection(store, key->start, key->length);
+    pthread_rwlock_unlock(&store->lock);
+    pthread_rwlock_rdlock(&store->lock);
+    if (collection == NULL) {
+      return NULL;
+    }
+    // it may have been dropped again while the lock was released.
+    collection = store_get_collection(store, key->start, key->length);
+  }
+  return collection;
+}
+
+/*
+ * called with the collection locked for writing.
+ */
+static void detect(Store *store, const Span *key, const Span *id, const Point *previous, const Point *current) {
+  pthread_rwlock_rdlock(&store->geofences_lock);
+  geofences_detect(&store->geofences, key->start, key->length, id->start, id->length, previous, current,
+                   store->on_detect, store->detect_user_data);
+  pthread_rwlock_unlock(&store->geofences_lock);
+}
+
+/*
+ * called with the store lock held for reading.
+ */
+static int execute_set(Store *store, Collection *collection, const PreparedStatement *prepared_statement,
+                       uint64_t *lsn) {
+  const Span *id = &prepared_statement->id;
+  pthread_rwlock_wrlock(&collection->lock);
+  // the previous position is what the geofence events are diffed against.
+  Point previous;
+  bool has_previous = get_object_point(collection, id, &previous);
+  int rc = collection_set(collection, id->start, id->length, &prepared_statement->geometry, prepared_statement->fields,
+                          prepared_statement->fields_count);
+  uint64_t expires_at = 0;
+  if (rc == STORE_OK && prepared_statement->expire_seconds > 0) {
+    uint64_t now = store_now_ms();
+    expires_at = now + (uint64_t)ceil(prepared_statement->expire_seconds * 1000);
+    rc = collection_set_expiration(collection, id->start, id->length, expires_at, now);
+  }
+  if (rc == STORE_OK) {
+    rc = log_write(store, prepared_statement, expires_at, lsn);
+  }
+  if (rc == STORE_OK && prepared_statement->geometry.type == GEOMETRY_POINT) {
+    // fences see the position as stored, which a quantized collection rounded.
+    Point current;
+    get_object_point(collection, id, &current);
+    detect(store, &prepared_statement->key, id, has_previous ? &previous : NULL, &current);
+  } else if (rc == STORE_OK && has_previous) {
+    // fences only watch points: a point replaced by bounds leaves them like a deleted one.
+    detect(store, &prepared_statement->key, id, &previous, NULL);
+  }
+  pthread_rwlock_unlock(&collection->lock);
+  return rc;
+}
+
+/*
+ * compiles the WHERE clauses of a query against the columns of `collection`. Column pointers move when the collection
+ * grows, so this runs for every execution under the collection lock. returns 0 on success, else 1 (out of memory).
+ */
+static int compile_statement_filter(Filter *filter, const Collection *collection,
+                                    const PreparedStatement *prepared_statement) {
+  return compile_filter(filter, prepared_statement->wheres, prepared_statement->wheres_count, collection->fields,
+                        collection->fields_count);
+}
+
+/*
+ * the filter to pass to a query, NULL when the statement has no WHERE clause.
+ */
+static const Filter *statement_filter(const Filter *filter) {
+  return filter->terms_count > 0 ? filter : NULL;
+}
+
+/*
+ * GET, DEL, FSET and the query commands, called with the store lock held for reading.
+ */
+static int execute_on_collection(Store *store, Collection *collection, const PreparedStatement *prepared_statement,
+                                 ExecuteResult *result, uint64_t *lsn) {
+  const Span *id = &prepared_statement->id;
+  switch (prepared_statement->command_type) {
+    case GET: {
+      result->object = collection_get(collection, id->start, id->length);
+      // an object past its deadline may not have been removed yet.
+      uint64_t expires_at = result->object == NULL ? 0 : collection_object_expiration(collection, result->object);
+      if (result->object == NULL || (expires_at != 0 && expires_at <= store_now_ms())) {
+        result->object = NULL;
+        return STORE_ID_NOT_FOUND;
+      }
+      stream_to_result(result->object, 0, result);
+      return STORE_OK;
+    }
+    case DELETE: {
+      Point previous;
+      bool has_previous = get_object_point(collection, id, &previous);
+      int rc = collection_delete(collection, id->start, id->length);
+      if (rc == STORE_OK) {
+        rc = log_write(store, prepared_statement, 0, lsn);
+      }
+      if (rc == STORE_OK && has_previous) {
+        detect(store, &prepared_statement->key, id, &previous, NULL);
+      }
+      return rc;
+    }
+    case FSET: {
+      int rc = collection_set_fields(collection, id->start, id->length, prepared_statement->fields,
+                                     prepared_statement->fields_count);
+      if (rc == STORE_OK) {
+        rc = log_object(store, collection, &prepared_statement->key, id, lsn);
+      }
+      return rc;
+    }
+    case NEARBY: {
+      Filter filter;
+      if (compile_statement_filter(&filter, collection, prepared_statement) != 0) {
+        return STORE_OUT_OF_MEMORY;
+      }
+      int rc = collection_nearby(collection, &prepared_statement->geometry.point, prepared_statement->limit,
+                                 prepared_statement->distance, statement_filter(&filter), store->scan_pool,
+                                 stream_to_result, result);
+      destroy_filter(&filter);
+      return rc;
+    }
+    case WITHIN:
+    case INTERSECTS: {
+      Polygon polygon;
+      if (init_polygon(&polygon, &prepared_statement->geometry.line_string) != 0) {
+        return STORE_OUT_OF_MEMORY;
+      }
+      Filter filter;
+      if (compile_statement_filter(&filter, collection, prepared_statement) != 0) {
+        destroy_polygon(&polygon);
+        return STORE_OUT_OF_MEMORY;
+      }
+      if (prepared_statement->command_type == WITHIN) {
+        collection_within(collection, &polygon, statement_filter(&filter), store->scan_pool, stream_object_to_result,
+                          result);
+      } else {
+        collection_intersects(collection, &polygon, statement_filter(&filter), store->scan_pool,
+                              stream_object_to_result, result);
+      }
+      destroy_filter(&filter);
+      destroy_polygon(&polygon);
+      return STORE_OK;
+    }
+    default: {
+      return STORE_INVALID_STATEMENT;
+    }
+  }
+}
+
+/*
+ * `execute_prepared_statement` without the log commit, `lsn` is set when the statement was logged.
+ */
+static int execute_statement(Store *store, const PreparedStatement *prepared_statement, ExecuteResult *result,
+                             uint64_t *lsn) {
+  const Span *key = &prepared_statement->key;
+  result->collection = NULL;
+  result->object = NULL;
+  result->objects_count = 0;
+
+  if (!statement_ready(prepared_statement)) {
+    return STORE_INVALID_STATEMENT;
+  }
+
+  switch (prepared_statement->command_type) {
+    case SET: {
+      pthread_rwlock_rdlock(&store->lock);
+      Collection *collection = find_collection(store, key, true);
+      int rc = collection == NULL ? STORE_OUT_OF_MEMORY : execute_set(store, collection, prepared_statement, lsn);
+      pthread_rwlock_unlock(&store->lock);
+      return rc;
+    }
+    case GET:
+    case DELETE:
+    case FSET:
+    case NEARBY:
+    case WITHIN:
+    case INTERSECTS: {
+      pthread_rwlock_rdlock(&store->lock);
+      Collection *collection = find_collection(store, key, false);
+      if (collection == NULL) {
+        pthread_rwlock_unlock(&store->lock);
+        return STORE_KEY_NOT_FOUND;
+      }
+      bool write = prepared_statement->command_type == DELETE || prepared_statement->command_type == FSET;
+      if (write) {
+        pthread_rwlock_wrlock(&collection->lock);
+      } else {
+        pthread_rwlock_rdlock(&collection->lock);
+        result->collection = collection;
+      }
+      int rc = execute_on_collection(store, collection, prepared_statement, result, lsn);
+      pthread_rwlock_unlock(&collection->lock);
+      pthread_rwlock_unlock(&store->lock);
+      return rc;
+    }
+    case DROP: {
+      pthread_rwlock_wrlock(&store->lock);
+      int rc = store_drop_collection(store, key->start, key->length);
+      if (rc == STORE_OK) {
+        rc = log_write(store, prepared_statement, 0, lsn);
+      }
+      pthread_rwlock_unlock(&store->lock);
+      return rc;
+    }
+    case SETCHAN: {
+      const Span *channel = &prepared_statement->channel;
+      pthread_rwlock_wrlock(&store->geofences_lock);
+      int rc;
+      if (prepared_statement->fence_command == NEARBY) {
+        rc = geofences_set_nearby(&store->geofences, channel->start, channel->length, key->start, key->length,
+                                  &prepared_statement->geometry.point, prepared_statement->distance);
+      } else {
+        rc = geofences_set_within(&store->geofences, channel->start, channel->length, key->start, key->length,
+                                  &prepared_statement->geometry.line_string);
+      }
+      pthread_rwlock_unlock(&store->geofences_lock);
+      return rc;
+    }
+    case DELCHAN: {
+      pthread_rwlock_wrlock(&store->geofences_lock);
+      int rc = geofences_delete(&store->geofences, prepared_statement->channel.start, prepared_statement->channel.length);
+      pthread_rwlock_unlock(&store->geofences_lock);
+      return rc;
+    }
+    default: {
+      return STORE_INVALID_STATEMENT;
+    }
+  }
+}
+
+/*
+ * records a statement executed since `start` (stats_now_ns), when the thread had visited `nodes_visited` index nodes.
+ */
+static void record_statement(Stats *stats, const PreparedStatement *prepared_statement, const ExecuteResult *result,
+                             int rc, uint64_t start, uint64_t nodes_visited) {
+  CommandType command_type = prepared_statement->command_type;
+  uint64_t results = 0;
+  if (rc == STORE_OK && result != NULL) {
+    if (command_type == GET) {
+      results = 1;
+    } else if (command_type == NEARBY || command_type == WITHIN || command_type == INTERSECTS) {
+      results = result->objects_count;
+    }
+  }
+  stats_record_command(stats, prepared_statement, stats_now_ns() - start, rc, results,
+                       rtree_nodes_visited - nodes_visited);
+}
+
+int execute_prepared_statement(Store *store, const PreparedStatement *prepared_statement, ExecuteResult *result) {
+  Stats *stats = store->stats;
+  uint64_t start = stats != NULL ? stats_now_ns() : 0;
+  uint64_t nodes_visited = rtree_nodes_visited;
+  uint64_t lsn = 0;
+  int rc = execute_statement(store, prepared_statement, result, &lsn);
+  if (lsn != 0 && wal_commit(store->wal, lsn) != 0) {
+    rc = STORE_IO_ERROR;
+  }
+  if (stats != NULL) {
+    record_statement(stats, prepared_statement, result, rc, start, nodes_visited);
+  }
+  return rc;
+}
+
+/*
+ * removes the objects of `collection` that are due, called with it locked for writing. The ids are read before
+ * `collection_delete` frees them. returns a StoreResult.
+ */
+static int expire_collection(Store *store, Collection *collection, uint64_t now, size_t *expired, uint64_t *lsn) {
+  Span key = { .start = collection->key, .length = collection->key_length };
+  uint32_t slots[EXPIRED_BATCH_SIZE];
+  int rc = STORE_OK;
+  size_t count;
+  do {
+    count = collection_expired(collection, now, slots, EXPIRED_BATCH_SIZE);
+    for (size_t i = 0; i < count; i++) {
+      const Object *object = &collection->objects[slots[i]];
+      Span id = collection_object_id(collection, object);
+      Point previous;
+      bool has_previous = object->type == GEOMETRY_POINT;
+      if (has_previous) {
+        previous = collection_object_point(collection, object);
+      }
+      if (store->wal != NULL) {
+        WalRecord record = { .op = WAL_DELETE, .key = key, .id = id };
+        if (wal_append(store->wal, &record, lsn) != 0) {
+          rc = STORE_IO_ERROR;
+        }
+      }
+      // fences see an expired object leave like a deleted one.
+      if (has_previous) {
+        detect(store, &key, &id, &previous, NULL);
+      }
+      if (collection_delete(collection, id.start, id.length) != STORE_OK) {
+        rc = STORE_OUT_OF_MEMORY;
+      }
+    }
+    *expired += count;
+  } while (count == EXPIRED_BATCH_SIZE);
+  return rc;
+}
+
+int store_expire(Store *store, uint64_t now, size_t *expired) {
+  size_t count = 0;
+  uint64_t lsn = 0;
+  int rc = STORE_OK;
+  pthread_rwlock_rdlock(&store->lock);
+  for (uint32_t i = 0; i < store->collections_count; i++) {
+    Collection *collection = store->collections[i];
+    // most keys don't expire anything, their readers aren't held up.
+    pthread_rwlock_rdlock(&collection->lock);
+    bool scheduled = collection->expirations.count > 0;
+    pthread_rwlock_unlock(&collection->lock);
+    if (!scheduled) {
+      continue;
+    }
+    pthread_rwlock_wrlock(&collection->lock);
+    int collection_rc = expire_collection(store, collection, now, &count, &lsn);
+    pthread_rwlock_unlock(&collection->lock);
+    if (rc == STORE_OK) {
+      rc = collection_rc;
+    }
+  }
+  pthread_rwlock_unlock(&store->lock);
+  if (lsn != 0 && wal_commit(store->wal, lsn) != 0) {
+    rc = STORE_IO_ERROR;
+  }
+  if (expired != NULL) {
+    *expired = count;
+  }
+  return rc;
+}
+
+/*
+ * commits the writes logged by statements `from` .. `to` of a batch, which turn into STORE_IO_ERROR if that fails.
+ */
+static void commit_batch_writes(Store *store, BatchResult *results, size_t from, size_t to, uint64_t *lsn) {
+  if (*lsn != 0 && wal_commit(store->wal, *lsn) != 0) {
+    for (size_t i = from; i < to; i++) {
+      if (results[i].store_result == STORE_OK) {
+        results[i].store_result = STORE_IO_ERROR;
+      }
+    }
+  }
+  *lsn = 0;
+}
+
+size_t execute_batch(Store *store, const char *commands, Arena *arena, BatchResult *results, size_t results_capacity,
+                     ExecuteResult *result, const char **rest) {
+  // bulk loads are runs of SETs on the same key, those reuse the collection instead of looking the key up every time.
+  Collection *collection = NULL;
+  uint64_t collection_drops = 0;
+  // runs of writes share one log commit. Reads commit the run before them, so a failed commit only fails writes.
+  uint64_t lsn = 0;
+  size_t run_start = 0;
+  size_t count = 0;
+  const char *cursor = commands;
+  while (*cursor != '\0' && count < results_capacity) {
+    PreparedStatement prepared_statement;
+    BatchResult *r = &results[count++];
+    Stats *stats = store->stats;
+    uint64_t start = stats != NULL ? stats_now_ns() : 0;
+    r->parse_result = make_next_prepared_statement(cursor, &cursor, &prepared_statement, arena, NULL);
+    r->store_result = STORE_INVALID_STATEMENT;
+    if (stats != NULL) {
+      uint64_t parsed = stats_now_ns();
+      stats_record_parse(stats, parsed - start, arena_used(arena), r->parse_result != 0);
+      start = parsed;
+    }
+    if (r->parse_result != 0) {
+      arena_reset(arena);
+      continue;
+    }
+    uint64_t nodes_visited = rtree_nodes_visited;
+
+    const Span *key = &prepared_statement.key;
+    CommandType command_type = prepared_statement.command_type;
+    if (command_type != SET && command_type != DELETE && command_type != DROP && command_type != FSET) {
+      commit_batch_writes(store, results, run_start, count - 1, &lsn);
+      run_start = count;
+    }
+    if (command_type == SET && statement_ready(&prepared_statement)) {
+      pthread_rwlock_rdlock(&store->lock);
+      if (collection == NULL || store->drops != collection_drops || collection->key_length != key->length ||
+          memcmp(collection->key, key->start, key->length) != 0) {
+        collection = find_collection(store, key, true);
+        collection_drops = store->drops;
+      }
+      r->store_result =
+          collection == NULL ? STORE_OUT_OF_MEMORY : execute_set(store, collection, &prepared_statement, &lsn);
+      pthread_rwlock_unlock(&store->lock);
+    } else {
+      r->store_result = execute_statement(store, &prepared_statement, result, &lsn);
+    }
+    // the log commit of a run of writes is shared, it isn't part of any statement's latency here.
+    if (stats != NULL) {
+      record_statement(stats, &prepared_statement, result, r->store_result, start, nodes_visited);
+    }
+    arena_reset(arena);
+  }
+  commit_batch_writes(store, results, run_start, count, &lsn);
+
+  if (rest != NULL) {
+    *rest = cursor;
+  }
+  return count;
+}
@@ -0,0 +1,182 @@
+#include "timer_wheel.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define LEVEL_SHIFT(level) ((unsigned)(level) * TIMER_WHEEL_LEVEL_BITS)
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+
+void init_timer_wheel(TimerWheel *wheel) {
+  *wheel = (TimerWheel){ 0 };
+  memset(wheel->buckets, 0xff, sizeof(wheel->buckets));
+}
+
+void destroy_timer_wheel(TimerWheel *wheel) {
+  free(wheel->deadlines);
+  free(wheel->next);
+  free(wheel->previous);
+  init_timer_wheel(wheel);
+}
+
+int timer_wheel_reserve(TimerWheel *wheel, uint32_t capacity) {
+  if (capacity <= wheel->capacity) {
+    return 0;
+  }
+  if (capacity > TIMER_WHEEL_HEAD) {
+    return 1;
+  }
+  // `capacity` only moves once all three arrays are as long, an array grown before a failure just grows again.
+  uint64_t *deadlines = realloc(wheel->deadlines, sizeof(uint64_t) * capacity);
+  if (deadlines == NULL) {
+    return 1;
+  }
+  memset(deadlines + wheel->capacity, 0, sizeof(uint64_t) * (capacity - wheel->capacity));
+  wheel->deadlines = deadlines;
+  uint32_t *next = realloc(wheel->next, sizeof(uint32_t) * capacity);
+  if (next == NULL) {
+    return 1;
+  }
+  wheel->next = next;
+  uint32_t *previous = realloc(wheel->previous, sizeof(uint32_t) * capacity);
+  if (previous == NULL) {
+    return 1;
+  }
+  wheel->previous = previous;
+  wheel->capacity = capacity;
+  return 0;
+}
+
+/*
+ * files a scheduled item into the bucket its deadline falls in relative to `now`.
+ */
+static void link_item(TimerWheel *wheel, uint32_t item) {
+  uint64_t deadline = wheel->deadlines[item] < wheel->now ? wheel->now : wheel->deadlines[item];
+  uint64_t diff = deadline ^ wheel->now;
+  unsigned level = diff == 0 ? 0 : (unsigned)(63 - __builtin_clzll(diff)) / TIMER_WHEEL_LEVEL_BITS;
+  if (level >= TIMER_WHEEL_LEVELS) {
+    // past the range of the wheel: parked in the top level and filed again whenever that bucket is cascaded.
+    level = TIMER_WHEEL_LEVELS - 1;
+  }
+  unsigned slot = (unsigned)(deadline >> LEVEL_SHIFT(level)) & SLOT_MASK;
+  uint32_t *head = &wheel->buckets[level][slot];
+  wheel->next[item] = *head;
+  wheel->previous[item] = TIMER_WHEEL_HEAD | (level * TIMER_WHEEL_SLOTS + slot);
+  if (*head != TIMER_WHEEL_NONE) {
+    wheel->previous[*head] = item;
+  }
+  *head = item;
+  wheel->occupied[level] |= (uint64_t)1 << slot;
+}
+
+static void unlink_item(TimerWheel *wheel, uint32_t item) {
+  uint32_t next = wheel->next[item];
+  uint32_t previous = wheel->previous[item];
+  if (previous & TIMER_WHEEL_HEAD) {
+    uint32_t bucket = previous & ~TIMER_WHEEL_HEAD;
+    unsigned level = bucket / TIMER_WHEEL_SLOTS;
+    unsigned slot = bucket % TIMER_WHEEL_SLOTS;
+    wheel->buckets[level][slot] = next;
+    if (next == TIMER_WHEEL_NONE) {
+      wheel->occupied[level] &= ~((uint64_t)1 << slot);
+    }
+  } else {
+    wheel->next[previous] = next;
+  }
+  if (next != TIMER_WHEEL_NONE) {
+    wheel->previous[next] = previous;
+  }
+}
+
+void timer_wheel_schedule(TimerWheel *wheel, uint32_t item, uint64_t deadline, uint64_t now) {
+  if (wheel->deadlines[item] != 0) {
+    unlink_item(wheel, item);
+  } else {
+    wheel->count++;
+  }
+  if (wheel->count == 1 && now > wheel->now) {
+    // nothing else is scheduled, there is nothing to fire in between.
+    wheel->now = now;
+  }
+  wheel->deadlines[item] = deadline;
+  link_item(wheel, item);
+}
+
+void timer_wheel_cancel(TimerWheel *wheel, uint32_t item) {
+  if (item >= wheel->capacity || wheel->deadlines[item] == 0) {
+    return;
+  }
+  unlink_item(wheel, item);
+  wheel->deadlines[item] = 0;
+  wheel->count--;
+}
+
+/*
+ * files the items of a bucket that starts at `now` again, into lower levels.
+ */
+static void cascade(TimerWheel *wheel, unsigned level, unsigned slot) {
+  uint32_t item = wheel->buckets[level][slot];
+  wheel->buckets[level][slot] = TIMER_WHEEL_NONE;
+  wheel->occupied[level] &= ~((uint64_t)1 << slot);
+  while (item != TIMER_WHEEL_NONE) {
+    uint32_t next = wheel->next[item];
+    link_item(wheel, item);
+    item = next;
+  }
+}
+
+/*
+ * the first tick after `tick` at which a bucket fires or has to be cascaded.
+ */
+static uint64_t next_busy_tick(const TimerWheel *wheel, uint64_t tick) {
+  uint64_t next = UINT64_MAX;
+  for (unsigned level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+    unsigned shift = LEVEL_SHIFT(level);
+    unsigned digit = (unsigned)(tick >> shift) & SLOT_MASK;
+    uint64_t later = digit == SLOT_MASK ? 0 : wheel->occupied[level] & (UINT64_MAX << (digit + 1));
+    if (later != 0) {
+      uint64_t rotation = tick >> (shift + TIMER_WHEEL_LEVEL_BITS) << (shift + TIMER_WHEEL_LEVEL_BITS);
+      uint64_t start = rotation + ((uint64_t)__builtin_ctzll(later) << shift);
+      if (start < next) {
+        next = start;
+      }
+    }
+  }
+  if (next == UINT64_MAX) {
+    // only parked items are left, the top level starts over.
+    unsigned shift = LEVEL_SHIFT(TIMER_WHEEL_LEVELS);
+    next = ((tick >> shift) + 1) << shift;
+  }
+  return next;
+}
+
+size_t timer_wheel_advance(TimerWheel *wheel, uint64_t now, uint32_t *expired, size_t capacity) {
+  size_t count = 0;
+  while (wheel->now <= now) {
+    if (wheel->count == 0) {
+      wheel->now = now + 1;
+      break;
+    }
+    uint64_t tick = wheel->now;
+    // highest level first, so what it cascades can still land in a lower bucket that starts now. Cascading again after
+    // a call that stopped half way through the tick is harmless.
+    for (unsigned level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+      if ((tick & (((uint64_t)1 << LEVEL_SHIFT(level)) - 1)) == 0) {
+        cascade(wheel, level, (unsigned)(tick >> LEVEL_SHIFT(level)) & SLOT_MASK);
+      }
+    }
+    uint32_t *bucket = &wheel->buckets[0][tick & SLOT_MASK];
+    while (*bucket != TIMER_WHEEL_NONE) {
+      if (count == capacity) {
+        return count;
+      }
+      uint32_t item = *bucket;
+      unlink_item(wheel, item);
+      wheel->deadlines[item] = 0;
+      wheel->count--;
+      expired[count++] = item;
+    }
+    uint64_t next = next_busy_tick(wheel, tick);
+    wheel->now = next <= now ? next : now + 1;
+  }
+  return count;
+}
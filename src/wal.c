@@ -0,0 +1,1073 @@
+#include "wal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+#include "hashmap.h"
+
+#define WAL_MAGIC 0x4c575147 // "GQWL" read as a little endian uint32_t
+#define WAL_VERSION 2
+#define WAL_HEADER_SIZE 16
+#define WAL_RECORD_HEADER_SIZE 8
+#define WAL_INITIAL_BUFFER_CAPACITY 4096
+#define WAL_COPY_BUFFER_SIZE (1 << 20)
+#define WAL_COMPACTION_CATCH_UP_ROUNDS 8
+
+#define GEOMETRY_FLAG_CLOSED 0x80
+
+/*
+ * crc32c (Castagnoli). The sse4.2 instruction and the slicing by 8 tables compute the same checksum, so logs are
+ * readable by builds with and without it.
+ */
+#if !defined(__SSE4_2__)
+static uint32_t CRC32C_TABLE[8][256];
+static pthread_once_t crc32c_table_once = PTHREAD_ONCE_INIT;
+
+static void init_crc32c_table(void) {
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++) {
+      c = c & 1 ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+    }
+    CRC32C_TABLE[0][i] = c;
+  }
+  for (uint32_t i = 0; i < 256; i++) {
+    for (int s = 1; s < 8; s++) {
+      CRC32C_TABLE[s][i] = (CRC32C_TABLE[s - 1][i] >> 8) ^ CRC32C_TABLE[0][CRC32C_TABLE[s - 1][i] & 0xff];
+    }
+  }
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const void *bytes, size_t length) {
+  const unsigned char *p = bytes;
+  crc = ~crc;
+#if defined(__SSE4_2__)
+  uint64_t c = crc;
+  for (; length >= 8; length -= 8, p += 8) {
+    uint64_t word;
+    memcpy(&word, p, sizeof(word));
+    c = _mm_crc32_u64(c, word);
+  }
+  crc = (uint32_t)c;
+  for (; length > 0; length--) {
+    crc = _mm_crc32_u8(crc, *p++);
+  }
+#else
+  pthread_once(&crc32c_table_once, init_crc32c_table);
+  const uint32_t(*t)[256] = CRC32C_TABLE;
+  for (; length >= 8; length -= 8, p += 8) {
+    crc ^= (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+    crc = t[7][crc & 0xff] ^ t[6][(crc >> 8) & 0xff] ^ t[5][(crc >> 16) & 0xff] ^ t[4][crc >> 24] ^ t[3][p[4]] ^
+          t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+  }
+  for (; length > 0; length--) {
+    crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+  }
+#endif
+  return ~crc;
+}
+
+static char *put_varint(char *out, uint64_t value) {
+  while (value >= 0x80) {
+    *out++ = (char)(value | 0x80);
+    value >>= 7;
+  }
+  *out++ = (char)value;
+  return out;
+}
+
+/*
+ * returns the position after the varint, NULL when it runs past `end`.
+ */
+static const char *get_varint(const char *in, const char *end, uint64_t *value) {
+  *value = 0;
+  for (int shift = 0; in < end && shift < 64; shift += 7) {
+    unsigned char byte = (unsigned char)*in++;
+    *value |= (uint64_t)(byte & 0x7f) << shift;
+    if (byte < 0x80) {
+      return in;
+    }
+  }
+  return NULL;
+}
+
+static char *put_point(char *out, const Point *p) {
+  *out++ = (char)p->has_z;
+  memcpy(out, &p->x, sizeof(double));
+  memcpy(out + sizeof(double), &p->y, sizeof(double));
+  out += 2 * sizeof(double);
+  if (p->has_z) {
+    memcpy(out, &p->z, sizeof(double));
+    out += sizeof(double);
+  }
+  return out;
+}
+
+static const char *get_point(const char *in, const char *end, Point *p) {
+  if (end - in < 1 + 2 * (ptrdiff_t)sizeof(double)) {
+    return NULL;
+  }
+  p->has_z = *in++ != 0;
+  memcpy(&p->x, in, sizeof(double));
+  memcpy(&p->y, in + sizeof(double), sizeof(double));
+  in += 2 * sizeof(double);
+  p->z = 0;
+  if (p->has_z) {
+    if (end - in < (ptrdiff_t)sizeof(double)) {
+      return NULL;
+    }
+    memcpy(&p->z, in, sizeof(double));
+    in += sizeof(double);
+  }
+  return in;
+}
+
+static size_t max_record_size(const WalRecord *record) {
+  size_t size = WAL_RECORD_HEADER_SIZE + 1 + 10 + record->key.length + 10 + record->id.length;
+  if (record->geometry != NULL) {
+    size_t points = record->geometry->type == GEOMETRY_POINT ? 1 : record->geometry->line_string.points_count;
+    size += 1 + 10 + points * (1 + 3 * sizeof(double));
+  }
+  if (record->fields_count > 0 || record->expires_at != 0) {
+    size += 10;
+    for (size_t i = 0; i < record->fields_count; i++) {
+      size += 10 + record->fields[i].name.length + sizeof(double);
+    }
+  }
+  if (record->expires_at != 0) {
+    size += sizeof(uint64_t);
+  }
+  return size;
+}
+
+/*
+ * writes the record (header included) at `out` and returns the position after it. `out` must have
+ * `max_record_size` bytes.
+ */
+static char *encode_record(char *out, const WalRecord *record) {
+  char *payload = out + WAL_RECORD_HEADER_SIZE;
+  char *p = payload;
+  *p++ = (char)record->op;
+  p = put_varint(p, record->key.length);
+  memcpy(p, record->key.start, record->key.length);
+  p += record->key.length;
+
+  if (record->op != WAL_DROP) {
+    p = put_varint(p, record->id.length);
+    memcpy(p, record->id.start, record->id.length);
+    p += record->id.length;
+  }
+
+  if (record->op == WAL_SET) {
+    const Geometry *g = record->geometry;
+    if (g->type == GEOMETRY_POINT) {
+      *p++ = (char)GEOMETRY_POINT;
+      p = put_point(p, &g->point);
+    } else {
+      *p++ = (char)(GEOMETRY_LINE_STRING | (g->line_string.is_closed ? GEOMETRY_FLAG_CLOSED : 0));
+      p = put_varint(p, g->line_string.points_count);
+      for (size_t i = 0; i < g->line_string.points_count; i++) {
+        p = put_point(p, &g->line_string.points[i]);
+      }
+    }
+    if (record->fields_count > 0 || record->expires_at != 0) {
+      p = put_varint(p, record->fields_count);
+      for (size_t i = 0; i < record->fields_count; i++) {
+        const FieldValue *field = &record->fields[i];
+        p = put_varint(p, field->name.length);
+        memcpy(p, field->name.start, field->name.length);
+        p += field->name.length;
+        memcpy(p, &field->value, sizeof(double));
+        p += sizeof(double);
+      }
+    }
+    if (record->expires_at != 0) {
+      memcpy(p, &record->expires_at, sizeof(uint64_t));
+      p += sizeof(uint64_t);
+    }
+  }
+
+  uint32_t length = (uint32_t)(p - payload);
+  uint32_t crc = crc32c(0, payload, length);
+  memcpy(out, &length, sizeof(uint32_t));
+  memcpy(out + sizeof(uint32_t), &crc, sizeof(uint32_t));
+  return p;
+}
+
+/*
+ * scratch space for the line string points and the fields of replayed records.
+ */
+typedef struct {
+  Point *points;
+  size_t capacity;
+  FieldValue *fields;
+  size_t fields_capacity;
+} ReplayScratch;
+
+/*
+ * decodes the fields at the end of a SET. returns the position after them, NULL when they are malformed and sets
+ * `*out_of_memory` when the scratch space could not grow.
+ */
+static const char *get_fields(const char *p, const char *end, WalRecord *record, ReplayScratch *scratch,
+                              bool *out_of_memory) {
+  uint64_t count;
+  // every field takes at least 9 bytes, which also bounds the allocation below.
+  if ((p = get_varint(p, end, &count)) == NULL || count > (uint64_t)(end - p) / 9) {
+    return NULL;
+  }
+  if (count > scratch->fields_capacity) {
+    FieldValue *fields = realloc(scratch->fields, sizeof(FieldValue) * count);
+    if (fields == NULL) {
+      *out_of_memory = true;
+      return NULL;
+    }
+    scratch->fields = fields;
+    scratch->fields_capacity = count;
+  }
+  for (size_t i = 0; i < count; i++) {
+    uint64_t length;
+    if ((p = get_varint(p, end, &length)) == NULL || length > (uint64_t)(end - p) ||
+        (uint64_t)(end - p) - length < sizeof(double)) {
+      return NULL;
+    }
+    scratch->fields[i].name = (Span){ .start = p, .length = length };
+    memcpy(&scratch->fields[i].value, p + length, sizeof(double));
+    p += length + sizeof(double);
+  }
+  record->fields = scratch->fields;
+  record->fields_count = count;
+  return p;
+}
+
+/*
+ * decodes the payload of one record. returns 0 on success, 1 when it is malformed and -1 when out of memory.
+ */
+static int decode_record(const char *p, const char *end, WalRecord *record, Geometry *geometry,
+                         ReplayScratch *scratch) {
+  *record = (WalRecord){ 0 };
+  if (p >= end || (unsigned char)*p > WAL_DROP) {
+    return 1;
+  }
+  record->op = (WalOp)*p++;
+
+  uint64_t length;
+  if ((p = get_varint(p, end, &length)) == NULL || length > (uint64_t)(end - p)) {
+    return 1;
+  }
+  record->key = (Span){ .start = p, .length = length };
+  p += length;
+
+  if (record->op != WAL_DROP) {
+    if ((p = get_varint(p, end, &length)) == NULL || length > (uint64_t)(end - p)) {
+      return 1;
+    }
+    record->id = (Span){ .start = p, .length = length };
+    p += length;
+  }
+
+  if (record->op == WAL_SET) {
+    if (p >= end) {
+      return 1;
+    }
+    unsigned char type = (unsigned char)*p++;
+    if (type == GEOMETRY_POINT) {
+      geometry->type = GEOMETRY_POINT;
+      if ((p = get_point(p, end, &geometry->point)) == NULL) {
+        return 1;
+      }
+    } else if ((type & ~GEOMETRY_FLAG_CLOSED) == GEOMETRY_LINE_STRING) {
+      uint64_t count;
+      // every point takes at least 17 bytes, which also bounds the allocation below.
+      if ((p = get_varint(p, end, &count)) == NULL || count > (uint64_t)(end - p) / 17) {
+        return 1;
+      }
+      if (count > scratch->capacity) {
+        Point *points = realloc(scratch->points, sizeof(Point) * count);
+        if (points == NULL) {
+          return -1;
+        }
+        scratch->points = points;
+        scratch->capacity = count;
+      }
+      for (size_t i = 0; i < count; i++) {
+        if ((p = get_point(p, end, &scratch->points[i])) == NULL) {
+          return 1;
+        }
+      }
+      geometry->type = GEOMETRY_LINE_STRING;
+      geometry->line_string = (LineString){
+        .points = scratch->points,
+        .points_count = count,
+        .is_closed = (type & GEOMETRY_FLAG_CLOSED) != 0,
+      };
+    } else {
+      return 1;
+    }
+    record->geometry = geometry;
+    if (p < end) {
+      bool out_of_memory = false;
+      if ((p = get_fields(p, end, record, scratch, &out_of_memory)) == NULL) {
+        return out_of_memory ? -1 : 1;
+      }
+    }
+    if ((size_t)(end - p) == sizeof(uint64_t)) {
+      memcpy(&record->expires_at, p, sizeof(uint64_t));
+      p += sizeof(uint64_t);
+    }
+  }
+  return p == end ? 0 : 1;
+}
+
+static int write_all(int fd, const char *bytes, size_t length) {
+  while (length > 0) {
+    ssize_t n = write(fd, bytes, length);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno;
+    }
+    bytes += n;
+    length -= (size_t)n;
+  }
+  return 0;
+}
+
+int sync_parent_directory(const char *path) {
+  const char *slash = strrchr(path, '/');
+  char *directory = slash == NULL ? strdup(".") : strndup(path, slash == path ? 1 : (size_t)(slash - path));
+  if (directory == NULL) {
+    return 1;
+  }
+  int fd = open(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  free(directory);
+  if (fd < 0) {
+    return 1;
+  }
+  int rc = fsync(fd);
+  close(fd);
+  return rc == 0 ? 0 : 1;
+}
+
+/*
+ * called with the lock held, returns with it held. Writes out everything appended so far (and syncs it when `sync`)
+ * with the lock released so other writers keep appending into the other buffer.
+ */
+static void lead(Wal *wal, bool sync) {
+  wal->flushing = true;
+  char *buffer = wal->buffer;
+  size_t capacity = wal->buffer_capacity;
+  size_t length = wal->buffer_used;
+  wal->buffer = wal->flush_buffer;
+  wal->buffer_capacity = wal->flush_buffer_capacity;
+  wal->buffer_used = 0;
+  wal->flush_buffer = buffer;
+  wal->flush_buffer_capacity = capacity;
+  uint64_t target = wal->appended_lsn;
+  pthread_mutex_unlock(&wal->lock);
+
+  int error = write_all(wal->fd, buffer, length);
+  if (error == 0 && sync && fdatasync(wal->fd) != 0) {
+    error = errno;
+  }
+
+  pthread_mutex_lock(&wal->lock);
+  wal->flushing = false;
+  if (error != 0) {
+    if (wal->error == 0) {
+      wal->error = error;
+    }
+  } else {
+    wal->written_lsn = target;
+    if (sync) {
+      wal->synced_lsn = target;
+    }
+  }
+  pthread_cond_broadcast(&wal->flushed);
+}
+
+static void *sync_periodically(void *arg) {
+  Wal *wal = arg;
+  pthread_mutex_lock(&wal->lock);
+  while (!wal->closing) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += wal->sync_interval_ms / 1000;
+    deadline.tv_nsec += (long)(wal->sync_interval_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&wal->syncer_wakeup, &wal->lock, &deadline);
+    // a busy leader means the next tick picks its records up.
+    if (!wal->closing && wal->error == 0 && !wal->flushing && wal->synced_lsn < wal->appended_lsn) {
+      lead(wal, true);
+    }
+  }
+  pthread_mutex_unlock(&wal->lock);
+  return NULL;
+}
+
+static uint64_t new_log_id(void) {
+  uint64_t id;
+  if (getrandom(&id, sizeof(id), 0) != sizeof(id)) {
+    id = (uint64_t)time(NULL) << 32 ^ (uint64_t)getpid();
+  }
+  return id;
+}
+
+static int write_header(int fd, uint64_t id) {
+  uint32_t header[4] = { WAL_MAGIC, WAL_VERSION };
+  memcpy(&header[2], &id, sizeof(id));
+  return write_all(fd, (const char *)header, sizeof(header));
+}
+
+/*
+ * `path` with `suffix` appended, NULL when out of memory.
+ */
+static char *suffixed_path(const char *path, const char *suffix) {
+  size_t path_length = strlen(path);
+  size_t suffix_length = strlen(suffix);
+  char *s = malloc(path_length + suffix_length + 1);
+  if (s != NULL) {
+    memcpy(s, path, path_length);
+    memcpy(s + path_length, suffix, suffix_length + 1);
+  }
+  return s;
+}
+
+int open_wal(Wal *wal, const char *path, WalSyncPolicy policy, unsigned int sync_interval_ms) {
+  *wal = (Wal){ 0 };
+  wal->policy = policy;
+  wal->sync_interval_ms = sync_interval_ms == 0 ? 1 : sync_interval_ms;
+  wal->path = strdup(path);
+  if (wal->path == NULL) {
+    return 1;
+  }
+  wal->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (wal->fd < 0) {
+    free(wal->path);
+    return 1;
+  }
+
+  uint32_t header[4];
+  ssize_t n = pread(wal->fd, header, sizeof(header), 0);
+  if (n == 0) {
+    wal->id = new_log_id();
+    if (write_header(wal->fd, wal->id) != 0 || fdatasync(wal->fd) != 0 || sync_parent_directory(path) != 0) {
+      close(wal->fd);
+      free(wal->path);
+      return 1;
+    }
+  } else if (n != sizeof(header) || header[0] != WAL_MAGIC || header[1] != WAL_VERSION) {
+    close(wal->fd);
+    free(wal->path);
+    errno = n < 0 ? errno : EINVAL;
+    return 1;
+  } else {
+    memcpy(&wal->id, &header[2], sizeof(wal->id));
+  }
+  off_t end = lseek(wal->fd, 0, SEEK_END);
+  if (end < 0) {
+    close(wal->fd);
+    free(wal->path);
+    return 1;
+  }
+  wal->end_offset = (uint64_t)end;
+
+  // left behind by a compaction that was interrupted, the log itself is intact.
+  char *compaction_path = suffixed_path(path, ".compact");
+  if (compaction_path != NULL) {
+    unlink(compaction_path);
+    free(compaction_path);
+  }
+
+  wal->buffer = malloc(WAL_INITIAL_BUFFER_CAPACITY);
+  wal->flush_buffer = malloc(WAL_INITIAL_BUFFER_CAPACITY);
+  if (wal->buffer == NULL || wal->flush_buffer == NULL) {
+    free(wal->buffer);
+    free(wal->flush_buffer);
+    close(wal->fd);
+    free(wal->path);
+    errno = ENOMEM;
+    return 1;
+  }
+  wal->buffer_capacity = WAL_INITIAL_BUFFER_CAPACITY;
+  wal->flush_buffer_capacity = WAL_INITIAL_BUFFER_CAPACITY;
+
+  pthread_mutex_init(&wal->lock, NULL);
+  pthread_cond_init(&wal->flushed, NULL);
+  pthread_cond_init(&wal->syncer_wakeup, NULL);
+  if (policy == WAL_SYNC_INTERVAL && pthread_create(&wal->syncer, NULL, sync_periodically, wal) != 0) {
+    pthread_cond_destroy(&wal->syncer_wakeup);
+    pthread_cond_destroy(&wal->flushed);
+    pthread_mutex_destroy(&wal->lock);
+    free(wal->buffer);
+    free(wal->flush_buffer);
+    close(wal->fd);
+    free(wal->path);
+    return 1;
+  }
+  return 0;
+}
+
+int close_wal(Wal *wal) {
+  wal_wait_compaction(wal);
+  pthread_mutex_lock(&wal->lock);
+  wal->closing = true;
+  pthread_cond_signal(&wal->syncer_wakeup);
+  pthread_mutex_unlock(&wal->lock);
+  if (wal->policy == WAL_SYNC_INTERVAL) {
+    pthread_join(wal->syncer, NULL);
+  }
+
+  pthread_mutex_lock(&wal->lock);
+  while (wal->flushing) {
+    pthread_cond_wait(&wal->flushed, &wal->lock);
+  }
+  if (wal->error == 0) {
+    lead(wal, true);
+  }
+  int rc = wal->error == 0 ? 0 : 1;
+  pthread_mutex_unlock(&wal->lock);
+
+  if (close(wal->fd) != 0) {
+    rc = 1;
+  }
+  pthread_cond_destroy(&wal->syncer_wakeup);
+  pthread_cond_destroy(&wal->flushed);
+  pthread_mutex_destroy(&wal->lock);
+  free(wal->buffer);
+  free(wal->flush_buffer);
+  free(wal->path);
+  *wal = (Wal){ 0 };
+  return rc;
+}
+
+int wal_replay(Wal *wal, uint64_t offset, wal_replay_callback cb, void *user_data) {
+  struct stat st;
+  if (fstat(wal->fd, &st) != 0) {
+    return -1;
+  }
+  size_t size = (size_t)st.st_size;
+  if (offset < WAL_HEADER_SIZE) {
+    offset = WAL_HEADER_SIZE;
+  }
+  if (offset > size) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (offset == size) {
+    return 0;
+  }
+
+  const char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, wal->fd, 0);
+  if (map == MAP_FAILED) {
+    return -1;
+  }
+  madvise((void *)map, size, MADV_SEQUENTIAL);
+
+  ReplayScratch scratch = { 0 };
+  int rc = 0;
+  while (size - offset >= WAL_RECORD_HEADER_SIZE) {
+    uint32_t length;
+    uint32_t crc;
+    memcpy(&length, map + offset, sizeof(uint32_t));
+    memcpy(&crc, map + offset + sizeof(uint32_t), sizeof(uint32_t));
+    const char *payload = map + offset + WAL_RECORD_HEADER_SIZE;
+    if (length > size - offset - WAL_RECORD_HEADER_SIZE || crc32c(0, payload, length) != crc) {
+      // torn tail.
+      break;
+    }
+
+    WalRecord record;
+    Geometry geometry;
+    int decoded = decode_record(payload, payload + length, &record, &geometry, &scratch);
+    if (decoded != 0) {
+      // a record with a valid checksum that can't be decoded was not written by this version.
+      errno = decoded < 0 ? ENOMEM : EINVAL;
+      rc = -1;
+      break;
+    }
+    if ((rc = cb(&record, user_data)) != 0) {
+      break;
+    }
+    offset += WAL_RECORD_HEADER_SIZE + length;
+  }
+  free(scratch.points);
+  free(scratch.fields);
+  munmap((void *)map, size);
+
+  if (rc != 0) {
+    return rc;
+  }
+  if (offset < size && (ftruncate(wal->fd, (off_t)offset) != 0 || fdatasync(wal->fd) != 0)) {
+    return -1;
+  }
+  if (lseek(wal->fd, (off_t)offset, SEEK_SET) < 0) {
+    return -1;
+  }
+  wal->end_offset = offset;
+  return 0;
+}
+
+/*
+ * what compaction keeps of the sealed part of the log: the last SET of every id that was neither deleted nor dropped
+ * since. The hash map keys point into the mapped log.
+ */
+typedef struct {
+  uint64_t offset; // of the last SET of the id, UINT64_MAX once deleted
+  uint32_t key; // index into `generations`
+  uint32_t generation; // of the key at that SET
+} LiveRecord;
+
+typedef struct {
+  HashMap ids; // encoded key and id of a record -> index into `records`
+  HashMap keys; // key -> index into `generations`
+  LiveRecord *records;
+  uint32_t records_count;
+  uint32_t records_capacity;
+  uint32_t *generations; // bumped by every DROP of the key, so the ids set before it no longer match
+  uint32_t keys_count;
+  uint32_t keys_capacity;
+} LiveState;
+
+static int init_live_state(LiveState *state) {
+  *state = (LiveState){ 0 };
+  if (init_hashmap(&state->ids, 1024) != 0) {
+    return 1;
+  }
+  if (init_hashmap(&state->keys, 16) != 0) {
+    destroy_hashmap(&state->ids);
+    return 1;
+  }
+  return 0;
+}
+
+static void destroy_live_state(LiveState *state) {
+  destroy_hashmap(&state->ids);
+  destroy_hashmap(&state->keys);
+  free(state->records);
+  free(state->generations);
+}
+
+/*
+ * doubles `*array` of `size` byte elements when `count` reached `*capacity`. returns 0 on success, else 1.
+ */
+static int reserve_one(void **array, uint32_t *capacity, uint32_t count, size_t size) {
+  if (count < *capacity) {
+    return 0;
+  }
+  if (*capacity > UINT32_MAX / 2) {
+    return 1;
+  }
+  uint32_t grown = *capacity == 0 ? 64 : *capacity * 2;
+  void *a = realloc(*array, size * grown);
+  if (a == NULL) {
+    return 1;
+  }
+  *array = a;
+  *capacity = grown;
+  return 0;
+}
+
+/*
+ * applies the record at `offset`, whose checksum was verified, to `state`. returns 0 on success, else an errno.
+ */
+static int track_record(LiveState *state, const char *payload, const char *end, uint64_t offset) {
+  const char *p = payload + 1;
+  uint64_t key_length;
+  if (payload >= end || (p = get_varint(p, end, &key_length)) == NULL || key_length > (uint64_t)(end - p)) {
+    return EINVAL;
+  }
+  const char *key = p;
+  p += key_length;
+
+  uint32_t k;
+  if (hashmap_get(&state->keys, key, key_length, &k) != 0) {
+    if (reserve_one((void **)&state->generations, &state->keys_capacity, state->keys_count, sizeof(uint32_t)) != 0 ||
+        hashmap_put(&state->keys, key, key_length, state->keys_count) != 0) {
+      return ENOMEM;
+    }
+    k = state->keys_count++;
+    state->generations[k] = 0;
+  }
+  if ((WalOp)*payload == WAL_DROP) {
+    state->generations[k]++;
+    return 0;
+  }
+
+  uint64_t id_length;
+  if ((p = get_varint(p, end, &id_length)) == NULL || id_length > (uint64_t)(end - p)) {
+    return EINVAL;
+  }
+  // the varint prefixed key and id, as encoded, identify the object.
+  const char *identity = payload + 1;
+  size_t identity_length = (size_t)(p + id_length - identity);
+  bool set = (WalOp)*payload == WAL_SET;
+  uint32_t r;
+  if (hashmap_get(&state->ids, identity, identity_length, &r) == 0) {
+    state->records[r] = (LiveRecord){ .offset = set ? offset : UINT64_MAX, .key = k, .generation = state->generations[k] };
+    return 0;
+  }
+  if (!set) {
+    return 0;
+  }
+  if (reserve_one((void **)&state->records, &state->records_capacity, state->records_count, sizeof(LiveRecord)) != 0 ||
+      hashmap_put(&state->ids, identity, identity_length, state->records_count) != 0) {
+    return ENOMEM;
+  }
+  state->records[state->records_count++] = (LiveRecord){ .offset = offset, .key = k, .generation = state->generations[k] };
+  return 0;
+}
+
+/*
+ * writes a log holding the live records of `map` (the first `size` bytes of the log) to `fd`. `buffer` has
+ * WAL_COPY_BUFFER_SIZE bytes. returns 0 on success, else an errno.
+ */
+static int write_live_records(int fd, uint64_t id, const char *map, uint64_t size, char *buffer) {
+  LiveState state;
+  if (init_live_state(&state) != 0) {
+    return ENOMEM;
+  }
+  int error = 0;
+  for (uint64_t offset = WAL_HEADER_SIZE; error == 0 && offset < size;) {
+    // everything before the seal was replayed or appended by this process, a bad record means corruption.
+    if (size - offset < WAL_RECORD_HEADER_SIZE) {
+      error = EINVAL;
+      break;
+    }
+    uint32_t length;
+    uint32_t crc;
+    memcpy(&length, map + offset, sizeof(uint32_t));
+    memcpy(&crc, map + offset + sizeof(uint32_t), sizeof(uint32_t));
+    const char *payload = map + offset + WAL_RECORD_HEADER_SIZE;
+    if (length > size - offset - WAL_RECORD_HEADER_SIZE || crc32c(0, payload, length) != crc) {
+      error = EINVAL;
+      break;
+    }
+    error = track_record(&state, payload, payload + length, offset);
+    offset += WAL_RECORD_HEADER_SIZE + length;
+  }
+
+  if (error == 0) {
+    error = write_header(fd, id);
+  }
+  size_t used = 0;
+  for (uint32_t i = 0; error == 0 && i < state.records_count; i++) {
+    const LiveRecord *r = &state.records[i];
+    if (r->offset == UINT64_MAX || r->generation != state.generations[r->key]) {
+      continue;
+    }
+    uint32_t length;
+    memcpy(&length, map + r->offset, sizeof(uint32_t));
+    size_t record_size = WAL_RECORD_HEADER_SIZE + length;
+    if (used + record_size > WAL_COPY_BUFFER_SIZE) {
+      error = write_all(fd, buffer, used);
+      used = 0;
+    }
+    if (record_size > WAL_COPY_BUFFER_SIZE) {
+      error = error == 0 ? write_all(fd, map + r->offset, record_size) : error;
+    } else {
+      memcpy(buffer + used, map + r->offset, record_size);
+      used += record_size;
+    }
+  }
+  if (error == 0) {
+    error = write_all(fd, buffer, used);
+  }
+  destroy_live_state(&state);
+  return error;
+}
+
+/*
+ * appends bytes `from` .. `to` of the file `in` to `out`. returns 0 on success, else an errno.
+ */
+static int copy_range(int in, int out, uint64_t from, uint64_t to, char *buffer) {
+  while (from < to) {
+    size_t length = to - from < WAL_COPY_BUFFER_SIZE ? (size_t)(to - from) : WAL_COPY_BUFFER_SIZE;
+    ssize_t n = pread(in, buffer, length, (off_t)from);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return n < 0 ? errno : EIO;
+    }
+    int error = write_all(out, buffer, (size_t)n);
+    if (error != 0) {
+      return error;
+    }
+    from += (uint64_t)n;
+  }
+  return 0;
+}
+
+/*
+ * called with the lock held, returns with it held once no leader is writing and this thread is the leader.
+ */
+static void become_leader(Wal *wal) {
+  while (wal->flushing) {
+    pthread_cond_wait(&wal->flushed, &wal->lock);
+  }
+  wal->flushing = true;
+}
+
+/*
+ * the compaction thread. The log is sealed at the end of what has been written: that prefix never changes, so its live
+ * records are collected and written to `<path>.compact` without holding anything. Writers keep appending to the log
+ * meanwhile, the new file then catches up with what they appended in a few rounds of copying. Only the last round runs
+ * as the leader, so commits wait for it (and a sync of the new file) but appends don't. The new file, which gets a new
+ * id, is then renamed over the log.
+ */
+static void *compact_log(void *arg) {
+  Wal *wal = arg;
+  pthread_mutex_lock(&wal->lock);
+  become_leader(wal);
+  uint64_t sealed = wal->end_offset - wal->buffer_used;
+  int error = wal->error;
+  wal->flushing = false;
+  pthread_cond_broadcast(&wal->flushed);
+  pthread_mutex_unlock(&wal->lock);
+
+  char *path = suffixed_path(wal->path, ".compact");
+  char *buffer = malloc(WAL_COPY_BUFFER_SIZE);
+  int fd = path == NULL ? -1 : open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  const char *map = MAP_FAILED;
+  if (error == 0 && (buffer == NULL || fd < 0)) {
+    error = buffer == NULL || path == NULL ? ENOMEM : errno;
+  }
+  if (error == 0 && (map = mmap(NULL, sealed, PROT_READ, MAP_PRIVATE, wal->fd, 0)) == MAP_FAILED) {
+    error = errno;
+  }
+  uint64_t id = new_log_id();
+  if (error == 0) {
+    madvise((void *)map, sealed, MADV_SEQUENTIAL);
+    error = write_live_records(fd, id, map, sealed, buffer);
+    munmap((void *)map, sealed);
+  }
+  off_t live_size = error == 0 ? lseek(fd, 0, SEEK_CUR) : -1;
+  if (error == 0 && live_size < 0) {
+    error = errno;
+  }
+
+  // catch up without the lock: a round can end in the middle of a record being written, the next one goes on from
+  // there.
+  uint64_t copied = sealed;
+  for (int round = 0; error == 0 && round < WAL_COMPACTION_CATCH_UP_ROUNDS; round++) {
+    struct stat st;
+    if (fstat(wal->fd, &st) != 0) {
+      error = errno;
+    } else if ((uint64_t)st.st_size - copied < WAL_COPY_BUFFER_SIZE) {
+      break;
+    } else {
+      error = copy_range(wal->fd, fd, copied, (uint64_t)st.st_size, buffer);
+      copied = (uint64_t)st.st_size;
+    }
+  }
+  if (error == 0 && fdatasync(fd) != 0) {
+    error = errno;
+  }
+
+  pthread_mutex_lock(&wal->lock);
+  become_leader(wal);
+  uint64_t end = wal->end_offset - wal->buffer_used;
+  error = error == 0 ? wal->error : error;
+  pthread_mutex_unlock(&wal->lock);
+
+  bool renamed = false;
+  int sync_error = 0;
+  if (error == 0) {
+    error = copy_range(wal->fd, fd, copied, end, buffer);
+  }
+  if (error == 0 && fdatasync(fd) != 0) {
+    error = errno;
+  }
+  if (error == 0) {
+    renamed = rename(path, wal->path) == 0;
+    error = renamed ? 0 : errno;
+    if (renamed && sync_parent_directory(wal->path) != 0) {
+      // the rename may be undone by a crash, records committed to the new file from now on would be lost with it.
+      sync_error = errno;
+    }
+  }
+
+  pthread_mutex_lock(&wal->lock);
+  if (renamed) {
+    close(wal->fd);
+    wal->fd = fd;
+    wal->id = id;
+    uint64_t size = (uint64_t)live_size + (end - sealed);
+    wal->end_offset = size + wal->buffer_used;
+    wal->synced_lsn = wal->written_lsn;
+    wal->compacted_size = size;
+    if (sync_error != 0 && wal->error == 0) {
+      wal->error = sync_error;
+    }
+  } else {
+    // don't retry before the log doubled again.
+    wal->compacted_size = wal->end_offset;
+  }
+  wal->compaction_error = error;
+  wal->compacting = false;
+  wal->flushing = false;
+  pthread_cond_broadcast(&wal->flushed);
+  pthread_mutex_unlock(&wal->lock);
+
+  if (!renamed) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    if (path != NULL) {
+      unlink(path);
+    }
+  }
+  free(path);
+  free(buffer);
+  return NULL;
+}
+
+/*
+ * called with the lock held. returns 0 when a compaction was started, else 1.
+ */
+static int start_compaction(Wal *wal) {
+  if (wal->compacting || wal->closing) {
+    return 1;
+  }
+  if (wal->compactor_started) {
+    // done, it only has to be reaped.
+    pthread_join(wal->compactor, NULL);
+    wal->compactor_started = false;
+  }
+  if (pthread_create(&wal->compactor, NULL, compact_log, wal) != 0) {
+    return 1;
+  }
+  wal->compactor_started = true;
+  wal->compacting = true;
+  return 0;
+}
+
+int wal_compact(Wal *wal) {
+  pthread_mutex_lock(&wal->lock);
+  int rc = start_compaction(wal);
+  pthread_mutex_unlock(&wal->lock);
+  return rc;
+}
+
+int wal_wait_compaction(Wal *wal) {
+  pthread_mutex_lock(&wal->lock);
+  bool started = wal->compactor_started;
+  pthread_t compactor = wal->compactor;
+  wal->compactor_started = false;
+  pthread_mutex_unlock(&wal->lock);
+  if (started) {
+    pthread_join(compactor, NULL);
+  }
+  pthread_mutex_lock(&wal->lock);
+  int rc = wal->compaction_error == 0 ? 0 : 1;
+  pthread_mutex_unlock(&wal->lock);
+  return rc;
+}
+
+void wal_auto_compact(Wal *wal, uint64_t min_size) {
+  pthread_mutex_lock(&wal->lock);
+  wal->compact_min_size = min_size;
+  pthread_mutex_unlock(&wal->lock);
+}
+
+int wal_append(Wal *wal, const WalRecord *record, uint64_t *lsn) {
+  size_t needed = max_record_size(record);
+  pthread_mutex_lock(&wal->lock);
+  if (wal->error != 0) {
+    pthread_mutex_unlock(&wal->lock);
+    return 1;
+  }
+  if (wal->buffer_used + needed > wal->buffer_capacity) {
+    size_t capacity = wal->buffer_capacity * 2;
+    while (capacity < wal->buffer_used + needed) {
+      capacity *= 2;
+    }
+    char *buffer = realloc(wal->buffer, capacity);
+    if (buffer == NULL) {
+      pthread_mutex_unlock(&wal->lock);
+      return 1;
+    }
+    wal->buffer = buffer;
+    wal->buffer_capacity = capacity;
+  }
+
+  char *start = wal->buffer + wal->buffer_used;
+  char *end = encode_record(start, record);
+  wal->buffer_used = (size_t)(end - wal->buffer);
+  wal->end_offset += (uint64_t)(end - start);
+  *lsn = ++wal->appended_lsn;
+
+  if (wal->compact_min_size != 0 && wal->end_offset >= wal->compact_min_size &&
+      wal->end_offset >= 2 * wal->compacted_size) {
+    start_compaction(wal);
+  }
+
+  // bulk writers that commit rarely shouldn't pile up the whole batch in memory.
+  if (wal->buffer_used >= WAL_FLUSH_THRESHOLD && !wal->flushing) {
+    lead(wal, false);
+  }
+  pthread_mutex_unlock(&wal->lock);
+  return 0;
+}
+
+int wal_commit(Wal *wal, uint64_t lsn) {
+  pthread_mutex_lock(&wal->lock);
+  int rc;
+  for (;;) {
+    if (wal->error != 0) {
+      rc = 1;
+      break;
+    }
+    uint64_t done = wal->policy == WAL_SYNC_ALWAYS ? wal->synced_lsn : wal->written_lsn;
+    if (done >= lsn) {
+      rc = 0;
+      break;
+    }
+    if (wal->flushing) {
+      pthread_cond_wait(&wal->flushed, &wal->lock);
+      continue;
+    }
+    lead(wal, wal->policy == WAL_SYNC_ALWAYS);
+  }
+  pthread_mutex_unlock(&wal->lock);
+  return rc;
+}
+
+int wal_sync(Wal *wal) {
+  pthread_mutex_lock(&wal->lock);
+  uint64_t lsn = wal->appended_lsn;
+  while (wal->error == 0 && wal->synced_lsn < lsn) {
+    if (wal->flushing) {
+      pthread_cond_wait(&wal->flushed, &wal->lock);
+    } else {
+      lead(wal, true);
+    }
+  }
+  int rc = wal->error == 0 ? 0 : 1;
+  pthread_mutex_unlock(&wal->lock);
+  return rc;
+}
+
+uint64_t wal_end_offset(Wal *wal) {
+  pthread_mutex_lock(&wal->lock);
+  uint64_t offset = wal->end_offset;
+  pthread_mutex_unlock(&wal->lock);
+  return offset;
+}
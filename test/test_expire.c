@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "testing_utils.h"
+#include "timer_wheel.h"
+#include "wal.h"
+
+#define PATH_SIZE 256
+#define WHEEL_ITEMS 500
+#define WHEEL_STEPS 4000
+#define EXPIRED_CAPACITY 7 // small, so advancing often stops with more due
+
+/*
+ * advances the wheel to `now` a few items at a time and checks that exactly the items of `deadlines` due by then fired.
+ * returns the number of mistakes.
+ */
+static size_t advance_and_check(TimerWheel *wheel, uint64_t *deadlines, uint64_t now) {
+  size_t wrong = 0;
+  uint32_t expired[EXPIRED_CAPACITY];
+  size_t n;
+  do {
+    n = timer_wheel_advance(wheel, now, expired, EXPIRED_CAPACITY);
+    for (size_t i = 0; i < n; i++) {
+      wrong += deadlines[expired[i]] == 0 || deadlines[expired[i]] > now; // not scheduled, or early
+      deadlines[expired[i]] = 0;
+    }
+  } while (n == EXPIRED_CAPACITY);
+
+  size_t scheduled = 0;
+  for (uint32_t item = 0; item < WHEEL_ITEMS; item++) {
+    wrong += deadlines[item] != 0 && deadlines[item] <= now; // late
+    wrong += timer_wheel_deadline(wheel, item) != deadlines[item];
+    scheduled += deadlines[item] != 0;
+  }
+  return wrong + (wheel->count != scheduled);
+}
+
+/*
+ * random schedules, reschedules and cancels against a plain array of deadlines. Deadlines reach up to 2^42 ticks ahead,
+ * well past the 64^6 ticks a rotation of the top level spans, and time moves in steps from one tick to 2^40.
+ */
+static void test_timer_wheel(void) {
+  TimerWheel wheel;
+  init_timer_wheel(&wheel);
+  if (timer_wheel_reserve(&wheel, WHEEL_ITEMS) != 0) {
+    EXPECT(!"out of memory");
+    return;
+  }
+  uint64_t deadlines[WHEEL_ITEMS] = { 0 };
+  uint64_t now = 1000;
+  size_t wrong = 0;
+  for (int step = 0; step < WHEEL_STEPS; step++) {
+    double r = test_random();
+    uint32_t item = (uint32_t)(test_random() * WHEEL_ITEMS);
+    if (r < 0.6) {
+      int bits = 1 + (int)(test_random() * 42);
+      uint64_t deadline = now + 1 + (uint64_t)(test_random() * (double)((uint64_t)1 << bits));
+      timer_wheel_schedule(&wheel, item, deadline, now);
+      deadlines[item] = deadline;
+    } else if (r < 0.7) {
+      timer_wheel_cancel(&wheel, item);
+      deadlines[item] = 0;
+    } else {
+      // a few ticks ahead, exactly to a deadline, or far ahead.
+      double how = test_random();
+      uint64_t target = now + (uint64_t)(test_random() * 200);
+      if (how < 0.4 && deadlines[item] != 0) {
+        target = deadlines[item];
+      } else if (how > 0.7) {
+        target = now + (uint64_t)(test_random() * (double)((uint64_t)1 << (int)(test_random() * 40)));
+      }
+      wrong += advance_and_check(&wheel, deadlines, target);
+      now = target;
+    }
+  }
+  wrong += advance_and_check(&wheel, deadlines, UINT64_MAX - 1);
+  EXPECT(wrong == 0);
+  EXPECT(wheel.count == 0);
+  destroy_timer_wheel(&wheel);
+}
+
+typedef struct {
+  size_t deletes;
+  bool deleted_kept;
+} LoggedDeletes;
+
+static int count_deletes(const WalRecord *record, void *user_data) {
+  LoggedDeletes *logged = user_data;
+  if (record->op == WAL_DELETE) {
+    logged->deletes++;
+    logged->deleted_kept |= record->id.length == 4 && memcmp(record->id.start, "kept", 4) == 0;
+  }
+  return 0;
+}
+
+static bool is_missing(Store *store, Arena *arena, const char *key_id) {
+  char statement[128];
+  snprintf(statement, sizeof(statement), "GET %s", key_id);
+  ExecuteResult result = { 0 };
+  return run_statement(store, arena, statement, &result) == STORE_ID_NOT_FOUND;
+}
+
+/*
+ * `store_expire` removes the objects due like a DEL, logged, and a SET without EX takes an object's deadline away.
+ */
+static void test_store_expire(Arena *arena, const char *log_path) {
+  Store store;
+  Wal wal;
+  EXPECT(init_store(&store) == STORE_OK);
+  EXPECT(open_wal(&wal, log_path, WAL_SYNC_ALWAYS, 0) == 0);
+  EXPECT(store_replay_wal(&store, &wal) == STORE_OK);
+  store_log_writes(&store, &wal);
+  ExecuteResult result = { 0 };
+  EXPECT(run_statement(&store, arena, "SET fleet soon EX 10 POINT 1 1", &result) == STORE_OK);
+  EXPECT(run_statement(&store, arena, "SET fleet kept EX 10 POINT 2 2", &result) == STORE_OK);
+  EXPECT(run_statement(&store, arena, "SET fleet kept POINT 2 3", &result) == STORE_OK);
+  EXPECT(run_statement(&store, arena, "SET fleet never POINT 3 3", &result) == STORE_OK);
+  const Collection *fleet = store_get_collection(&store, "fleet", 5);
+  EXPECT(fleet != NULL && fleet->expirations.count == 1);
+
+  uint64_t now = store_now_ms();
+  size_t expired = SIZE_MAX;
+  EXPECT(store_expire(&store, now, &expired) == STORE_OK && expired == 0);
+  EXPECT(!is_missing(&store, arena, "fleet soon"));
+  EXPECT(store_expire(&store, now + 20000, &expired) == STORE_OK && expired == 1);
+  EXPECT(is_missing(&store, arena, "fleet soon"));
+  EXPECT(!is_missing(&store, arena, "fleet kept"));
+  EXPECT(!is_missing(&store, arena, "fleet never"));
+  EXPECT(run_statement(&store, arena, "NEARBY fleet POINT 0 0", &result) == STORE_OK && result.objects_count == 2);
+  EXPECT(fleet != NULL && fleet->expirations.count == 0);
+  EXPECT(close_wal(&wal) == 0);
+  destroy_store(&store);
+
+  LoggedDeletes logged = { 0 };
+  EXPECT(open_wal(&wal, log_path, WAL_SYNC_ALWAYS, 0) == 0);
+  EXPECT(wal_replay(&wal, 0, count_deletes, &logged) == 0);
+  EXPECT(logged.deletes == 1 && !logged.deleted_kept);
+  EXPECT(close_wal(&wal) == 0);
+
+  EXPECT(init_store(&store) == STORE_OK);
+  EXPECT(open_wal(&wal, log_path, WAL_SYNC_ALWAYS, 0) == 0);
+  EXPECT(store_replay_wal(&store, &wal) == STORE_OK);
+  EXPECT(is_missing(&store, arena, "fleet soon"));
+  EXPECT(!is_missing(&store, arena, "fleet kept"));
+  fleet = store_get_collection(&store, "fleet", 5);
+  EXPECT(fleet != NULL && fleet->expirations.count == 0);
+  EXPECT(close_wal(&wal) == 0);
+  destroy_store(&store);
+}
+
+void test_expire(void) {
+  Arena arena;
+  if (init_arena(&arena, 0) != 0) {
+    EXPECT(!"out of memory");
+    return;
+  }
+  char log_path[PATH_SIZE];
+  temporary_path(log_path, sizeof(log_path), "expire.log");
+
+  test_timer_wheel();
+  test_store_expire(&arena, log_path);
+
+  unlink(log_path);
+  destroy_arena(&arena);
+}
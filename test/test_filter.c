@@ -0,0 +1,138 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "filter.h"
+#include "testing_utils.h"
+
+#define SLOTS_COUNT 200
+#define COLUMNS_COUNT 3
+#define FILTERS_COUNT 300
+
+static const char *COLUMN_NAMES[] = { "a", "b", "c", "missing" };
+
+/*
+ * what `filter_block` computes, one candidate and one clause at a time.
+ */
+static bool reference_passes(const WhereClause *clauses, size_t count, double values[][SLOTS_COUNT], uint32_t slot) {
+  bool passed = false;
+  bool group = true;
+  for (size_t i = 0; i < count; i++) {
+    if (clauses[i].starts_group) {
+      passed = passed || group;
+      group = true;
+    }
+    size_t column = clauses[i].field.start[0] - 'a';
+    double v = column < COLUMNS_COUNT ? values[column][slot] : NAN;
+    group = group && v >= clauses[i].min && v <= clauses[i].max;
+  }
+  return passed || group;
+}
+
+static double random_bound(void) {
+  double r = test_random();
+  return r < 0.1 ? -INFINITY : r > 0.9 ? INFINITY : floor(test_random() * 10);
+}
+
+/*
+ * random WHERE clauses, grouped by OR and naming columns that don't exist, against columns holding NAN for objects
+ * without a value, on blocks of every size so the vectorised compares end on every possible scalar tail.
+ */
+static void test_filter_blocks(void) {
+  static double values[COLUMNS_COUNT][SLOTS_COUNT];
+  for (size_t c = 0; c < COLUMNS_COUNT; c++) {
+    for (size_t s = 0; s < SLOTS_COUNT; s++) {
+      values[c][s] = test_random() < 0.2 ? NAN : floor(test_random() * 10);
+    }
+  }
+  FieldColumn columns[COLUMNS_COUNT];
+  for (size_t c = 0; c < COLUMNS_COUNT; c++) {
+    columns[c] = (FieldColumn){ .name = (char *)COLUMN_NAMES[c], .name_length = 1, .values = values[c] };
+  }
+
+  size_t wrong = 0;
+  for (int f = 0; f < FILTERS_COUNT; f++) {
+    WhereClause clauses[6];
+    size_t count = 1 + (size_t)(test_random() * 6);
+    for (size_t i = 0; i < count; i++) {
+      const char *name = COLUMN_NAMES[test_random() < 0.05 ? COLUMNS_COUNT : (size_t)(test_random() * COLUMNS_COUNT)];
+      double min = random_bound();
+      double max = random_bound();
+      clauses[i] = (WhereClause){
+        .field = { .start = name, .length = strlen(name) },
+        .min = fmin(min, max),
+        .max = fmax(min, max),
+        .starts_group = i > 0 && test_random() < 0.3,
+      };
+    }
+    Filter filter;
+    if (compile_filter(&filter, clauses, count, columns, COLUMNS_COUNT) != 0) {
+      EXPECT(!"out of memory");
+      return;
+    }
+    for (size_t size = 1; size <= FILTER_BLOCK_SIZE; size++) {
+      uint32_t slots[FILTER_BLOCK_SIZE];
+      for (size_t i = 0; i < size; i++) {
+        slots[i] = (uint32_t)(test_random() * SLOTS_COUNT);
+      }
+      uint64_t passed = filter_block(&filter, slots, size);
+      for (size_t i = 0; i < size; i++) {
+        wrong += ((passed >> i) & 1) != reference_passes(clauses, count, values, slots[i]);
+      }
+      wrong += size < 64 && passed >> size != 0;
+    }
+    destroy_filter(&filter);
+  }
+  EXPECT(wrong == 0);
+}
+
+static size_t count_matches(Store *store, Arena *arena, const char *statement) {
+  ExecuteResult result = { 0 };
+  if (run_statement(store, arena, statement, &result) != STORE_OK) {
+    return SIZE_MAX;
+  }
+  return result.objects_count;
+}
+
+/*
+ * WHERE clauses of queries: AND within a group, OR across groups, a field no object has and objects without a value.
+ */
+static void test_where_queries(Arena *arena) {
+  Store store;
+  if (init_store(&store) != STORE_OK) {
+    EXPECT(!"out of memory");
+    return;
+  }
+  ExecuteResult result = { 0 };
+  char statement[128];
+  for (int i = 0; i < 10; i++) {
+    // speed is i, fuel only on even ids.
+    if (i % 2 == 0) {
+      snprintf(statement, sizeof(statement), "SET fleet t%d FIELD speed %d FIELD fuel %d POINT 0 0.%d", i, i, i, i);
+    } else {
+      snprintf(statement, sizeof(statement), "SET fleet t%d FIELD speed %d POINT 0 0.%d", i, i, i);
+    }
+    EXPECT(run_statement(&store, arena, statement, &result) == STORE_OK);
+  }
+  EXPECT(count_matches(&store, arena, "NEARBY fleet WHERE speed 2 5 POINT 0 0") == 4);
+  EXPECT(count_matches(&store, arena, "NEARBY fleet WHERE speed 2 5 WHERE fuel -inf +inf POINT 0 0") == 2);
+  EXPECT(count_matches(&store, arena, "NEARBY fleet WHERE speed 0 1 OR WHERE speed 8 +inf POINT 0 0") == 4);
+  EXPECT(count_matches(&store, arena, "NEARBY fleet WHERE fuel 0 3 OR WHERE speed 3 3 POINT 0 0") == 3);
+  EXPECT(count_matches(&store, arena, "NEARBY fleet WHERE weight -inf +inf POINT 0 0") == 0);
+  EXPECT(count_matches(&store, arena, "NEARBY fleet WHERE weight -inf +inf OR WHERE speed 9 9 POINT 0 0") == 1);
+  EXPECT(count_matches(&store, arena, "NEARBY fleet LIMIT 2 WHERE fuel 1 +inf POINT 0 0") == 2);
+  EXPECT(count_matches(&store, arena, "WITHIN fleet WHERE speed 4 +inf BOUNDS -1 -1 -1 1 1 1 1 -1 -1 -1") == 6);
+  EXPECT(count_matches(&store, arena, "INTERSECTS fleet WHERE fuel 0 0 BOUNDS -1 -1 -1 1 1 1 1 -1 -1 -1") == 1);
+  destroy_store(&store);
+}
+
+void test_filter(void) {
+  Arena arena;
+  if (init_arena(&arena, 0) != 0) {
+    EXPECT(!"out of memory");
+    return;
+  }
+  test_filter_blocks();
+  test_where_queries(&arena);
+  destroy_arena(&arena);
+}
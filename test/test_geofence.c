@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "testing_utils.h"
+
+#define EVENTS_CAPACITY 16
+
+typedef struct {
+  DetectType types[EVENTS_CAPACITY];
+  char channels[EVENTS_CAPACITY][16];
+  char ids[EVENTS_CAPACITY][16];
+  size_t channel_lengths[EVENTS_CAPACITY];
+  size_t id_lengths[EVENTS_CAPACITY];
+  size_t count;
+} Events;
+
+static void record_event(const DetectEvent *event, void *user_data) {
+  Events *events = user_data;
+  if (events->count == EVENTS_CAPACITY) {
+    return;
+  }
+  events->types[events->count] = event->type;
+  snprintf(events->channels[events->count], sizeof(events->channels[0]), "%.*s", (int)event->channel.length,
+           event->channel.start);
+  snprintf(events->ids[events->count], sizeof(events->ids[0]), "%.*s", (int)event->id.length, event->id.start);
+  events->channel_lengths[events->count] = event->channel.length;
+  events->id_lengths[events->count] = event->id.length;
+  events->count++;
+}
+
+/*
+ * runs `statement` and checks that it emitted exactly the events of `expected`, "" for none. Every event is written
+ * as type:channel:id and they are separated by spaces, for example "enter:zone:truck1 exit:depot:truck1".
+ */
+static void expect_events(Store *store, Arena *arena, Events *events, const char *statement, const char *expected) {
+  static const char *TYPES[] = { "enter", "exit", "inside", "outside" };
+  events->count = 0;
+  ExecuteResult result = { 0 };
+  EXPECT(run_statement(store, arena, statement, &result) == STORE_OK);
+
+  char actual[256] = "";
+  size_t used = 0;
+  for (size_t i = 0; i < events->count && used < sizeof(actual); i++) {
+    used += snprintf(actual + used, sizeof(actual) - used, "%s%s:%s:%s", i == 0 ? "" : " ", TYPES[events->types[i]],
+                     events->channels[i], events->ids[i]);
+  }
+  if (strcmp(actual, expected) != 0) {
+    printf("[FAILED] %s: expected \"%s\", got \"%s\"\n", statement, expected, actual);
+    tests_failed++;
+  }
+}
+
+static void test_nearby_fence(Store *store, Arena *arena, Events *events) {
+  // about 1.1 km around the fence center.
+  expect_events(store, arena, events, "SETCHAN zone NEARBY fleet FENCE POINT 33 -112 1100", "");
+  expect_events(store, arena, events, "SET fleet t1 POINT 40 -100", "");
+  expect_events(store, arena, events, "SET fleet t1 POINT 33.005 -112", "enter:zone:t1");
+  expect_events(store, arena, events, "SET fleet t1 POINT 33.006 -112.001", "inside:zone:t1");
+  expect_events(store, arena, events, "SET fleet t1 POINT 33.02 -112", "exit:zone:t1");
+  expect_events(store, arena, events, "SET fleet t1 POINT 33 -112", "enter:zone:t1");
+  expect_events(store, arena, events, "DEL fleet t1", "exit:zone:t1");
+  // other keys are not watched.
+  expect_events(store, arena, events, "SET trains t1 POINT 33 -112", "");
+  expect_events(store, arena, events, "DELCHAN zone", "");
+  expect_events(store, arena, events, "SET fleet t1 POINT 33 -112", "");
+}
+
+static void test_within_fence(Store *store, Arena *arena, Events *events) {
+  expect_events(store, arena, events, "SETCHAN depot WITHIN fleet FENCE BOUNDS 10 10 10 11 11 11 11 10 10 10", "");
+  expect_events(store, arena, events, "SET fleet t2 POINT 10.5 10.5", "enter:depot:t2");
+  expect_events(store, arena, events, "SET fleet t2 POINT 11.5 10.5", "exit:depot:t2");
+  expect_events(store, arena, events, "SET fleet t2 POINT 10.2 10.9", "enter:depot:t2");
+
+  // replacing the fence tests against the new one.
+  expect_events(store, arena, events, "SETCHAN depot WITHIN fleet FENCE BOUNDS 20 20 20 21 21 21 21 20 20 20", "");
+  expect_events(store, arena, events, "SET fleet t2 POINT 20.5 20.5", "enter:depot:t2");
+  expect_events(store, arena, events, "SET fleet t2 POINT 10.5 10.5", "exit:depot:t2");
+  expect_events(store, arena, events, "DELCHAN depot", "");
+}
+
+static void test_point_replaced(Store *store, Arena *arena, Events *events) {
+  expect_events(store, arena, events, "SETCHAN yard NEARBY fleet FENCE POINT -20 30 5000", "");
+  expect_events(store, arena, events, "SET fleet t3 POINT -20 30", "enter:yard:t3");
+  // fences only watch points: bounds leave it, and deleting them has nothing left to report.
+  expect_events(store, arena, events, "SET fleet t3 BOUNDS -20 30 -20 30.01 -20.01 30.01 -20 30", "exit:yard:t3");
+  expect_events(store, arena, events, "DEL fleet t3", "");
+  expect_events(store, arena, events, "DELCHAN yard", "");
+}
+
+static void test_antimeridian_fence(Store *store, Arena *arena, Events *events) {
+  expect_events(store, arena, events, "SETCHAN dateline NEARBY fleet FENCE POINT 0 179.95 50000", "");
+  // 16 km east of the center, across the antimeridian.
+  expect_events(store, arena, events, "SET fleet t4 POINT 0 -179.9", "enter:dateline:t4");
+  expect_events(store, arena, events, "SET fleet t4 POINT 0.1 179.8", "inside:dateline:t4");
+  expect_events(store, arena, events, "SET fleet t4 POINT 0 -179", "exit:dateline:t4");
+  expect_events(store, arena, events, "DELCHAN dateline", "");
+}
+
+static void test_high_latitude_fences(Store *store, Arena *arena, Events *events) {
+  // 994 km from the center but further east than 1000 km spans along the center's parallel.
+  expect_events(store, arena, events, "SETCHAN north NEARBY fleet FENCE POINT 60 0 1000000", "");
+  expect_events(store, arena, events, "SET fleet t5 POINT 61 18.1", "enter:north:t5");
+  expect_events(store, arena, events, "SET fleet t5 POINT 61 18.3", "exit:north:t5");
+  expect_events(store, arena, events, "DELCHAN north", "");
+
+  // the circle contains the pole, so it reaches every longitude.
+  expect_events(store, arena, events, "SETCHAN pole NEARBY fleet FENCE POINT 80 0 1500000", "");
+  expect_events(store, arena, events, "SET fleet t6 POINT 89 180", "enter:pole:t6");
+  expect_events(store, arena, events, "SET fleet t6 POINT 85 -90", "inside:pole:t6");
+  expect_events(store, arena, events, "SET fleet t6 POINT 70 180", "exit:pole:t6");
+  expect_events(store, arena, events, "DELCHAN pole", "");
+}
+
+/*
+ * the callback gets channels and ids whole, however long.
+ */
+static void test_long_names(Store *store, Arena *arena, Events *events) {
+  char channel[QUEUED_EVENT_SPAN_LENGTH + 20];
+  char id[QUEUED_EVENT_SPAN_LENGTH + 11];
+  memset(channel, 'c', sizeof(channel) - 1);
+  channel[sizeof(channel) - 1] = '\0';
+  memset(id, 'x', sizeof(id) - 1);
+  id[sizeof(id) - 1] = '\0';
+  char statement[256];
+  ExecuteResult result = { 0 };
+  snprintf(statement, sizeof(statement), "SETCHAN %s NEARBY long FENCE POINT 5 5 100", channel);
+  EXPECT(run_statement(store, arena, statement, &result) == STORE_OK);
+  events->count = 0;
+  snprintf(statement, sizeof(statement), "SET long %s POINT 5 5", id);
+  EXPECT(run_statement(store, arena, statement, &result) == STORE_OK);
+  EXPECT(events->count == 1 && events->types[0] == DETECT_ENTER);
+  EXPECT(events->channel_lengths[0] == strlen(channel) && events->id_lengths[0] == strlen(id));
+  snprintf(statement, sizeof(statement), "DELCHAN %s", channel);
+  EXPECT(run_statement(store, arena, statement, &result) == STORE_OK);
+}
+
+/*
+ * events queued on a ring carry their own strings, so they read back after the fence is gone, long ids cut and
+ * flagged.
+ */
+static void test_published_events(void) {
+  Arena arena;
+  Store store;
+  EventRing ring;
+  if (init_arena(&arena, 0) != 0 || init_store(&store) != STORE_OK ||
+      init_event_ring(&ring, 16, OVERFLOW_DROP_NEWEST) != 0) {
+    EXPECT(!"out of memory");
+    return;
+  }
+  store_publish_events(&store, &ring);
+
+  char id[QUEUED_EVENT_SPAN_LENGTH + 11];
+  memset(id, 'x', sizeof(id) - 1);
+  id[sizeof(id) - 1] = '\0';
+  char statement[160];
+  snprintf(statement, sizeof(statement), "SET fleet %s POINT 5 5", id);
+  ExecuteResult result = { 0 };
+  EXPECT(run_statement(&store, &arena, "SETCHAN gate NEARBY fleet FENCE POINT 5 5 100", &result) == STORE_OK);
+  EXPECT(run_statement(&store, &arena, statement, &result) == STORE_OK);
+  EXPECT(run_statement(&store, &arena, "SET fleet t1 POINT 5 5", &result) == STORE_OK);
+  EXPECT(run_statement(&store, &arena, "DELCHAN gate", &result) == STORE_OK);
+
+  QueuedDetectEvent events[3];
+  EXPECT(event_ring_drain(&ring, events, 3) == 2);
+  EXPECT(events[0].type == DETECT_ENTER);
+  EXPECT(events[0].channel_length == 4 && memcmp(events[0].channel, "gate", 4) == 0);
+  EXPECT(events[0].key_length == 5 && memcmp(events[0].key, "fleet", 5) == 0);
+  EXPECT(events[0].id_length == QUEUED_EVENT_SPAN_LENGTH && memcmp(events[0].id, id, QUEUED_EVENT_SPAN_LENGTH) == 0);
+  EXPECT(events[0].truncated);
+  EXPECT(events[1].id_length == 2 && memcmp(events[1].id, "t1", 2) == 0 && !events[1].truncated);
+
+  destroy_store(&store);
+  destroy_event_ring(&ring);
+  destroy_arena(&arena);
+}
+
+void test_geofence(void) {
+  Arena arena;
+  Store store;
+  Events *events = calloc(1, sizeof(Events));
+  if (init_arena(&arena, 0) != 0 || events == NULL || init_store(&store) != STORE_OK) {
+    EXPECT(!"out of memory");
+    return;
+  }
+  store.on_detect = record_event;
+  store.detect_user_data = events;
+
+  test_nearby_fence(&store, &arena, events);
+  test_within_fence(&store, &arena, events);
+  test_point_replaced(&store, &arena, events);
+  test_antimeridian_fence(&store, &arena, events);
+  test_high_latitude_fences(&store, &arena, events);
+  test_long_names(&store, &arena, events);
+
+  destroy_store(&store);
+  destroy_arena(&arena);
+  free(events);
+
+  test_published_events();
+}
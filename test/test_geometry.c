@@ -0,0 +1,228 @@
+#include <math.h>
+#include <stdio.h>
+
+#include "geometry.h"
+#include "testing_utils.h"
+
+static void test_point_distance(void) {
+  Point a = { .x = 0, .y = 0 };
+  Point b = { .x = 0, .y = 1 };
+  // a degree of a great circle on the mean earth radius.
+  EXPECT(fabs(point_distance_meters(&a, &b) - 111195.08) < 0.01);
+  EXPECT(point_distance_meters(&a, &a) == 0);
+
+  Point east = { .x = 179.5, .y = 10 };
+  Point west = { .x = -179.5, .y = 10 };
+  Point near = { .x = 180.5, .y = 10 };
+  EXPECT(fabs(point_distance_meters(&east, &west) - point_distance_meters(&east, &near)) < 1e-6);
+}
+
+static void test_rect_distance(void) {
+  Rect r = { .min_x = -1, .min_y = -1, .max_x = 1, .max_y = 1 };
+  Point inside = { .x = 0.5, .y = -0.5 };
+  EXPECT(rect_distance_meters(&inside, &r) == 0);
+
+  Point north = { .x = 0, .y = 2 };
+  Point corner = { .x = 0, .y = 1 };
+  EXPECT(rect_distance_meters(&north, &r) == point_distance_meters(&north, &corner));
+
+  // across the antimeridian the box is a few kilometers away, not most of the way around the earth.
+  Point east = { .x = 179.95, .y = 0 };
+  Rect west = { .min_x = -179.95, .min_y = -1, .max_x = -179.9, .max_y = 1 };
+  Point west_edge = { .x = -179.95, .y = 0 };
+  EXPECT(fabs(rect_distance_meters(&east, &west) - point_distance_meters(&east, &west_edge)) < 1e-6);
+
+  // far north a box to the east is closest at its top corner, not at the point's latitude.
+  Point far_north = { .x = 0, .y = 80 };
+  Rect band = { .min_x = 60, .min_y = 70, .max_x = 61, .max_y = 85 };
+  Point top = { .x = 60, .y = 85 };
+  EXPECT(rect_distance_meters(&far_north, &band) < point_distance_meters(&far_north, &top));
+  Point level = { .x = 60, .y = 80 };
+  EXPECT(rect_distance_meters(&far_north, &band) < point_distance_meters(&far_north, &level));
+}
+
+/*
+ * the distance to random boxes, some across the antimeridian or near the poles, is never larger than the distance to
+ * any point sampled in them, and not much smaller than the closest sample.
+ */
+static void test_rect_distance_lower_bound(void) {
+  const int steps = 40;
+  size_t overestimates = 0;
+  size_t loose = 0;
+  for (int i = 0; i < 2000; i++) {
+    Point p = { .x = test_random() * 360 - 180, .y = test_random() * 180 - 90 };
+    double width = test_random() * (i % 2 == 0 ? 2 : 40);
+    double height = test_random() * (i % 2 == 0 ? 2 : 40);
+    Rect r = { .min_x = test_random() * 360 - 180, .min_y = test_random() * (180 - height) - 90 };
+    r.max_x = r.min_x + width;
+    r.max_y = r.min_y + height;
+    double bound = rect_distance_meters(&p, &r);
+
+    double closest = INFINITY;
+    for (int a = 0; a <= steps; a++) {
+      for (int b = 0; b <= steps; b++) {
+        Point q = { .x = r.min_x + width * a / steps, .y = r.min_y + height * b / steps };
+        double d = point_distance_meters(&p, &q);
+        closest = d < closest ? d : closest;
+      }
+    }
+    // a sample is at most half a grid cell from the true closest point.
+    double cell = hypot(width, height) / steps * 111195;
+    overestimates += bound > closest * (1 + 1e-12) + 1e-6;
+    loose += bound < closest - cell;
+  }
+  EXPECT(overestimates == 0);
+  EXPECT(loose == 0);
+}
+
+/*
+ * points just inside random circles, found by walking from the center along random bearings, are inside the circles'
+ * boxes, also for circles that cross the antimeridian or contain a pole.
+ */
+static void test_circle_rect(void) {
+  size_t outside = 0;
+  for (int i = 0; i < 2000; i++) {
+    Point center = { .x = test_random() * 360 - 180, .y = test_random() * 180 - 90 };
+    double radius = test_random() * (i % 2 == 0 ? 20000 : 3000000);
+    Rect box = circle_rect(&center, radius);
+    for (int j = 0; j < 16; j++) {
+      // the destination of a great circle walk of `radius` (just short of it) on `bearing`.
+      double angle = radius * (1 - 1e-9) / 6371008.8;
+      double bearing = test_random() * 2 * M_PI;
+      double lat = center.y * M_PI / 180;
+      double y = asin(sin(lat) * cos(angle) + cos(lat) * sin(angle) * cos(bearing));
+      double dx = atan2(sin(bearing) * sin(angle) * cos(lat), cos(angle) - sin(lat) * sin(y)) * 180 / M_PI;
+      Point q = { .x = center.x + dx, .y = y * 180 / M_PI };
+      q.x -= 360 * nearbyint(q.x / 360);
+      outside += q.x < box.min_x || q.x > box.max_x || q.y < box.min_y || q.y > box.max_y;
+    }
+  }
+  EXPECT(outside == 0);
+
+  // the circle is widest east and west of its center a little poleward of the center's parallel.
+  Point north = { .x = 0, .y = 60 };
+  Rect box = circle_rect(&north, 1000000);
+  EXPECT(box.max_x > 18.1 && box.max_x < 18.3);
+  Point arctic = { .x = 0, .y = 80 };
+  box = circle_rect(&arctic, 1500000);
+  EXPECT(box.min_x == -180 && box.max_x == 180 && box.max_y == 90);
+}
+
+#define KERNEL_BATCH 61 // not a multiple of the vector width, so every kernel finishes on its scalar tail
+
+static const char *KERNELS[] = { "scalar", "sse2", "avx2" };
+
+/*
+ * every kernel this cpu runs stays within DISTANCE_BATCH_RELATIVE_ERROR (or a nanometer) of `point_distance_meters` up
+ * to 20000 km, near the query and across the antimeridian included.
+ */
+static void test_kernel_error(distance_kernel kernel) {
+  double xs[KERNEL_BATCH];
+  double ys[KERNEL_BATCH];
+  double distances[KERNEL_BATCH];
+  size_t off = 0;
+  for (int i = 0; i < 200; i++) {
+    Point q = { .x = test_random() * 360 - 180, .y = test_random() * 180 - 90 };
+    DistanceQuery query;
+    init_distance_query(&query, &q, INFINITY);
+    query.kernel = kernel;
+    // a third nearby, a third within a few degrees, the rest anywhere.
+    for (size_t j = 0; j < KERNEL_BATCH; j++) {
+      double spread = j % 3 == 0 ? 0.001 : (j % 3 == 1 ? 5 : 360);
+      xs[j] = q.x + (test_random() - 0.5) * spread;
+      ys[j] = fmax(-90, fmin(90, q.y + (test_random() - 0.5) * spread / 2));
+    }
+    point_distances_meters(&query, xs, ys, KERNEL_BATCH, distances);
+    for (size_t j = 0; j < KERNEL_BATCH; j++) {
+      Point p = { .x = xs[j], .y = ys[j] };
+      double expected = point_distance_meters(&q, &p);
+      if (expected <= 20000000) {
+        off += fabs(distances[j] - expected) > fmax(expected * DISTANCE_BATCH_RELATIVE_ERROR, 1e-9);
+      }
+    }
+  }
+  EXPECT(off == 0);
+}
+
+/*
+ * with a max distance, candidates within it are measured and those beyond are either measured or INFINITY.
+ */
+static void test_kernel_shortcut(distance_kernel kernel) {
+  double xs[KERNEL_BATCH];
+  double ys[KERNEL_BATCH];
+  double distances[KERNEL_BATCH];
+  size_t wrong = 0;
+  for (int i = 0; i < 200; i++) {
+    Point q = { .x = test_random() * 360 - 180, .y = test_random() * 170 - 85 };
+    double max_distance = test_random() * 500000;
+    DistanceQuery query;
+    init_distance_query(&query, &q, max_distance);
+    query.kernel = kernel;
+    for (size_t j = 0; j < KERNEL_BATCH; j++) {
+      xs[j] = q.x + (test_random() - 0.5) * 20;
+      ys[j] = fmax(-90, fmin(90, q.y + (test_random() - 0.5) * 10));
+    }
+    point_distances_meters(&query, xs, ys, KERNEL_BATCH, distances);
+    for (size_t j = 0; j < KERNEL_BATCH; j++) {
+      Point p = { .x = xs[j], .y = ys[j] };
+      double expected = point_distance_meters(&q, &p);
+      if (isinf(distances[j])) {
+        wrong += expected <= max_distance;
+      } else {
+        wrong += fabs(distances[j] - expected) > fmax(expected * DISTANCE_BATCH_RELATIVE_ERROR, 1e-9);
+      }
+    }
+  }
+  EXPECT(wrong == 0);
+}
+
+/*
+ * the batched box distances match `rect_distance_meters` whatever the kernel.
+ */
+static void test_kernel_rects(distance_kernel kernel) {
+  double min_x[KERNEL_BATCH];
+  double min_y[KERNEL_BATCH];
+  double max_x[KERNEL_BATCH];
+  double max_y[KERNEL_BATCH];
+  double distances[KERNEL_BATCH];
+  size_t off = 0;
+  for (int i = 0; i < 200; i++) {
+    Point q = { .x = test_random() * 360 - 180, .y = test_random() * 180 - 90 };
+    DistanceQuery query;
+    init_distance_query(&query, &q, INFINITY);
+    query.kernel = kernel;
+    for (size_t j = 0; j < KERNEL_BATCH; j++) {
+      min_x[j] = test_random() * 360 - 180;
+      min_y[j] = test_random() * 170 - 90;
+      max_x[j] = min_x[j] + test_random() * 20;
+      max_y[j] = fmin(90, min_y[j] + test_random() * 20);
+    }
+    rect_distances_meters(&query, min_x, min_y, max_x, max_y, KERNEL_BATCH, distances);
+    for (size_t j = 0; j < KERNEL_BATCH; j++) {
+      Rect r = { .min_x = min_x[j], .min_y = min_y[j], .max_x = max_x[j], .max_y = max_y[j] };
+      double expected = rect_distance_meters(&q, &r);
+      if (expected <= 20000000) {
+        off += fabs(distances[j] - expected) > fmax(expected * DISTANCE_BATCH_RELATIVE_ERROR, 1e-9);
+      }
+    }
+  }
+  EXPECT(off == 0);
+}
+
+void test_geometry(void) {
+  test_point_distance();
+  test_rect_distance();
+  test_rect_distance_lower_bound();
+  test_circle_rect();
+
+  for (size_t i = 0; i < sizeof(KERNELS) / sizeof(KERNELS[0]); i++) {
+    distance_kernel kernel = distance_kernel_by_name(KERNELS[i]);
+    if (kernel == NULL) {
+      printf("[SKIPPED] the %s distance kernel, this cpu can't run it\n", KERNELS[i]);
+      continue;
+    }
+    test_kernel_error(kernel);
+    test_kernel_shortcut(kernel);
+    test_kernel_rects(kernel);
+  }
+}
@@ -0,0 +1,264 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "import.h"
+#include "scan_pool.h"
+#include "testing_utils.h"
+#include "wal.h"
+
+#define PATH_SIZE 256
+#define TAGS_COUNT 40 // nested objects per feature of the large file, most of its `}, {` separate them
+
+static void write_file(const char *path, const char *contents, size_t size) {
+  FILE *file = fopen(path, "w");
+  EXPECT(file != NULL && fwrite(contents, 1, size, file) == size);
+  if (file != NULL) {
+    EXPECT(fclose(file) == 0);
+  }
+}
+
+static const Object *get_object(Store *store, Arena *arena, const char *key_id, ExecuteResult *result) {
+  char statement[128];
+  snprintf(statement, sizeof(statement), "GET %s WITHFIELDS", key_id);
+  *result = (ExecuteResult){ 0 };
+  return run_statement(store, arena, statement, result) == STORE_OK ? result->object : NULL;
+}
+
+static bool has_point(Store *store, Arena *arena, const char *key_id, double lat, double lon) {
+  ExecuteResult result;
+  const Object *object = get_object(store, arena, key_id, &result);
+  if (object == NULL || object->type != GEOMETRY_POINT) {
+    return false;
+  }
+  Point p = collection_object_point(result.collection, object);
+  return p.y == lat && p.x == lon;
+}
+
+static double field_of(Store *store, Arena *arena, const char *key_id, const char *name) {
+  ExecuteResult result;
+  const Object *object = get_object(store, arena, key_id, &result);
+  if (object == NULL) {
+    return NAN;
+  }
+  for (uint32_t i = 0; i < result.collection->fields_count; i++) {
+    if (strcmp(result.collection->fields[i].name, name) == 0) {
+      return collection_object_field(result.collection, object, i);
+    }
+  }
+  return NAN;
+}
+
+static const char SMALL_GEOJSON[] =
+  "{\"type\": \"FeatureCollection\", \"features\": [\n"
+  "  {\"type\": \"Feature\", \"id\": \"truck1\", \"geometry\": {\"type\": \"Point\", \"coordinates\": [-112.25, 33.5]},"
+  " \"properties\": {\"speed\": 50, \"name\": \"a }, { b\", \"fuel\": 0.5}},\n"
+  "  {\"type\": \"Feature\", \"id\": 42, \"geometry\": {\"type\": \"Point\", \"coordinates\": [2, 1, 3]}},\n"
+  "  {\"type\": \"Feature\", \"id\": \"zone\", \"geometry\": {\"type\": \"Polygon\", \"coordinates\": "
+  "[[[0, 0], [1, 0], [1, 1], [0, 1], [0, 0]], [[0.2, 0.2], [0.3, 0.2], [0.3, 0.3], [0.2, 0.2]]]}},\n"
+  "  {\"type\": \"Feature\", \"id\": \"road\", \"geometry\": {\"type\": \"LineString\", "
+  "\"coordinates\": [[0, 0], [1, 1]]}},\n"
+  "  {\"type\": \"Feature\", \"id\": \"nowhere\", \"geometry\": null, \"properties\": null},\n"
+  "  {\"type\": \"Feature\", \"geometry\": {\"type\": \"Point\", \"coordinates\": [6, 5]}}\n"
+  "]}\n";
+
+static void expect_small_geojson(Store *store, Arena *arena) {
+  EXPECT(has_point(store, arena, "geo truck1", 33.5, -112.25));
+  EXPECT(field_of(store, arena, "geo truck1", "speed") == 50);
+  EXPECT(field_of(store, arena, "geo truck1", "fuel") == 0.5);
+  EXPECT(isnan(field_of(store, arena, "geo truck1", "name")));
+  EXPECT(has_point(store, arena, "geo 42", 1, 2));
+  EXPECT(has_point(store, arena, "geo 6", 5, 6)); // no id, its position in the file
+
+  // the outer ring of the polygon, its hole dropped.
+  ExecuteResult result;
+  const Object *zone = get_object(store, arena, "geo zone", &result);
+  EXPECT(zone != NULL && zone->type == GEOMETRY_LINE_STRING);
+  if (zone != NULL) {
+    Geometry geometry = collection_object_geometry(result.collection, zone);
+    EXPECT(geometry.line_string.points_count == 5 && geometry.line_string.is_closed);
+  }
+  EXPECT(get_object(store, arena, "geo road", &result) == NULL);
+  EXPECT(get_object(store, arena, "geo nowhere", &result) == NULL);
+}
+
+/*
+ * string and numeric ids, a polygon and skipped geometries, imported with the log on and replayed into a fresh store.
+ */
+static void test_import_geojson(Arena *arena, const char *path, const char *log_path) {
+  write_file(path, SMALL_GEOJSON, sizeof(SMALL_GEOJSON) - 1);
+  Store store;
+  Wal wal;
+  EXPECT(init_store(&store) == STORE_OK);
+  EXPECT(open_wal(&wal, log_path, WAL_SYNC_ALWAYS, 0) == 0);
+  EXPECT(store_replay_wal(&store, &wal) == STORE_OK);
+  store_log_writes(&store, &wal);
+  ImportReport report;
+  EXPECT(store_import(&store, "geo", 3, path, IMPORT_GEOJSON, &report) == STORE_OK);
+  EXPECT(report.records == 6 && report.imported == 4 && report.skipped == 2);
+  expect_small_geojson(&store, arena);
+  EXPECT(close_wal(&wal) == 0);
+  destroy_store(&store);
+
+  EXPECT(init_store(&store) == STORE_OK);
+  EXPECT(open_wal(&wal, log_path, WAL_SYNC_ALWAYS, 0) == 0);
+  EXPECT(store_replay_wal(&store, &wal) == STORE_OK);
+  expect_small_geojson(&store, arena);
+  EXPECT(close_wal(&wal) == 0);
+  destroy_store(&store);
+}
+
+static void test_import_csv(Arena *arena, const char *path) {
+  static const char csv[] = "id,lat,lon,speed,note\n"
+                            "\"a,b\",1.5,2.5,10,\"said \"\"hi\"\"\"\n"
+                            "c,3,4,,x\n"
+                            ",5,6,\"7\",\n";
+  write_file(path, csv, sizeof(csv) - 1);
+  Store store;
+  EXPECT(init_store(&store) == STORE_OK);
+  ImportReport report;
+  EXPECT(store_import(&store, "rows", 4, path, IMPORT_CSV, &report) == STORE_OK);
+  EXPECT(report.records == 3 && report.imported == 3 && report.skipped == 0);
+
+  // statements can't spell an id with a comma, look it up directly.
+  const Collection *rows = store_get_collection(&store, "rows", 4);
+  const Object *quoted = rows != NULL ? collection_get(rows, "a,b", 3) : NULL;
+  EXPECT(quoted != NULL);
+  if (quoted != NULL) {
+    Point p = collection_object_point(rows, quoted);
+    EXPECT(p.y == 1.5 && p.x == 2.5);
+    EXPECT(rows->fields_count >= 1 && strcmp(rows->fields[0].name, "speed") == 0);
+    EXPECT(collection_object_field(rows, quoted, 0) == 10);
+  }
+  EXPECT(has_point(&store, arena, "rows c", 3, 4));
+  EXPECT(isnan(field_of(&store, arena, "rows c", "speed")));
+  EXPECT(isnan(field_of(&store, arena, "rows c", "note"))); // not a number
+  EXPECT(has_point(&store, arena, "rows 3", 5, 6));
+  EXPECT(field_of(&store, arena, "rows 3", "speed") == 7);
+  destroy_store(&store);
+}
+
+static void test_import_malformed(const char *path) {
+  static const char bad[] = "{\"type\": \"FeatureCollection\", \"features\": [\n"
+                            "  {\"type\": \"Feature\", \"id\": \"ok\", \"geometry\": "
+                            "{\"type\": \"Point\", \"coordinates\": [1, 2]}},\n"
+                            "  {\"type\": \"Feature\", \"id\" \"bad\", \"geometry\": "
+                            "{\"type\": \"Point\", \"coordinates\": [3, 4]}}\n"
+                            "]}\n";
+  write_file(path, bad, sizeof(bad) - 1);
+  Store store;
+  EXPECT(init_store(&store) == STORE_OK);
+  ImportReport report;
+  EXPECT(store_import(&store, "geo", 3, path, IMPORT_GEOJSON, &report) == STORE_INVALID_IMPORT);
+  EXPECT(report.error_offset == (size_t)(strstr(bad, "\"id\" \"bad\"") - bad) + 5); // the missing colon
+  // the error is in the only chunk, so nothing was set and the new key is gone again.
+  EXPECT(store_get_collection(&store, "geo", 3) == NULL);
+
+  static const char no_features[] = "{\"type\": \"FeatureCollection\"}";
+  write_file(path, no_features, sizeof(no_features) - 1);
+  EXPECT(store_import(&store, "other", 5, path, IMPORT_GEOJSON, &report) == STORE_INVALID_IMPORT);
+  EXPECT(report.error_offset == sizeof(no_features) - 2);
+  EXPECT(store_get_collection(&store, "other", 5) == NULL);
+
+  static const char truncated[] = "{\"features\": [{\"type\": \"Feature\", \"geometry\": null},";
+  write_file(path, truncated, sizeof(truncated) - 1);
+  EXPECT(store_import(&store, "other", 5, path, IMPORT_GEOJSON, &report) == STORE_INVALID_IMPORT);
+  EXPECT(report.error_offset == sizeof(truncated) - 1);
+  destroy_store(&store);
+}
+
+/*
+ * the first `}` `,` `{` at or after `from`, as the importer guesses where a chunk starts.
+ */
+static const char *next_separator(const char *from, const char *end) {
+  for (const char *p = from; p < end; p++) {
+    const char *q = p + 1;
+    if (*p != '}' || q >= end || *q != ',') {
+      continue;
+    }
+    for (q++; q < end && (*q == ' ' || *q == '\n'); q++) {
+    }
+    if (q < end && *q == '{') {
+      return q;
+    }
+  }
+  return end;
+}
+
+/*
+ * a file of more than one chunk whose second chunk is guessed to start at a `{` nested in the properties of a feature,
+ * so it is parsed again from where the first one stopped.
+ */
+static void test_import_chunks(Arena *arena, const char *path) {
+  const size_t features = IMPORT_CHUNK_SIZE / 500 + 1000;
+  size_t capacity = features * (600 + TAGS_COUNT * 16) + 64;
+  char *contents = malloc(capacity);
+  if (contents == NULL) {
+    EXPECT(!"out of memory");
+    return;
+  }
+  size_t size = (size_t)snprintf(contents, capacity, "{\"type\": \"FeatureCollection\", \"features\": [\n");
+  size_t first = size;
+  for (size_t i = 0; i < features; i++) {
+    size += (size_t)snprintf(contents + size, capacity - size,
+                             "%s{\"type\": \"Feature\", \"id\": \"f%zu\", \"geometry\": {\"type\": \"Point\", "
+                             "\"coordinates\": [%zu.25, %zu.5]}, \"properties\": {\"speed\": %zu, \"tags\": [",
+                             i == 0 ? "" : ",\n", i, i % 180, i % 90, i);
+    for (int t = 0; t < TAGS_COUNT; t++) {
+      size += (size_t)snprintf(contents + size, capacity - size, "%s{\"t\": %d}", t == 0 ? "" : ", ", t);
+    }
+    size += (size_t)snprintf(contents + size, capacity - size, "]}}");
+  }
+  size += (size_t)snprintf(contents + size, capacity - size, "\n]}\n");
+  const char *guess = next_separator(contents + first + IMPORT_CHUNK_SIZE, contents + size);
+  EXPECT(strncmp(guess, "{\"t\"", 4) == 0);
+  write_file(path, contents, size);
+  free(contents);
+
+  ScanPool pool;
+  if (init_scan_pool(&pool, 3, 1) != 0) {
+    EXPECT(!"could not start the scan pool");
+    return;
+  }
+  for (int parallel = 0; parallel < 2; parallel++) {
+    Store store;
+    EXPECT(init_store(&store) == STORE_OK);
+    store_parallel_scans(&store, parallel ? &pool : NULL);
+    ImportReport report;
+    EXPECT(store_import(&store, "big", 3, path, IMPORT_GEOJSON, &report) == STORE_OK);
+    EXPECT(report.records == features && report.imported == features && report.skipped == 0);
+    size_t wrong = 0;
+    for (size_t i = 0; i < features; i++) {
+      char key_id[32];
+      snprintf(key_id, sizeof(key_id), "big f%zu", i);
+      wrong += !has_point(&store, arena, key_id, (double)(i % 90) + 0.5, (double)(i % 180) + 0.25) ||
+               field_of(&store, arena, key_id, "speed") != (double)i;
+    }
+    EXPECT(wrong == 0);
+    destroy_store(&store);
+  }
+  destroy_scan_pool(&pool);
+}
+
+void test_import(void) {
+  Arena arena;
+  if (init_arena(&arena, 0) != 0) {
+    EXPECT(!"out of memory");
+    return;
+  }
+  char path[PATH_SIZE];
+  char log_path[PATH_SIZE];
+  temporary_path(path, sizeof(path), "import");
+  temporary_path(log_path, sizeof(log_path), "import.log");
+
+  test_import_geojson(&arena, path, log_path);
+  test_import_csv(&arena, path);
+  test_import_malformed(path);
+  test_import_chunks(&arena, path);
+
+  unlink(path);
+  unlink(log_path);
+  destroy_arena(&arena);
+}
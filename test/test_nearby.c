@@ -0,0 +1,140 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "scan_pool.h"
+#include "testing_utils.h"
+
+#define POINTS_COUNT 3000
+#define QUERIES_COUNT 60
+
+typedef struct {
+  double *distances;
+  size_t count;
+} Found;
+
+static int record_distance(const Object *object, double distance, void *user_data) {
+  (void)object;
+  Found *found = user_data;
+  found->distances[found->count++] = distance;
+  return 0;
+}
+
+static int compare_distances(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+static bool near_equal(double a, double b) {
+  return fabs(a - b) <= fmax(fmax(a, b) * 1e-11, 1e-8);
+}
+
+/*
+ * a position spread over the whole earth, or squeezed against the antimeridian or a pole where lat/lon boxes are the
+ * most misleading, as it reads back from 7 decimals.
+ */
+static Point random_position(int kind) {
+  Point p = { .x = test_random() * 360 - 180, .y = test_random() * 180 - 90 };
+  if (kind == 1) {
+    p.x = test_random() < 0.5 ? 179.5 + test_random() * 0.5 : -180 + test_random() * 0.5;
+    p.y = (test_random() - 0.5) * 2;
+  } else if (kind == 2) {
+    p.y = 84 + test_random() * 6;
+  }
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), "%.7f %.7f", p.y, p.x);
+  sscanf(buffer, "%lf %lf", &p.y, &p.x);
+  return p;
+}
+
+/*
+ * runs `NEARBY fleet [LIMIT limit] POINT q [max_distance]` and checks that it yields the objects a brute force scan
+ * finds, nearest first: the same number and the same distances in the same order.
+ */
+static void expect_nearby(Store *store, Arena *arena, const Point *points, const Point *q, size_t limit,
+                          double max_distance, double *expected, Found *found) {
+  char statement[160];
+  int used = snprintf(statement, sizeof(statement), "NEARBY fleet ");
+  if (limit != 0) {
+    used += snprintf(statement + used, sizeof(statement) - used, "LIMIT %zu ", limit);
+  }
+  used += snprintf(statement + used, sizeof(statement) - used, "POINT %.7f %.7f", q->y, q->x);
+  if (max_distance < INFINITY) {
+    snprintf(statement + used, sizeof(statement) - used, " %.1f", max_distance);
+  }
+
+  size_t expected_count = 0;
+  for (size_t i = 0; i < POINTS_COUNT; i++) {
+    double d = point_distance_meters(q, &points[i]);
+    if (d <= max_distance) {
+      expected[expected_count++] = d;
+    }
+  }
+  qsort(expected, expected_count, sizeof(double), compare_distances);
+  if (limit != 0 && limit < expected_count) {
+    expected_count = limit;
+  }
+
+  found->count = 0;
+  ExecuteResult result = { .on_object = record_distance, .user_data = found };
+  EXPECT(run_statement(store, arena, statement, &result) == STORE_OK);
+  size_t mismatches = found->count == expected_count ? 0 : 1;
+  for (size_t i = 0; i < found->count && i < expected_count; i++) {
+    mismatches += !near_equal(found->distances[i], expected[i]);
+  }
+  if (mismatches != 0) {
+    printf("[FAILED] %s: %zu of %zu objects differ from a brute force scan (%zu found)\n", statement, mismatches,
+           expected_count, found->count);
+    tests_failed++;
+  }
+}
+
+static void run_queries(Store *store, Arena *arena, const Point *points, double *expected, Found *found) {
+  for (int i = 0; i < QUERIES_COUNT; i++) {
+    Point q = random_position(i % 3);
+    expect_nearby(store, arena, points, &q, 0, INFINITY, expected, found);
+    expect_nearby(store, arena, points, &q, 10, INFINITY, expected, found);
+    expect_nearby(store, arena, points, &q, 0, 50000 + test_random() * 2000000, expected, found);
+    expect_nearby(store, arena, points, &q, 25, 50000 + test_random() * 2000000, expected, found);
+  }
+}
+
+void test_nearby(void) {
+  Arena arena;
+  Store store;
+  ScanPool pool;
+  Point *points = malloc(sizeof(Point) * POINTS_COUNT);
+  double *expected = malloc(sizeof(double) * POINTS_COUNT);
+  Found found = { .distances = malloc(sizeof(double) * POINTS_COUNT) };
+  if (init_arena(&arena, 0) != 0 || init_store(&store) != STORE_OK || points == NULL || expected == NULL ||
+      found.distances == NULL) {
+    EXPECT(!"out of memory");
+    return;
+  }
+
+  ExecuteResult result = { 0 };
+  for (size_t i = 0; i < POINTS_COUNT; i++) {
+    points[i] = random_position(i % 3);
+    char statement[96];
+    snprintf(statement, sizeof(statement), "SET fleet %zu POINT %.7f %.7f", i, points[i].y, points[i].x);
+    EXPECT(run_statement(&store, &arena, statement, &result) == STORE_OK);
+  }
+  run_queries(&store, &arena, points, expected, &found);
+
+  // split across workers, every subtree merged back nearest first.
+  if (init_scan_pool(&pool, 3, 1) == 0) {
+    store_parallel_scans(&store, &pool);
+    run_queries(&store, &arena, points, expected, &found);
+    store_parallel_scans(&store, NULL);
+    destroy_scan_pool(&pool);
+  } else {
+    EXPECT(!"could not start the scan pool");
+  }
+
+  destroy_store(&store);
+  destroy_arena(&arena);
+  free(found.distances);
+  free(expected);
+  free(points);
+}
@@ -0,0 +1,130 @@
+#include <math.h>
+#include <string.h>
+
+#include "parse.h"
+#include "testing_utils.h"
+
+static bool span_equals(Span span, const char *expected) {
+  return span.length == strlen(expected) && memcmp(span.start, expected, span.length) == 0;
+}
+
+static int parse(const char *statement, PreparedStatement *prepared_statement, Arena *arena) {
+  arena_reset(arena);
+  return make_prepared_statement(statement, prepared_statement, arena, NULL);
+}
+
+static void test_parse_set(Arena *arena) {
+  PreparedStatement ps;
+  EXPECT(parse("SET fleet truck1 POINT 33.5 -112.25", &ps, arena) == 0);
+  EXPECT(ps.command_type == SET);
+  EXPECT(span_equals(ps.key, "fleet"));
+  EXPECT(span_equals(ps.id, "truck1"));
+  EXPECT(ps.geometry.type == GEOMETRY_POINT);
+  EXPECT(ps.geometry.point.y == 33.5 && ps.geometry.point.x == -112.25);
+  EXPECT(!ps.geometry.point.has_z);
+
+  EXPECT(parse("SET fleet 2 POINT +1 -2.0 3e2", &ps, arena) == 0);
+  EXPECT(ps.geometry.point.has_z && ps.geometry.point.z == 300);
+
+  EXPECT(parse("SET fleet b1 FIELD speed 12.5 EX 30 BOUNDS 0 0 0 1 1 1 0 0", &ps, arena) == 0);
+  EXPECT(ps.geometry.type == GEOMETRY_LINE_STRING);
+  EXPECT(ps.geometry.line_string.points_count == 4 && ps.geometry.line_string.is_closed);
+  EXPECT(ps.fields_count == 1 && span_equals(ps.fields[0].name, "speed") && ps.fields[0].value == 12.5);
+  EXPECT(ps.expire_seconds == 30);
+
+  // numbers are converted exactly, without strtod.
+  EXPECT(parse("SET fleet 1 POINT 0.1 -179.9999999", &ps, arena) == 0);
+  EXPECT(ps.geometry.point.y == 0.1 && ps.geometry.point.x == -179.9999999);
+
+  // latin-1 superscripts (and utf-8 bytes that look like them) are not digits.
+  EXPECT(parse("SET fleet 1 POINT \xb2 1", &ps, arena) != 0);
+  EXPECT(parse("SET fleet 1 POINT 1\xb3 1", &ps, arena) != 0);
+  EXPECT(parse("SET fleet 1 POINT 1 2.\xb9", &ps, arena) != 0);
+}
+
+static void test_parse_queries(Arena *arena) {
+  PreparedStatement ps;
+  EXPECT(parse("NEARBY fleet LIMIT 5 WHERE speed 0 +inf POINT 33 -112 1000", &ps, arena) == 0);
+  EXPECT(ps.command_type == NEARBY);
+  EXPECT(ps.limit == 5 && ps.distance == 1000);
+  EXPECT(ps.wheres_count == 1 && isinf(ps.wheres[0].max));
+
+  EXPECT(parse("NEARBY fleet POINT 33 -112", &ps, arena) == 0);
+  EXPECT(ps.limit == 0 && isinf(ps.distance));
+
+  EXPECT(parse("WITHIN fleet BOUNDS 0 0 0 1 1 1 0 0", &ps, arena) == 0);
+  EXPECT(ps.command_type == WITHIN);
+
+  EXPECT(parse("SETCHAN zone NEARBY fleet FENCE POINT 33 -112 500", &ps, arena) == 0);
+  EXPECT(ps.command_type == SETCHAN && ps.fence_command == NEARBY && span_equals(ps.channel, "zone"));
+
+  EXPECT(parse("GET fleet truck1 WITHFIELDS", &ps, arena) == 0);
+  EXPECT(ps.command_type == GET && ps.with_fields);
+
+  EXPECT(parse("DEL fleet truck1", &ps, arena) == 0);
+  EXPECT(ps.command_type == DELETE);
+}
+
+static void test_parse_errors(Arena *arena) {
+  PreparedStatement ps;
+  EXPECT(parse("PUT fleet 1 POINT 1 2", &ps, arena) != 0);
+  EXPECT(parse("SET fleet 1 POINT 1", &ps, arena) != 0);
+  EXPECT(parse("SET fleet 1 POINT 1 2 3 4", &ps, arena) != 0);
+  EXPECT(parse("SET fleet 1 BOUNDS 0 0 0 1 1 1 1 0", &ps, arena) != 0); // not closed
+  EXPECT(parse("NEARBY fleet POINT 1 2 -5", &ps, arena) != 0);
+  EXPECT(parse("SET fleet 1 POINT 1.2.3 2", &ps, arena) != 0);
+}
+
+static void test_parse_placeholders(Arena *arena) {
+  PreparedStatement ps;
+  EXPECT(parse("SET fleet ? POINT ? ?", &ps, arena) == 0);
+  EXPECT(ps.parameters_count == 3 && ps.unbound_count == 3);
+  EXPECT(bind_span(&ps, 0, "truck9", 6) == 0);
+  EXPECT(bind_double(&ps, 1, 45) == 0);
+  EXPECT(bind_double(&ps, 2, 7) == 0);
+  EXPECT(ps.unbound_count == 0);
+  EXPECT(span_equals(ps.id, "truck9") && ps.geometry.point.y == 45 && ps.geometry.point.x == 7);
+  EXPECT(bind_double(&ps, 3, 1) != 0);
+  reset_prepared_statement(&ps);
+  EXPECT(ps.unbound_count == 3);
+}
+
+static void test_parse_batch(Arena *arena) {
+  const char *batch = "SET fleet 1 POINT 1 2\nGET fleet 1\nDEL fleet 1";
+  const char *next = batch;
+  CommandType expected[] = { SET, GET, DELETE };
+  for (size_t i = 0; i < 3; i++) {
+    PreparedStatement ps;
+    arena_reset(arena);
+    EXPECT(make_next_prepared_statement(next, &next, &ps, arena, NULL) == 0);
+    EXPECT(ps.command_type == expected[i]);
+  }
+  EXPECT(*next == '\0');
+
+  // statements failing on their first token, part way and at their end are skipped whole, quotes don't span lines.
+  const char *failing = "BOGUS 1 2\nSET fleet 1 POINT x 2\nGET 'fleet\nSET fleet 1 POINT 1\nDEL fleet 1\n";
+  const char *starts[] = { failing, strstr(failing, "SET"), strstr(failing, "GET"),
+                           strstr(failing, "SET fleet 1 POINT 1\n"), strstr(failing, "DEL") };
+  next = failing;
+  for (size_t i = 0; i < 5; i++) {
+    PreparedStatement ps;
+    arena_reset(arena);
+    EXPECT(next == starts[i]);
+    EXPECT((make_next_prepared_statement(next, &next, &ps, arena, NULL) == 0) == (i == 4));
+  }
+  EXPECT(*next == '\0');
+}
+
+void test_parse(void) {
+  Arena arena;
+  if (init_arena(&arena, 0) != 0) {
+    EXPECT(!"out of memory");
+    return;
+  }
+  test_parse_set(&arena);
+  test_parse_queries(&arena);
+  test_parse_errors(&arena);
+  test_parse_placeholders(&arena);
+  test_parse_batch(&arena);
+  destroy_arena(&arena);
+}
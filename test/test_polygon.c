@@ -0,0 +1,140 @@
+#include <math.h>
+#include <stdio.h>
+
+#include "polygon.h"
+#include "testing_utils.h"
+
+#define RING_CAPACITY 256
+
+typedef struct {
+  Point points[RING_CAPACITY];
+  size_t count;
+} Ring;
+
+static void add_point(Ring *ring, double x, double y) {
+  ring->points[ring->count++] = (Point){ .x = x, .y = y };
+}
+
+/*
+ * prepares `ring` after closing it. Every polygon built by the tests must be destroyed.
+ */
+static Polygon make_polygon(Ring *ring) {
+  ring->points[ring->count] = ring->points[0];
+  LineString ls = { .points = ring->points, .points_count = ring->count + 1, .is_closed = true };
+  Polygon polygon;
+  if (init_polygon(&polygon, &ls) != 0) {
+    EXPECT(!"out of memory");
+  }
+  return polygon;
+}
+
+static Polygon box_polygon(double min_x, double min_y, double max_x, double max_y) {
+  Ring ring = { .count = 0 };
+  add_point(&ring, min_x, min_y);
+  add_point(&ring, max_x, min_y);
+  add_point(&ring, max_x, max_y);
+  add_point(&ring, min_x, max_y);
+  return make_polygon(&ring);
+}
+
+/*
+ * the boundary counts as inside: equal rings and rings along the edges are contained, an edge leaving the ring through
+ * one of its vertices is not.
+ */
+static void test_boundary(void) {
+  Polygon square = box_polygon(0, 0, 3, 3);
+  Polygon left_half = box_polygon(0, 0, 1.5, 3);
+  Polygon inside = box_polygon(1, 1, 2, 2);
+  Polygon across = box_polygon(2, 1, 4, 2);
+  EXPECT(polygon_contains_polygon(&square, &square));
+  EXPECT(polygon_contains_polygon(&square, &left_half));
+  EXPECT(polygon_contains_polygon(&square, &inside));
+  EXPECT(!polygon_contains_polygon(&square, &across));
+  EXPECT(!polygon_contains_polygon(&inside, &square));
+  EXPECT(polygons_intersect(&square, &across));
+
+  // a U open at the top: its box touches the U at every corner but bridges the gap.
+  Ring u = { .count = 0 };
+  add_point(&u, 0, 0);
+  add_point(&u, 3, 0);
+  add_point(&u, 3, 3);
+  add_point(&u, 2, 3);
+  add_point(&u, 2, 1);
+  add_point(&u, 1, 1);
+  add_point(&u, 1, 3);
+  add_point(&u, 0, 3);
+  Polygon u_shape = make_polygon(&u);
+  Polygon bottom = box_polygon(0, 0, 3, 1);
+  Polygon gap = box_polygon(1, 1, 2, 3);
+  EXPECT(polygon_contains_polygon(&u_shape, &u_shape));
+  EXPECT(!polygon_contains_polygon(&u_shape, &square));
+  EXPECT(polygon_contains_polygon(&u_shape, &bottom));
+  EXPECT(!polygon_contains_polygon(&u_shape, &gap));
+  EXPECT(polygon_contains_polygon(&square, &u_shape));
+
+  Polygon *polygons[] = { &square, &left_half, &inside, &across, &u_shape, &bottom, &gap };
+  for (size_t i = 0; i < sizeof(polygons) / sizeof(polygons[0]); i++) {
+    destroy_polygon(polygons[i]);
+  }
+}
+
+/*
+ * rings large enough for y buckets answer like they do without them, for random triangles around their boundary.
+ */
+static void test_buckets(void) {
+  // a circle, and a square whose sides are cut into many (horizontal and vertical) edges.
+  Ring circle_ring = { .count = 0 };
+  Ring square_ring = { .count = 0 };
+  for (int i = 0; i < 120; i++) {
+    double angle = 2 * M_PI * i / 120;
+    add_point(&circle_ring, 10 * cos(angle), 10 * sin(angle));
+  }
+  for (int side = 0; side < 4; side++) {
+    for (int i = 0; i < 25; i++) {
+      double s = -10 + 20.0 * i / 25;
+      double x = side == 0 ? s : side == 1 ? 10 : side == 2 ? -s : -10;
+      double y = side == 0 ? -10 : side == 1 ? s : side == 2 ? 10 : -s;
+      add_point(&square_ring, x, y);
+    }
+  }
+  Polygon rings[] = { make_polygon(&circle_ring), make_polygon(&square_ring) };
+
+  size_t differences = 0;
+  for (size_t r = 0; r < 2; r++) {
+    Polygon *ring = &rings[r];
+    EXPECT(ring->buckets_count > 0);
+    EXPECT(polygon_contains_polygon(ring, ring));
+    Polygon flat = *ring;
+    flat.buckets_count = 0;
+
+    for (int i = 0; i < 2000; i++) {
+      Ring triangle = { .count = 0 };
+      double x = (test_random() - 0.5) * 24;
+      double y = (test_random() - 0.5) * 24;
+      add_point(&triangle, x, y);
+      add_point(&triangle, x + test_random() * 4, y);
+      add_point(&triangle, x, y + test_random() * 4);
+      Polygon small = make_polygon(&triangle);
+      differences += polygon_contains_polygon(ring, &small) != polygon_contains_polygon(&flat, &small);
+      differences += polygons_intersect(ring, &small) != polygons_intersect(&flat, &small);
+      differences += polygons_intersect(&small, ring) != polygons_intersect(&small, &flat);
+      destroy_polygon(&small);
+    }
+  }
+  EXPECT(differences == 0);
+
+  // along the edges of the many edged square, touching it from inside, and out again.
+  Polygon half = box_polygon(-10, -10, 0, 10);
+  Polygon beyond = box_polygon(-10, -10, 0, 10.5);
+  EXPECT(polygon_contains_polygon(&rings[1], &half));
+  EXPECT(!polygon_contains_polygon(&rings[1], &beyond));
+  destroy_polygon(&half);
+  destroy_polygon(&beyond);
+  destroy_polygon(&rings[0]);
+  destroy_polygon(&rings[1]);
+}
+
+void test_polygon(void) {
+  test_boundary();
+  test_buckets();
+}
@@ -0,0 +1,193 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "parse.h"
+#include "resp.h"
+#include "testing_utils.h"
+
+static bool span_equals(Span span, const char *expected, size_t expected_length) {
+  return span.length == expected_length && memcmp(span.start, expected, expected_length) == 0;
+}
+
+/*
+ * true when `statement` has the words of `expected`, however many spaces separate them: a rewritten array keeps a
+ * space for every byte of the framing it overwrote.
+ */
+static bool words_equal(const char *statement, const char *expected) {
+  for (;;) {
+    while (*statement == ' ') {
+      statement++;
+    }
+    while (*expected == ' ') {
+      expected++;
+    }
+    if (*statement == '\0' || *expected == '\0') {
+      return *statement == *expected;
+    }
+    while (*statement != ' ' && *statement != '\0' && *statement == *expected) {
+      statement++;
+      expected++;
+    }
+    if ((*statement != ' ' && *statement != '\0') || (*expected != ' ' && *expected != '\0')) {
+      return false;
+    }
+  }
+}
+
+// three requests sent back to back: an array, an array with an empty argument and an inline command.
+static const char PIPELINE[] = "*6\r\n$3\r\nSET\r\n$5\r\nfleet\r\n$2\r\nt1\r\n$5\r\nPOINT\r\n$2\r\n33\r\n$4\r\n-112\r\n"
+                               "*3\r\n$3\r\nGET\r\n$5\r\nfleet\r\n$0\r\n\r\n"
+                               "PING hello\r\n";
+static const char *PIPELINE_STATEMENTS[] = { "SET fleet t1 POINT 33 -112", "GET fleet ?", "PING hello" };
+#define PIPELINE_REQUESTS 3
+
+/*
+ * frames the requests of `buffer[*offset, length)` until one is incomplete, checking each against the next of
+ * PIPELINE_STATEMENTS. returns false when a request was framed wrong.
+ */
+static bool frame_pipeline(char *buffer, size_t length, size_t *offset, size_t *framed, Arena *arena) {
+  for (;;) {
+    RespRequest request;
+    size_t consumed = 0;
+    RespFrame frame = resp_next_request(buffer + *offset, length - *offset, arena, &request, &consumed);
+    if (frame == RESP_INCOMPLETE) {
+      return true;
+    }
+    if (frame != RESP_REQUEST || *framed == PIPELINE_REQUESTS ||
+        !words_equal(request.statement, PIPELINE_STATEMENTS[*framed])) {
+      return false;
+    }
+    if (*framed == 1 && (request.parameters_count != 1 || request.parameters[0].length != 0)) {
+      return false;
+    }
+    *offset += consumed;
+    (*framed)++;
+  }
+}
+
+/*
+ * whatever byte the pipeline is cut at, the requests before the cut are framed, the one it falls in reports
+ * RESP_INCOMPLETE without the buffer being touched, and framing it again once the rest arrived gives the same requests.
+ */
+static void test_resp_split_pipeline(Arena *arena) {
+  const size_t length = sizeof(PIPELINE) - 1;
+  char *buffer = malloc(length);
+  if (buffer == NULL) {
+    EXPECT(!"out of memory");
+    return;
+  }
+  size_t wrong = 0;
+  for (size_t cut = 0; cut <= length; cut++) {
+    arena_reset(arena);
+    memcpy(buffer, PIPELINE, cut);
+    size_t offset = 0;
+    size_t framed = 0;
+    wrong += !frame_pipeline(buffer, cut, &offset, &framed, arena);
+    wrong += memcmp(buffer + offset, PIPELINE + offset, cut - offset) != 0;
+    memcpy(buffer + cut, PIPELINE + cut, length - cut);
+    wrong += !frame_pipeline(buffer, length, &offset, &framed, arena);
+    wrong += framed != PIPELINE_REQUESTS || offset != length;
+  }
+  EXPECT(wrong == 0);
+  free(buffer);
+}
+
+/*
+ * arguments the statement tokenizer would not read back as they are become bound placeholders, every byte kept.
+ */
+static void test_resp_placeholders(Arena *arena) {
+  static const char arguments[][8] = { "", "a b", "x\ny", "\"q", "?", "t\tab" };
+  char buffer[] = "*7\r\n$5\r\nWORDS\r\n$0\r\n\r\n$3\r\na b\r\n$3\r\nx\ny\r\n$2\r\n\"q\r\n$1\r\n?\r\n"
+                  "$4\r\nt\tab\r\n";
+  size_t length = strlen(buffer);
+  RespRequest request;
+  size_t consumed;
+  arena_reset(arena);
+  EXPECT(resp_next_request(buffer, length, arena, &request, &consumed) == RESP_REQUEST);
+  EXPECT(consumed == length && request.arguments_count == 7);
+  EXPECT(words_equal(request.statement, "WORDS ? ? ? ? ? ?"));
+  EXPECT(request.parameters_count == 6);
+  for (size_t i = 0; i < request.parameters_count && i < 6; i++) {
+    EXPECT(span_equals(request.parameters[i], arguments[i], strlen(arguments[i])));
+  }
+  EXPECT(span_equals(request.argument, "", 0));
+
+  // the placeholders bind like those of a typed statement.
+  char set[] = "*6\r\n$3\r\nSET\r\n$5\r\nfleet\r\n$7\r\ntruck 1\r\n$5\r\nPOINT\r\n$1\r\n1\r\n$1\r\n2\r\n";
+  arena_reset(arena);
+  EXPECT(resp_next_request(set, strlen(set), arena, &request, &consumed) == RESP_REQUEST);
+  PreparedStatement ps;
+  EXPECT(make_prepared_statement(request.statement, &ps, arena, NULL) == 0);
+  EXPECT(ps.parameters_count == 1 && request.parameters_count == 1);
+  EXPECT(bind_span(&ps, 0, request.parameters[0].start, request.parameters[0].length) == 0);
+  EXPECT(span_equals(ps.id, "truck 1", 7) && ps.geometry.point.y == 1 && ps.geometry.point.x == 2);
+}
+
+static void test_resp_inline(Arena *arena) {
+  RespRequest request;
+  size_t consumed;
+  char get[] = "GET fleet t1\r\nNEARBY";
+  size_t length = strlen(get);
+  EXPECT(resp_next_request(get, length, arena, &request, &consumed) == RESP_REQUEST);
+  EXPECT(consumed == 14 && strcmp(request.statement, "GET fleet t1") == 0);
+  EXPECT(request.arguments_count == 3 && span_equals(request.name, "GET", 3) &&
+         span_equals(request.argument, "fleet", 5));
+  // the next request has no newline yet.
+  EXPECT(resp_next_request(get + 14, length - 14, arena, &request, &consumed) == RESP_INCOMPLETE);
+
+  char blank[] = "  \n";
+  EXPECT(resp_next_request(blank, strlen(blank), arena, &request, &consumed) == RESP_REQUEST);
+  EXPECT(consumed == 3 && request.arguments_count == 0 && request.name.length == 0);
+
+  // a line that never ends is refused once it is longer than any request can be.
+  char *endless = malloc(RESP_MAX_INLINE_LENGTH);
+  if (endless != NULL) {
+    memset(endless, 'a', RESP_MAX_INLINE_LENGTH);
+    EXPECT(resp_next_request(endless, RESP_MAX_INLINE_LENGTH - 1, arena, &request, &consumed) == RESP_INCOMPLETE);
+    EXPECT(resp_next_request(endless, RESP_MAX_INLINE_LENGTH, arena, &request, &consumed) == RESP_PROTOCOL_ERROR);
+    free(endless);
+  }
+}
+
+static void test_resp_protocol_errors(Arena *arena) {
+  static const char *errors[] = {
+    "*x\r\n",                              // no count
+    "*1\n$3\r\nGET\r\n",                   // bare newline
+    "*2\r\n$3\r\nGET\r\n:5\r\n",           // not a bulk string
+    "*1\r\n$3\r\nGETS\r\n",                // longer than its length
+    "*1\r\n$-5\r\n",                       // negative length
+    "*1\r\n$99999999999999999999\r\n",     // too many digits
+    "*2000000\r\n",                        // too many arguments
+    "*1\r\n$600000000\r\n",                // too long
+  };
+  size_t wrong = 0;
+  for (size_t i = 0; i < sizeof(errors) / sizeof(errors[0]); i++) {
+    char buffer[64];
+    size_t length = strlen(errors[i]);
+    memcpy(buffer, errors[i], length);
+    RespRequest request;
+    size_t consumed;
+    wrong += resp_next_request(buffer, length, arena, &request, &consumed) != RESP_PROTOCOL_ERROR;
+  }
+  EXPECT(wrong == 0);
+
+  // a null array is an empty request.
+  char null_array[] = "*-1\r\n";
+  RespRequest request;
+  size_t consumed;
+  EXPECT(resp_next_request(null_array, 5, arena, &request, &consumed) == RESP_REQUEST);
+  EXPECT(consumed == 5 && request.arguments_count == 0);
+}
+
+void test_resp(void) {
+  Arena arena;
+  if (init_arena(&arena, 0) != 0) {
+    EXPECT(!"out of memory");
+    return;
+  }
+  test_resp_split_pipeline(&arena);
+  test_resp_placeholders(&arena);
+  test_resp_inline(&arena);
+  test_resp_protocol_errors(&arena);
+  destroy_arena(&arena);
+}
@@ -0,0 +1,222 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rtree.h"
+#include "testing_utils.h"
+
+#define ITEMS_COUNT 2000
+
+typedef struct {
+  Rect rects[ITEMS_COUNT];
+  bool present[ITEMS_COUNT];
+} Items;
+
+typedef struct {
+  const Items *items;
+  size_t found[ITEMS_COUNT];
+  size_t found_count;
+  bool unexpected; // an item reported with the wrong rect, or not present
+} SearchState;
+
+typedef struct {
+  double x;
+  double y;
+  double distances[ITEMS_COUNT];
+  size_t count;
+  size_t limit;
+} NearbyState;
+
+static Rect random_rect(void) {
+  double x = test_random() * 100;
+  double y = test_random() * 100;
+  return (Rect){ .min_x = x, .min_y = y, .max_x = x + test_random(), .max_y = y + test_random() };
+}
+
+static int collect(uint32_t item, const Rect *rect, void *user_data) {
+  SearchState *state = user_data;
+  if (item >= ITEMS_COUNT || !state->items->present[item] ||
+      memcmp(rect, &state->items->rects[item], sizeof(Rect)) != 0) {
+    state->unexpected = true;
+    return 0;
+  }
+  state->found[state->found_count++] = item;
+  return 0;
+}
+
+static int compare_items(const void *a, const void *b) {
+  size_t x = *(const size_t *)a;
+  size_t y = *(const size_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+/*
+ * every present item intersecting `query` is found exactly once, and nothing else.
+ */
+static void expect_search(const RTree *tree, const Items *items, const Rect *query) {
+  SearchState *state = calloc(1, sizeof(SearchState));
+  state->items = items;
+  EXPECT(rtree_search(tree, query, collect, state) == 0);
+  EXPECT(!state->unexpected);
+  qsort(state->found, state->found_count, sizeof(size_t), compare_items);
+
+  size_t expected = 0;
+  bool matches = true;
+  for (size_t i = 0; i < ITEMS_COUNT; i++) {
+    if (!items->present[i] || !rects_intersect(&items->rects[i], query)) {
+      continue;
+    }
+    if (expected >= state->found_count || state->found[expected] != i) {
+      matches = false;
+    }
+    expected++;
+  }
+  EXPECT(matches && expected == state->found_count);
+  free(state);
+}
+
+static double rect_distance(double x, double y, double min_x, double min_y, double max_x, double max_y) {
+  double dx = x < min_x ? min_x - x : (x > max_x ? x - max_x : 0);
+  double dy = y < min_y ? min_y - y : (y > max_y ? y - max_y : 0);
+  return sqrt(dx * dx + dy * dy);
+}
+
+static void planar_distances(const RTreeNode *node, double *distances, void *user_data) {
+  const NearbyState *state = user_data;
+  for (int i = 0; i < node->count; i++) {
+    distances[i] = rect_distance(state->x, state->y, node->min_x[i], node->min_y[i], node->max_x[i], node->max_y[i]);
+  }
+}
+
+static int record_distance(uint32_t item, double distance, void *user_data) {
+  (void)item;
+  NearbyState *state = user_data;
+  state->distances[state->count++] = distance;
+  return state->count == state->limit;
+}
+
+static int compare_distances(const void *a, const void *b) {
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return x < y ? -1 : x > y;
+}
+
+/*
+ * the `limit` nearest items come out in increasing distance and are the nearest ones of a brute force scan.
+ */
+static void expect_nearby(const RTree *tree, const Items *items, size_t limit) {
+  NearbyState *state = calloc(1, sizeof(NearbyState));
+  state->x = test_random() * 100;
+  state->y = test_random() * 100;
+  state->limit = limit;
+  EXPECT(rtree_nearby(tree, planar_distances, record_distance, state) == 0);
+
+  double *expected = malloc(sizeof(double) * ITEMS_COUNT);
+  size_t expected_count = 0;
+  for (size_t i = 0; i < ITEMS_COUNT; i++) {
+    if (items->present[i]) {
+      const Rect *r = &items->rects[i];
+      expected[expected_count++] = rect_distance(state->x, state->y, r->min_x, r->min_y, r->max_x, r->max_y);
+    }
+  }
+  qsort(expected, expected_count, sizeof(double), compare_distances);
+
+  size_t wanted = limit < expected_count ? limit : expected_count;
+  EXPECT(state->count == wanted);
+  bool matches = true;
+  for (size_t i = 0; i < state->count && i < wanted; i++) {
+    matches = matches && state->distances[i] == expected[i];
+  }
+  EXPECT(matches);
+  free(expected);
+  free(state);
+}
+
+static void test_insert_remove(Items *items) {
+  RTree tree;
+  EXPECT(init_rtree(&tree) == 0);
+  for (uint32_t i = 0; i < ITEMS_COUNT; i++) {
+    items->rects[i] = random_rect();
+    items->present[i] = true;
+    EXPECT(rtree_insert(&tree, &items->rects[i], i) == 0);
+  }
+  EXPECT(tree.items_count == ITEMS_COUNT);
+  for (size_t i = 0; i < 20; i++) {
+    Rect query = random_rect();
+    query.max_x += 10;
+    query.max_y += 10;
+    expect_search(&tree, items, &query);
+  }
+  expect_nearby(&tree, items, 10);
+  expect_nearby(&tree, items, ITEMS_COUNT);
+
+  // removing an item that isn't there fails and changes nothing.
+  Rect elsewhere = { .min_x = -5, .min_y = -5, .max_x = -4, .max_y = -4 };
+  EXPECT(rtree_remove(&tree, &elsewhere, 0) != 0);
+
+  for (uint32_t i = 0; i < ITEMS_COUNT; i += 2) {
+    EXPECT(rtree_remove(&tree, &items->rects[i], i) == 0);
+    items->present[i] = false;
+  }
+  EXPECT(tree.items_count == ITEMS_COUNT / 2);
+  Rect everything = { .min_x = 0, .min_y = 0, .max_x = 101, .max_y = 101 };
+  expect_search(&tree, items, &everything);
+  expect_nearby(&tree, items, 25);
+
+  // moves that stay inside their leaf and ones that don't.
+  for (uint32_t i = 1; i < ITEMS_COUNT; i += 2) {
+    Rect moved = items->rects[i];
+    double shift = i % 4 == 1 ? 1e-9 : test_random() * 50;
+    moved.min_x += shift;
+    moved.max_x += shift;
+    EXPECT(rtree_update(&tree, &items->rects[i], &moved, i) == 0);
+    items->rects[i] = moved;
+  }
+  everything.max_x = 200;
+  expect_search(&tree, items, &everything);
+  expect_nearby(&tree, items, ITEMS_COUNT);
+
+  for (uint32_t i = 1; i < ITEMS_COUNT; i += 2) {
+    EXPECT(rtree_remove(&tree, &items->rects[i], i) == 0);
+    items->present[i] = false;
+  }
+  EXPECT(tree.items_count == 0);
+  expect_search(&tree, items, &everything);
+  destroy_rtree(&tree);
+}
+
+static void test_bulk_load(Items *items) {
+  Rect *rects = malloc(sizeof(Rect) * ITEMS_COUNT);
+  uint32_t *values = malloc(sizeof(uint32_t) * ITEMS_COUNT);
+  for (uint32_t i = 0; i < ITEMS_COUNT; i++) {
+    items->rects[i] = rects[i] = random_rect();
+    items->present[i] = true;
+    values[i] = i;
+  }
+  RTree tree;
+  EXPECT(init_rtree(&tree) == 0);
+  EXPECT(rtree_bulk_load(&tree, rects, values, ITEMS_COUNT) == 0);
+  EXPECT(tree.items_count == ITEMS_COUNT);
+  EXPECT(rtree_bulk_load(&tree, rects, values, ITEMS_COUNT) != 0); // not empty
+  Rect query = { .min_x = 20, .min_y = 30, .max_x = 45, .max_y = 50 };
+  expect_search(&tree, items, &query);
+  expect_nearby(&tree, items, 50);
+
+  // a bulk loaded tree takes inserts and removes like any other.
+  for (uint32_t i = 0; i < ITEMS_COUNT; i += 3) {
+    EXPECT(rtree_remove(&tree, &items->rects[i], i) == 0);
+    items->present[i] = false;
+  }
+  expect_search(&tree, items, &query);
+  expect_nearby(&tree, items, ITEMS_COUNT);
+  destroy_rtree(&tree);
+  free(values);
+  free(rects);
+}
+
+void test_rtree(void) {
+  Items *items = calloc(1, sizeof(Items));
+  test_insert_remove(items);
+  test_bulk_load(items);
+  free(items);
+}
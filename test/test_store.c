@@ -0,0 +1,308 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "snapshot.h"
+#include "testing_utils.h"
+#include "wal.h"
+
+#define PATH_SIZE 256
+
+static bool has_point(Store *store, Arena *arena, const char *key_id, double lat, double lon) {
+  char statement[128];
+  snprintf(statement, sizeof(statement), "GET %s", key_id);
+  ExecuteResult result = { 0 };
+  if (run_statement(store, arena, statement, &result) != STORE_OK || result.object == NULL) {
+    return false;
+  }
+  Point p = collection_object_point(result.collection, result.object);
+  return p.y == lat && p.x == lon;
+}
+
+static bool is_missing(Store *store, Arena *arena, const char *key_id) {
+  char statement[128];
+  snprintf(statement, sizeof(statement), "GET %s", key_id);
+  ExecuteResult result = { 0 };
+  int rc = run_statement(store, arena, statement, &result);
+  return rc == STORE_ID_NOT_FOUND || rc == STORE_KEY_NOT_FOUND;
+}
+
+static double field_of(Store *store, Arena *arena, const char *key_id, const char *name) {
+  char statement[128];
+  snprintf(statement, sizeof(statement), "GET %s WITHFIELDS", key_id);
+  ExecuteResult result = { 0 };
+  if (run_statement(store, arena, statement, &result) != STORE_OK || result.object == NULL) {
+    return NAN;
+  }
+  const Collection *collection = result.collection;
+  for (uint32_t i = 0; i < collection->fields_count; i++) {
+    if (strcmp(collection->fields[i].name, name) == 0) {
+      return collection_object_field(collection, result.object, i);
+    }
+  }
+  return NAN;
+}
+
+static size_t count_nearby(Store *store, Arena *arena, const char *statement) {
+  ExecuteResult result = { 0 };
+  if (run_statement(store, arena, statement, &result) != STORE_OK) {
+    return SIZE_MAX;
+  }
+  return result.objects_count;
+}
+
+/*
+ * what the writes of `write_fleet` leave behind.
+ */
+static void expect_fleet(Store *store, Arena *arena) {
+  EXPECT(has_point(store, arena, "fleet truck1", 33.5, -112.25));
+  EXPECT(is_missing(store, arena, "fleet truck2"));
+  EXPECT(has_point(store, arena, "fleet truck3", -10, 170.125));
+  EXPECT(field_of(store, arena, "fleet truck3", "speed") == 80);
+  EXPECT(field_of(store, arena, "fleet truck3", "fuel") == 0.5);
+  EXPECT(!is_missing(store, arena, "fleet zone"));
+  EXPECT(is_missing(store, arena, "gone 1"));
+  EXPECT(count_nearby(store, arena, "NEARBY fleet POINT 0 0") == 3);
+}
+
+static void write_fleet(Store *store, Arena *arena) {
+  ExecuteResult result = { 0 };
+  EXPECT(run_statement(store, arena, "SET fleet truck1 POINT 1 2", &result) == STORE_OK);
+  EXPECT(run_statement(store, arena, "SET fleet truck2 POINT 3 4", &result) == STORE_OK);
+  EXPECT(run_statement(store, arena, "SET fleet truck1 POINT 33.5 -112.25", &result) == STORE_OK);
+  EXPECT(run_statement(store, arena, "DEL fleet truck2", &result) == STORE_OK);
+  EXPECT(run_statement(store, arena, "SET fleet truck3 FIELD speed 50 EX 100000 POINT -10 170.125", &result) ==
+         STORE_OK);
+  EXPECT(run_statement(store, arena, "FSET fleet truck3 speed 80 fuel 0.5", &result) == STORE_OK);
+  EXPECT(run_statement(store, arena, "SET fleet zone BOUNDS 0 0 0 1 1 1 0 0", &result) == STORE_OK);
+  EXPECT(run_statement(store, arena, "SET gone 1 POINT 5 5", &result) == STORE_OK);
+  EXPECT(run_statement(store, arena, "DROP gone", &result) == STORE_OK);
+}
+
+static void test_wal_replay(Arena *arena, const char *log_path) {
+  Store store;
+  Wal wal;
+  EXPECT(init_store(&store) == STORE_OK);
+  EXPECT(open_wal(&wal, log_path, WAL_SYNC_ALWAYS, 0) == 0);
+  EXPECT(store_replay_wal(&store, &wal) == STORE_OK);
+  store_log_writes(&store, &wal);
+  write_fleet(&store, arena);
+  expect_fleet(&store, arena);
+  EXPECT(close_wal(&wal) == 0);
+  destroy_store(&store);
+
+  EXPECT(init_store(&store) == STORE_OK);
+  EXPECT(open_wal(&wal, log_path, WAL_SYNC_ALWAYS, 0) == 0);
+  EXPECT(store_replay_wal(&store, &wal) == STORE_OK);
+  expect_fleet(&store, arena);
+  EXPECT(close_wal(&wal) == 0);
+  destroy_store(&store);
+}
+
+/*
+ * a record cut short by a crash ends the log: the writes before it replay and new ones are appended after them.
+ */
+static void test_wal_torn_tail(Arena *arena, const char *log_path) {
+  Store store;
+  Wal wal;
+  EXPECT(init_store(&store) == STORE_OK);
+  EXPECT(open_wal(&wal, log_path, WAL_SYNC_ALWAYS, 0) == 0);
+  EXPECT(store_replay_wal(&store, &wal) == STORE_OK);
+  store_log_writes(&store, &wal);
+  ExecuteResult result = { 0 };
+  EXPECT(run_statement(&store, arena, "SET fleet torn POINT 7 8", &result) == STORE_OK);
+  EXPECT(close_wal(&wal) == 0);
+  destroy_store(&store);
+
+  struct stat st;
+  EXPECT(stat(log_path, &st) == 0);
+  EXPECT(truncate(log_path, st.st_size - 3) == 0);
+
+  EXPECT(init_store(&store) == STORE_OK);
+  EXPECT(open_wal(&wal, log_path, WAL_SYNC_ALWAYS, 0) == 0);
+  EXPECT(store_replay_wal(&store, &wal) == STORE_OK);
+  expect_fleet(&store, arena);
+  EXPECT(is_missing(&store, arena, "fleet torn"));
+  store_log_writes(&store, &wal);
+  EXPECT(run_statement(&store, arena, "SET fleet after POINT 9 9", &result) == STORE_OK);
+  EXPECT(close_wal(&wal) == 0);
+  destroy_store(&store);
+
+  EXPECT(init_store(&store) == STORE_OK);
+  EXPECT(open_wal(&wal, log_path, WAL_SYNC_ALWAYS, 0) == 0);
+  EXPECT(store_replay_wal(&store, &wal) == STORE_OK);
+  EXPECT(has_point(&store, arena, "fleet after", 9, 9));
+  EXPECT(close_wal(&wal) == 0);
+  destroy_store(&store);
+}
+
+/*
+ * a snapshot restores what it was taken of, and only the log written after it is replayed on top.
+ */
+static void test_snapshot_round_trip(Arena *arena, const char *log_path, const char *snapshot_path) {
+  Store store;
+  Wal wal;
+  EXPECT(init_store(&store) == STORE_OK);
+  EXPECT(open_wal(&wal, log_path, WAL_SYNC_ALWAYS, 0) == 0);
+  EXPECT(store_replay_wal(&store, &wal) == STORE_OK);
+  store_log_writes(&store, &wal);
+  EXPECT(wal_sync(&wal) == 0);
+  EXPECT(store_write_snapshot(&store, snapshot_path, wal.id, wal_end_offset(&wal)) == STORE_OK);
+  ExecuteResult result = { 0 };
+  EXPECT(run_statement(&store, arena, "SET fleet truck1 POINT -1 -2", &result) == STORE_OK);
+  EXPECT(close_wal(&wal) == 0);
+  destroy_store(&store);
+
+  EXPECT(init_store(&store) == STORE_OK);
+  EXPECT(open_wal(&wal, log_path, WAL_SYNC_ALWAYS, 0) == 0);
+  EXPECT(store_load_snapshot(&store, snapshot_path, &wal) == STORE_OK);
+  EXPECT(has_point(&store, arena, "fleet truck1", 33.5, -112.25)); // as of the snapshot
+  EXPECT(store_replay_wal(&store, &wal) == STORE_OK);
+  EXPECT(has_point(&store, arena, "fleet truck1", -1, -2));
+  EXPECT(has_point(&store, arena, "fleet truck3", -10, 170.125));
+  EXPECT(field_of(&store, arena, "fleet truck3", "fuel") == 0.5);
+  EXPECT(count_nearby(&store, arena, "NEARBY fleet POINT 0 0") == 4); // with the one of the torn tail test
+
+  // the collections loaded from the mapping take writes like any other.
+  store_log_writes(&store, &wal);
+  EXPECT(run_statement(&store, arena, "DEL fleet zone", &result) == STORE_OK);
+  EXPECT(run_statement(&store, arena, "SET fleet truck4 POINT 2 2", &result) == STORE_OK);
+  EXPECT(count_nearby(&store, arena, "NEARBY fleet POINT 0 0") == 4);
+  EXPECT(close_wal(&wal) == 0);
+  destroy_store(&store);
+
+  // a snapshot of another log is refused and the store left empty.
+  char other_log[PATH_SIZE];
+  temporary_path(other_log, sizeof(other_log), "other.log");
+  EXPECT(init_store(&store) == STORE_OK);
+  EXPECT(open_wal(&wal, other_log, WAL_SYNC_ALWAYS, 0) == 0);
+  EXPECT(store_load_snapshot(&store, snapshot_path, &wal) == STORE_INVALID_SNAPSHOT);
+  EXPECT(is_missing(&store, arena, "fleet truck1"));
+  EXPECT(close_wal(&wal) == 0);
+  destroy_store(&store);
+  unlink(other_log);
+}
+
+#define COMPACTION_IDS 64
+
+/*
+ * the last write of `write_round` to every id of fleet: the latitude (the longitude is the number of the id), NAN once
+ * deleted, and the speed field.
+ */
+typedef struct {
+  double lat[COMPACTION_IDS];
+  double speed[COMPACTION_IDS];
+} Latest;
+
+static void write_round(Store *store, Arena *arena, Latest *latest, int round) {
+  ExecuteResult result = { 0 };
+  char statement[128];
+  for (int i = 0; i < COMPACTION_IDS; i++) {
+    if ((i + round) % 7 == 0) {
+      snprintf(statement, sizeof(statement), "DEL fleet c%d", i);
+      int rc = run_statement(store, arena, statement, &result);
+      EXPECT(isnan(latest->lat[i]) ? rc == STORE_ID_NOT_FOUND || rc == STORE_KEY_NOT_FOUND : rc == STORE_OK);
+      latest->lat[i] = NAN;
+      continue;
+    }
+    char lat[16];
+    snprintf(lat, sizeof(lat), "%d.%02d", round, i);
+    latest->lat[i] = strtod(lat, NULL);
+    latest->speed[i] = round * 10 + i;
+    snprintf(statement, sizeof(statement), "SET fleet c%d FIELD speed %d POINT %s %d", i, round, lat, i);
+    EXPECT(run_statement(store, arena, statement, &result) == STORE_OK);
+    snprintf(statement, sizeof(statement), "FSET fleet c%d speed %d", i, round * 10 + i);
+    EXPECT(run_statement(store, arena, statement, &result) == STORE_OK);
+  }
+  snprintf(statement, sizeof(statement), "SET gone r%d POINT 1 1", round);
+  EXPECT(run_statement(store, arena, statement, &result) == STORE_OK);
+  EXPECT(run_statement(store, arena, "DROP gone", &result) == STORE_OK);
+}
+
+static void expect_latest(Store *store, Arena *arena, const Latest *latest) {
+  size_t wrong = 0;
+  for (int i = 0; i < COMPACTION_IDS; i++) {
+    char key_id[32];
+    snprintf(key_id, sizeof(key_id), "fleet c%d", i);
+    if (isnan(latest->lat[i])) {
+      wrong += !is_missing(store, arena, key_id);
+    } else {
+      wrong += !has_point(store, arena, key_id, latest->lat[i], i);
+      wrong += field_of(store, arena, key_id, "speed") != latest->speed[i];
+    }
+  }
+  EXPECT(wrong == 0);
+  EXPECT(is_missing(store, arena, "gone r0"));
+}
+
+/*
+ * a log compacted while writes keep coming replays to the same objects and is smaller, and a snapshot of the log as it
+ * was before is refused.
+ */
+static void test_wal_compaction(Arena *arena, const char *log_path, const char *snapshot_path) {
+  Latest latest;
+  for (int i = 0; i < COMPACTION_IDS; i++) {
+    latest.lat[i] = NAN;
+  }
+  Store store;
+  Wal wal;
+  EXPECT(init_store(&store) == STORE_OK);
+  EXPECT(open_wal(&wal, log_path, WAL_SYNC_OS, 0) == 0);
+  EXPECT(store_replay_wal(&store, &wal) == STORE_OK);
+  store_log_writes(&store, &wal);
+  int round = 0;
+  for (; round < 50; round++) {
+    write_round(&store, arena, &latest, round);
+  }
+  EXPECT(wal_sync(&wal) == 0);
+  EXPECT(store_write_snapshot(&store, snapshot_path, wal.id, wal_end_offset(&wal)) == STORE_OK);
+  uint64_t size_before = wal_end_offset(&wal);
+
+  EXPECT(wal_compact(&wal) == 0);
+  for (; round < 60; round++) {
+    write_round(&store, arena, &latest, round);
+  }
+  EXPECT(wal_wait_compaction(&wal) == 0);
+  write_round(&store, arena, &latest, round);
+  expect_latest(&store, arena, &latest);
+  EXPECT(close_wal(&wal) == 0);
+  destroy_store(&store);
+
+  struct stat st;
+  EXPECT(stat(log_path, &st) == 0);
+  EXPECT((uint64_t)st.st_size < size_before / 4);
+
+  EXPECT(init_store(&store) == STORE_OK);
+  EXPECT(open_wal(&wal, log_path, WAL_SYNC_OS, 0) == 0);
+  EXPECT(store_load_snapshot(&store, snapshot_path, &wal) == STORE_INVALID_SNAPSHOT);
+  EXPECT(store_replay_wal(&store, &wal) == STORE_OK);
+  expect_latest(&store, arena, &latest);
+  EXPECT(close_wal(&wal) == 0);
+  destroy_store(&store);
+}
+
+void test_store(void) {
+  Arena arena;
+  if (init_arena(&arena, 0) != 0) {
+    EXPECT(!"out of memory");
+    return;
+  }
+  char log_path[PATH_SIZE];
+  char snapshot_path[PATH_SIZE];
+  temporary_path(log_path, sizeof(log_path), "store.log");
+  temporary_path(snapshot_path, sizeof(snapshot_path), "store.snapshot");
+
+  test_wal_replay(&arena, log_path);
+  test_wal_torn_tail(&arena, log_path);
+  test_snapshot_round_trip(&arena, log_path, snapshot_path);
+  unlink(log_path);
+  unlink(snapshot_path);
+  test_wal_compaction(&arena, log_path, snapshot_path);
+
+  unlink(log_path);
+  unlink(snapshot_path);
+  destroy_arena(&arena);
+}
@@ -1,9 +1,49 @@
 #ifndef TESTING_UTILS_H
 #define TESTING_UTILS_H
 
-//#include "parser.h"
+#include <stdio.h>
 
-//int RESULT_EQ(Result *expected, Result *actual);
-//int RESULT_TEST(char *label, char *input, Result *expected);
+#include "arena.h"
+#include "store.h"
+
+/*
+ * counts a failure and reports where it happened, the test carries on.
+ */
+#define EXPECT(condition)                                                                                              \
+  do {                                                                                                                 \
+    if (!(condition)) {                                                                                                \
+      printf("[FAILED] %s:%d: %s\n", __FILE__, __LINE__, #condition);                                                 \
+      tests_failed++;                                                                                                  \
+    }                                                                                                                  \
+  } while (0)
+
+extern int tests_failed;
+
+/*
+ * parses and executes `statement` on `store`. returns the StoreResult, STORE_INVALID_STATEMENT when parsing failed.
+ */
+int run_statement(Store *store, Arena *arena, const char *statement, ExecuteResult *result);
+
+/*
+ * a path in the temporary directory, unique to this process and `name`, that doesn't exist yet.
+ */
+void temporary_path(char *buffer, size_t size, const char *name);
+
+/*
+ * uniform in [0, 1), from a fixed seed so every run tests the same data.
+ */
+double test_random(void);
+
+void test_parse(void);
+void test_rtree(void);
+void test_polygon(void);
+void test_geometry(void);
+void test_nearby(void);
+void test_filter(void);
+void test_store(void);
+void test_import(void);
+void test_resp(void);
+void test_geofence(void);
+void test_expire(void);
 
 #endif